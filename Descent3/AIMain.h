@@ -61,4 +61,11 @@ bool AITurnTowardsMatrix(object *obj, float turn_rate, matrix *g_orient);
 int AIFindRandomRoom(object *obj, ai_frame *ai_info, goal *goal_ptr, int avoid_room, int min_depth, int max_depth, bool f_check_path, bool f_cur_room_ok, int *depth);
 int AIMakeNextRoomList(int roomnum, int *next_rooms, int max_rooms);
 
+// Prepass for the parallel object frame (see ObjDoFrameAll).  AIWantsVisPrepass returns true if the
+// object will cast its target vision ray this frame.  AIDoVisPrepass casts the wall part of that ray
+// ahead of time; it only reads the world, so it can run on a job thread.  It returns false if the
+// ray couldn't be cast there.
+bool AIWantsVisPrepass(object *obj);
+bool AIDoVisPrepass(object *obj);
+
 #endif
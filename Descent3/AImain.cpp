@@ -2723,6 +2723,175 @@ void AIInitAll()
 	mprintf((0, "Done Initializing AI systems\n"));
 }
 
+// Target vision rays cast ahead of the object frame by AIDoVisPrepass.  They only check the room
+// geometry, so all they can show is that a wall is or isn't in the way.
+typedef struct
+{
+	bool valid;
+	bool clear;						// Nothing but objects can be in the way
+	int frame;						// FrameCount the ray was cast on
+	int room_changes;				// Room_physics_changes when the ray was cast
+	int target_handle;
+	int roomnum;
+	vector pos, target_pos;
+	float wall_dist;				// How far along the ray the wall was hit, or -1 if no usable wall was hit
+	short hit_room, hit_face;	// The face that was hit, or -1 for the terrain
+	int face_info;					// GetFacePhysicsFlags() of that face when it was hit
+} ai_vis_prepass;
+
+static ai_vis_prepass AI_vis_prepass[MAX_OBJECTS];
+
+// How much closer than the target the wall must be before a prepass ray is trusted
+#define VIS_PREPASS_MARGIN			0.5f
+
+bool AIWantsVisPrepass(object *obj)
+{
+	if(obj->control_type != CT_AI && obj->control_type != CT_DYING_AND_AI)
+		return false;
+
+	ai_frame *ai_info = obj->ai_info;
+
+	if(ai_info == NULL || (ai_info->flags & AIF_DISABLED) || obj->type == OBJ_DUMMY)
+		return false;
+
+	if(Demo_flags == DF_PLAYBACK || ((Game_mode & GM_MULTI) && (Netgame.local_role == LR_CLIENT)))
+		return false;
+
+	if(!(ai_info->notify_flags & (0x00000001 << AIN_SEE_TARGET)))
+		return false;
+
+	// Only when AICheckTargetVis is going to cast its ray
+	if(Gametime - ai_info->last_see_target_time <= MIN_VIS_RECENT_CHECK_INTERVAL || Gametime < ai_info->next_check_see_target_time)
+		return false;
+
+	object *target = ObjGet(ai_info->target_handle);
+
+	if(target == NULL || obj->roomnum == -1 || ROOMNUM_OUTSIDE(obj->roomnum))
+		return false;
+
+	return BOA_IsVisible(obj->roomnum, target->roomnum);
+}
+
+bool AIDoVisPrepass(object *obj)
+{
+	ai_vis_prepass *vp = &AI_vis_prepass[OBJNUM(obj)];
+	object *target = ObjGet(obj->ai_info->target_handle);
+	fvi_info hit_info;
+	fvi_query fq;
+
+	vp->valid = true;
+	vp->frame = FrameCount;
+	vp->room_changes = Room_physics_changes;
+	vp->target_handle = target->handle;
+	vp->roomnum = obj->roomnum;
+	vp->pos = obj->pos;
+	vp->target_pos = target->pos;
+	vp->wall_dist = -1.0f;
+
+	// The same ray as AICheckTargetVis, without the objects
+	fq.p0 = &vp->pos;
+	fq.p1 = &vp->target_pos;
+	fq.startroom = vp->roomnum;
+	fq.rad = 0.0f;
+	fq.flags = FQ_NO_RELINK;
+	fq.thisobjnum = -1;
+	fq.ignore_obj_list = NULL;
+
+	int fate = fvi_FindWallIntersection(&fq, &hit_info);
+
+	vp->clear = (fate == HIT_NONE);
+
+	if(fate == HIT_WALL)
+	{
+		room *rp = &Rooms[hit_info.hit_face_room[0]];
+
+		vp->hit_room = hit_info.hit_face_room[0];
+		vp->hit_face = hit_info.hit_face[0];
+		vp->face_info = GetFacePhysicsFlags(rp, &rp->faces[vp->hit_face]);
+		vp->wall_dist = hit_info.hit_dist;
+	}
+	else if(fate == HIT_TERRAIN)
+	{
+		vp->hit_room = vp->hit_face = -1;
+		vp->wall_dist = hit_info.hit_dist;
+	}
+
+	return (fate != -1);
+}
+
+// Returns true if the prepass ray found a wall between the object and the nearest point of its
+// target.  The ray in AICheckTargetVis would stop at that wall too, so it can be skipped.  If the
+// prepass ray didn't hit anything, only objects can block the ray, so FQ_IGNORE_WALLS is added to fq.
+static bool AIVisPrepassBlocked(object *obj, object *target, fvi_query *fq)
+{
+	ai_vis_prepass *vp = &AI_vis_prepass[OBJNUM(obj)];
+
+	if(!vp->valid || vp->frame != FrameCount)
+		return false;
+
+	vp->valid = false;
+
+	if(vp->wall_dist < 0.0f && !vp->clear)
+		return false;
+
+	// Objects earlier in the frame can move either end of the ray, or change the walls and portals along it
+	if(vp->target_handle != target->handle || vp->roomnum != obj->roomnum || vp->pos != obj->pos || vp->target_pos != target->pos ||
+		vp->room_changes != Room_physics_changes ||
+		(!vp->clear && vp->hit_face != -1 && GetFacePhysicsFlags(&Rooms[vp->hit_room], &Rooms[vp->hit_room].faces[vp->hit_face]) != vp->face_info))
+	{
+		Obj_frame_stats.rays_stale++;
+		return false;
+	}
+
+	if(vp->clear)
+	{
+		if(Obj_check_frame)
+		{
+			fvi_info hit_info;
+			fvi_query clear_fq = *fq;
+			int fate = fvi_FindIntersection(fq, &hit_info);
+			bool sees = ((fate == HIT_OBJECT || fate == HIT_SPHERE_2_POLY_OBJECT) && hit_info.hit_object[0] == OBJNUM(target)) || (fate == HIT_NONE);
+
+			clear_fq.flags |= FQ_IGNORE_WALLS;
+			fate = fvi_FindIntersection(&clear_fq, &hit_info);
+
+			if(sees != (((fate == HIT_OBJECT || fate == HIT_SPHERE_2_POLY_OBJECT) && hit_info.hit_object[0] == OBJNUM(target)) || (fate == HIT_NONE)))
+			{
+				mprintf((0, "Object prepass: object %d %s object %d without the walls\n", OBJNUM(obj), sees ? "doesn't see" : "sees", OBJNUM(target)));
+				Obj_frame_stats.mismatches++;
+				return false;
+			}
+		}
+
+		fq->flags |= FQ_IGNORE_WALLS;
+		Obj_frame_stats.rays_clear++;
+		return false;
+	}
+
+	float reach = target->size;
+	if((target->flags & OF_POLYGON_OBJECT) && Poly_models[target->rtype.pobj_info.model_num].anim_size > reach)
+		reach = Poly_models[target->rtype.pobj_info.model_num].anim_size;
+
+	if(vp->wall_dist > vm_VectorDistance(&vp->pos, &vp->target_pos) - reach - VIS_PREPASS_MARGIN)
+		return false;
+
+	if(Obj_check_frame)
+	{
+		fvi_info hit_info;
+		int fate = fvi_FindIntersection(fq, &hit_info);
+
+		if(((fate == HIT_OBJECT || fate == HIT_SPHERE_2_POLY_OBJECT) && hit_info.hit_object[0] == OBJNUM(target)) || (fate == HIT_NONE))
+		{
+			mprintf((0, "Object prepass: object %d sees object %d through a wall %.2f units away\n", OBJNUM(obj), OBJNUM(target), vp->wall_dist));
+			Obj_frame_stats.mismatches++;
+			return false;
+		}
+	}
+
+	Obj_frame_stats.rays_used++;
+	return true;
+}
+
 void AICheckTargetVis(object *obj)
 {
 	ai_frame *ai_info = obj->ai_info;
@@ -2885,7 +3054,10 @@ void AICheckTargetVis(object *obj)
 			ignore_obj_list[num_ignored] = -1;
 			fq.ignore_obj_list = ignore_obj_list;
 
-			fate = fvi_FindIntersection(&fq, &hit_info); 
+			if(AIVisPrepassBlocked(obj, target, &fq))
+				fate = HIT_WALL;
+			else
+				fate = fvi_FindIntersection(&fq, &hit_info); 
 			
 			#ifdef _DEBUG
 			if(AI_debug_robot_do && OBJNUM(obj) == AI_debug_robot_index)
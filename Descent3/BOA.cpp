@@ -36,6 +36,11 @@
 #include "mem.h"
 #include "doorway.h"
 #include "string.h"
+#include "jobsystem.h"
+#include "ddio.h"
+#include "args.h"
+#include <float.h>
+#include <vector>
 
 #define BOA_VERSION 25
 
@@ -955,6 +960,8 @@ void compute_costs()
 	}
 }
 
+// Original pairwise path search. MakeBOA now uses the routing code below; this is kept so
+// -testboa can time the two against each other.
 void update_path_info(q_item* node_list[MAX_ROOMS], int start, int end)
 {
 	int cur_room;
@@ -1165,7 +1172,7 @@ done:
 	return;
 }
 
-void compute_next_segs()
+void compute_next_segs_legacy()
 {
 	int i, j;
 
@@ -1211,73 +1218,513 @@ void compute_next_segs()
 	}
 }
 
-void compute_blockage_info()
+#define BOA_MAX_NODES (MAX_ROOMS + MAX_BOA_TERRAIN_REGIONS)
+
+// Extra cost for going through a locked door or blocked portal. Paths only go through one if there's no other way.
+#define BOA_BLOCKED_COST 1000000.0f
+
+// Room to room connection in the routing graph
+struct boa_edge
 {
-	int i, j;
+	short to;
+	// Portal crossed, in the inside room for terrain regions
+	short roomnum, portal;
+	bool blocked;
+	float cost;
+};
 
-	for (i = 0; i <= Highest_room_index + BOA_num_terrain_regions; i++)
+static std::vector<boa_edge> BOA_edges;
+static int BOA_edge_start[BOA_MAX_NODES + 1];
+static int BOA_num_nodes = 0;
+static bool BOA_graph_built = false;
+
+// Shortest path tree from each BOA index, kept so rows can be repaired when doors and portals change
+static float BOA_route_dist[BOA_MAX_NODES][BOA_MAX_NODES];
+static ushort BOA_route_hops[BOA_MAX_NODES][BOA_MAX_NODES];
+static short BOA_route_parent[BOA_MAX_NODES][BOA_MAX_NODES];
+static bool BOA_routes_built = false;
+static bool BOA_routes_dirty = false;
+
+// Returns true if paths can start or end at the given BOA index
+static bool BOA_RouteNode(int index)
+{
+	if (index <= Highest_room_index)
+		return Rooms[index].used && !(Rooms[index].flags & RF_EXTERNAL);
+
+	return index <= Highest_room_index + BOA_num_terrain_regions;
+}
+
+static inline float BOA_EdgeCost(const boa_edge& edge)
+{
+	return edge.blocked ? edge.cost + BOA_BLOCKED_COST : edge.cost;
+}
+
+// Builds the room connection graph that the path search walks. The edges and costs are the same as FindPath uses.
+static void BOA_BuildGraph()
+{
+	bool f_making_boa = BOA_f_making_boa;
+	BOA_f_making_boa = true;
+
+	BOA_num_nodes = Highest_room_index + BOA_num_terrain_regions + 1;
+	BOA_edges.clear();
+
+	for (int cur = 0; cur < BOA_num_nodes; cur++)
 	{
-		if (i <= Highest_room_index && (!Rooms[i].used))
-			continue;
+		BOA_edge_start[cur] = BOA_edges.size();
 
-		if (i <= Highest_room_index && (Rooms[i].flags & RF_EXTERNAL))
+		if (!BOA_RouteNode(cur))
 			continue;
 
-		if (i > Highest_room_index + BOA_num_terrain_regions)
-			continue;
+		int num_portals;
+		int t_index = -1;
 
-		for (j = 0; j <= Highest_room_index + BOA_num_terrain_regions; j++)
+		if (cur <= Highest_room_index)
+		{
+			num_portals = Rooms[cur].num_portals;
+		}
+		else
+		{
+			t_index = cur - Highest_room_index - 1;
+			num_portals = BOA_num_connect[t_index];
+		}
+
+		for (int counter = 0; counter < num_portals; counter++)
 		{
-			int cur_room = i;
+			int next_room;
 
-			if (i == j)
+			if (!BOA_PassablePortal(cur, counter))
 				continue;
 
-			if (i == Highest_room_index + 1 && j > Highest_room_index)
-				continue;
+			if (t_index == -1)
+				next_room = Rooms[cur].portals[counter].croom;
+			else
+				next_room = BOA_connect[t_index][counter].roomnum;
 
-			if (j == Highest_room_index + 1 && i > Highest_room_index)
+			if (next_room < 0 || next_room == BOA_NO_PATH)
 				continue;
 
-			if (j <= Highest_room_index && (i <= Highest_room_index && !Rooms[i].used))
+			if ((next_room <= Highest_room_index) && (Rooms[next_room].flags & RF_EXTERNAL))
+			{
+				int cell = GetTerrainCellFromPos(&Rooms[cur].portals[counter].path_pnt);
+				ASSERT(cell >= 0 && cell < TERRAIN_WIDTH * TERRAIN_DEPTH);
+
+				next_room = Highest_room_index + TERRAIN_REGION(cell) + 1;
+			}
+
+			// Moving within a terrain region costs nothing and goes nowhere
+			if (BOA_INDEX(next_room) == cur)
 				continue;
 
-			if (j <= Highest_room_index && (i <= Highest_room_index && (Rooms[i].flags & RF_EXTERNAL)))
+			int next_portal = BOA_DetermineStartRoomPortal(next_room, NULL, cur, NULL);
+
+			boa_edge edge;
+			edge.to = BOA_INDEX(next_room);
+			if (t_index == -1)
+			{
+				edge.roomnum = cur;
+				edge.portal = counter;
+			}
+			else
+			{
+				edge.roomnum = BOA_connect[t_index][counter].roomnum;
+				edge.portal = BOA_connect[t_index][counter].portal;
+			}
+			edge.blocked = false;
+			edge.cost = BOA_cost_array[cur][counter];
+			if (next_portal >= 0)
+				edge.cost += BOA_cost_array[edge.to][next_portal];
+
+			BOA_edges.push_back(edge);
+		}
+	}
+
+	BOA_edge_start[BOA_num_nodes] = BOA_edges.size();
+	BOA_graph_built = true;
+	BOA_f_making_boa = f_making_boa;
+}
+
+// Indexed binary heap of BOA indices, ordered by distance, then hop count, then index
+struct boa_heap
+{
+	short nodes[BOA_MAX_NODES];
+	short pos[BOA_MAX_NODES];
+	int size;
+	const float* dist;
+	const ushort* hops;
+
+	bool less(int a, int b) const
+	{
+		if (dist[a] != dist[b])
+			return dist[a] < dist[b];
+		if (hops[a] != hops[b])
+			return hops[a] < hops[b];
+		return a < b;
+	}
+
+	void place(int i, int node)
+	{
+		nodes[i] = node;
+		pos[node] = i;
+	}
+
+	void up(int i)
+	{
+		int node = nodes[i];
+		while (i > 0)
+		{
+			int parent = (i - 1) / 2;
+			if (!less(node, nodes[parent]))
+				break;
+			place(i, nodes[parent]);
+			i = parent;
+		}
+		place(i, node);
+	}
+
+	void down(int i)
+	{
+		int node = nodes[i];
+		while (true)
+		{
+			int child = i * 2 + 1;
+			if (child >= size)
+				break;
+			if (child + 1 < size && less(nodes[child + 1], nodes[child]))
+				child++;
+			if (!less(nodes[child], node))
+				break;
+			place(i, nodes[child]);
+			i = child;
+		}
+		place(i, node);
+	}
+
+	// Adds a node, or moves it up if it's already in the heap and its distance went down
+	void push(int node)
+	{
+		if (pos[node] == -1)
+		{
+			pos[node] = size;
+			nodes[size++] = node;
+		}
+		up(pos[node]);
+	}
+
+	int pop()
+	{
+		int node = nodes[0];
+		pos[node] = -1;
+		if (--size > 0)
+		{
+			nodes[0] = nodes[size];
+			down(0);
+		}
+		return node;
+	}
+};
+
+// Finds the shortest paths from one BOA index to every other one and fills in its row of BOA_Array.
+// Only touches the source's own rows, so sources can be done in parallel.
+static void BOA_RouteFrom(int source)
+{
+	float* dist = BOA_route_dist[source];
+	ushort* hops = BOA_route_hops[source];
+	short* parent = BOA_route_parent[source];
+	short first[BOA_MAX_NODES];
+	boa_heap heap;
+	int i;
+
+	heap.size = 0;
+	heap.dist = dist;
+	heap.hops = hops;
+
+	for (i = 0; i < BOA_num_nodes; i++)
+	{
+		dist[i] = FLT_MAX;
+		hops[i] = 0;
+		parent[i] = -1;
+		heap.pos[i] = -1;
+	}
+
+	dist[source] = 0.0f;
+	first[source] = source;
+	heap.push(source);
+
+	while (heap.size > 0)
+	{
+		int cur = heap.pop();
+
+		for (int e = BOA_edge_start[cur]; e < BOA_edge_start[cur + 1]; e++)
+		{
+			const boa_edge& edge = BOA_edges[e];
+			int next = edge.to;
+			float new_dist = dist[cur] + BOA_EdgeCost(edge);
+			int new_hops = hops[cur] + 1;
+
+			if (new_dist < dist[next] || (new_dist == dist[next] && new_hops < hops[next]))
+			{
+				dist[next] = new_dist;
+				hops[next] = new_hops;
+				parent[next] = cur;
+				first[next] = (cur == source) ? next : first[cur];
+				heap.push(next);
+			}
+		}
+	}
+
+	unsigned short* row = BOA_Array[source];
+	for (i = 0; i < BOA_num_nodes; i++)
+	{
+		if (i == source || !BOA_RouteNode(i))
+			continue;
+
+		int next_room;
+		if (source == Highest_room_index + 1 && i > Highest_room_index)
+			next_room = i;	// Terrain regions all connect through the first one
+		else if (i == Highest_room_index + 1 && source > Highest_room_index)
+			next_room = i;
+		else if (dist[i] == FLT_MAX)
+			next_room = BOA_NO_PATH;
+		else
+			next_room = first[i];
+
+		row[i] = (row[i] & ~BOA_ROOM_MASK) | next_room;
+	}
+}
+
+static void BOA_RouteJob(void* data, int index)
+{
+	const short* sources = (const short*)data;
+	BOA_RouteFrom(sources[index]);
+}
+
+// Routes from each of the given BOA indices, spread over the job pool
+static void BOA_RouteSources(short* sources, int num_sources)
+{
+	job_ParallelFor(num_sources, BOA_RouteJob, sources);
+}
+
+// Fills in the next room part of BOA_Array for every pair of rooms and terrain regions
+void compute_next_segs()
+{
+	short sources[BOA_MAX_NODES];
+	int num_sources = 0;
+
+	BOA_BuildGraph();
+
+	for (int i = 0; i < BOA_num_nodes; i++)
+	{
+		if (BOA_RouteNode(i))
+			sources[num_sources++] = i;
+	}
+
+	BOA_RouteSources(sources, num_sources);
+	BOA_routes_built = true;
+}
+
+static bool BOA_HasPathFlags(int i);
+static void compute_blockage_row(int i);
+static void compute_robot_path_row(int i);
+
+// Returns true if a connection is currently blocked by a locked door or a blocked portal
+static bool BOA_EdgeBlockedNow(const boa_edge& edge)
+{
+	if (Rooms[edge.roomnum].portals[edge.portal].flags & PF_BLOCK)
+		return true;
+
+	if (edge.to <= Highest_room_index && (Rooms[edge.to].flags & RF_DOOR) && Rooms[edge.to].doorway_data && DoorwayLocked(&Rooms[edge.to]))
+		return true;
+
+	return false;
+}
+
+void BOA_ResetRoutes()
+{
+	BOA_graph_built = false;
+	BOA_routes_built = false;
+	BOA_routes_dirty = true;
+}
+
+void BOA_MarkRoutesDirty()
+{
+	BOA_routes_dirty = true;
+}
+
+void BOA_UpdateRoutes()
+{
+	if (!BOA_routes_dirty)
+		return;
+	BOA_routes_dirty = false;
+
+	if (Highest_room_index < 0)
+		return;
+
+	if (!BOA_graph_built)
+		BOA_BuildGraph();
+
+	static bool blocked_now[BOA_MAX_NODES * MAX_PATH_PORTALS];
+	int num_edges = BOA_edges.size();
+	int num_changed = 0;
+	int e;
+
+	for (e = 0; e < num_edges; e++)
+	{
+		blocked_now[e] = BOA_EdgeBlockedNow(BOA_edges[e]);
+		if (blocked_now[e] != BOA_edges[e].blocked)
+			num_changed++;
+	}
+
+	if (num_changed == 0)
+		return;
+
+	double start = timer_GetTime64();
+
+	// The table from the level file has every door and portal open, so start from that
+	if (!BOA_routes_built)
+		compute_next_segs();
+
+	// Work out which sources have paths that the changes could affect
+	static bool affected[BOA_MAX_NODES];
+	memset(affected, 0, sizeof(affected));
+
+	for (int from = 0; from < BOA_num_nodes; from++)
+	{
+		for (e = BOA_edge_start[from]; e < BOA_edge_start[from + 1]; e++)
+		{
+			boa_edge& edge = BOA_edges[e];
+			if (blocked_now[e] == edge.blocked)
 				continue;
 
-			if (BOA_NEXT_ROOM(cur_room, j) != BOA_NO_PATH && BOA_NEXT_ROOM(cur_room, j) != cur_room)
+			float old_cost = BOA_EdgeCost(edge);
+			edge.blocked = blocked_now[e];
+			float new_cost = BOA_EdgeCost(edge);
+
+			for (int source = 0; source < BOA_num_nodes; source++)
 			{
-				int last_room = cur_room;
+				if (affected[source] || !BOA_RouteNode(source))
+					continue;
 
-				do
+				if (new_cost > old_cost)
 				{
-					if (cur_room <= Highest_room_index && (Rooms[cur_room].flags & RF_DOOR))
-					{
-						BOA_Array[i][j] |= BOAF_BLOCKAGE;
-						break;
-					}
+					// Only matters if the shortest path tree goes through this connection
+					if (BOA_route_parent[source][edge.to] == from)
+						affected[source] = true;
+				}
+				else if (BOA_route_dist[source][from] != FLT_MAX)
+				{
+					// Only matters if this connection is now a shorter way there
+					float dist = BOA_route_dist[source][from] + new_cost;
+					int hops = BOA_route_hops[source][from] + 1;
+					if (dist < BOA_route_dist[source][edge.to] || (dist == BOA_route_dist[source][edge.to] && hops < BOA_route_hops[source][edge.to]))
+						affected[source] = true;
+				}
+			}
+		}
+	}
+
+	short sources[BOA_MAX_NODES];
+	int num_sources = 0;
+	for (int i = 0; i < BOA_num_nodes; i++)
+	{
+		if (affected[i])
+			sources[num_sources++] = i;
+	}
+
+	BOA_RouteSources(sources, num_sources);
+
+	// The blockage and robot size flags walk the paths through other rooms' rows, so any
+	// row's flags can change when a repaired row is on its way somewhere.  Redo them all.
+	for (int row = 0; row < BOA_num_nodes; row++)
+	{
+		if (!BOA_HasPathFlags(row))
+			continue;
+
+		for (int j = 0; j < BOA_num_nodes; j++)
+			BOA_Array[row][j] &= ~(BOAF_BLOCKAGE | BOAF_TOO_SMALL_FOR_ROBOT);
+
+		compute_blockage_row(row);
+		compute_robot_path_row(row);
+	}
+
+	mprintf((0, "BOA: %d connections changed, repaired %d of %d rows in %.3f ms\n", num_changed, num_sources, BOA_num_nodes, (timer_GetTime64() - start) * 1000));
+}
+
+// Returns true if BOA_Array row i gets blockage and robot size flags
+static bool BOA_HasPathFlags(int i)
+{
+	if (i <= Highest_room_index && (!Rooms[i].used))
+		return false;
+
+	if (i <= Highest_room_index && (Rooms[i].flags & RF_EXTERNAL))
+		return false;
+
+	if (i > Highest_room_index + BOA_num_terrain_regions)
+		return false;
+
+	return true;
+}
+
+// Flags the paths from i that go through a door or a portal that's closed off
+static void compute_blockage_row(int i)
+{
+	int j;
+
+	for (j = 0; j <= Highest_room_index + BOA_num_terrain_regions; j++)
+	{
+		int cur_room = i;
+
+		if (i == j)
+			continue;
+
+		if (i == Highest_room_index + 1 && j > Highest_room_index)
+			continue;
 
-					last_room = cur_room;
-					cur_room = BOA_NEXT_ROOM(cur_room, j);
+		if (j == Highest_room_index + 1 && i > Highest_room_index)
+			continue;
+
+		if (BOA_NEXT_ROOM(cur_room, j) != BOA_NO_PATH && BOA_NEXT_ROOM(cur_room, j) != cur_room)
+		{
+			int last_room = cur_room;
+
+			do
+			{
+				if (cur_room <= Highest_room_index && (Rooms[cur_room].flags & RF_DOOR))
+				{
+					BOA_Array[i][j] |= BOAF_BLOCKAGE;
+					break;
+				}
+
+				last_room = cur_room;
+				cur_room = BOA_NEXT_ROOM(cur_room, j);
+
+				if (last_room != cur_room)
+				{
+					bool f_making_boa = BOA_f_making_boa;
+					BOA_f_making_boa = false;
+					int portal = BOA_DetermineStartRoomPortal(last_room, NULL, cur_room, NULL, true);
+					BOA_f_making_boa = f_making_boa;
 
-					if (last_room != cur_room)
+					if (portal == -1)
 					{
-						BOA_f_making_boa = false;
-						if (BOA_DetermineStartRoomPortal(last_room, NULL, cur_room, NULL, true) == -1)
-						{
-							BOA_Array[i][j] |= BOAF_BLOCKAGE;
-							BOA_f_making_boa = true;
-							break;
-						}
-						BOA_f_making_boa = true;
+						BOA_Array[i][j] |= BOAF_BLOCKAGE;
+						break;
 					}
+				}
 
-				} while (cur_room != j);
-			}
+			} while (cur_room != j);
 		}
 	}
 }
 
+void compute_blockage_info()
+{
+	for (int i = 0; i <= Highest_room_index + BOA_num_terrain_regions; i++)
+	{
+		if (BOA_HasPathFlags(i))
+			compute_blockage_row(i);
+	}
+}
+
 // Goes through all the valid points in the indoor engine and returns a unique
 // checksum
 
@@ -2151,77 +2598,66 @@ void find_small_portals()
 	mprintf((0, "   Found %d small portals...  :)\n", counter));
 }
 
-void compute_robot_path_info()
+// Flags the paths from i that go through a portal too small for robots
+static void compute_robot_path_row(int i)
 {
-	int i, j;
+	int j;
+	bool f_making_boa = BOA_f_making_boa;
 
-	for (i = 0; i <= Highest_room_index + BOA_num_terrain_regions; i++)
+	BOA_f_making_boa = true;
+
+	for (j = 0; j <= Highest_room_index + BOA_num_terrain_regions; j++)
 	{
-		if (i <= Highest_room_index && (!Rooms[i].used))
+		int cur_room = i;
+
+		if (i == j)
 			continue;
 
-		if (i <= Highest_room_index && (Rooms[i].flags & RF_EXTERNAL))
+		if (i == Highest_room_index + 1 && j > Highest_room_index)
 			continue;
 
-		if (i > Highest_room_index + BOA_num_terrain_regions)
+		if (j == Highest_room_index + 1 && i > Highest_room_index)
 			continue;
 
-		for (j = 0; j <= Highest_room_index + BOA_num_terrain_regions; j++)
+		if (BOA_NEXT_ROOM(cur_room, j) != BOA_NO_PATH && BOA_NEXT_ROOM(cur_room, j) != cur_room)
 		{
-			int cur_room = i;
-
-			if (j <= Highest_room_index && (i <= Highest_room_index && !Rooms[i].used))
-				continue;
-
-			if (j <= Highest_room_index && (i <= Highest_room_index && (Rooms[i].flags & RF_EXTERNAL)))
-				continue;
-
-			if (i == j)
-				continue;
-
-			if (i == Highest_room_index + 1 && j > Highest_room_index)
-				continue;
+			int last_room = cur_room;
 
-			if (j == Highest_room_index + 1 && i > Highest_room_index)
-				continue;
-
-			if (BOA_NEXT_ROOM(cur_room, j) != BOA_NO_PATH && BOA_NEXT_ROOM(cur_room, j) != cur_room)
+			do
 			{
-				int last_room = cur_room;
+				last_room = cur_room;
+				cur_room = BOA_NEXT_ROOM(cur_room, j);
 
-				do
+				if (last_room != cur_room)
 				{
-					last_room = cur_room;
-					cur_room = BOA_NEXT_ROOM(cur_room, j);
-
-					if (last_room != cur_room)
+					if (BOA_DetermineStartRoomPortal(last_room, NULL, cur_room, NULL, false, true) == -1)
 					{
-						if (BOA_DetermineStartRoomPortal(last_room, NULL, cur_room, NULL, false, true) == -1)
-						{
-							BOA_Array[i][j] |= BOAF_TOO_SMALL_FOR_ROBOT;
-							break;
-						}
+						BOA_Array[i][j] |= BOAF_TOO_SMALL_FOR_ROBOT;
+						break;
 					}
+				}
 
-				} while (cur_room != j);
-			}
+			} while (cur_room != j);
 		}
 	}
+
+	BOA_f_making_boa = f_making_boa;
 }
 
-void MakeBOA(void)
+void compute_robot_path_info()
 {
-	ASSERT(BOA_ROOM_MASK > MAX_ROOMS + MAX_BOA_TERRAIN_REGIONS);
-	int cur_check = BOAGetMineChecksum();
-
-	if (cur_check == BOA_vis_checksum)
-		BOA_vis_valid = 1;
-	else
-		BOA_vis_valid = 0;
+	for (int i = 0; i <= Highest_room_index + BOA_num_terrain_regions; i++)
+	{
+		if (BOA_HasPathFlags(i))
+			compute_robot_path_row(i);
+	}
+}
 
-	if (cur_check == BOA_mine_checksum) return;
+static bool BOA_legacy_paths = false;
 
-	//OutrageMessageBox("Reminder: You need to make BOA Vis on this level.\nThis is either because it hasn't\nbeen done or Chris updated BOA.");
+static void BOA_Build(int cur_check)
+{
+	double start = timer_GetTime64();
 
 	BOA_mine_checksum = cur_check;
 	BOA_f_making_boa = true;
@@ -2248,7 +2684,15 @@ void MakeBOA(void)
 	mprintf((0, "  Done computing %d terrain regions.\n", BOA_num_terrain_regions));
 
 	mprintf((0, "  Making designers wait for no particular reason...\n"));
-	compute_next_segs();
+	double path_start = timer_GetTime64();
+	if (BOA_legacy_paths)
+	{
+		compute_next_segs_legacy();
+		BOA_routes_built = false;
+	}
+	else
+		compute_next_segs();
+	double path_time = timer_GetTime64() - path_start;
 	mprintf((0, "  Done with the sodomy...\n"));
 
 	mprintf((0, "  Start computing blockage info.\n"));
@@ -2283,8 +2727,120 @@ void MakeBOA(void)
 	//	}
 
 	BOA_f_making_boa = false;
-	mprintf((0, "BOA is done\n"));
+	mprintf((0, "BOA is done in %.3f s, %.3f s of it finding paths\n", timer_GetTime64() - start, path_time));
+}
+
+// Length of the path from start to end that the given table leads along, or -1 if it doesn't get there
+static float BOA_TablePathCost(unsigned short table[BOA_MAX_NODES][BOA_MAX_NODES], int start, int end)
+{
+	float cost = 0.0f;
+	int cur = start;
+
+	for (int steps = 0; cur != end; steps++)
+	{
+		int next = table[cur][end] & BOA_ROOM_MASK;
+		if (next == BOA_NO_PATH || next == cur || next >= BOA_num_nodes || steps > BOA_num_nodes)
+			return -1.0f;
+
+		// Use the cheapest connection, since the table doesn't say which portal
+		float step_cost = FLT_MAX;
+		for (int e = BOA_edge_start[cur]; e < BOA_edge_start[cur + 1]; e++)
+		{
+			if (BOA_edges[e].to == next && BOA_edges[e].cost < step_cost)
+				step_cost = BOA_edges[e].cost;
+		}
+		if (step_cost != FLT_MAX)
+			cost += step_cost;
+
+		cur = next;
+	}
+
+	return cost;
+}
+
+// Builds the BOA with the original pairwise path search and then with the new one, and logs
+// how long each took and how the paths compare. Enabled with -testboa.
+static void BOA_TestPaths(int cur_check)
+{
+	typedef unsigned short boa_row[BOA_MAX_NODES];
+	boa_row* saved = (boa_row*)mem_malloc(sizeof(BOA_Array));
+	boa_row* legacy = (boa_row*)mem_malloc(sizeof(BOA_Array));
+	memcpy(saved, BOA_Array, sizeof(BOA_Array));
+
+	BOA_legacy_paths = true;
+	double start = timer_GetTime64();
+	BOA_Build(cur_check);
+	double legacy_time = timer_GetTime64() - start;
+	memcpy(legacy, BOA_Array, sizeof(BOA_Array));
+
+	BOA_legacy_paths = false;
+	start = timer_GetTime64();
+	BOA_Build(cur_check);
+	double new_time = timer_GetTime64() - start;
+
+	int num_pairs = 0, num_different = 0, num_longer = 0, num_broken = 0;
+	for (int i = 0; i < BOA_num_nodes; i++)
+	{
+		if (!BOA_RouteNode(i))
+			continue;
+
+		for (int j = 0; j < BOA_num_nodes; j++)
+		{
+			if (i == j || !BOA_RouteNode(j))
+				continue;
+
+			num_pairs++;
+			if ((legacy[i][j] & BOA_ROOM_MASK) == (BOA_Array[i][j] & BOA_ROOM_MASK))
+				continue;
+
+			// Different next rooms are fine as long as the paths are as short
+			num_different++;
+			float legacy_cost = BOA_TablePathCost(legacy, i, j);
+			float new_cost = BOA_TablePathCost(BOA_Array, i, j);
+			if (new_cost < 0.0f && legacy_cost >= 0.0f)
+				num_broken++;
+			else if (legacy_cost >= 0.0f && new_cost > legacy_cost * 1.001f + 0.01f)
+				num_longer++;
+		}
+	}
+
+	// Rebuilding clears the vis bits, so put back the ones the level came with
+	for (int i = 0; i < BOA_MAX_NODES; i++)
+		for (int j = 0; j < BOA_MAX_NODES; j++)
+			BOA_Array[i][j] = (BOA_Array[i][j] & ~BOAF_VIS) | (saved[i][j] & BOAF_VIS);
+
+	mem_free(saved);
+	mem_free(legacy);
+
+	mprintf((0, "TestBOA: %d rooms and regions, %d edges, %d worker threads\n", BOA_num_nodes, (int)BOA_edges.size(), job_GetNumThreads()));
+	mprintf((0, "TestBOA: MakeBOA took %.3f s with the pairwise search and %.3f s with per-room routing\n", legacy_time, new_time));
+	mprintf((0, "TestBOA: %d of %d next rooms differ, %d paths longer, %d paths broken\n", num_different, num_pairs, num_longer, num_broken));
+}
+
+void MakeBOA(void)
+{
+	ASSERT(BOA_ROOM_MASK > MAX_ROOMS + MAX_BOA_TERRAIN_REGIONS);
+	int cur_check = BOAGetMineChecksum();
+
+	// Whatever was known about the last level's doors and portals doesn't apply any more
+	BOA_ResetRoutes();
+
+	if (cur_check == BOA_vis_checksum)
+		BOA_vis_valid = 1;
+	else
+		BOA_vis_valid = 0;
+
+	if (FindArg("-testboa"))
+	{
+		BOA_TestPaths(cur_check);
+		return;
+	}
+
+	if (cur_check == BOA_mine_checksum) return;
+
+	//OutrageMessageBox("Reminder: You need to make BOA Vis on this level.\nThis is either because it hasn't\nbeen done or Chris updated BOA.");
 
+	BOA_Build(cur_check);
 }
 
 int Current_sort_room;
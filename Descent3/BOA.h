@@ -158,6 +158,19 @@ extern connect_data BOA_connect[MAX_BOA_TERRAIN_REGIONS][MAX_PATH_PORTALS];
 
 void MakeBOA(void);
 
+// Keeping paths up to date with locked doors and blocked portals.
+// BOA_Array is made with every door and portal open. When one is closed off, the paths that went
+// through it are rerouted, and only the rows of BOA_Array whose paths changed are recomputed.
+
+// Forgets the path state of the last level. Called by MakeBOA().
+void BOA_ResetRoutes();
+
+// Notes that a door was locked or unlocked, or a portal was blocked or unblocked.
+void BOA_MarkRoutesDirty();
+
+// Reroutes paths around doors and portals that changed since the last call. Called once a frame before the AI runs.
+void BOA_UpdateRoutes();
+
 // Goes through all the rooms and determines their visibility in relation to one another
 void MakeBOAVisTable (bool from_lighting=0);
 
@@ -513,6 +513,7 @@ void GetGameAPI(game_api* api)
 	NEXTFP = (int*)dInven_GetTypeIDCount;
 	NEXTFP = (int*)dInven_FindPos;
 	NEXTFP = (int*)dInven_GetInventoryItemList;
+	NEXTFP = (int*)MarkRoomForRemesh;
 
 	// Variable pointers
 	api->vp[0] = (int*)&Player_num;
@@ -94,6 +94,8 @@
 #include "renderobject.h"
 #include "vibeinterface.h"
 #include "gamespy.h"
+#include "framealloc.h"
+#include "objgrid.h"
 
 #ifdef EDITOR
 #include "editor\d3edit.h"
@@ -2433,19 +2435,28 @@ void GameFrame(void)
 			RTP_tENDTIME(processkeys_time, curr_time);
 		}
 
+		//Route paths around any doors or portals that were closed off since last frame
+		BOA_UpdateRoutes();
+
 		//Global AI Frame Stuff  -- must be before ObjMoveAll
 		RTP_tSTARTTIME(aiframeall_time, curr_time);
-		if (DoAI)
-			AIFrameAll();
+		{
+			RTP_ZONE("AIFrameAll", RTZ_AI);
+			if (DoAI)
+				AIFrameAll();
 
-		a_life.DoFrame();
+			a_life.DoFrame();
+		}
 		RTP_tENDTIME(aiframeall_time, curr_time);
 
 		//ApplyShadowsToRooms ();
 
 		//Move objects for this frame
 		RTP_tSTARTTIME(objframe_time, curr_time);
-		ObjDoFrameAll();
+		{
+			RTP_ZONE("ObjDoFrameAll", RTZ_GAME);
+			ObjDoFrameAll();
+		}
 		RTP_tENDTIME(objframe_time, curr_time);
 
 		RTP_tSTARTTIME(matcenframe_time, curr_time);
@@ -2523,7 +2534,10 @@ void GameFrame(void)
 	// 
 	// Do multiplayer stuff
 	RTP_tSTARTTIME(multiframe_time, curr_time);
-	MultiDoFrame();
+	{
+		RTP_ZONE("MultiDoFrame", RTZ_MULTI);
+		MultiDoFrame();
+	}
 	RTP_tENDTIME(multiframe_time, curr_time);
 
 	//Do Gamespy stuff
@@ -2540,8 +2554,11 @@ void GameFrame(void)
 	{
 		RTP_tSTARTTIME(renderframe_time, curr_time);
 		if (!Skip_render_game_frame)
+		{
+			RTP_ZONE("GameRenderFrame", RTZ_RENDER);
 			//Render the frame
 			GameRenderFrame();
+		}
 
 		RTP_tENDTIME(renderframe_time, curr_time);
 	}
@@ -2563,25 +2580,34 @@ void GameFrame(void)
 
 		//float start_delay = timer_GetTime();
 		//Slow down the game if the user asked us to
-		double current_timer = timer_GetTime64();
-		double target_time = last_timer + Min_allowed_frametime;
-		if (current_timer > target_time) //If running slow, drop frames
-			target_time = current_timer;
+		double target_time;
+		if (Dedicated_server && Dedicated_tick_rate > 0)
+		{
+			//The dedicated server blocks on its sockets until the next tick is due
+			target_time = DedicatedServerWaitForTick(last_timer);
+		}
 		else
 		{
-			if ((current_timer - last_timer) < Min_allowed_frametime)
+			double current_timer = timer_GetTime64();
+			target_time = last_timer + Min_allowed_frametime;
+			if (current_timer > target_time) //If running slow, drop frames
+				target_time = current_timer;
+			else
 			{
-				unsigned int sleeptime = (Min_allowed_frametime - (current_timer - last_timer)) * 1000;
-				//mprintf((0,"Sleeping for %d ms\n",sleeptime));
-				if (Dedicated_server)
+				if ((current_timer - last_timer) < Min_allowed_frametime)
 				{
-					Sleep(sleeptime);
+					unsigned int sleeptime = (Min_allowed_frametime - (current_timer - last_timer)) * 1000;
+					//mprintf((0,"Sleeping for %d ms\n",sleeptime));
+					if (Dedicated_server)
+					{
+						Sleep(sleeptime);
+					}
+					else if (sleeptime > 2)
+						Sleep(sleeptime - 2);
+					
 				}
-				else if (sleeptime > 2)
-					Sleep(sleeptime - 2);
-				
+				while (timer_GetTime64() < target_time) {} //[ISB] Sleeping isn't precise enough, poll for next update
 			}
-			while (timer_GetTime64() < target_time) {} //[ISB] Sleeping isn't precise enough, poll for next update
 		}
 
 		static int graph_id = -2;
@@ -2613,6 +2639,9 @@ void GameFrame(void)
 	Sound_system.EndSoundFrame();
 	DoDestroyedLightsForFrame();
 
+	// Free textures that haven't been used in a while
+	bm_UpdateResidency(timer_GetTime());
+
 	// Clear lod stuff
 	ClearLODOffs();
 
@@ -2642,6 +2671,18 @@ void GameFrame(void)
 	mprintf_at((1, 1, 39, "Pw %05d, L %05d", Physics_walking_counter, Physics_walking_looping_counter));
 	mprintf_at((1, 2, 39, "Pv %05d", Physics_vis_counter));
 	mprintf_at((1, 3, 39, "Fc %05d, R %05d", FVI_counter, FVI_room_counter));
+	mprintf_at((1, 4, 39, "Fa %07d, H %07d, S %d", frame_GetBytesUsed(), frame_GetHighWater(), frame_GetSystemAllocs()));
+
+	//Check the object grid against the room object lists on a frame's worth of collision queries
+	if (Obj_grid_test)
+	{
+		fvi_ReplayRecordedQueries();
+		if ((FrameCount % 128) == 0)
+			fvi_StartQueryRecording();
+	}
+
+	//Release all the scratch memory used this frame
+	frame_Reset();
 
 #ifdef D3_FAST
 	if (FrameCount > 20)
@@ -53,6 +53,9 @@
 #include "multi.h"
 #include "render.h"
 #include "newrender.h"
+#include "lighting.h"
+#include "multi_snapshot.h"
+#include "args.h"
 
 //	---------------------------------------------------------------------------
 //	Data
@@ -773,6 +776,24 @@ void LoadLevelText(char* level_filename)
 	}
 
 }
+
+//	Runs the benchmarks and self tests asked for on the command line that work on the level that
+//	was just loaded.  None of them need the renderer, so they also work on a dedicated server.
+static void RunLevelTests()
+{
+	if (FindArg("-testnewvis"))
+		NewRender_TestVisibility();
+
+	if (FindArg("-testdynlight"))
+		TestDynamicLighting();
+
+	if (FindArg("-testobjlight"))
+		TestObjectLighting();
+
+	if (FindArg("-testsnapshots"))
+		TestSnapshots();
+}
+
 extern bool Hud_show_controls;
 /*	loads a level and sets it as current level in mission
 */
@@ -813,6 +834,8 @@ bool LoadMissionLevel(int level)
 		NewRender_InitNewLevel();
 	}
 
+	RunLevelTests();
+
 	LoadLevelText(Current_mission.levels[level - 1].filename);
 
 	return true;
@@ -18,6 +18,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #ifndef __LINUX__
 typedef int socklen_t;
@@ -46,6 +47,7 @@ typedef int socklen_t;
 #include "multi_save_settings.h"
 #include "objinfo.h"
 #include "rtperformance.h"
+#include "multi_interest.h"
 #include "player.h"
 #include "stringtable.h"
 #include "init.h"
@@ -67,6 +69,8 @@ int Dedicated_allow_remote = 0;
 ushort Dedicated_listen_port = 2092;
 char dedicated_telnet_password[65];
 int Dedicated_num_teams = 1;
+//Ticks per second when the server runs on its own schedule, 0 to run at the frame cap
+int Dedicated_tick_rate = 0;
 
 int CheckMissionForScript(char* mission, char* script, int dedicated_server_num_teams);
 
@@ -117,6 +121,11 @@ cvar_entry CVars[] =
 {"SetLevel",CVAR_TYPE_INT,NULL,-1,-1,CVAR_GAMEINIT | CVAR_GAMEPLAY},//33
 {"SetDifficulty",CVAR_TYPE_INT,NULL,0,4,CVAR_GAMEINIT},//34
 {"MOTD",CVAR_TYPE_STRING,&Multi_message_of_the_day,-1,HUD_MESSAGE_LENGTH * 2,CVAR_GAMEINIT},//35 
+{"DumpMemStats",CVAR_TYPE_NONE,NULL,-1,-1,CVAR_GAMEPLAY},//36
+{"RtSummary",CVAR_TYPE_NONE,NULL,-1,-1,CVAR_GAMEPLAY},//37
+{"NetStats",CVAR_TYPE_NONE,NULL,-1,-1,CVAR_GAMEPLAY},//38
+{"TickRate",CVAR_TYPE_INT,&Dedicated_tick_rate,0,DEDICATED_MAX_TICK_RATE,CVAR_GAMEINIT | CVAR_GAMEPLAY},//39
+{"TickStats",CVAR_TYPE_NONE,NULL,-1,-1,CVAR_GAMEPLAY},//40
 };
 
 #define CVAR_TIMELIMIT	1
@@ -142,6 +151,11 @@ cvar_entry CVars[] =
 #define CVAR_SETLEVEL		33
 #define CVAR_SETDIFF			34
 #define CVAR_MOTD			35
+#define CVAR_DUMPMEMSTATS	36
+#define CVAR_RTSUMMARY		37
+#define CVAR_NETSTATS		38
+#define CVAR_TICKRATE		39
+#define CVAR_TICKSTATS		40
 
 #define MAX_CVARS	(sizeof(CVars)/sizeof(cvar_entry))
 
@@ -317,6 +331,16 @@ void StartDedicatedServer()
 		return;
 
 	Dedicated_server = true;
+
+	int tickarg = FindArg("-tickrate");
+	if (tickarg)
+	{
+		Dedicated_tick_rate = atoi(GameArgs[tickarg + 1]);
+		if (Dedicated_tick_rate < 0)
+			Dedicated_tick_rate = 0;
+		if (Dedicated_tick_rate > DEDICATED_MAX_TICK_RATE)
+			Dedicated_tick_rate = DEDICATED_MAX_TICK_RATE;
+	}
 }
 
 // Sets the value for a cvar NONE type
@@ -349,6 +373,61 @@ void SetCVarNone(int index)
 	if (index == CVAR_STOPLOG)
 		rtp_StopLog();
 
+	if (index == CVAR_DUMPMEMSTATS)
+	{
+		if (mem_dumpmallocstofile("memstats.txt"))
+			PrintDedicatedMessage("Memory stats written to memstats.txt\n");
+		else
+			PrintDedicatedMessage("No memory stats. Run with -mempool or -memstats.\n");
+	}
+
+	if (index == CVAR_RTSUMMARY)
+	{
+		// Print a line at a time, the summary is longer than a console line
+		char summary[2048];
+		rtp_GetSummary(summary, sizeof(summary));
+
+		char* line = summary;
+		while (*line)
+		{
+			char* end = strchr(line, '\n');
+			if (end)
+				*end = 0;
+			PrintDedicatedMessage("%s\n", line);
+			if (!end)
+				break;
+			line = end + 1;
+		}
+	}
+
+	if (index == CVAR_NETSTATS)
+	{
+		char str[CON_MAX_STRINGLEN];
+
+		if (Interest_budget > 0)
+			PrintDedicatedMessage("Positional update budget is %d bytes/sec per client\n", Interest_budget);
+
+		for (int i = 0; i < MAX_NET_PLAYERS; i++)
+		{
+			if (i == Player_num || !(NetPlayers[i].flags & NPF_CONNECTED) || NetPlayers[i].sequence != NETSEQ_PLAYING)
+				continue;
+
+			MultiInterestGetStats(i, str, sizeof(str));
+			PrintDedicatedMessage("%s\n", str);
+
+			nw_reliable_stats rstats;
+			if (nw_GetReliableStats(NetPlayers[i].reliable_socket, &rstats))
+			{
+				PrintDedicatedMessage("%-16s rtt %dms (+/-%d), window %d, %d queued, %d sent, %d resent, %d resent early\n",
+					Players[i].callsign, (int)(rstats.rtt * 1000), (int)(rstats.rttvar * 1000), (int)rstats.cwnd, rstats.queued,
+					rstats.sent, rstats.resent, rstats.fast_resent);
+			}
+		}
+	}
+
+	if (index == CVAR_TICKSTATS)
+		DedicatedPrintTickStats();
+
 }
 
 // Sets the value for a cvar INT type
@@ -492,6 +571,11 @@ void SetCVarInt(int index, int val)
 		Netgame.difficulty = val;
 	}
 	break;
+	case CVAR_TICKRATE:
+	{
+		DedicatedResetTickStats();
+	}
+	break;
 	}
 
 
@@ -834,12 +918,16 @@ void PrintDedicatedMessage(const char* fmt, ...)
 #include <sys/termios.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #include "linux/linux_fix.h"
 #include "errno.h"
 #define BOOL bool
-#define SOCKET unsigned int
+#ifndef SOCKET
+#define SOCKET int
+#endif
 #define SOCKADDR_IN sockaddr_in
 #define SOCKADDR sockaddr
 #define INVALID_SOCKET -1
@@ -875,6 +963,53 @@ SOCKET	dedicated_listen_socket = INVALID_SOCKET;
 
 #define DEDICATED_LOGIN_PROMPT	TXT_DS_ENTERPASS
 
+// What woke us up between ticks
+#define TICK_EV_NETWORK		1
+#define TICK_EV_LISTEN		2
+#define TICK_EV_TELNET		3
+
+#ifdef __LINUX__
+static int Tick_epoll = -1;
+static bool Tick_epoll_failed = false;
+
+// Adds a socket to the set we block on between ticks
+static void DedicatedWatchSocket(SOCKET sock, int what)
+{
+	if (Tick_epoll == -1)
+	{
+		if (Tick_epoll_failed)
+			return;
+
+		Tick_epoll = epoll_create(16);
+		if (Tick_epoll == -1)
+		{
+			mprintf((0, "Unable to create epoll set for dedicated server, errno %d\n", errno));
+			Tick_epoll_failed = true;
+			return;
+		}
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = what;
+
+	if (epoll_ctl(Tick_epoll, EPOLL_CTL_ADD, sock, &ev) == -1 && errno != EEXIST)
+		mprintf((0, "Unable to watch socket %d for dedicated server, errno %d\n", sock, errno));
+}
+
+static void DedicatedUnwatchSocket(SOCKET sock)
+{
+	if (Tick_epoll != -1)
+		epoll_ctl(Tick_epoll, EPOLL_CTL_DEL, sock, NULL);
+}
+#else
+// select() is handed the sockets every time it's called
+static void DedicatedWatchSocket(SOCKET sock, int what)
+{
+}
+#endif
+
 void InitDedicatedSocket(ushort port)
 {
 	SOCKADDR_IN	sock_addr;
@@ -911,6 +1046,7 @@ void InitDedicatedSocket(ushort port)
 	ioctl(dedicated_listen_socket, FIONBIO, &argp);
 #endif
 
+	DedicatedWatchSocket(dedicated_listen_socket, TICK_EV_LISTEN);
 }
 
 void ListenDedicatedSocket(void)
@@ -961,6 +1097,7 @@ void ListenDedicatedSocket(void)
 		new_socket->input[0] = NULL;
 		new_socket->sock = incoming_socket;
 		new_socket->validated = false;
+		DedicatedWatchSocket(incoming_socket, TICK_EV_TELNET);
 		//Give the new connection the login prompt
 		send(new_socket->sock, DEDICATED_LOGIN_PROMPT, strlen(DEDICATED_LOGIN_PROMPT) + 1, 0);
 	}
@@ -1162,3 +1299,363 @@ void DedicatedReadTelnet(void)
 			conn = conn->next;
 	}
 }
+
+// ------------------------------------------------------------------------------------------------------
+// TICK SCHEDULER
+//
+// With a tick rate set, GameFrame hands the end of each frame to DedicatedServerWaitForTick instead
+// of sleeping off the frame cap and polling the timer.  Between ticks we block on the game and telnet
+// sockets, and handle packets and console commands as they arrive.  Ticks are due at fixed intervals,
+// so Frametime is always a whole number of ticks.  A tick that runs long is made up by running the
+// next ones back to back; once we're more than TICK_MAX_CATCHUP ticks behind, the missed ones are
+// skipped and the next tick covers them.
+
+#define TICK_MAX_CATCHUP		5
+#define TICK_NUM_BUCKETS		8		// under 1ms, then doubling up to 64ms and over
+#define TICK_MAX_EVENTS			16
+#define TICK_MAX_NET_SOCKETS	2
+#define TICK_BAR_LEN			30
+
+typedef struct
+{
+	int ticks;
+	int late;						// ticks that started a whole tick or more after they were due
+	int skipped;					// ticks dropped because we fell too far behind
+	int wakeups;					// times traffic woke us up between ticks
+	double run_time;				// seconds spent running ticks
+	double wait_time;				// seconds spent between ticks, including handling traffic
+	double max_run;					// longest tick
+	double start_time;				// when these stats started
+	int run[TICK_NUM_BUCKETS];		// how long ticks took to run
+	int delay[TICK_NUM_BUCKETS];	// how long after they were due ticks started
+} tick_stats;
+
+static tick_stats Tick_stats;
+static double Tick_run_start = -1;		// when the tick that's running now started, -1 if none is
+
+static const char* Tick_bucket_names[TICK_NUM_BUCKETS] = { "<1ms","1-2ms","2-4ms","4-8ms","8-16ms","16-32ms","32-64ms",">64ms" };
+
+#ifdef __LINUX__
+static SOCKET Tick_net_socks[TICK_MAX_NET_SOCKETS];
+static int Tick_num_net_socks = 0;
+
+// Keeps the game sockets in the epoll set while the networking code has room to read from them
+static void DedicatedWatchNetwork()
+{
+	SOCKET socks[TICK_MAX_NET_SOCKETS];
+	int num = nw_GetReceiveSockets(socks, TICK_MAX_NET_SOCKETS);
+
+	if (num == Tick_num_net_socks && !memcmp(socks, Tick_net_socks, num * sizeof(SOCKET)))
+		return;
+
+	for (int i = 0; i < Tick_num_net_socks; i++)
+		DedicatedUnwatchSocket(Tick_net_socks[i]);
+
+	for (int i = 0; i < num; i++)
+	{
+		DedicatedWatchSocket(socks[i], TICK_EV_NETWORK);
+		Tick_net_socks[i] = socks[i];
+	}
+	Tick_num_net_socks = num;
+}
+#endif
+
+// Blocks until there's traffic or "ms" milliseconds have passed, then handles the traffic
+static void DedicatedWaitForTraffic(int ms)
+{
+	bool network = false, listen = false, telnet = false;
+
+#ifdef __LINUX__
+	DedicatedWatchNetwork();
+
+	if (Tick_epoll == -1)
+	{
+		Sleep(ms);
+		return;
+	}
+
+	struct epoll_event events[TICK_MAX_EVENTS];
+	int num = epoll_wait(Tick_epoll, events, TICK_MAX_EVENTS, ms);
+
+	if (num == -1 && errno != EINTR)
+	{
+		mprintf((0, "epoll_wait failed in dedicated server, errno %d\n", errno));
+		Sleep(ms);
+		return;
+	}
+
+	for (int i = 0; i < num; i++)
+	{
+		switch (events[i].data.u32)
+		{
+		case TICK_EV_NETWORK:
+			network = true;
+			break;
+		case TICK_EV_LISTEN:
+			listen = true;
+			break;
+		case TICK_EV_TELNET:
+			telnet = true;
+			break;
+		}
+	}
+#else
+	SOCKET socks[TICK_MAX_NET_SOCKETS];
+	int num = nw_GetReceiveSockets(socks, TICK_MAX_NET_SOCKETS);
+	int count = 0;
+	SOCKET maxsock = 0;
+	fd_set rfds;
+	dedicated_socket* conn;
+
+	FD_ZERO(&rfds);
+	for (int i = 0; i < num; i++)
+	{
+		FD_SET(socks[i], &rfds);
+		maxsock = max(maxsock, socks[i]);
+		count++;
+	}
+	if (dedicated_listen_socket != INVALID_SOCKET)
+	{
+		FD_SET(dedicated_listen_socket, &rfds);
+		maxsock = max(maxsock, dedicated_listen_socket);
+		count++;
+	}
+	for (conn = Head_sock; conn && count < FD_SETSIZE; conn = conn->next)
+	{
+		FD_SET(conn->sock, &rfds);
+		maxsock = max(maxsock, conn->sock);
+		count++;
+	}
+
+	// select() with nothing to wait on returns straight away
+	if (!count)
+	{
+		Sleep(ms);
+		return;
+	}
+
+	struct timeval timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+
+	if (select(maxsock + 1, &rfds, NULL, NULL, &timeout) > 0)
+	{
+		for (int i = 0; i < num; i++)
+		{
+			if (FD_ISSET(socks[i], &rfds))
+				network = true;
+		}
+		if (dedicated_listen_socket != INVALID_SOCKET && FD_ISSET(dedicated_listen_socket, &rfds))
+			listen = true;
+		for (conn = Head_sock; conn; conn = conn->next)
+		{
+			if (FD_ISSET(conn->sock, &rfds))
+				telnet = true;
+		}
+	}
+#endif
+
+	if (network)
+		nw_DoReceiveCallbacks();
+	if (listen)
+		ListenDedicatedSocket();
+	if (telnet)
+		DedicatedReadTelnet();
+
+	if (network || listen || telnet)
+		Tick_stats.wakeups++;
+}
+
+// Returns which histogram bucket a time falls in
+static int DedicatedTickBucket(double seconds)
+{
+	int ms = (int)(seconds * 1000);
+	int bucket = 0;
+
+	while (ms > 0 && bucket < TICK_NUM_BUCKETS - 1)
+	{
+		ms >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+double DedicatedServerWaitForTick(double last_tick)
+{
+	double tick = 1.0 / Dedicated_tick_rate;
+	double now = timer_GetTime64();
+
+	if (Tick_stats.start_time == 0)
+		DedicatedResetTickStats();
+
+	// Account for the tick that just ran
+	if (Tick_run_start >= 0)
+	{
+		double run = now - Tick_run_start;
+
+		Tick_stats.run_time += run;
+		Tick_stats.run[DedicatedTickBucket(run)]++;
+		if (run > Tick_stats.max_run)
+			Tick_stats.max_run = run;
+	}
+
+	double target = last_tick + tick;
+	if (now - target > tick * TICK_MAX_CATCHUP)
+	{
+		// Too far behind to catch up, so the next tick covers all the ones we missed
+		int missed = (int)((now - last_tick) / tick);
+		Tick_stats.skipped += missed - 1;
+		target = last_tick + missed * tick;
+	}
+
+	double remaining;
+	while ((remaining = target - timer_GetTime64()) > 0)
+		DedicatedWaitForTraffic((int)ceil(remaining * 1000));
+
+	Tick_run_start = timer_GetTime64();
+	Tick_stats.wait_time += Tick_run_start - now;
+
+	double delay = Tick_run_start - target;
+	Tick_stats.delay[DedicatedTickBucket(delay)]++;
+	if (delay >= tick)
+		Tick_stats.late++;
+	Tick_stats.ticks++;
+
+	return target;
+}
+
+void DedicatedResetTickStats()
+{
+	memset(&Tick_stats, 0, sizeof(Tick_stats));
+	Tick_stats.start_time = timer_GetTime64();
+	Tick_run_start = -1;
+}
+
+static void DedicatedPrintHistogram(const char* title, int* buckets)
+{
+	int most = 1;
+
+	for (int i = 0; i < TICK_NUM_BUCKETS; i++)
+		most = max(most, buckets[i]);
+
+	PrintDedicatedMessage("%s\n", title);
+	for (int i = 0; i < TICK_NUM_BUCKETS; i++)
+	{
+		char bar[TICK_BAR_LEN + 1];
+		int len = (buckets[i] * TICK_BAR_LEN + most - 1) / most;
+
+		memset(bar, '#', len);
+		bar[len] = 0;
+		PrintDedicatedMessage("  %-8s %8d %s\n", Tick_bucket_names[i], buckets[i], bar);
+	}
+}
+
+void DedicatedPrintTickStats()
+{
+	if (Dedicated_tick_rate <= 0)
+	{
+		PrintDedicatedMessage("No tick rate set, the server is running at the frame cap\n");
+		return;
+	}
+
+	if (!Tick_stats.ticks)
+	{
+		PrintDedicatedMessage("No ticks have run yet\n");
+		return;
+	}
+
+	double seconds = timer_GetTime64() - Tick_stats.start_time;
+	double total = Tick_stats.run_time + Tick_stats.wait_time;
+
+	PrintDedicatedMessage("%d ticks at %dHz in %d seconds, %d late, %d skipped, woken %d times by traffic\n",
+		Tick_stats.ticks, Dedicated_tick_rate, (int)seconds, Tick_stats.late, Tick_stats.skipped, Tick_stats.wakeups);
+	PrintDedicatedMessage("Busy %.1f%% of the time, ticks take %.2fms on average and %.2fms at most\n",
+		total > 0 ? Tick_stats.run_time * 100 / total : 0, Tick_stats.run_time * 1000 / Tick_stats.ticks, Tick_stats.max_run * 1000);
+
+	DedicatedPrintHistogram("Time to run a tick:", Tick_stats.run);
+	DedicatedPrintHistogram("Time a tick started after it was due:", Tick_stats.delay);
+}
+
+// ------------------------------------------------------------------------------------------------------
+// TICK SCHEDULER TEST
+
+#define TEST_TICK_RATE		30
+#define TEST_TICK_SECONDS	5.0
+
+// Returns the CPU time this process has used
+static double TestTickCPUTime()
+{
+#if defined(WIN32)
+	FILETIME create, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user);
+	return ((((unsigned __int64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+		(((unsigned __int64)user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10000000.0;
+#elif defined(__LINUX__)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+#else
+	return 0;
+#endif
+}
+
+void TestDedicatedTick()
+{
+	double tick = 1.0 / TEST_TICK_RATE;
+	tick_stats saved_stats = Tick_stats;
+	double saved_run_start = Tick_run_start;
+	int saved_rate = Dedicated_tick_rate;
+
+	mprintf((0, "TestDedicatedTick: %dHz with nothing to do for %.0f seconds each way\n", TEST_TICK_RATE, TEST_TICK_SECONDS));
+
+	Dedicated_tick_rate = TEST_TICK_RATE;
+	DedicatedResetTickStats();
+
+	for (int scheduled = 0; scheduled < 2; scheduled++)
+	{
+		double start = timer_GetTime64();
+		double cpu = TestTickCPUTime();
+		double last = start, total_delay = 0, max_delay = 0;
+		int ticks = 0;
+
+		while (last - start < TEST_TICK_SECONDS)
+		{
+			double target;
+
+			if (scheduled)
+				target = DedicatedServerWaitForTick(last);
+			else
+			{
+				// The frame cap from GameFrame
+				double now = timer_GetTime64();
+				target = last + tick;
+				if (now > target)
+					target = now;
+				else
+				{
+					unsigned int sleeptime = (tick - (now - last)) * 1000;
+					Sleep(sleeptime);
+					while (timer_GetTime64() < target) {}
+				}
+			}
+
+			double delay = timer_GetTime64() - target;
+			total_delay += delay;
+			max_delay = max(max_delay, delay);
+
+			last = target;
+			ticks++;
+		}
+
+		double wall = timer_GetTime64() - start;
+		cpu = TestTickCPUTime() - cpu;
+
+		mprintf((0, "TestDedicatedTick: %-14s %d ticks, %.2f%% of a core, ticks start %.3fms late on average and %.3fms at most\n",
+			scheduled ? "tick scheduler" : "frame cap", ticks, cpu * 100 / wall, total_delay * 1000 / ticks, max_delay * 1000));
+	}
+
+	Tick_stats = saved_stats;
+	Tick_run_start = saved_run_start;
+	Dedicated_tick_rate = saved_rate;
+}
@@ -27,6 +27,7 @@
 #include "stringtable.h"
 #include "player.h"
 #include "osiris_dll.h"
+#include "BOA.h"
 
 //	---------------------------------------------------------------------------
 //	Globals
@@ -524,6 +525,9 @@ void DoorwayLockUnlock(int door_obj_handle, bool state)
 		dp->flags |= DF_LOCKED;
 	else
 		dp->flags &= ~DF_LOCKED;
+
+	//Paths through the door change
+	BOA_MarkRoutesDirty();
 }
 
 //Returns the current position of the door.  0.0 = totally closed, 1.0 = totally open
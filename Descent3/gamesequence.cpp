@@ -82,11 +82,13 @@
 #include "multi_ui.h"
 #include "rocknride.h"
 #include "gamepath.h"
+#include "CFILE.H"
 #include "vclip.h"
 #include "bsp.h"
 #include "vibeinterface.h"
 
 #include "args.h"
+#include "multi_snapshot.h"
 void ResetHudMessages(void);
 
 //	Variables
@@ -716,6 +718,11 @@ bool LoadAndStartCurrentLevel()
 		}
 	}
 
+	//Time the load, so hog access modes can be compared
+	float load_start_time = timer_GetTime();
+	memset(&Cfile_stats, 0, sizeof(Cfile_stats));
+	memset(&Obj_frame_stats, 0, sizeof(Obj_frame_stats));
+
 	//	load the level. if fails, then bail out
 	//ShowProgressScreen (TXT_LOADINGLEVEL);
 	if (!LoadMissionLevel(Current_mission.cur_level))
@@ -726,6 +733,17 @@ bool LoadAndStartCurrentLevel()
 	//Now start the level
 	StartLevel();
 
+	mprintf((0, "Level load took %.3f seconds: %d hog opens, %d disk opens, %d hog reopens, %d bytes read\n",
+		timer_GetTime() - load_start_time, Cfile_stats.lib_opens, Cfile_stats.disk_opens, Cfile_stats.lib_fopens, Cfile_stats.bytes_read));
+	mprintf((0, "File index: %d of %d lookups found, %.3f ms total\n",
+		Cfile_stats.index_hits, Cfile_stats.index_lookups, Cfile_stats.index_time * 1000.0f));
+	mprintf((0, "Prefetch: %d files queued, %d used, %d waited on\n",
+		Cfile_stats.prefetch_queued, Cfile_stats.prefetch_hits, Cfile_stats.prefetch_waits));
+	mprintf((0, "Bitmaps: %d KB in %d pageable bitmaps, %d evicted (%d over budget), %d reloaded in %.3f ms (longest %.3f ms), %d of %d deferred mips built\n",
+		(int)(Bitmap_residency_stats.resident_bytes / 1024), Bitmap_residency_stats.resident_bitmaps, Bitmap_residency_stats.evictions,
+		Bitmap_residency_stats.budget_evictions, Bitmap_residency_stats.reloads, Bitmap_residency_stats.reload_time * 1000.0f,
+		Bitmap_residency_stats.max_reload_time * 1000.0f, Bitmap_residency_stats.mips_built, Bitmap_residency_stats.mips_deferred));
+
 	//Done!
 	return true;
 }
@@ -832,6 +850,18 @@ void FreeThisLevel()
 	if (!Level_started)
 		return;
 
+	if (Obj_frame_stats.frames)
+		mprintf((0, "Object frame: %d frames, %.3f ms per frame\n", Obj_frame_stats.frames, Obj_frame_stats.frame_time * 1000.0f / Obj_frame_stats.frames));
+
+	if (Obj_frame_stats.prepass_frames)
+		mprintf((0, "Object prepass: %d frames, %d batches, %d vision rays (%d used, %d clear, %d stale, %d unsafe), %d mismatches, %.3f ms per frame\n",
+			Obj_frame_stats.prepass_frames, Obj_frame_stats.batches, Obj_frame_stats.rays, Obj_frame_stats.rays_used, Obj_frame_stats.rays_clear,
+			Obj_frame_stats.rays_stale, Obj_frame_stats.rays_unsafe, Obj_frame_stats.mismatches, Obj_frame_stats.prepass_time * 1000.0f / Obj_frame_stats.prepass_frames));
+
+	if ((Game_mode & GM_MULTI) && Snap_stats.legacy_bytes)
+		mprintf((0, "Snapshots: %d full, %d delta, %d acks, %d baselines, %d failures, %d bytes of positions (%d without snapshots)\n",
+			Snap_stats.full, Snap_stats.deltas, Snap_stats.acks, Snap_stats.promoted, Snap_stats.failures, Snap_stats.bytes, Snap_stats.legacy_bytes));
+
 	bool original_controls = Control_poll_flag;
 
 	Cinematic_Stop();
@@ -1740,7 +1770,89 @@ void PageInGeneric(int id)
 
 extern char* Static_sound_names[];
 
+//Queues a background read of a bitmap's file if it needs to be paged in
+static void PrefetchBitmap(int bm_handle)
+{
+	if (bm_handle > 0 && (GameBitmaps[bm_handle].flags & BF_NOT_RESIDENT))
+		cf_Prefetch(GameBitmaps[bm_handle].name);
+}
 
+//Queues a background read of a texture's bitmaps if they need to be paged in
+static void PrefetchTexture(int id)
+{
+	if (id == -1 || id == 0 || !GameTextures[id].used)
+		return;
+
+	//Animated textures are read through the vclip system, so leave them alone
+	if (GameTextures[id].flags & TF_ANIMATED)
+		return;
+
+	PrefetchBitmap(GameTextures[id].bm_handle);
+	if ((GameTextures[id].flags & TF_DESTROYABLE) && GameTextures[id].destroy_handle > 0)
+	{
+		texture* dtex = &GameTextures[GameTextures[id].destroy_handle];
+		if (dtex->used && !(dtex->flags & TF_ANIMATED))
+			PrefetchBitmap(dtex->bm_handle);
+	}
+}
+
+//Queues a background read of a polymodel's file if it needs to be paged in
+static void PrefetchModel(int handle)
+{
+	if (handle >= 0 && Poly_models[handle].used && (Poly_models[handle].flags & PMF_NOT_RESIDENT))
+		cf_Prefetch(Poly_models[handle].name);
+}
+
+//Starts reading the files that PageInAllData() is about to load, so the disk is busy
+//while the main thread is decoding the files it has.
+static void PrefetchLevelData()
+{
+	int i;
+
+	if (Dedicated_server)
+		return;
+
+	//Models first, since they're opened first
+	PrefetchModel(Ships[Players[Player_num].ship_index].model_handle);
+	for (i = 0; i <= Highest_object_index; i++)
+	{
+		object* obj = &Objects[i];
+		if (obj->type == OBJ_POWERUP || obj->type == OBJ_ROBOT || obj->type == OBJ_CLUTTER || obj->type == OBJ_BUILDING)
+			PrefetchModel(Object_info[obj->id].render_handle);
+		else if (obj->type == OBJ_DOOR)
+			PrefetchModel(Doors[obj->id].model_handle);
+	}
+
+	for (i = 0; i < NUM_STATIC_SOUNDS; i++)
+	{
+		int sid = FindSoundName(Static_sound_names[i]);
+		if (sid != -1)
+		{
+			sound_file_info* sf = &SoundFiles[Sounds[sid].sample_index];
+			if (!sf->sample_8bit && !sf->sample_16bit)
+				cf_Prefetch(sf->name);
+		}
+	}
+
+	for (i = 0; i <= Highest_room_index; i++)
+	{
+		if (!Rooms[i].used)
+			continue;
+
+		room* rp = &Rooms[i];
+		for (int t = 0; t < rp->num_faces; t++)
+			PrefetchTexture(rp->faces[t].tmap);
+	}
+
+	for (i = 0; i < TERRAIN_TEX_WIDTH * TERRAIN_TEX_DEPTH; i++)
+		PrefetchTexture(Terrain_tex_seg[i].tex_index);
+	if (Terrain_sky.textured)
+		PrefetchTexture(Terrain_sky.dome_texture);
+	for (i = 0; i < Terrain_sky.num_satellites; i++)
+		PrefetchTexture(Terrain_sky.satellite_texture[i]);
+
+	mprintf((0, "Queued %d files for prefetch\n", Cfile_stats.prefetch_queued));
+}
 
 void PageInAllData()
 {
@@ -1751,6 +1863,8 @@ void PageInAllData()
 	memset(Sounds_to_free, 0, MAX_SOUNDS);
 	memset(Models_to_free, 0, MAX_POLY_MODELS);
 
+	PrefetchLevelData();
+
 	PageInShip(Players[Player_num].ship_index);
 	LoadLevelProgress(LOAD_PROGRESS_PAGING_DATA, PAGED_IN_CALC);
 	/*
@@ -1853,5 +1967,9 @@ void PageInAllData()
 			continue;
 		}
 	}
+
+	//Throw away anything that was prefetched but not used
+	cf_ClearPrefetches();
+
 	LoadLevelProgress(LOAD_PROGRESS_PREPARE, 0);
 }
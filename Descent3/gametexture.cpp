@@ -297,6 +297,8 @@ int GetTextureBitmap(int handle, int framenum, bool force)
 		if (GameTextures[handle].procedural == NULL)
 			AllocateProceduralForTexture(handle);
 
+		if (!ProceduralUpdateDue(handle) && !force)
+			do_eval = 0;
 		if (GameTextures[handle].procedural->last_procedural_frame == FrameCount)
 			do_eval = 0;
 		if (timer_GetTime() < GameTextures[handle].procedural->last_evaluation_time + GameTextures[handle].procedural->evaluation_time)
@@ -317,7 +319,11 @@ int GetTextureBitmap(int handle, int framenum, bool force)
 			GameBitmaps[src_bitmap].flags |= BF_CHANGED;
 		}
 		else
+		{
 			src_bitmap = GameTextures[handle].procedural->procedural_bitmap;
+			if (CollectProcedural(handle, false))
+				GameBitmaps[src_bitmap].flags |= BF_CHANGED;
+		}
 	}
 
 	return src_bitmap;
@@ -636,6 +642,7 @@ void FreeProceduralForTexture(int n)
 {
 	if (GameTextures[n].procedural != NULL)
 	{
+		FreeProceduralJob(n);
 		FreeStaticProceduralsForTexture(n);
 		mem_free(GameTextures[n].procedural->proc1);
 		mem_free(GameTextures[n].procedural->proc2);
@@ -85,6 +85,8 @@
 #include "PilotPicsAPI.h"
 #include "osiris_dll.h"
 #include "mem.h"
+#include "jobsystem.h"
+#include "movie.h"
 #include "multi.h"
 #include "marker.h"
 #include "gamecinematics.h"
@@ -92,6 +94,11 @@
 #include "rocknride.h"
 #include "vibeinterface.h"
 #include "gamespy.h"
+#include "procedurals.h"
+
+#ifdef __LINUX__
+#include "linux/mixer.h"
+#endif
 
 
 //Uncomment this to allow all languages
@@ -277,6 +284,11 @@ void PreInitD3Systems()
 		Mem_low_memory_mode = Mem_superlow_memory_mode = true;
 	if(FindArg("-dedicated"))
 		Mem_low_memory_mode = true;
+	//-mempool uses the size-class allocator, -memstats times the allocator calls
+	if(FindArg("-mempool"))
+		Mem_use_pool = true;
+	if(FindArg("-memstats"))
+		Mem_stats = true;
 #ifndef MACINTOSH
 	mem_Init();
 #endif
@@ -692,6 +704,7 @@ static void CopyFileToDir(const char* srcfile, const char* destdir)
 	strcat(name, ext);
 	ddio_MakePath(destpath, destdir, name, nullptr);
 	ddio_CopyFile(srcfile, destpath);
+	cf_InvalidateSearchPaths();
 }
 
 static void CopyPatternToDir(const char* srcpattern, const char* destdir)
@@ -747,6 +760,46 @@ static void TransferUserData(const char* dest)
 /*
 	I/O systems initialization
 */
+//Runs the benchmarks and self tests asked for on the command line that don't need a level loaded.
+//Results go to the mono window.
+static void RunStartupTests()
+{
+	//-mvebench <movie> [checksum file] times the movie decoder modes and checks they all produce the same frames
+	int mvebench_arg = FindArg("-mvebench");
+	if (mvebench_arg && GetArg(mvebench_arg + 1))
+	{
+		//Don't take the next switch for the checksum file
+		const char *checksum_file = GetArg(mvebench_arg + 2);
+		if (checksum_file && checksum_file[0] == '-')
+			checksum_file = NULL;
+		mve_Benchmark(GetArg(mvebench_arg + 1), checksum_file);
+	}
+
+#ifdef __LINUX__
+	//-mixbench [voices] times the software mixer kernels
+	int mixbench_arg = FindArg("-mixbench");
+	if (mixbench_arg)
+	{
+		const char *voices = GetArg(mixbench_arg + 1);
+		int num_voices = voices ? atoi(voices) : 0;
+		software_mixer::Benchmark(num_voices > 0 ? num_voices : 32);
+	}
+#endif
+
+	if (FindArg("-testprocedurals"))
+		TestProcedurals();
+
+	if (FindArg("-testnetbatch"))
+		nw_TestBatchedIO();
+
+	//Forks, so it runs here while the worker threads are still idle rather than during a level load
+	if (FindArg("-testreliable"))
+		nw_TestReliable();
+
+	if (FindArg("-testtick"))
+		TestDedicatedTick();
+}
+
 void InitIOSystems(bool editor)
 {
 	ddio_init_info io_info;
@@ -897,7 +950,17 @@ void InitIOSystems(bool editor)
 	#endif
 	}
 
+	//Start the worker threads, used to read level data ahead of time among other things
+	job_Init();
+	atexit(job_Shutdown);
+
+	RunStartupTests();
+
 	//Init hogfiles
+	//-hogmmap maps the hogs into memory instead of reading them through stdio
+	cf_SetLibraryMapping(FindArg("-hogmmap") != 0);
+	//-noprefetch turns off background reading of level data, to compare load times
+	cf_SetPrefetching(FindArg("-noprefetch") == 0);
 	int d3_hid=-1,extra_hid=-1,extra1_hid=-1,merc_hid=-1,sys_hid=-1,extra13_hid=-1;
 	char fullname[_MAX_PATH];
 
@@ -1021,6 +1084,16 @@ void InitStringTable()
 
 void InitGraphics(bool editor)
 {
+	//-texidle sets how many seconds an unused texture stays in memory, -texbudget caps texture memory in megabytes
+	int arg = FindArg("-texidle");
+	if (arg)
+		Bitmap_evict_idle_time = atof(GameArgs[arg + 1]);
+	arg = FindArg("-texbudget");
+	if (arg)
+		Bitmap_residency_budget = (longlong)atoi(GameArgs[arg + 1]) * 1024 * 1024;
+	if (FindArg("-nolazymips"))
+		Bitmap_lazy_mips = false;
+
 // Init our bitmaps, must be called before InitTextures
 	bm_InitBitmaps();
 
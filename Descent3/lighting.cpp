@@ -16,6 +16,7 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <vector>
 #include "3d.h"
 #include "texture.h"
 #include "gametexture.h"
@@ -35,6 +36,10 @@
 #include "dedicated_server.h"
 #include "objinfo.h"
 #include "Macros.h"
+#include "jobsystem.h"
+#include "args.h"
+#include "ddio.h"
+#include "objgrid.h"
 
 #define NUM_DYNAMIC_CLASSES	7
 #define MAX_DYNAMIC_FACES	2000
@@ -72,6 +77,14 @@ int Specular_maps[NUM_DYNAMIC_CLASSES];
 ushort Edges_to_blend[MAX_DYNAMIC_LIGHTMAPS];
 int Num_edges_to_blend = 0;
 
+// Light rooms and objects on the calling thread as each light is applied
+static bool Lighting_serial = false;
+
+// Goes up whenever a light runs out of dynamic faces or dynamic lightmaps
+static int Num_dynamic_lighting_overflows = 0;
+
+static void InitObjectLightClusters();
+
 
 int Num_specular_faces = 0;
 int Num_dynamic_faces = 0;
@@ -104,6 +117,9 @@ void InitDynamicLighting()
 
 	memset(Lmi_spoken_for, 0, MAX_LIGHTMAP_INFOS / 8);
 
+	Lighting_serial = FindArg("-seriallighting") != 0;
+	InitObjectLightClusters();
+
 	for (i = 0; i < 16; i++)
 		Light_component_scalar[i] = i / 15.0;
 	for (i = 16; i < 32; i++)
@@ -183,11 +199,15 @@ int GetFreeDynamicLightmap(int w, int h)
 	int total = w * h * 2;
 
 	if (Num_dynamic_lightmaps == MAX_DYNAMIC_LIGHTMAPS)
+	{
+		Num_dynamic_lighting_overflows++;
 		return -1;
+	}
 
 	if (total + Cur_dynamic_mem_ptr > DYNAMIC_LIGHTMAP_MEMORY)
 	{
 		mprintf((0, "Ran out of lightmap memory (%d)\n", DYNAMIC_LIGHTMAP_MEMORY));
+		Num_dynamic_lighting_overflows++;
 		return -1;
 	}
 
@@ -683,6 +703,7 @@ void ApplyLightingToSubmodel(object* obj, poly_model* pm, bsp_info* sm, float li
 		if (Num_dynamic_faces >= MAX_DYNAMIC_FACES)
 		{
 			mprintf((0, "Too many dynamic faces!\n"));
+			Num_dynamic_lighting_overflows++;
 			DoneLightingInstance();
 			return;
 		}
@@ -993,6 +1014,22 @@ void ApplySpecularLightingToWall (room *rp,face *fp,vector *pos,float light_dist
 }*/
 
 // Applys dynamic volumetric lighting to an object
+// Adds an object to the list of volume lit objects that get reset at the end of the frame
+static void AddDynamicVolumeObject(object* obj)
+{
+	if (!obj->effect_info->dynamic_this_frame)
+	{
+		if (Num_volume_objects < MAX_VOLUME_OBJECTS)
+		{
+			Dynamic_volume_object_list[Num_volume_objects].handle = obj->handle;
+			Dynamic_volume_object_list[Num_volume_objects++].objnum = obj - Objects;
+			obj->effect_info->spec_mag = -100000;
+
+			obj->effect_info->dynamic_this_frame = 1;
+		}
+	}
+}
+
 void ApplyVolumeLightToObject(vector* pos, object* obj, float light_dist, float red_scale, float green_scale, float blue_scale, vector* light_direction, float dot_range)
 {
 	vector subvec = *pos - obj->pos;
@@ -1025,17 +1062,7 @@ void ApplyVolumeLightToObject(vector* pos, object* obj, float light_dist, float
 
 	ASSERT(obj->effect_info != NULL);
 
-	if (!obj->effect_info->dynamic_this_frame)
-	{
-		if (Num_volume_objects < MAX_VOLUME_OBJECTS)
-		{
-			Dynamic_volume_object_list[Num_volume_objects].handle = obj->handle;
-			Dynamic_volume_object_list[Num_volume_objects++].objnum = obj - Objects;
-			obj->effect_info->spec_mag = -100000;
-
-			obj->effect_info->dynamic_this_frame = 1;
-		}
-	}
+	AddDynamicVolumeObject(obj);
 
 	// See if this specular light source is greater than our current one
 	if ((light_dist - mag) > obj->effect_info->spec_mag && Detail_settings.Specular_lighting && !(Object_info[obj->id].lighting_info.flags & OLF_NO_SPECULARITY))
@@ -1057,8 +1084,512 @@ void ApplyVolumeLightToObject(vector* pos, object* obj, float light_dist, float
 	}
 }
 
-// Applies lighting to all objects in a certain distance 
-void ApplyLightingToObjects(vector* pos, int roomnum, float light_dist, float red_scale, float green_scale, float blue_scale, vector* light_direction, float dot_range)
+// Lights inside the mine don't light objects as they're applied.  ApplyLightingToObjects bins each
+// light into the rooms it reaches, and FlushObjectLighting lights every object in those rooms once,
+// from the lights in its room's cluster, in the order they were applied.  An object that is lit by
+// the same lights from the same place as last frame gets last frame's result back from the cache.
+
+#define MAX_OBJECT_LIGHTS				512
+#define MAX_LIGHT_CLUSTER_ENTRIES	4096
+#define MAX_CACHED_LIGHTMAPS			2048
+#define MAX_CACHED_TEXELS				65536
+
+// A light waiting to be applied to objects
+struct object_light
+{
+	vector pos;
+	vector direction;
+	vector min_xyz, max_xyz;
+	float light_dist;
+	float red_scale, green_scale, blue_scale;
+	float dot_range;
+	bool directional;
+};
+
+// One light in a room's cluster
+struct light_cluster_entry
+{
+	short light;
+	short next;		// Next light in the same room, -1 if none
+};
+
+// A lightmap of a cached object, and where its lit texels are kept
+struct cached_lightmap
+{
+	ushort lmi_handle;
+	int texel_offset;
+};
+
+// What the lights did to an object the last time it was lit from its cluster
+struct object_light_cache
+{
+	int handle;						// Object this belongs to
+	int frame;						// Object_lighting_frame this was filled in, -1 if it wasn't
+	int lit_frame;					// Last Object_lighting_frame anything lit the object
+	unsigned int key;				// Hash of where the object was and the lights that reached it
+	int num_lights;
+
+	// Volume lighting
+	ubyte registered;
+	ubyte specular;
+	float dynamic_red, dynamic_green, dynamic_blue;
+	float spec_mag;
+	vector spec_pos;
+	float spec_r, spec_g, spec_b;
+
+	// Lightmap lighting, in Cached_lightmaps[frame & 1]
+	int first_lightmap, num_lightmaps;
+};
+
+static object_light Object_lights[MAX_OBJECT_LIGHTS];
+static light_cluster_entry Light_cluster_entries[MAX_LIGHT_CLUSTER_ENTRIES];
+static short Room_cluster_first[MAX_ROOMS];
+static short Room_cluster_last[MAX_ROOMS];
+static short Clustered_rooms[MAX_ROOMS];
+
+static int Num_object_lights = 0;
+static int Num_light_cluster_entries = 0;
+static int Num_clustered_rooms = 0;
+
+// The cache is double buffered, so last frame's lightmaps can be read while this frame's are kept
+static object_light_cache Object_light_cache[MAX_OBJECTS];
+static cached_lightmap Cached_lightmaps[2][MAX_CACHED_LIGHTMAPS];
+static ushort Cached_texels[2][MAX_CACHED_TEXELS];
+static int Num_cached_lightmaps[2];
+static int Num_cached_texels[2];
+
+// Counts the frames of dynamic lighting.  Goes up in ClearDynamicLightmaps
+static int Object_lighting_frame = 0;
+
+// Only cleared by TestObjectLighting, to time the clusters without the cache
+static bool Object_light_cache_enabled = true;
+static int Object_light_cache_hits = 0;
+
+// Empties the room clusters and the cache
+static void InitObjectLightClusters()
+{
+	int i;
+
+	for (i = 0; i < MAX_ROOMS; i++)
+		Room_cluster_first[i] = -1;
+
+	for (i = 0; i < MAX_OBJECTS; i++)
+	{
+		Object_light_cache[i].handle = -1;
+		Object_light_cache[i].frame = -1;
+		Object_light_cache[i].lit_frame = -1;
+	}
+}
+
+static inline unsigned int HashLightingBytes(unsigned int hash, const void* data, int size)
+{
+	const ubyte* bytes = (const ubyte*)data;
+
+	for (int i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	return hash;
+}
+
+// Hashes where an object is and the lights that reach it, which is everything its lighting depends on
+static unsigned int HashObjectLights(object* obj, const short* lights, int num_lights, const float* normalized_time, int num_times)
+{
+	unsigned int hash = 2166136261u;
+
+	hash = HashLightingBytes(hash, &obj->pos, sizeof(vector));
+	hash = HashLightingBytes(hash, &obj->orient, sizeof(matrix));
+	hash = HashLightingBytes(hash, &Detail_settings.Specular_lighting, sizeof(Detail_settings.Specular_lighting));
+	if (normalized_time)
+		hash = HashLightingBytes(hash, normalized_time, num_times * sizeof(float));
+
+	for (int i = 0; i < num_lights; i++)
+	{
+		object_light* lp = &Object_lights[lights[i]];
+
+		hash = HashLightingBytes(hash, &lp->pos, sizeof(vector));
+		hash = HashLightingBytes(hash, &lp->light_dist, sizeof(float));
+		hash = HashLightingBytes(hash, &lp->red_scale, sizeof(float));
+		hash = HashLightingBytes(hash, &lp->green_scale, sizeof(float));
+		hash = HashLightingBytes(hash, &lp->blue_scale, sizeof(float));
+		hash = HashLightingBytes(hash, &lp->directional, sizeof(bool));
+		if (lp->directional)
+		{
+			hash = HashLightingBytes(hash, &lp->direction, sizeof(vector));
+			hash = HashLightingBytes(hash, &lp->dot_range, sizeof(float));
+		}
+	}
+
+	return hash;
+}
+
+// Returns true if the cache holds what these lights did to this object last frame
+static bool ObjectLightCacheMatches(object_light_cache* cache, object* obj, unsigned int key, int num_lights)
+{
+	return cache->handle == obj->handle && cache->frame == Object_lighting_frame - 1 && cache->key == key && cache->num_lights == num_lights;
+}
+
+// Grows the changed part of a lightmap to take in the rectangle from x1,y1 to x2,y2
+static void AddToLightmapLimits(int lm_handle, int x1, int y1, int x2, int y2)
+{
+	if (!(GameLightmaps[lm_handle].flags & LF_LIMITS))
+	{
+		GameLightmaps[lm_handle].cx1 = x1;
+		GameLightmaps[lm_handle].cx2 = x2;
+		GameLightmaps[lm_handle].cy1 = y1;
+		GameLightmaps[lm_handle].cy2 = y2;
+	}
+	else
+	{
+		if (x1 < GameLightmaps[lm_handle].cx1)
+			GameLightmaps[lm_handle].cx1 = x1;
+		if (x2 > GameLightmaps[lm_handle].cx2)
+			GameLightmaps[lm_handle].cx2 = x2;
+		if (y1 < GameLightmaps[lm_handle].cy1)
+			GameLightmaps[lm_handle].cy1 = y1;
+		if (y2 > GameLightmaps[lm_handle].cy2)
+			GameLightmaps[lm_handle].cy2 = y2;
+	}
+
+	GameLightmaps[lm_handle].flags |= (LF_LIMITS | LF_CHANGED);
+}
+
+// Keeps the texels of the lightmaps made dynamic since first_face, so the object can get them back next frame
+static bool StoreCachedLightmaps(object_light_cache* cache, int first_face)
+{
+	int buffer = Object_lighting_frame & 1;
+	int num_lightmaps = Num_dynamic_faces - first_face;
+	int num_texels = 0;
+	int i;
+
+	for (i = first_face; i < Num_dynamic_faces; i++)
+		num_texels += lmi_w(Dynamic_face_list[i].lmi_handle) * lmi_h(Dynamic_face_list[i].lmi_handle);
+
+	if (Num_cached_lightmaps[buffer] + num_lightmaps > MAX_CACHED_LIGHTMAPS || Num_cached_texels[buffer] + num_texels > MAX_CACHED_TEXELS)
+		return false;
+
+	cache->first_lightmap = Num_cached_lightmaps[buffer];
+	cache->num_lightmaps = num_lightmaps;
+
+	for (i = first_face; i < Num_dynamic_faces; i++)
+	{
+		int lmi_handle = Dynamic_face_list[i].lmi_handle;
+		lightmap_info* lmi_ptr = &LightmapInfo[lmi_handle];
+		int xres = lmi_w(lmi_handle);
+		int yres = lmi_h(lmi_handle);
+		int lmw = lm_w(lmi_ptr->lm_handle);
+		ushort* src_data = (ushort*)lm_data(lmi_ptr->lm_handle);
+
+		cached_lightmap* clm = &Cached_lightmaps[buffer][Num_cached_lightmaps[buffer]++];
+		clm->lmi_handle = lmi_handle;
+		clm->texel_offset = Num_cached_texels[buffer];
+
+		ushort* dest_data = &Cached_texels[buffer][clm->texel_offset];
+		for (int y = 0; y < yres; y++, dest_data += xres)
+			memcpy(dest_data, &src_data[((lmi_ptr->y1 + y) * lmw) + lmi_ptr->x1], xres * sizeof(ushort));
+
+		Num_cached_texels[buffer] += xres * yres;
+	}
+
+	return true;
+}
+
+// Puts back the lit lightmaps an object had last frame, setting them up as dynamic lightmaps the same
+// way ApplyLightingToSubmodel does.  Does nothing and returns false if they wouldn't all fit
+static bool RestoreCachedLightmaps(object_light_cache* cache)
+{
+	int buffer = (Object_lighting_frame - 1) & 1;
+	cached_lightmap* lightmaps = &Cached_lightmaps[buffer][cache->first_lightmap];
+	int mem = 0;
+	int i;
+
+	if (Num_dynamic_faces + cache->num_lightmaps > MAX_DYNAMIC_FACES || Num_dynamic_lightmaps + cache->num_lightmaps > MAX_DYNAMIC_LIGHTMAPS)
+		return false;
+
+	for (i = 0; i < cache->num_lightmaps; i++)
+	{
+		lightmap_info* lmi_ptr = &LightmapInfo[lightmaps[i].lmi_handle];
+		if (lmi_ptr->used < 1 || lmi_ptr->dynamic != BAD_LM_INDEX)
+			return false;
+		mem += lmi_w(lightmaps[i].lmi_handle) * lmi_h(lightmaps[i].lmi_handle) * 2;
+	}
+
+	if (Cur_dynamic_mem_ptr + mem > DYNAMIC_LIGHTMAP_MEMORY)
+		return false;
+
+	for (i = 0; i < cache->num_lightmaps; i++)
+	{
+		int lmi_handle = lightmaps[i].lmi_handle;
+		lightmap_info* lmi_ptr = &LightmapInfo[lmi_handle];
+		int xres = lmi_w(lmi_handle);
+		int yres = lmi_h(lmi_handle);
+		int lm_handle = lmi_ptr->lm_handle;
+		int lmw = lm_w(lm_handle);
+		ushort* data = (ushort*)lm_data(lm_handle);
+		ushort* texels = &Cached_texels[buffer][lightmaps[i].texel_offset];
+
+		int dynamic_handle = GetFreeDynamicLightmap(xres, yres);
+		ushort* dynamic_data = Dynamic_lightmaps[dynamic_handle].mem_ptr;
+
+		for (int y = 0, index = 0; y < yres; y++)
+		{
+			for (int x = 0; x < xres; x++, index++)
+			{
+				int texel_num = ((lmi_ptr->y1 + y) * lmw) + lmi_ptr->x1 + x;
+				dynamic_data[index] = data[texel_num];
+				data[texel_num] = texels[index];
+			}
+		}
+
+		lmi_ptr->dynamic = dynamic_handle;
+
+		// The cache doesn't keep which part of the lightmap the lights changed, so mark all of it
+		AddToLightmapLimits(lm_handle, lmi_ptr->x1, lmi_ptr->y1, lmi_ptr->x1 + xres, lmi_ptr->y1 + yres);
+
+		Dynamic_face_list[Num_dynamic_faces].lmi_handle = lmi_handle;
+		Num_dynamic_faces++;
+
+		Edges_to_blend[Num_edges_to_blend++] = lmi_handle;
+	}
+
+	return true;
+}
+
+// Applies a volume lit object's lights, or last frame's result if nothing changed
+static void LightVolumeObjectFromCluster(object* obj, const short* lights, int num_lights, bool first)
+{
+	object_light_cache* cache = &Object_light_cache[OBJNUM(obj)];
+	bool use_cache = first && Object_light_cache_enabled;
+	unsigned int key = 0;
+	int i;
+
+	if (use_cache)
+	{
+		key = HashObjectLights(obj, lights, num_lights, NULL, 0) ^ (obj->effect_info->type_flags & EF_VOLUME_LIT);
+
+		if (ObjectLightCacheMatches(cache, obj, key, num_lights))
+		{
+			if (cache->registered)
+				AddDynamicVolumeObject(obj);
+
+			obj->effect_info->dynamic_red = cache->dynamic_red;
+			obj->effect_info->dynamic_green = cache->dynamic_green;
+			obj->effect_info->dynamic_blue = cache->dynamic_blue;
+			if (cache->registered)
+				obj->effect_info->spec_mag = cache->spec_mag;
+
+			if (cache->specular)
+			{
+				obj->effect_info->type_flags |= EF_SPECULAR;
+				obj->effect_info->spec_pos = cache->spec_pos;
+				obj->effect_info->spec_r = cache->spec_r;
+				obj->effect_info->spec_g = cache->spec_g;
+				obj->effect_info->spec_b = cache->spec_b;
+			}
+
+			cache->frame = Object_lighting_frame;
+			Object_light_cache_hits++;
+			return;
+		}
+	}
+
+	for (i = 0; i < num_lights; i++)
+	{
+		object_light* lp = &Object_lights[lights[i]];
+		ApplyVolumeLightToObject(&lp->pos, obj, lp->light_dist, lp->red_scale, lp->green_scale, lp->blue_scale, lp->directional ? &lp->direction : NULL, lp->dot_range);
+	}
+
+	if (!use_cache)
+		return;
+
+	cache->handle = obj->handle;
+	cache->frame = Object_lighting_frame;
+	cache->key = key;
+	cache->num_lights = num_lights;
+	cache->registered = obj->effect_info->dynamic_this_frame;
+	cache->specular = (obj->effect_info->type_flags & EF_SPECULAR) != 0;
+	cache->dynamic_red = obj->effect_info->dynamic_red;
+	cache->dynamic_green = obj->effect_info->dynamic_green;
+	cache->dynamic_blue = obj->effect_info->dynamic_blue;
+	cache->spec_mag = obj->effect_info->spec_mag;
+	cache->spec_pos = obj->effect_info->spec_pos;
+	cache->spec_r = obj->effect_info->spec_r;
+	cache->spec_g = obj->effect_info->spec_g;
+	cache->spec_b = obj->effect_info->spec_b;
+	cache->num_lightmaps = 0;
+}
+
+// Applies a lightmapped object's lights, or puts back last frame's lightmaps if nothing changed
+static void LightLightmapObjectFromCluster(object* obj, const short* lights, int num_lights, bool first)
+{
+	object_light_cache* cache = &Object_light_cache[OBJNUM(obj)];
+	poly_model* pm = &Poly_models[obj->rtype.pobj_info.model_num];
+	float normalized_time[MAX_SUBOBJECTS];
+	bool from_cache = false;
+	int first_face = Num_dynamic_faces;
+	int overflows = Num_dynamic_lighting_overflows;
+	unsigned int key = 0;
+	int i;
+
+	SetNormalizedTimeObj(obj, normalized_time);
+
+	if (first && Object_light_cache_enabled)
+	{
+		key = HashObjectLights(obj, lights, num_lights, normalized_time, pm->n_models);
+
+		from_cache = ObjectLightCacheMatches(cache, obj, key, num_lights) && RestoreCachedLightmaps(cache);
+		if (from_cache)
+			Object_light_cache_hits++;
+	}
+
+	if (!from_cache)
+	{
+		SetModelAnglesAndPos(pm, normalized_time);
+
+		for (i = 0; i < num_lights; i++)
+		{
+			object_light* lp = &Object_lights[lights[i]];
+
+			// Set our light position
+			Light_position = lp->pos;
+
+			// Set up light direction if this is a directional light
+			if (lp->directional)
+			{
+				Light_direction = lp->direction;
+				Use_light_direction = 1;
+			}
+			else
+				Use_light_direction = 0;
+
+			StartLightingInstance(&obj->pos, &obj->orient);
+
+			for (int t = 0; t < pm->n_models; t++)
+			{
+				bsp_info* sm = &pm->submodel[t];
+				if (sm->parent == -1)
+					ApplyLightingToSubmodel(obj, pm, sm, lp->light_dist, lp->red_scale, lp->green_scale, lp->blue_scale, lp->dot_range);
+			}
+
+			DoneLightingInstance();
+			ASSERT(Light_instance_depth == 0);
+		}
+	}
+
+	if (!first || !Object_light_cache_enabled)
+		return;
+
+	// Don't keep a result that ran out of dynamic lightmaps part way through
+	cache->frame = -1;
+	if (Num_dynamic_lighting_overflows == overflows && StoreCachedLightmaps(cache, first_face))
+	{
+		cache->handle = obj->handle;
+		cache->frame = Object_lighting_frame;
+		cache->key = key;
+		cache->num_lights = num_lights;
+	}
+}
+
+// Lights an object once from all the lights in its cluster that reach it
+static void LightObjectFromCluster(object* obj, const short* lights, int num_lights)
+{
+	int i;
+
+	if (obj->type == OBJ_ROOM)
+	{
+		for (i = 0; i < num_lights; i++)
+		{
+			object_light* lp = &Object_lights[lights[i]];
+			ApplyLightingToExternalRoom(&lp->pos, obj->id, lp->light_dist, lp->red_scale, lp->green_scale, lp->blue_scale, lp->directional ? &lp->direction : NULL, lp->dot_range);
+		}
+		return;
+	}
+
+	if (obj->renderframe != ((FrameCount - 1) % 65536))
+	{
+		if (obj != Viewer_object)
+			return;
+	}
+
+	// The cache only holds what the lights do to an unlit object, so it's no use once something else lit it this frame
+	object_light_cache* cache = &Object_light_cache[OBJNUM(obj)];
+	bool first = (cache->lit_frame != Object_lighting_frame);
+
+	if (obj->lm_object.used == 0)
+	{
+		if (obj->effect_info && ((obj->effect_info->type_flags & EF_VOLUME_LIT) || obj->lighting_render_type == LRT_GOURAUD || obj->type == OBJ_POWERUP))
+		{
+			cache->lit_frame = Object_lighting_frame;
+			LightVolumeObjectFromCluster(obj, lights, num_lights, first);
+		}
+		return;
+	}
+
+	cache->lit_frame = Object_lighting_frame;
+	LightLightmapObjectFromCluster(obj, lights, num_lights, first);
+}
+
+// Lights all the objects reached by the lights binned since the last flush
+void FlushObjectLighting()
+{
+	static short room_objs[MAX_OBJECTS];
+	short lights[MAX_OBJECT_LIGHTS];
+	int i, j, e;
+
+	for (i = 0; i < Num_clustered_rooms; i++)
+	{
+		int roomnum = Clustered_rooms[i];
+
+		// Gather the objects any of the room's lights might reach
+		e = Room_cluster_first[roomnum];
+		vector min_xyz = Object_lights[Light_cluster_entries[e].light].min_xyz;
+		vector max_xyz = Object_lights[Light_cluster_entries[e].light].max_xyz;
+
+		for (e = Light_cluster_entries[e].next; e != -1; e = Light_cluster_entries[e].next)
+		{
+			object_light* lp = &Object_lights[Light_cluster_entries[e].light];
+
+			min_xyz.x = min(min_xyz.x, lp->min_xyz.x);
+			min_xyz.y = min(min_xyz.y, lp->min_xyz.y);
+			min_xyz.z = min(min_xyz.z, lp->min_xyz.z);
+			max_xyz.x = max(max_xyz.x, lp->max_xyz.x);
+			max_xyz.y = max(max_xyz.y, lp->max_xyz.y);
+			max_xyz.z = max(max_xyz.z, lp->max_xyz.z);
+		}
+
+		int num_room_objs = ObjGridGather(roomnum, &min_xyz, &max_xyz, room_objs);
+
+		for (j = 0; j < num_room_objs; j++)
+		{
+			object* obj = &Objects[room_objs[j]];
+			int num_lights = 0;
+
+			// Same overlap test fvi_QuickDistObjectList does for each light
+			for (e = Room_cluster_first[roomnum]; e != -1; e = Light_cluster_entries[e].next)
+			{
+				object_light* lp = &Object_lights[Light_cluster_entries[e].light];
+
+				if (obj->max_xyz.x < lp->min_xyz.x || lp->max_xyz.x < obj->min_xyz.x ||
+					obj->max_xyz.z < lp->min_xyz.z || lp->max_xyz.z < obj->min_xyz.z ||
+					obj->max_xyz.y < lp->min_xyz.y || lp->max_xyz.y < obj->min_xyz.y)
+					continue;
+
+				lights[num_lights++] = Light_cluster_entries[e].light;
+			}
+
+			if (num_lights)
+				LightObjectFromCluster(obj, lights, num_lights);
+		}
+
+		Room_cluster_first[roomnum] = -1;
+	}
+
+	Num_object_lights = 0;
+	Num_light_cluster_entries = 0;
+	Num_clustered_rooms = 0;
+}
+
+// Lights the objects within reach of a light right away
+static void ApplyLightingToObjectsNow(vector* pos, int roomnum, float light_dist, float red_scale, float green_scale, float blue_scale, vector* light_direction, float dot_range)
 {
 	short objlist[MAX_DYNAMIC_FACES];
 	int num_objects, i;
@@ -1082,6 +1613,9 @@ void ApplyLightingToObjects(vector* pos, int roomnum, float light_dist, float re
 				continue;
 		}
 
+		// Lit outside of its cluster, so the cache can't stand in for it this frame
+		Object_light_cache[objlist[i]].lit_frame = Object_lighting_frame;
+
 		if (obj->lm_object.used == 0)
 		{
 			if (obj->effect_info && ((obj->effect_info->type_flags & EF_VOLUME_LIT) || obj->lighting_render_type == LRT_GOURAUD || obj->type == OBJ_POWERUP))
@@ -1110,21 +1644,300 @@ void ApplyLightingToObjects(vector* pos, int roomnum, float light_dist, float re
 
 		StartLightingInstance(&obj->pos, &obj->orient);
 
-		// Now, get the lights position in the objects submodel space
-		SetNormalizedTimeObj(obj, normalized_time);
-		SetModelAnglesAndPos(pm, normalized_time);
+		// Now, get the lights position in the objects submodel space
+		SetNormalizedTimeObj(obj, normalized_time);
+		SetModelAnglesAndPos(pm, normalized_time);
+
+		for (int t = 0; t < pm->n_models; t++)
+		{
+			bsp_info* sm = &pm->submodel[t];
+			if (sm->parent == -1)
+				ApplyLightingToSubmodel(obj, pm, sm, light_dist, red_scale, green_scale, blue_scale, dot_range);
+		}
+
+		DoneLightingInstance();
+		ASSERT(Light_instance_depth == 0);
+
+	}
+}
+
+// Applies lighting to all objects in a certain distance
+void ApplyLightingToObjects(vector* pos, int roomnum, float light_dist, float red_scale, float green_scale, float blue_scale, vector* light_direction, float dot_range)
+{
+	short rooms[MAX_QUICK_ROOMS];
+	int num_rooms, i;
+
+	if (Lighting_serial || ROOMNUM_OUTSIDE(roomnum))
+	{
+		ApplyLightingToObjectsNow(pos, roomnum, light_dist, red_scale, green_scale, blue_scale, light_direction, dot_range);
+		return;
+	}
+
+	// Make sure this light fits in the clusters
+	if (Num_object_lights == MAX_OBJECT_LIGHTS || Num_light_cluster_entries + MAX_QUICK_ROOMS > MAX_LIGHT_CLUSTER_ENTRIES)
+		FlushObjectLighting();
+
+	int light_index = Num_object_lights++;
+	object_light* lp = &Object_lights[light_index];
+	vector rad = { light_dist, light_dist, light_dist };
+
+	lp->pos = *pos;
+	lp->min_xyz = *pos - rad;
+	lp->max_xyz = *pos + rad;
+	lp->light_dist = light_dist;
+	lp->red_scale = red_scale;
+	lp->green_scale = green_scale;
+	lp->blue_scale = blue_scale;
+	lp->dot_range = dot_range;
+	lp->directional = (light_direction != NULL);
+	if (light_direction)
+		lp->direction = *light_direction;
+
+	// Add the light to the cluster of every room it reaches
+	num_rooms = fvi_QuickDistRoomList(pos, roomnum, light_dist, rooms, MAX_QUICK_ROOMS);
+
+	for (i = 0; i < num_rooms; i++)
+	{
+		int entry = Num_light_cluster_entries++;
+		int r = rooms[i];
+
+		Light_cluster_entries[entry].light = light_index;
+		Light_cluster_entries[entry].next = -1;
+
+		if (Room_cluster_first[r] == -1)
+		{
+			Room_cluster_first[r] = entry;
+			Clustered_rooms[Num_clustered_rooms++] = r;
+		}
+		else
+			Light_cluster_entries[Room_cluster_last[r]].next = entry;
+
+		Room_cluster_last[r] = entry;
+	}
+}
+
+// Room lightmaps aren't lit as each light is applied.  ApplyLightingToRooms works out which part
+// of which lightmap a light touches and queues it, and FlushDynamicLighting accumulates the queue
+// one lightmap per job.  Every lightmap still gets its lights in the order they were applied, so
+// the result is the same no matter how many threads do the work.
+
+#define MAX_PENDING_LIGHTS		512
+#define MAX_PENDING_RECTS		4096
+#define MAX_LIGHTMAP_ROW			128
+#define MIN_PARALLEL_TEXELS		2048
+
+// A light waiting to be accumulated into room lightmaps
+struct pending_light
+{
+	vector pos;
+	vector direction;
+	float light_dist;
+	float red_scale, green_scale, blue_scale;
+	float dot_range;
+	bool directional;
+};
+
+// The part of a lightmap that a pending light touches
+struct pending_rect
+{
+	vector base_vector;		// Position of the first texel
+	vector xstep, ystep;		// Distance between texels along a row and between rows
+	int lmi_handle;
+	short light;
+	short start_x, start_y, width, height;
+	short next;					// Next rect on the same lightmap, -1 if none
+};
+
+// All the pending rects on one lightmap
+struct pending_lightmap
+{
+	int lmi_handle;
+	short first, last;
+};
+
+static pending_light Pending_lights[MAX_PENDING_LIGHTS];
+static pending_rect Pending_rects[MAX_PENDING_RECTS];
+static pending_lightmap Pending_lightmaps[MAX_PENDING_RECTS];
+static ushort Lmi_pending[MAX_LIGHTMAP_INFOS];		// Index into Pending_lightmaps plus one, 0 if nothing pending
+
+static int Num_pending_lights = 0;
+static int Num_pending_rects = 0;
+static int Num_pending_lightmaps = 0;
+static int Num_pending_texels = 0;
+
+// Only cleared by TestDynamicLighting, to time the queue without the job pool
+static bool Lighting_use_jobs = true;
+
+// Same result as vm_GetMagnitudeFast, but sorts the components with min/max so a row of these vectorizes
+static inline float LightingMagnitudeFast(float x, float y, float z)
+{
+	x = fabsf(x);
+	y = fabsf(y);
+	z = fabsf(z);
+
+	float a = max(max(x, y), z);
+	float b = max(min(x, y), min(max(x, y), z));
+	float c = min(min(x, y), z);
+	float bc = (b / 4) + (c / 8);
+
+	return a + bc + (bc / 2);
+}
+
+// Adds one light to one rectangle of a lightmap
+static void AccumulateLightingRect(const pending_rect* rect)
+{
+	const pending_light* lp = &Pending_lights[rect->light];
+	lightmap_info* lmi_ptr = &LightmapInfo[rect->lmi_handle];
+	int lmw = lm_w(lmi_ptr->lm_handle);
+	ushort* dest_data = (ushort*)lm_data(lmi_ptr->lm_handle);
+	int width = rect->width;
+	int red_limit = 31;
+	int green_limit = 31;
+	int blue_limit = 31;
+
+	float xpos[MAX_LIGHTMAP_ROW], ypos[MAX_LIGHTMAP_ROW], zpos[MAX_LIGHTMAP_ROW];
+	float scalars[MAX_LIGHTMAP_ROW];
+
+	ASSERT(width <= MAX_LIGHTMAP_ROW);
+
+	vector base_vector = rect->base_vector;
+	int texel_num = ((rect->start_y + lmi_ptr->y1) * lmw) + rect->start_x + lmi_ptr->x1;
+
+	for (int y = 0; y < rect->height; y++, base_vector -= rect->ystep, texel_num += lmw)
+	{
+		vector element_vec = base_vector;
+		int x;
+
+		// Stepping along the row has to add up the same way it always has, so do that on its own
+		for (x = 0; x < width; x++, element_vec += rect->xstep)
+		{
+			xpos[x] = element_vec.x - lp->pos.x;
+			ypos[x] = element_vec.y - lp->pos.y;
+			zpos[x] = element_vec.z - lp->pos.z;
+		}
+
+		for (x = 0; x < width; x++)
+		{
+			float dist = LightingMagnitudeFast(xpos[x], ypos[x], zpos[x]);
+			scalars[x] = 1.0 - (dist / lp->light_dist);
+		}
+
+		if (lp->directional)
+		{
+			for (x = 0; x < width; x++)
+			{
+				vector lsubvec = { xpos[x], ypos[x], zpos[x] };
+				vm_NormalizeVectorFast(&lsubvec);
+				float dp = vm_DotProduct(&lsubvec, &lp->direction);
+				if (dp < lp->dot_range)
+					scalars[x] = 0;
+				else
+				{
+					float add_scale = (dp - lp->dot_range) / (1.0 - lp->dot_range);
+					scalars[x] *= add_scale;
+				}
+			}
+		}
+
+		ushort* row_data = &dest_data[texel_num];
+
+		for (x = 0; x < width; x++)
+		{
+			ushort lightmap_texel = row_data[x];
+			float scalar = scalars[x];
+
+			if (!(lightmap_texel & OPAQUE_FLAG))
+				continue;
+
+			if (scalar <= 0)
+				continue;
+
+			int r = (lightmap_texel >> 10) & 0x1f;
+			int g = (lightmap_texel >> 5) & 0x1f;
+			int b = lightmap_texel & 0x1f;
+
+			if (lp->red_scale < 0)
+			{
+				// we are subtracting light
+				r = max(0, r + (scalar * lp->red_scale * 31));
+			}
+			else
+			{
+				// we are adding light
+				if (r < red_limit)
+					r = min(red_limit, r + (scalar * lp->red_scale * 31));
+			}
+
+			if (lp->green_scale < 0)
+			{
+				// we are subtracting light
+				g = max(0, g + (scalar * lp->green_scale * 31));
+			}
+			else
+			{
+				// we are adding light
+				if (g < green_limit)
+					g = min(green_limit, g + (scalar * lp->green_scale * 31));
+			}
+
+			if (lp->blue_scale < 0)
+			{
+				// we are subtracting light
+				b = max(0, b + (scalar * lp->blue_scale * 31));
+			}
+			else
+			{
+				if (b < blue_limit)
+					b = min(blue_limit, b + (scalar * lp->blue_scale * 31));
+			}
+
+			row_data[x] = OPAQUE_FLAG | (r << 10) | (g << 5) | b;
+		}
+	}
+}
+
+// Adds every pending light on one lightmap, in the order they were applied
+static void AccumulatePendingLightmap(int index)
+{
+	pending_lightmap* plm = &Pending_lightmaps[index];
+
+	if (LightmapInfo[plm->lmi_handle].used < 1)
+		return;		// this face was killed since the light was applied
+
+	for (int i = plm->first; i != -1; i = Pending_rects[i].next)
+		AccumulateLightingRect(&Pending_rects[i]);
+}
+
+static void AccumulatePendingLightmapJob(void*, int index)
+{
+	AccumulatePendingLightmap(index);
+}
+
+// Accumulates all queued room lighting into the lightmaps
+void FlushDynamicLighting()
+{
+	int i;
 
-		for (int t = 0; t < pm->n_models; t++)
-		{
-			bsp_info* sm = &pm->submodel[t];
-			if (sm->parent == -1)
-				ApplyLightingToSubmodel(obj, pm, sm, light_dist, red_scale, green_scale, blue_scale, dot_range);
-		}
+	FlushObjectLighting();
 
-		DoneLightingInstance();
-		ASSERT(Light_instance_depth == 0);
+	if (Num_pending_rects == 0)
+		return;
 
+	if (!Lighting_serial && Lighting_use_jobs && job_GetNumThreads() > 0 && Num_pending_lightmaps > 1 && Num_pending_texels >= MIN_PARALLEL_TEXELS)
+		job_ParallelFor(Num_pending_lightmaps, AccumulatePendingLightmapJob, NULL);
+	else
+	{
+		for (i = 0; i < Num_pending_lightmaps; i++)
+			AccumulatePendingLightmap(i);
 	}
+
+	for (i = 0; i < Num_pending_lightmaps; i++)
+		Lmi_pending[Pending_lightmaps[i].lmi_handle] = 0;
+
+	Num_pending_lights = 0;
+	Num_pending_rects = 0;
+	Num_pending_lightmaps = 0;
+	Num_pending_texels = 0;
 }
 
 // Applys dynamic lightmap changes to rooms and room objects.  If light direction is non-null, we are applying a directional light
@@ -1135,7 +1948,6 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 	int num_spoken_for = 0;
 
 	int num_faces, i, t, lm_handle;
-	ushort* dest_data;
 	int faces_misreported = 0;
 
 	if (Dedicated_server)
@@ -1155,9 +1967,22 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 	if (num_faces < 1)
 		return;
 
-	int red_limit = 31;
-	int green_limit = 31;
-	int blue_limit = 31;
+	// Make sure this light's rects fit in the queue
+	if (Num_pending_lights == MAX_PENDING_LIGHTS || Num_pending_rects + num_faces > MAX_PENDING_RECTS)
+		FlushDynamicLighting();
+
+	int light_index = Num_pending_lights++;
+	pending_light* lp = &Pending_lights[light_index];
+
+	lp->pos = *pos;
+	lp->light_dist = light_dist;
+	lp->red_scale = red_scale;
+	lp->green_scale = green_scale;
+	lp->blue_scale = blue_scale;
+	lp->dot_range = dot_range;
+	lp->directional = (light_direction != NULL);
+	if (light_direction)
+		lp->direction = *light_direction;
 
 	for (i = 0; i < num_faces; i++)
 	{
@@ -1174,7 +1999,7 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 		if (Num_dynamic_faces >= MAX_DYNAMIC_FACES)
 		{
 			mprintf((0, "Too many dynamic faces!\n"));
-			return;
+			break;
 		}
 
 		// Make sure there already is a lightmap for this face
@@ -1277,7 +2102,6 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 		if (lmi_ptr->dynamic != BAD_LM_INDEX)		// already lit, so just adjust, not start over
 		{
 			lm_handle = LightmapInfo[fp->lmi_handle].lm_handle;
-			dest_data = (ushort*)lm_data(lm_handle);
 
 			if (start_x + lmi_ptr->x1 < GameLightmaps[lm_handle].cx1)
 				GameLightmaps[lm_handle].cx1 = start_x + lmi_ptr->x1;
@@ -1306,12 +2130,14 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 			if (dynamic_handle < 0)
 			{
 				mprintf((0, "No free dynamic maps!\n"));
-				return;		// None free!
+				break;		// None free!
 			}
 
 
-			// Now copy our source data to our dest data so we have a base to work with
+			// Now copy our source data to our dest data so we have a base to work with.
+			// Nothing is pending on this lightmap yet, since it wasn't dynamic
 			ushort* src_data;
+			ushort* dest_data;
 
 			src_data = (ushort*)lm_data(LightmapInfo[fp->lmi_handle].lm_handle);
 			dest_data = Dynamic_lightmaps[dynamic_handle].mem_ptr;
@@ -1322,7 +2148,6 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 					dest_data[index] = src_data[((lmi_ptr->y1 + y) * lmw) + lmi_ptr->x1 + x];
 			}
 
-			dest_data = src_data;
 			lm_handle = LightmapInfo[fp->lmi_handle].lm_handle;
 
 			// Mark it as changed
@@ -1363,96 +2188,41 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 			Edges_to_blend[Num_edges_to_blend++] = fp->lmi_handle;
 		}
 
-		vector element_vec;
+		// Queue the rectangle for FlushDynamicLighting
+		int rect_index = Num_pending_rects++;
+		pending_rect* rect = &Pending_rects[rect_index];
 
-		base_vector -= (start_y * (facematrix.uvec * lmi_ptr->yspacing));
-		base_vector += (start_x * (facematrix.rvec * lmi_ptr->xspacing));
+		rect->xstep = facematrix.rvec * lmi_ptr->xspacing;
+		rect->ystep = facematrix.uvec * lmi_ptr->yspacing;
+
+		base_vector -= (start_y * rect->ystep);
+		base_vector += (start_x * rect->xstep);
 
 		base_vector -= ((facematrix.uvec / 2) * lmi_ptr->yspacing);
 		base_vector += ((facematrix.rvec / 2) * lmi_ptr->xspacing);
 
-		// Go through and change each element of this lightmap
-		// SLOW!
-
-		int texel_num = ((start_y + lmi_ptr->y1) * lmw) + start_x + lmi_ptr->x1;
-		for (int y = 0; y < height; y++, base_vector -= (facematrix.uvec * lmi_ptr->yspacing), texel_num += lmw)
+		rect->base_vector = base_vector;
+		rect->lmi_handle = fp->lmi_handle;
+		rect->light = light_index;
+		rect->start_x = start_x;
+		rect->start_y = start_y;
+		rect->width = width;
+		rect->height = height;
+		rect->next = -1;
+
+		int pending = Lmi_pending[fp->lmi_handle] - 1;
+		if (pending < 0)
 		{
-			element_vec = base_vector;
-
-			for (int x = 0; x < width; x++, element_vec += (facematrix.rvec * lmi_ptr->xspacing))
-			{
-				int lightmap_texel_num = texel_num + x;
-
-				ushort lightmap_texel = dest_data[lightmap_texel_num];
-
-				if (!(lightmap_texel & OPAQUE_FLAG))
-					continue;
-
-				float dist = vm_VectorDistanceQuick(&element_vec, pos);
-				float scalar = 1.0 - (dist / light_dist);
-
-				if (light_direction)
-				{
-					vector lsubvec = element_vec - *pos;
-					vm_NormalizeVectorFast(&lsubvec);
-					float dp = vm_DotProduct(&lsubvec, light_direction);
-					if (dp < dot_range)
-						continue;
-					else
-					{
-
-						float add_scale = (dp - dot_range) / (1.0 - dot_range);
-						scalar *= add_scale;
-					}
-				}
-
-				if (scalar <= 0)
-					continue;
-
-				int r = (lightmap_texel >> 10) & 0x1f;
-				int g = (lightmap_texel >> 5) & 0x1f;
-				int b = lightmap_texel & 0x1f;
-
-				if (red_scale < 0)
-				{
-					// we are subtracting light
-					r = max(0, r + (scalar * red_scale * 31));
-				}
-				else
-				{
-					// we are adding light
-					if (r < red_limit)
-						r = min(red_limit, r + (scalar * red_scale * 31));
-				}
-
-				if (green_scale < 0)
-				{
-					// we are subtracting light
-					g = max(0, g + (scalar * green_scale * 31));
-				}
-				else
-				{
-					// we are adding light
-					if (g < green_limit)
-						g = min(green_limit, g + (scalar * green_scale * 31));
-				}
-
-				if (blue_scale < 0)
-				{
-					// we are subtracting light
-					b = max(0, b + (scalar * blue_scale * 31));
-				}
-				else
-				{
-					if (b < blue_limit)
-						b = min(blue_limit, b + (scalar * blue_scale * 31));
-				}
-
-				lightmap_texel = OPAQUE_FLAG | (r << 10) | (g << 5) | b;
-
-				dest_data[lightmap_texel_num] = lightmap_texel;
-			}
+			pending = Num_pending_lightmaps++;
+			Pending_lightmaps[pending].lmi_handle = fp->lmi_handle;
+			Pending_lightmaps[pending].first = rect_index;
+			Lmi_pending[fp->lmi_handle] = pending + 1;
 		}
+		else
+			Pending_rects[Pending_lightmaps[pending].last].next = rect_index;
+
+		Pending_lightmaps[pending].last = rect_index;
+		Num_pending_texels += width * height;
 	}
 
 	for (i = 0; i < num_spoken_for; i++)
@@ -1460,12 +2230,17 @@ void ApplyLightingToRooms(vector* pos, int roomnum, float light_dist, float red_
 		int index = lmilist[i];
 		Lmi_spoken_for[index / 8] = 0;
 	}
+
+	if (Lighting_serial)
+		FlushDynamicLighting();
 }
 
 
 // Blends all the edges that need blending for this frame
 void BlendAllLightingEdges()
 {
+	FlushDynamicLighting();
+
 	for (int i = 0; i < Num_edges_to_blend; i++)
 	{
 		if (LightmapInfo[Edges_to_blend[i]].used < 1)
@@ -1480,6 +2255,14 @@ void ClearDynamicLightmaps()
 {
 	int i;
 
+	// Anything still queued has to land before the lightmaps are restored
+	FlushDynamicLighting();
+
+	// Start a new frame in the object lighting cache
+	Object_lighting_frame++;
+	Num_cached_lightmaps[Object_lighting_frame & 1] = 0;
+	Num_cached_texels[Object_lighting_frame & 1] = 0;
+
 	// First clear dynamic lightmap list
 	for (i = 0; i < Num_dynamic_lightmaps; i++)
 		Dynamic_lightmaps[i].used = 0;
@@ -2403,3 +3186,347 @@ void DoDestroyedLightsForFrame()
 	Num_destroyed_lights_this_frame = 0;
 }
 
+
+#define TEST_LIGHTS_PER_FRAME	32
+
+// Hashes the texels of one lightmap
+static unsigned int HashLightmapTexels(int lmi_handle)
+{
+	lightmap_info* lmi_ptr = &LightmapInfo[lmi_handle];
+	int lmw = lm_w(lmi_ptr->lm_handle);
+	ushort* data = (ushort*)lm_data(lmi_ptr->lm_handle);
+	unsigned int hash = HashLightingBytes(2166136261u, &lmi_handle, sizeof(int));
+
+	for (int y = 0; y < lmi_h(lmi_handle); y++)
+		hash = HashLightingBytes(hash, &data[((lmi_ptr->y1 + y) * lmw) + lmi_ptr->x1], lmi_w(lmi_handle) * sizeof(ushort));
+
+	return hash;
+}
+
+// Hashes the lightmap texels of every face that was lit dynamically this frame.
+// Objects can be lit in a different order, so the order the faces were lit in doesn't count
+static unsigned int HashDynamicLightmaps()
+{
+	unsigned int hash = 0;
+
+	for (int i = 0; i < Num_dynamic_faces; i++)
+		hash += HashLightmapTexels(Dynamic_face_list[i].lmi_handle);
+
+	return hash;
+}
+
+// Lights the current level with a few lights per room, a frame's worth at a time, once a light at a time
+// on this thread, once queued on this thread, and once queued with the job pool.  Reports how long each
+// took and any frame whose lightmaps didn't come out the same as lighting a light at a time.
+void TestDynamicLighting()
+{
+	static const char* mode_names[] = { "per light", "queued serial", "queued parallel" };
+	static vector directions[] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+
+	struct test_light
+	{
+		vector pos;
+		int roomnum;
+		float dist;
+		float r, g, b;
+		int direction;
+	};
+
+	if (Dedicated_server)
+	{
+		mprintf((0, "TestDynamicLighting: no lightmaps on a dedicated server\n"));
+		return;
+	}
+
+	// Everything counts as rendered last frame, or the lights would skip it
+	std::vector<ubyte> old_renderframes;
+	int roomnum, i;
+
+	for (roomnum = 0; roomnum <= Highest_room_index; roomnum++)
+	{
+		room* rp = &Rooms[roomnum];
+		if (!rp->used)
+			continue;
+		for (i = 0; i < rp->num_faces; i++)
+		{
+			old_renderframes.push_back(rp->faces[i].renderframe);
+			rp->faces[i].renderframe = (FrameCount - 1) % 256;
+		}
+	}
+
+	// Three lights per room, spread between its center and its walls, with some directional and some negative
+	std::vector<test_light> lights;
+
+	for (roomnum = 0; roomnum <= Highest_room_index; roomnum++)
+	{
+		room* rp = &Rooms[roomnum];
+		if (!rp->used || (rp->flags & RF_EXTERNAL) || rp->num_verts < 3)
+			continue;
+
+		vector center;
+		ComputeRoomCenter(&center, rp);
+
+		for (i = 0; i < 3; i++)
+		{
+			test_light light;
+			int n = lights.size();
+
+			light.pos = (center + rp->verts[(i * rp->num_verts) / 3]) / 2;
+			light.roomnum = roomnum;
+			light.dist = 30 + (n % 4) * 10;
+			light.r = (n % 3 == 0) ? 1.0f : 0.5f;
+			light.g = (n % 3 == 1) ? 1.0f : 0.4f;
+			light.b = (n % 3 == 2) ? 1.0f : 0.3f;
+			if (n % 7 == 6)
+			{
+				light.r = -light.r;
+				light.g = -light.g;
+				light.b = -light.b;
+			}
+			light.direction = (n % 5 == 4) ? (n / 5) % 6 : -1;
+			lights.push_back(light);
+		}
+	}
+
+	int num_frames = (lights.size() + TEST_LIGHTS_PER_FRAME - 1) / TEST_LIGHTS_PER_FRAME;
+	std::vector<unsigned int> hashes(num_frames);
+	bool old_serial = Lighting_serial;
+	int num_faces = 0;
+
+	for (int mode = 0; mode < 3; mode++)
+	{
+		int num_mismatches = 0;
+		double time = 0;
+
+		Lighting_serial = (mode == 0);
+		Lighting_use_jobs = (mode == 2);
+
+		for (int frame = 0; frame < num_frames; frame++)
+		{
+			int first = frame * TEST_LIGHTS_PER_FRAME;
+			int last = min(first + TEST_LIGHTS_PER_FRAME, (int)lights.size());
+
+			double start = timer_GetTime64();
+			for (i = first; i < last; i++)
+			{
+				test_light* lp = &lights[i];
+				if (lp->direction >= 0)
+					ApplyLightingToRooms(&lp->pos, lp->roomnum, lp->dist, lp->r, lp->g, lp->b, &directions[lp->direction], 0.5f);
+				else
+					ApplyLightingToRooms(&lp->pos, lp->roomnum, lp->dist, lp->r, lp->g, lp->b);
+			}
+			FlushDynamicLighting();
+			time += timer_GetTime64() - start;
+
+			unsigned int hash = HashDynamicLightmaps();
+			if (mode == 0)
+			{
+				hashes[frame] = hash;
+				num_faces += Num_dynamic_faces;
+			}
+			else if (hash != hashes[frame])
+			{
+				num_mismatches++;
+				mprintf((0, "TestDynamicLighting: frame %d came out different %s\n", frame, mode_names[mode]));
+			}
+
+			ClearDynamicLightmaps();
+		}
+
+		mprintf((0, "TestDynamicLighting: %s %.3f ms per frame, %d mismatches\n", mode_names[mode], num_frames ? time * 1000 / num_frames : 0.0, num_mismatches));
+	}
+
+	mprintf((0, "TestDynamicLighting: %d lights in %d frames, %.1f lightmaps lit per frame, %d worker threads\n", (int)lights.size(), num_frames,
+		num_frames ? (float)num_faces / num_frames : 0.0f, job_GetNumThreads()));
+
+	Lighting_serial = old_serial;
+	Lighting_use_jobs = true;
+
+	int face_index = 0;
+	for (roomnum = 0; roomnum <= Highest_room_index; roomnum++)
+	{
+		room* rp = &Rooms[roomnum];
+		if (!rp->used)
+			continue;
+		for (i = 0; i < rp->num_faces; i++)
+			rp->faces[i].renderframe = old_renderframes[face_index++];
+	}
+}
+
+#define TEST_OBJECT_LIGHTS		64
+#define TEST_OBJECT_FRAMES		8
+
+// Hashes the dynamic lighting on every object, in object order
+static unsigned int HashObjectLighting()
+{
+	unsigned int hash = 2166136261u;
+
+	for (int i = 0; i <= Highest_object_index; i++)
+	{
+		object* obj = &Objects[i];
+
+		if (obj->type == OBJ_NONE)
+			continue;
+
+		if (obj->effect_info && obj->effect_info->dynamic_this_frame)
+		{
+			bool specular = (obj->effect_info->type_flags & EF_SPECULAR) != 0;
+
+			hash = HashLightingBytes(hash, &i, sizeof(int));
+			hash = HashLightingBytes(hash, &obj->effect_info->dynamic_red, sizeof(float));
+			hash = HashLightingBytes(hash, &obj->effect_info->dynamic_green, sizeof(float));
+			hash = HashLightingBytes(hash, &obj->effect_info->dynamic_blue, sizeof(float));
+			hash = HashLightingBytes(hash, &specular, sizeof(bool));
+			if (specular)
+			{
+				hash = HashLightingBytes(hash, &obj->effect_info->spec_pos, sizeof(vector));
+				hash = HashLightingBytes(hash, &obj->effect_info->spec_r, sizeof(float));
+				hash = HashLightingBytes(hash, &obj->effect_info->spec_g, sizeof(float));
+				hash = HashLightingBytes(hash, &obj->effect_info->spec_b, sizeof(float));
+			}
+		}
+
+		if (obj->lm_object.used)
+		{
+			for (int sm = 0; sm < obj->lm_object.num_models; sm++)
+			{
+				for (int t = 0; t < obj->lm_object.num_faces[sm]; t++)
+				{
+					int lmi_handle = obj->lm_object.lightmap_faces[sm][t].lmi_handle;
+					if (LightmapInfo[lmi_handle].dynamic != BAD_LM_INDEX)
+						hash = (hash ^ HashLightmapTexels(lmi_handle)) * 16777619u;
+				}
+			}
+		}
+	}
+
+	return hash;
+}
+
+// Puts TEST_OBJECT_LIGHTS lights around the objects in the current level and lights the objects with them for
+// TEST_OBJECT_FRAMES frames, a light at a time, from the room clusters, and from the clusters with the cache.
+// Reports how long the object lighting took and any frame where the objects didn't come out the same.
+void TestObjectLighting()
+{
+	static const char* mode_names[] = { "per light", "clustered", "clustered and cached" };
+
+	struct test_light
+	{
+		vector pos;
+		int roomnum;
+		float dist;
+		float r, g, b;
+		bool directional;
+		vector direction;
+	};
+
+	if (Dedicated_server)
+	{
+		mprintf((0, "TestObjectLighting: no dynamic lighting on a dedicated server\n"));
+		return;
+	}
+
+	// Objects inside the mine that dynamic lights do something to
+	std::vector<int> lit_objects;
+	int i;
+
+	for (i = 0; i <= Highest_object_index; i++)
+	{
+		object* obj = &Objects[i];
+
+		if (obj->type == OBJ_NONE || obj->type == OBJ_ROOM || ROOMNUM_OUTSIDE(obj->roomnum))
+			continue;
+
+		if (obj->lm_object.used || (obj->effect_info && ((obj->effect_info->type_flags & EF_VOLUME_LIT) || obj->lighting_render_type == LRT_GOURAUD || obj->type == OBJ_POWERUP)))
+			lit_objects.push_back(i);
+	}
+
+	if (lit_objects.empty())
+	{
+		mprintf((0, "TestObjectLighting: no lit objects in this level\n"));
+		return;
+	}
+
+	// Lights next to the objects, some directional and pointed at them, some negative
+	std::vector<test_light> lights;
+
+	for (i = 0; i < TEST_OBJECT_LIGHTS; i++)
+	{
+		object* obj = &Objects[lit_objects[(i * 7) % lit_objects.size()]];
+		vector axes[] = { obj->orient.fvec, obj->orient.rvec, obj->orient.uvec };
+		test_light light;
+
+		light.pos = obj->pos + axes[i % 3] * (((i / 3) % 2) ? -obj->size : obj->size);
+		light.roomnum = obj->roomnum;
+		light.dist = obj->size * 2 + 20;
+		light.r = (i % 3 == 0) ? 1.0f : 0.5f;
+		light.g = (i % 3 == 1) ? 1.0f : 0.4f;
+		light.b = (i % 3 == 2) ? 1.0f : 0.3f;
+		if (i % 9 == 8)
+		{
+			light.r = -light.r;
+			light.g = -light.g;
+			light.b = -light.b;
+		}
+		light.directional = (i % 4 == 3);
+		light.direction = obj->pos - light.pos;
+		vm_NormalizeVector(&light.direction);
+		lights.push_back(light);
+	}
+
+	// Every object counts as rendered last frame, or the lights would skip it
+	std::vector<ushort> old_renderframes;
+
+	for (i = 0; i <= Highest_object_index; i++)
+	{
+		old_renderframes.push_back(Objects[i].renderframe);
+		Objects[i].renderframe = (FrameCount - 1) % 65536;
+	}
+
+	bool old_serial = Lighting_serial;
+	unsigned int hashes[TEST_OBJECT_FRAMES];
+
+	for (int mode = 0; mode < 3; mode++)
+	{
+		int num_mismatches = 0;
+		double time = 0;
+
+		Lighting_serial = (mode == 0);
+		Object_light_cache_enabled = (mode == 2);
+		Object_light_cache_hits = 0;
+
+		for (int frame = 0; frame < TEST_OBJECT_FRAMES; frame++)
+		{
+			double start = timer_GetTime64();
+			for (i = 0; i < (int)lights.size(); i++)
+			{
+				test_light* lp = &lights[i];
+				ApplyLightingToObjects(&lp->pos, lp->roomnum, lp->dist, lp->r, lp->g, lp->b, lp->directional ? &lp->direction : NULL, 0.5f);
+			}
+			FlushObjectLighting();
+			time += timer_GetTime64() - start;
+
+			unsigned int hash = HashObjectLighting();
+			if (mode == 0)
+				hashes[frame] = hash;
+			else if (hash != hashes[frame])
+			{
+				num_mismatches++;
+				mprintf((0, "TestObjectLighting: frame %d came out different %s\n", frame, mode_names[mode]));
+			}
+
+			ClearDynamicLightmaps();
+		}
+
+		mprintf((0, "TestObjectLighting: %s %.3f ms per frame, %d mismatches, %d cache hits\n", mode_names[mode], time * 1000 / TEST_OBJECT_FRAMES,
+			num_mismatches, Object_light_cache_hits));
+	}
+
+	mprintf((0, "TestObjectLighting: %d lights around %d lit objects for %d frames\n", (int)lights.size(), (int)lit_objects.size(), TEST_OBJECT_FRAMES));
+
+	Lighting_serial = old_serial;
+	Object_light_cache_enabled = true;
+
+	for (i = 0; i <= Highest_object_index; i++)
+		Objects[i].renderframe = old_renderframes[i];
+}
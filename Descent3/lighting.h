@@ -118,6 +118,24 @@ void DoDestroyedLightsForFrame ();
 // Blends all the edges that need blending for this frame
 void BlendAllLightingEdges ();
 
+// Accumulates the room lighting queued by ApplyLightingToRooms into the lightmaps.
+// BlendAllLightingEdges and ClearDynamicLightmaps do this first, so most code never needs to
+void FlushDynamicLighting ();
+
+// Applies lighting to all objects within light_dist of a light.  Objects inside the mine are lit
+// when FlushObjectLighting runs, once per object from all the lights that reach it
+void ApplyLightingToObjects (vector *pos,int roomnum,float light_dist,float red_scale,float green_scale,float blue_scale,vector *light_direction=NULL,float dot_range=0);
+
+// Lights the objects reached by the lights applied since the last flush.  FlushDynamicLighting does this first
+void FlushObjectLighting ();
+
+// Lights the current level with the per light, queued and parallel paths and reports timings and mismatches
+void TestDynamicLighting ();
+
+// Lights the objects in the current level with 64 lights a frame, a light at a time, clustered, and clustered and cached,
+// and reports timings and mismatches
+void TestObjectLighting ();
+
 
 #endif
 
@@ -52,6 +52,8 @@
 #include "weather.h"
 #include "cockpit.h"
 #include "hud.h"
+#include "objgrid.h"
+#include "BOA.h"
 
 void PageInAllData ();
 
@@ -442,6 +444,7 @@ int LGSRooms(CFILE *fp)
 					int facenum=cf_ReadShort (fp);
 					Rooms[i].faces[facenum].tmap=gs_Xlates->tex_handles[cf_ReadShort(fp)];
 					Rooms[i].faces[facenum].flags |= FF_TEXTURE_CHANGED;
+					MarkRoomForRemesh(i);
 				}			
 			//}
 			for(p = 0;p<Rooms[i].num_portals;p++)
@@ -470,6 +473,9 @@ int LGSRooms(CFILE *fp)
 	//Rebuild the active doorway list
 	//DoorwayRebuildActiveList();
 
+	//Doors and portals may have been locked or blocked differently in the saved game
+	BOA_MarkRoutesDirty();
+
 	return retval;
 }
 
@@ -1291,6 +1297,7 @@ START_VERIFY_SAVEFILE(fp);
 	{
 		Rooms[i].objects = -1;
 	}
+	ObjGridClear();
 	max_terr = TERRAIN_WIDTH*TERRAIN_DEPTH;
 	for(i=0;i<max_terr;i++)
 	{
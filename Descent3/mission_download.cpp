@@ -775,6 +775,7 @@ int msn_ExtractZipFile(char* zipfilename, char* mn3name)
 		rend_Flip();
 	}
 	zfile.CloseZip();
+	cf_InvalidateSearchPaths();
 
 	if (DoMessageBox("Confirm", "Do you want to delete the zip file? It is no longer needed.", MSGBOX_YESNO, UICOL_WINDOW_TITLE, UICOL_TEXT_NORMAL))
 	{
@@ -24,6 +24,8 @@
 #include "multi.h"
 #include "multi_client.h"
 #include "multi_server.h"
+#include "multi_snapshot.h"
+#include "multi_interest.h"
 #include "ddio.h"
 #include "hud.h"
 #include "robotfire.h"
@@ -258,15 +260,16 @@ void MultiSendBadChecksum(int slot)
 
 // Puts player "slot" position info into the passed in buffer
 // Returns the number of bytes used
-int MultiStuffPosition (int slot,ubyte *data)
+int MultiStuffPosition (int slot,ubyte *data,int to_slot)
 {
 	int size;
 	int count=0;
 	ubyte flags=0;
+	bool snapshot=(to_slot>=0 && MultiSnapshotsActive());
 	
 	object *obj=&Objects[Players[slot].objnum];
 
-	size=START_DATA (MP_PLAYER_POS,data,&count);
+	size=START_DATA (snapshot?MP_PLAYER_POS_DELTA:MP_PLAYER_POS,data,&count);
 	MultiAddByte (slot,data,&count);
 
 	if (slot==Player_num)
@@ -283,21 +286,32 @@ int MultiStuffPosition (int slot,ubyte *data)
 		MultiAddFloat (Gametime,data,&count);
 	else
 		MultiAddFloat (NetPlayers[slot].packet_time,data,&count);
+
+	if (snapshot)
+	{
+		// Position, orientation, room and velocity all go in the snapshot entry
+		ushort seq=MultiSnapshotNewPacket (to_slot);
+		MultiAddUshort (seq,data,&count);
+		Snap_stats.bytes+=2+MultiSnapshotAddObject (to_slot,seq,Players[slot].objnum,data,&count);
+		Snap_stats.legacy_bytes+=22;
+	}
+	else
+	{
+		// Do position
+		MultiAddPositionData (&obj->pos,data,&count);
 		
-	// Do position
-	MultiAddPositionData (&obj->pos,data,&count);
-	
-	// Do orientation
-	angvec angs;
-	vm_ExtractAnglesFromMatrix (&angs,&obj->orient);
+		// Do orientation
+		angvec angs;
+		vm_ExtractAnglesFromMatrix (&angs,&obj->orient);
 
-	MultiAddShort (angs.p,data,&count);
-	MultiAddShort (angs.h,data,&count);
-	MultiAddShort (angs.b,data,&count);
+		MultiAddShort (angs.p,data,&count);
+		MultiAddShort (angs.h,data,&count);
+		MultiAddShort (angs.b,data,&count);
 
-	// Do roomnumber and terrain flag
-	
-	MultiAddShort (CELLNUM (obj->roomnum),data,&count);
+		// Do roomnumber and terrain flag
+		
+		MultiAddShort (CELLNUM (obj->roomnum),data,&count);
+	}
 
 	
 	// Fill flags
@@ -322,9 +336,12 @@ int MultiStuffPosition (int slot,ubyte *data)
 
 //	mprintf ((0,"Outvel x=%f y=%f z=%f\n",vel->x,vel->y,vel->z));
 	
-	MultiAddShort ((vel->x*128.0),data,&count);
-	MultiAddShort ((vel->y*128.0),data,&count);
-	MultiAddShort ((vel->z*128.0),data,&count);
+	if (!snapshot)
+	{
+		MultiAddShort ((vel->x*128.0),data,&count);
+		MultiAddShort ((vel->y*128.0),data,&count);
+		MultiAddShort ((vel->z*128.0),data,&count);
+	}
 
 	if (Netgame.flags & NF_SENDROTVEL)
 	{
@@ -423,6 +440,56 @@ int MultiStuffRobotPosition (unsigned short objectnum,ubyte *data)
 	return count;
 }
 
+// Adds a robot position to the MP_ROBOT_POS_DELTA open at *offset in Multi_send_buffer[slot]
+// Starts a new one (sending the buffer first if need be) when *offset is -1 or there's no room
+// Returns the number of bytes added
+int MultiStuffRobotSnapshot (int slot,unsigned short objectnum,int *offset)
+{
+	ubyte *data=Multi_send_buffer[slot];
+	int count;
+	int bytes=0;
+
+	ASSERT (Objects[objectnum].flags & OF_CLIENT_KNOWS);
+
+	// Entries are tagged with the packet they go out in, so make room before writing one
+	int needed=2+SNAP_MAX_ENTRY_SIZE;
+	if (*offset==-1)
+		needed+=6;
+	if (Multi_send_size[slot]+needed>=MAX_GAME_DATA_SIZE || MultiSnapshotBufferPacket (slot)==-1)
+	{
+		MultiSendFullPacket (slot,0);
+		*offset=-1;
+	}
+
+	int seq=MultiSnapshotBufferPacket (slot);
+
+	// Header, packet sequence and number of robots
+	if (*offset==-1)
+	{
+		count=Multi_send_size[slot];
+		*offset=START_DATA (MP_ROBOT_POS_DELTA,data,&count);
+		MultiAddUshort (seq,data,&count);
+		MultiAddUbyte (0,data,&count);
+		bytes+=count-Multi_send_size[slot];
+		Multi_send_size[slot]=count;
+	}
+
+	count=Multi_send_size[slot];
+	MultiAddUshort (objectnum,data,&count);
+	MultiSnapshotAddObject (slot,seq,objectnum,data,&count);
+
+	// An MP_ROBOT_POS is 28 bytes
+	bytes+=count-Multi_send_size[slot];
+	Snap_stats.bytes+=bytes;
+	Snap_stats.legacy_bytes+=28;
+	Multi_send_size[slot]=count;
+
+	data[*offset+4]++;
+	END_DATA (count-(*offset-1),data,*offset);
+
+	return bytes;
+}
+
 // Puts player "slot" position info into the passed in buffer
 // Returns the number of bytes used
 int MultiSendRobotFireWeapon (unsigned short objectnum,vector *pos,vector *dir,unsigned short weaponnum)
@@ -1303,6 +1370,9 @@ void MultiDoEnteringGame (ubyte *data)
 
 	mprintf ((0,"Client %d (%s) entering game.\n",slot,Players[slot].callsign));
 
+	MultiSnapshotResetClient (slot);
+	MultiInterestResetClient (slot);
+
 	MultiSendPlayerEnteredGame (slot);
 
 	//send the player the audio taunt delay time
@@ -1578,6 +1648,8 @@ void MultiDoPlayerPos (ubyte *data)
 {
 	int use_smoothing=(Netgame.flags & NF_USE_SMOOTHING);
 	int count=0; 
+	bool snapshot=(data[0]==MP_PLAYER_POS_DELTA);
+	int snap_result=1;
 	
 	// Skip header stuff
 	SKIP_HEADER (data,&count);
@@ -1598,31 +1670,38 @@ void MultiDoPlayerPos (ubyte *data)
 	matrix orient;
 	ushort short_roomnum;
 	int roomnum;
+	vector vel={0,0,0},rotvel;
+	angle turnroll;
 
-	// Get position
-	MultiExtractPositionData (&pos,data,&count);
-	
-	// Get orientation
-	ushort p=MultiGetShort (data,&count);
-	ushort h=MultiGetShort (data,&count);
-	ushort b=MultiGetShort (data,&count);
-
-	vm_AnglesToMatrix (&orient,p,h,b);
+	if (snapshot)
+	{
+		ushort seq=MultiGetUshort (data,&count);
+		snap_result=MultiSnapshotReadObject (seq,Players[slot].objnum,data,&count,&pos,&roomnum,&orient,&vel);
+	}
+	else
+	{
+		// Get position
+		MultiExtractPositionData (&pos,data,&count);
+		
+		// Get orientation
+		ushort p=MultiGetShort (data,&count);
+		ushort h=MultiGetShort (data,&count);
+		ushort b=MultiGetShort (data,&count);
 
-	// Get room and terrain flag
-	short_roomnum=MultiGetUshort (data,&count);
+		vm_AnglesToMatrix (&orient,p,h,b);
 
-	roomnum = short_roomnum;
+		// Get room and terrain flag
+		short_roomnum=MultiGetUshort (data,&count);
 
-	vector vel={0,0,0},rotvel;
-	angle turnroll;
+		roomnum = short_roomnum;
 
-//	float dist=vm_VectorDistance (&pos,&obj->pos);
+//		float dist=vm_VectorDistance (&pos,&obj->pos);
 	
 		// Get velocity
-	vel.x=((float)MultiGetShort (data,&count))/128.0;
-	vel.y=((float)MultiGetShort (data,&count))/128.0;
-	vel.z=((float)MultiGetShort (data,&count))/128.0;
+		vel.x=((float)MultiGetShort (data,&count))/128.0;
+		vel.y=((float)MultiGetShort (data,&count))/128.0;
+		vel.z=((float)MultiGetShort (data,&count))/128.0;
+	}
 
 	//mprintf ((0,"INCOMING x=%f y=%f z=%f dist=%f\n",vel.x,vel.y,vel.z,dist));
 	
@@ -1719,6 +1798,9 @@ void MultiDoPlayerPos (ubyte *data)
 	if ((flags & MPF_DEAD))// || (Players[slot].flags & PLAYER_FLAGS_DYING) || (Players[slot].flags & PLAYER_FLAGS_DEAD))
 		return;		// If dying, don't do positional updates
 
+	if (snap_result<1)
+		return;		// Snapshot entry we couldn't use
+
 	if (! ROOMNUM_OUTSIDE(roomnum))
 	{
 		// Deal with late packets from last level
@@ -1835,6 +1917,45 @@ void MultiDoRobotPos (ubyte *data)
 
 }
 
+// Server is sending us a batch of robot positions as snapshot entries
+void MultiDoRobotPosSnapshot (ubyte *data)
+{
+	int count=0;
+	
+	SKIP_HEADER (data,&count);
+
+	ushort seq=MultiGetUshort (data,&count);
+	int num=MultiGetUbyte (data,&count);
+
+	for (int i=0;i<num;i++)
+	{
+		vector pos,vel;
+		matrix orient;
+		int roomnum;
+
+		// Read every entry even if we can't use it, since the server will build on them
+		ushort server_objnum=MultiGetUshort (data,&count);
+		if (MultiSnapshotReadObject (seq,server_objnum,data,&count,&pos,&roomnum,&orient,&vel)<1)
+			continue;
+
+		ushort objectnum = Server_object_list[server_objnum];
+		if(objectnum==65535 || !(Objects[objectnum].flags & OF_SERVER_OBJECT))
+		{
+			mprintf((0,"Bad robotposition object number!\n"));
+			continue;
+		}
+		object *obj=&Objects[objectnum];
+
+		obj->mtype.phys_info.velocity=vel;
+
+		obj->mtype.phys_info.flags &=~PF_NO_COLLIDE;
+		obj->render_type=RT_POLYOBJ;
+
+		if(!(obj->flags & (OF_DEAD)) && obj->type!=OBJ_NONE)
+			ObjSetPos (obj,&pos,roomnum,&orient,false);
+	}
+}
+
 
 // Stuffs a players firing information into a packet
 int MultiStuffPlayerFire (int slot,ubyte *data)
@@ -2037,6 +2158,7 @@ void MultiLeaveGame ()
 	
 	CallMultiDLL(MT_EVT_GAME_OVER);
 	MultiCloseGame ();
+	MultiSnapshotFree ();
 	
 	SetFunctionMode(MENU_MODE); 
 	if(Netgame.local_role==LR_SERVER)
@@ -5344,6 +5466,9 @@ bool MultiStartNewLevel (int level)
 
 	memset(Player_pos_fix,0,sizeof(Player_pos_fix));
 
+	MultiSnapshotStartLevel ();
+	MultiInterestStartLevel ();
+
 	memset (Multi_building_states,0,MAX_OBJECTS);
 	Multi_num_buildings_changed=0;
 
@@ -5440,6 +5565,7 @@ void MultiSendFullPacket (int slot,int flags)
 	MULTI_ASSERT_NOMESSAGE (NetPlayers[slot].flags & NPF_CONNECTED);
 	nw_Send (&NetPlayers[slot].addr,Multi_send_buffer[slot],Multi_send_size[slot],flags);
 	Multi_send_size[slot]=0;
+	MultiSnapshotBufferSent (slot);
 }
 
 // Sends a full packet out the the server
@@ -5681,6 +5807,7 @@ void MultiPaintGoalRooms (int *texcolors)
 					{
 						Rooms[roomnum].faces[t].tmap=tex;
 						Rooms[roomnum].faces[t].flags |= FF_TEXTURE_CHANGED;
+						MarkRoomForRemesh(roomnum);
 
 					}
 
@@ -8889,6 +9016,7 @@ void MultiProcessData (ubyte *data,int len,int slot,network_address *from_addr)
 			MultiDoRequestWorldStates (data);
 			break;
 		case MP_PLAYER_POS:
+		case MP_PLAYER_POS_DELTA:
 			ACCEPT_CONDITION (NETSEQ_PLAYING,NETSEQ_PLAYING);
 			NetPlayers[Player_num].total_bytes_rcvd += len;
 			MultiDoPlayerPos(data);
@@ -9037,6 +9165,14 @@ void MultiProcessData (ubyte *data,int len,int slot,network_address *from_addr)
 			ACCEPT_CONDITION (NETSEQ_PLAYING,NETSEQ_PLAYING);
 			MultiDoRobotPos(data);
 			break;
+		case MP_ROBOT_POS_DELTA:
+			ACCEPT_CONDITION (NETSEQ_PLAYING,NETSEQ_PLAYING);
+			MultiDoRobotPosSnapshot(data);
+			break;
+		case MP_SNAPSHOT_ACK:
+			ACCEPT_CONDITION (NETSEQ_PLAYING,NETSEQ_PLAYING);
+			MultiDoSnapshotAck(data,slot);
+			break;
 		case MP_ROBOT_FIRE:
 			ACCEPT_CONDITION (NETSEQ_PLAYING,NETSEQ_PLAYING);
 			MultiDoRobotFire(data);
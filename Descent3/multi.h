@@ -172,6 +172,9 @@ extern bool Multi_bail_ui_menu;
 #define MP_MISSILE_RELEASE						121 // Informing about a guided missile being released from guided mode
 #define MP_STRIP_PLAYER							122 // Strips player of all weapons (but laser) and reduces energy to 0
 #define MP_REJECTED_CHECKSUM					123 // The server rejected the client checksum. This lets the client know.
+#define MP_PLAYER_POS_DELTA						124 // Player position packet as a snapshot entry
+#define MP_ROBOT_POS_DELTA						125 // Robot position as a snapshot entry
+#define MP_SNAPSHOT_ACK							126 // Client is acknowledging snapshot packets
 
 // Shield request defines
 #define MAX_SHIELD_REQUEST_TYPES	1
@@ -425,8 +428,9 @@ bool MultiStartNewLevel (int level);
 int MultiCountPlayers ();
 
 // Puts player "slot" position info into the passed in buffer
+// If to_slot is given, the server is sending to that client and can use a snapshot entry
 // Returns the number of bytes used
-int MultiStuffPosition (int slot,ubyte *data);
+int MultiStuffPosition (int slot,ubyte *data,int to_slot=-1);
 
 // Sends a full packet out the the server
 // Resets the send_size variable
@@ -535,6 +539,11 @@ void GetServerGameTime();
 //Send robot info
 int MultiStuffRobotPosition (unsigned short objectnum,ubyte *data);
 
+// Adds a robot position to the MP_ROBOT_POS_DELTA open at *offset in Multi_send_buffer[slot]
+// Starts a new one (sending the buffer first if need be) when *offset is -1 or there's no room
+// Returns the number of bytes added
+int MultiStuffRobotSnapshot (int slot,unsigned short objectnum,int *offset);
+
 //Handle robot position
 void MultiDoRobotPos (ubyte *data);
 
@@ -18,6 +18,7 @@
 
 #include "multi.h"
 #include "multi_client.h"
+#include "multi_snapshot.h"
 #include "game.h"
 #include "player.h"
 #include "ddio.h"
@@ -386,6 +387,10 @@ void MultiDoClientFrame()
 				count += add_count;
 			}
 
+			// Let the server know which snapshot packets we got
+			if (MultiSnapshotsActive())
+				count += MultiStuffSnapshotAck(&data[count]);
+
 			ASSERT(count < MAX_GAME_DATA_SIZE);
 
 			if (Netgame.flags & NF_PEER_PEER)
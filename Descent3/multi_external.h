@@ -154,6 +154,7 @@ struct network_game
 #define NF_ALLOW_MLOOK			0x10000	//Allow mouse lookers
 #define NF_TRACK_RANK			0x20000 // Track rankings for PXO
 #define NF_COOP					0x40000	// This game is a cooperative game
+#define NF_DELTA_SNAPSHOTS		0x80000	// Positions go to clients as deltas against what they've acked
 
 
 struct netgame_info
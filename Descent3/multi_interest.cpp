@@ -0,0 +1,303 @@
+/*
+* Descent 3
+* Copyright (C) 2024 Parallax Software
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdio.h>
+
+#include "multi_interest.h"
+#include "multi.h"
+#include "player.h"
+#include "room.h"
+#include "terrain.h"
+#include "BOA.h"
+#include "game.h"
+#include "ddio.h"
+#include "pserror.h"
+
+// Most viewpoints a client can have: ship, guided missile, and the three small views
+#define INTEREST_MAX_VIEWS		5
+
+// Bits in the per-client room table
+#define INTEREST_SEEN			1		// objects in this room are visible to a viewpoint
+#define INTEREST_SEES			2		// a viewpoint can see this room
+
+// Objects closer than this all get full priority
+#define INTEREST_NEAR_DIST		50.0f
+// Priority for an object directly behind a viewpoint, relative to one straight ahead
+#define INTEREST_MIN_FACING		0.25f
+// How many seconds of budget a client can save up
+#define INTEREST_BURST			0.25f
+
+#define INTEREST_NUM_ROOMS		(MAX_ROOMS+MAX_BOA_TERRAIN_REGIONS)
+
+typedef struct
+{
+	int num_views;
+	int view_objs[INTEREST_MAX_VIEWS];
+	int view_rooms[INTEREST_MAX_VIEWS];
+	int view_index[INTEREST_MAX_VIEWS];		// BOA index of each viewpoint's room, or -1
+	int num_rooms;							// size of the room table when it was built, 0 if it needs building
+	float tokens;							// bytes of budget left
+	ubyte rooms[INTEREST_NUM_ROOMS];
+} interest_client;
+
+interest_stats Interest_stats[MAX_NET_PLAYERS];
+int Interest_budget = 0;
+
+static interest_client Interest_clients[MAX_NET_PLAYERS];
+static float Interest_priority[MAX_NET_PLAYERS][MAX_OBJECTS];
+
+// Returns where "roomnum" lives in BOA_Array, or -1 if it isn't a room in use
+static int InterestBOAIndex (int roomnum)
+{
+	if (roomnum==-1)
+		return -1;
+
+	if (ROOMNUM_OUTSIDE(roomnum))
+		return TERRAIN_REGION(roomnum)+Highest_room_index+1;
+
+	if (roomnum>Highest_room_index || !Rooms[roomnum].used)
+		return -1;
+
+	return roomnum;
+}
+
+// Builds the list of objects a client is looking through.  This is the same list
+// MultiSendPositionalUpdates and MultiIsGenericVisibleToPlayer used to build for every check.
+static int InterestGetViewers (int slot,int *objs)
+{
+	int num=1;
+
+	objs[0]=Players[slot].objnum;
+
+	if (Players[slot].guided_obj!=NULL)
+		objs[num++]=Players[slot].guided_obj-Objects;
+
+	if (Players[slot].small_dll_obj!=-1)
+	{
+		int objnum=Players[slot].small_dll_obj;
+		if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type==OBJ_NONE)
+			Players[slot].small_dll_obj=-1;
+		else
+			objs[num++]=objnum;
+	}
+
+	if (Players[slot].small_left_obj!=-1)
+	{
+		int objnum=Players[slot].small_left_obj;
+		if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type==OBJ_NONE || Objects[objnum].type==OBJ_WEAPON)
+			Players[slot].small_left_obj=-1;
+		else
+			objs[num++]=objnum;
+	}
+
+	if (Players[slot].small_right_obj!=-1)
+	{
+		int objnum=Players[slot].small_right_obj;
+		if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type==OBJ_NONE || Objects[objnum].type==OBJ_WEAPON)
+			Players[slot].small_right_obj=-1;
+		else
+			objs[num++]=objnum;
+	}
+
+	return num;
+}
+
+// Fills in which rooms are visible to and from the client's viewpoints
+static void InterestBuildRooms (interest_client *ic)
+{
+	int num_rooms=Highest_room_index+1+MAX_BOA_TERRAIN_REGIONS;
+
+	memset (ic->rooms,0,num_rooms);
+
+	for (int t=0;t<ic->num_views;t++)
+	{
+		int v=ic->view_index[t];
+		if (v==-1)
+			continue;
+
+		// Anything in the same room or terrain region as a viewpoint counts
+		ic->rooms[v]|=INTEREST_SEEN|INTEREST_SEES;
+
+		for (int i=0;i<num_rooms;i++)
+		{
+			if (i<=Highest_room_index && !Rooms[i].used)
+				continue;
+
+			if (BOA_Array[i][v] & BOAF_VIS)
+				ic->rooms[i]|=INTEREST_SEEN;
+			if (BOA_Array[v][i] & BOAF_VIS)
+				ic->rooms[i]|=INTEREST_SEES;
+		}
+	}
+
+	ic->num_rooms=num_rooms;
+}
+
+void MultiInterestResetClient (int slot)
+{
+	interest_client *ic=&Interest_clients[slot];
+
+	ic->num_views=0;
+	ic->num_rooms=0;
+	ic->tokens=Interest_budget*INTEREST_BURST;
+
+	memset (Interest_priority[slot],0,sizeof(Interest_priority[slot]));
+	memset (&Interest_stats[slot],0,sizeof(interest_stats));
+	Interest_stats[slot].start_time=timer_GetTime ();
+}
+
+void MultiInterestStartLevel ()
+{
+	for (int i=0;i<MAX_NET_PLAYERS;i++)
+		MultiInterestResetClient (i);
+}
+
+void MultiInterestUpdate (int slot)
+{
+	interest_client *ic=&Interest_clients[slot];
+	int objs[INTEREST_MAX_VIEWS];
+	int num=InterestGetViewers (slot,objs);
+	bool changed=(num!=ic->num_views || ic->num_rooms!=Highest_room_index+1+MAX_BOA_TERRAIN_REGIONS);
+
+	for (int t=0;t<num;t++)
+	{
+		int roomnum=Objects[objs[t]].roomnum;
+		int index=InterestBOAIndex (roomnum);
+
+		if (t>=ic->num_views || ic->view_index[t]!=index)
+			changed=true;
+
+		ic->view_objs[t]=objs[t];
+		ic->view_rooms[t]=roomnum;
+		ic->view_index[t]=index;
+	}
+	ic->num_views=num;
+
+	// Nobody moved between rooms, so the set from last frame still holds
+	if (changed && BOA_vis_valid)
+	{
+		InterestBuildRooms (ic);
+		Interest_stats[slot].rebuilds++;
+	}
+
+	if (Interest_budget>0)
+	{
+		ic->tokens+=Interest_budget*Frametime;
+		if (ic->tokens>Interest_budget*INTEREST_BURST)
+			ic->tokens=Interest_budget*INTEREST_BURST;
+	}
+}
+
+bool MultiInterestIsRelevant (int slot,int roomnum)
+{
+	if (!BOA_vis_valid)
+		return true;
+
+	int index=InterestBOAIndex (roomnum);
+	if (index==-1 || index>=Interest_clients[slot].num_rooms)
+		return false;
+
+	return (Interest_clients[slot].rooms[index] & INTEREST_SEEN)!=0;
+}
+
+bool MultiInterestCanSee (int slot,int roomnum)
+{
+	if (!BOA_vis_valid)
+		return true;
+
+	int index=InterestBOAIndex (roomnum);
+	if (index==-1 || index>=Interest_clients[slot].num_rooms)
+		return false;
+
+	return (Interest_clients[slot].rooms[index] & INTEREST_SEES)!=0;
+}
+
+int MultiInterestGetViewRooms (int slot,int *rooms)
+{
+	interest_client *ic=&Interest_clients[slot];
+
+	for (int t=0;t<ic->num_views;t++)
+		rooms[t]=ic->view_rooms[t];
+
+	return ic->num_views;
+}
+
+float MultiInterestAddPriority (int slot,object *obj)
+{
+	interest_client *ic=&Interest_clients[slot];
+	float best=0;
+
+	// Closer objects and ones in front of a viewpoint matter more
+	for (int t=0;t<ic->num_views;t++)
+	{
+		object *view=&Objects[ic->view_objs[t]];
+		vector subvec=obj->pos-view->pos;
+		float dist=vm_GetMagnitudeFast (&subvec);
+		float facing=1.0f;
+
+		if (dist>0.001f)
+		{
+			subvec/=dist;
+			facing=(1.0f+vm_DotProduct (&subvec,&view->orient.fvec))*0.5f;
+		}
+
+		float score=INTEREST_MIN_FACING+(1.0f-INTEREST_MIN_FACING)*facing;
+		if (dist>INTEREST_NEAR_DIST)
+			score*=INTEREST_NEAR_DIST/dist;
+
+		if (score>best)
+			best=score;
+	}
+
+	float *priority=&Interest_priority[slot][OBJNUM(obj)];
+	*priority+=best;
+	return *priority;
+}
+
+void MultiInterestSent (int slot,int objnum,int bytes)
+{
+	Interest_priority[slot][objnum]=0;
+	Interest_stats[slot].sent++;
+	MultiInterestSpend (slot,bytes);
+}
+
+bool MultiInterestHaveBudget (int slot)
+{
+	return (Interest_budget<=0 || Interest_clients[slot].tokens>0);
+}
+
+void MultiInterestSpend (int slot,int bytes)
+{
+	Interest_stats[slot].bytes+=bytes;
+
+	if (Interest_budget>0)
+		Interest_clients[slot].tokens-=bytes;
+}
+
+void MultiInterestGetStats (int slot,char *str,int len)
+{
+	interest_stats *is=&Interest_stats[slot];
+	float seconds=timer_GetTime ()-is->start_time;
+
+	if (seconds<1.0f)
+		seconds=1.0f;
+
+	snprintf (str,len,"%-16s considered %d, relevant %d, sent %d, deferred %d, %d bytes/sec, %d rebuilds",
+		Players[slot].callsign,is->considered,is->relevant,is->sent,is->deferred,(int)(is->bytes/seconds),is->rebuilds);
+}
@@ -0,0 +1,82 @@
+/*
+* Descent 3
+* Copyright (C) 2024 Parallax Software
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MULTI_INTEREST_H
+#define MULTI_INTEREST_H
+
+#include "pstypes.h"
+#include "object.h"
+#include "multi_external.h"
+
+// Interest management for the server.  Once a frame each client gets a list of viewpoints
+// (their ship, guided missile and small views) and a set of rooms that are visible from
+// them according to BOA.  The room set is only rebuilt when a viewpoint changes room, so
+// deciding whether an object is relevant to a client is a table lookup.  Relevant objects
+// collect priority every robot frame, and when the server is running with a byte budget
+// the highest priority ones go out first.
+
+typedef struct
+{
+	int considered;			// moved objects looked at for this client
+	int relevant;			// ...that were in a room the client can see
+	int sent;				// ...that went out
+	int deferred;			// ...that were held back by the byte budget
+	int bytes;				// positional bytes sent to this client
+	int rebuilds;			// times the visible room set was rebuilt
+	float start_time;		// when these stats started
+} interest_stats;
+
+extern interest_stats Interest_stats[MAX_NET_PLAYERS];
+
+// Bytes per second each client can take in positional updates, 0 for no limit
+extern int Interest_budget;
+
+// Forgets all viewpoints, priorities and stats
+void MultiInterestStartLevel ();
+
+// Forgets everything about one client
+void MultiInterestResetClient (int slot);
+
+// Works out a client's viewpoints for this frame and refills their byte budget
+void MultiInterestUpdate (int slot);
+
+// Returns true if an object in "roomnum" is visible to any of the client's viewpoints
+bool MultiInterestIsRelevant (int slot,int roomnum);
+
+// Returns true if "roomnum" is visible from any of the client's viewpoints
+bool MultiInterestCanSee (int slot,int roomnum);
+
+// Fills in the rooms of the client's viewpoints and returns how many there are
+int MultiInterestGetViewRooms (int slot,int *rooms);
+
+// Adds this frame's priority for an object and returns the total it has built up
+float MultiInterestAddPriority (int slot,object *obj);
+
+// The object went out, so it starts building priority again from nothing
+void MultiInterestSent (int slot,int objnum,int bytes);
+
+// Returns true if the client has budget left for more positional updates
+bool MultiInterestHaveBudget (int slot);
+
+// Charges bytes sent to a client against their budget
+void MultiInterestSpend (int slot,int bytes);
+
+// Writes a line of stats for a client into "str"
+void MultiInterestGetStats (int slot,char *str,int len);
+
+#endif
@@ -19,6 +19,8 @@
 #include "args.h"
 #include "multi.h"
 #include "multi_server.h"
+#include "multi_snapshot.h"
+#include "multi_interest.h"
 #include "player.h"
 #include "game.h"
 #include "mono.h"
@@ -69,6 +71,38 @@ int GameDLLGetConnectingPlayersTeam(int slot);
 int Moved_robots[MAX_NET_PLAYERS][MAX_CHANGED_OBJECTS];
 ushort Num_moved_robots[MAX_NET_PLAYERS];
 
+// Bit n is set if the object is on Moved_robots[n], so we don't have to search the list
+static uint Moved_robot_slots[MAX_OBJECTS];
+
+// Robots that moved this frame, gathered once for all the clients
+static short Moved_this_frame[MAX_OBJECTS];
+static int Num_moved_this_frame = 0;
+
+// Adds a robot to the list of ones that need their position sent to this slot
+static void MultiAddMovedRobot(int slot, object* obj)
+{
+	int objnum = OBJNUM(obj);
+
+	if (Moved_robot_slots[objnum] & (1 << slot))
+		return;
+
+	if (Num_moved_robots[slot] >= MAX_CHANGED_OBJECTS)
+		return;
+
+	ASSERT(obj->flags & OF_CLIENT_KNOWS);
+	Moved_robots[slot][Num_moved_robots[slot]++] = obj->handle;
+	Moved_robot_slots[objnum] |= (1 << slot);
+}
+
+// Empties the moved robot list for this slot
+static void MultiClearMovedRobots(int slot)
+{
+	for (int i = 0; i < Num_moved_robots[slot]; i++)
+		Moved_robot_slots[Moved_robots[slot][i] & HANDLE_OBJNUM_MASK] &= ~(1 << slot);
+
+	Num_moved_robots[slot] = 0;
+}
+
 int Changed_anim[MAX_CHANGED_OBJECTS][MAX_NET_PLAYERS];
 ushort Num_changed_anim[MAX_NET_PLAYERS];
 
@@ -138,6 +172,7 @@ void MultiStartServer(int playing, char* scriptname, int dedicated_server_num_te
 		NetPlayers[i].ping_time = 0;
 		NetPlayers[i].last_ping_time = 0;
 	}
+	memset(Moved_robot_slots, 0, sizeof(Moved_robot_slots));
 	NetPlayers[Player_num].custom_file_seq = 0xff;
 	Current_pilot.get_multiplayer_data(NetPlayers[Player_num].ship_logo, NetPlayers[Player_num].voice_taunt1, NetPlayers[Player_num].voice_taunt2, NULL, NetPlayers[Player_num].voice_taunt3, NetPlayers[Player_num].voice_taunt4);
 
@@ -161,6 +196,18 @@ void MultiStartServer(int playing, char* scriptname, int dedicated_server_num_te
 
 	Game_mode = GM_NETWORK;
 
+	if (FindArg("-deltasnapshots"))
+		Netgame.flags |= NF_DELTA_SNAPSHOTS;
+	else
+		Netgame.flags &= ~NF_DELTA_SNAPSHOTS;
+
+	// Bytes per second of positional updates each client can take
+	int budgetarg = FindArg("-netbudget");
+	if (budgetarg)
+		Interest_budget = atoi(GameArgs[budgetarg + 1]);
+	else
+		Interest_budget = 0;
+
 	// Setup audio taunt delay time
 	int audiotauntdelayarg = FindArg("-audiotauntdelay");
 	if (audiotauntdelayarg > 0)
@@ -846,7 +893,7 @@ void MultiSendJoinObjects(int slot)
 	ushort total_objects = 0;
 	last_sent_bytes[slot] = timer_GetTime();
 
-	Num_moved_robots[slot] = 0;
+	MultiClearMovedRobots(slot);
 	Num_changed_anim[slot] = 0;
 	Num_changed_turret[slot] = 0;
 	Num_changed_wb_anim[slot] = 0;
@@ -1613,80 +1660,26 @@ void MultiSendPositionalUpdates(int to_slot)
 		//if (i==Player_num)	// Always send server position
 		//	send_position=1;
 
-		int num_src_to_check = 1;
-		int srcs[10];
-		srcs[0] = Players[to_slot].objnum;
-
-		// Check for guideds
-		if (Players[to_slot].guided_obj != NULL)
-			srcs[num_src_to_check++] = Players[to_slot].guided_obj - Objects;
-
-		if (Players[to_slot].small_dll_obj != -1)
-		{
-			int objnum = Players[to_slot].small_dll_obj;
-			if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type == OBJ_NONE)
-			{
-				Players[to_slot].small_dll_obj = -1;
-			}
-			else
-			{
-				srcs[num_src_to_check] = objnum;
-				num_src_to_check++;
-			}
-		}
+		if (MultiInterestCanSee(to_slot, Objects[Players[i].objnum].roomnum))
+			send_position = 1;
 
-		// See if there are any small views we need to send for
-		// Do left view
-		if (Players[to_slot].small_left_obj != -1)
+		if (Player_fire_packet[i].fired_on_this_frame != PFP_NO_FIRED)
 		{
-			int objnum = Players[to_slot].small_left_obj;
-			if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type == OBJ_NONE || Objects[objnum].type == OBJ_WEAPON)
-			{
-				Players[to_slot].small_left_obj = -1;
-			}
-			else
-			{
-				srcs[num_src_to_check] = objnum;
-				num_src_to_check++;
-			}
-		}
+			timer_popped = 1;
 
-		// Do right view
-		if (Players[to_slot].small_right_obj != -1)
-		{
-			int objnum = Players[to_slot].small_right_obj;
-			if ((Objects[objnum].flags & OF_DEAD) || (Objects[objnum].type == OBJ_NONE) || (Objects[objnum].type == OBJ_WEAPON))
+			if (Player_fire_packet[i].wb_index >= SECONDARY_INDEX)
 			{
-				Players[to_slot].small_right_obj = -1;
+				send_position = 1;
 			}
 			else
 			{
-				srcs[num_src_to_check] = objnum;
-				num_src_to_check++;
-			}
-		}
-
-		for (int t = 0; t < num_src_to_check; t++)
-		{
-			int room_a = Objects[srcs[t]].roomnum;
-			int room_b = Objects[Players[i].objnum].roomnum;
-
-			if (BOA_IsVisible(room_a, room_b))
-				send_position = 1;
-
-			if (Player_fire_packet[i].fired_on_this_frame != PFP_NO_FIRED)
-			{
-				timer_popped = 1;
+				int view_rooms[10];
+				int num_views = MultiInterestGetViewRooms(to_slot, view_rooms);
 
-				if (Player_fire_packet[i].wb_index >= SECONDARY_INDEX)
+				for (int t = 0; t < num_views && !send_position; t++)
 				{
-					send_position = 1;
-				}
-				else
-				{
-					if (BOA_IsVisible(Player_fire_packet[i].dest_roomnum, Objects[srcs[t]].roomnum))
+					if (BOA_IsVisible(Player_fire_packet[i].dest_roomnum, view_rooms[t]))
 						send_position = 1;
-
 				}
 			}
 		}
@@ -1703,12 +1696,14 @@ void MultiSendPositionalUpdates(int to_slot)
 			if (i != Player_num)
 				Multi_last_sent_time[to_slot][i] = 0;
 
+			Interest_stats[to_slot].considered++;
 
 			if (send_position)
 			{
 				Multi_visible_players[to_slot] |= (1 << i);
+				Interest_stats[to_slot].relevant++;
 
-				int count = MultiStuffPosition(i, data);
+				int count = MultiStuffPosition(i, data, to_slot);
 				NetPlayers[to_slot].total_bytes_sent += count;
 
 				int add_count = 0;
@@ -1727,6 +1722,9 @@ void MultiSendPositionalUpdates(int to_slot)
 
 				nw_Send(&NetPlayers[to_slot].addr, data, count, 0);
 
+				// Players always go out, but they still use up the budget
+				MultiInterestSent(to_slot, Players[i].objnum, count);
+
 				// TODO: SEND RELIABLE WEAPON FIRE HERE
 				if (Player_fire_packet[i].fired_on_this_frame == PFP_FIRED_RELIABLE)
 				{
@@ -1745,43 +1743,30 @@ void MultiSendPositionalUpdates(int to_slot)
 
 }
 
-// Figures out which robots have moved since the last time this player slot was updated
-void MultiUpdateRobotMovedList(int slot)
+// Finds the robots that moved this frame.  Done once before MultiUpdateRobotMovedList is
+// called for each slot.
+void MultiCollectMovedRobots()
 {
-	bool skip_this_obj = false;
-	//check for moved robots
+	Num_moved_this_frame = 0;
+
 	for (int a = 0; a <= Highest_object_index; a++)
 	{
 		object* obj = &Objects[a];
 		if (obj->type == OBJ_NONE)
 			continue;
 
-		if (MultiIsValidMovedObject(obj))
-		{
-			if ((obj->flags & OF_MOVED_THIS_FRAME))
-			{
-				skip_this_obj = false;
-				//mprintf ((0,"Object %d (type=%d) moved this frame!\n",a,obj->type));
-				//Check to see if this robot is on the list already
-				for (int b = 0; b < Num_moved_robots[slot] && !skip_this_obj; b++)
-				{
-					if (Moved_robots[slot][b] == obj->handle)
-					{
-						skip_this_obj = true;
-					}
-				}
-
-				if (!skip_this_obj)
-				{
-					Moved_robots[slot][Num_moved_robots[slot]] = obj->handle;
-					ASSERT(Objects[a].flags & OF_CLIENT_KNOWS);
-					Num_moved_robots[slot]++;
-				}
-			}
-		}
+		if ((obj->flags & OF_MOVED_THIS_FRAME) && MultiIsValidMovedObject(obj))
+			Moved_this_frame[Num_moved_this_frame++] = a;
 	}
 }
 
+// Figures out which robots have moved since the last time this player slot was updated
+void MultiUpdateRobotMovedList(int slot)
+{
+	for (int a = 0; a < Num_moved_this_frame; a++)
+		MultiAddMovedRobot(slot, &Objects[Moved_this_frame[a]]);
+}
+
 // Sets up our data structures so that the nonvisible robots will be sent when they are needed
 void MultiSetupNonVisRobots(int slot, object* obj)
 {
@@ -1845,24 +1830,8 @@ void MultiDoNonVisGenericForSlot(int slot)
 				bool skip_this_obj = false;
 				int b;
 
-				//For movement, Check to see if this robot is on the list already
-				for (b = 0; b < Num_moved_robots[slot] && !skip_this_obj; b++)
-				{
-					if (Moved_robots[slot][b] == obj->handle)
-					{
-						skip_this_obj = true;
-					}
-				}
-
-				if (!skip_this_obj)
-				{
-					if (Num_moved_robots[slot] < MAX_CHANGED_OBJECTS)
-					{
-						Moved_robots[slot][Num_moved_robots[slot]] = obj->handle;
-						ASSERT(Objects[i].flags & OF_CLIENT_KNOWS);
-						Num_moved_robots[slot]++;
-					}
-				}
+				//For movement
+				MultiAddMovedRobot(slot, obj);
 
 				// Now do changed anim
 				skip_this_obj = false;
@@ -1956,93 +1925,88 @@ void MultiDoNonVisGenericForSlot(int slot)
 // This takes into account markers, dll objects, and other stuff
 bool MultiIsGenericVisibleToPlayer(int test_objnum, int to_slot)
 {
-	int srcs[10], num_src_to_check = 1;
-
-	srcs[0] = Players[to_slot].objnum;
-
-	if (Players[to_slot].guided_obj != NULL)
-		srcs[num_src_to_check++] = Players[to_slot].guided_obj - Objects;
-
-	if (Players[to_slot].small_dll_obj != -1)
-	{
-		int objnum = Players[to_slot].small_dll_obj;
-		if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type == OBJ_NONE)
-		{
-			Players[to_slot].small_dll_obj = -1;
-		}
-		else
-		{
-			srcs[num_src_to_check] = objnum;
-			num_src_to_check++;
-		}
-	}
-	// See if there are any small views we need to send for
-	// Do left view
-	if (Players[to_slot].small_left_obj != -1)
-	{
-		int objnum = Players[to_slot].small_left_obj;
-		if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type == OBJ_NONE || Objects[objnum].type == OBJ_WEAPON)
-		{
-			Players[to_slot].small_left_obj = -1;
-		}
-		else
-		{
-			srcs[num_src_to_check] = objnum;
-			num_src_to_check++;
-		}
-	}
+	// MultiInterestUpdate has already worked out what this player can see this frame
+	return MultiInterestIsRelevant(to_slot, Objects[test_objnum].roomnum);
+}
 
-	// Do right view
-	if (Players[to_slot].small_right_obj != -1)
-	{
-		int objnum = Players[to_slot].small_right_obj;
-		if (Objects[objnum].flags & OF_DEAD || Objects[objnum].type == OBJ_NONE || Objects[objnum].type == OBJ_WEAPON)
-		{
-			Players[to_slot].small_right_obj = -1;
-		}
-		else
-		{
-			srcs[num_src_to_check] = objnum;
-			num_src_to_check++;
-		}
-	}
+typedef struct
+{
+	int objnum;
+	float priority;
+} robot_send_entry;
 
-	for (int t = 0; t < num_src_to_check; t++)
-	{
-		if (BOA_IsVisible(Objects[test_objnum].roomnum, Objects[srcs[t]].roomnum))
-			return true;
-	}
+static robot_send_entry Robot_send_list[MAX_CHANGED_OBJECTS];
 
-	return false;
+// Sorts robots so the highest priority comes first
+static int RobotSendCompare(const void* a, const void* b)
+{
+	float pa = ((robot_send_entry*)a)->priority;
+	float pb = ((robot_send_entry*)b)->priority;
 
+	if (pa > pb)
+		return -1;
+	if (pa < pb)
+		return 1;
+	return 0;
 }
 
-
-
-
 // Does robot stuff for a particular client
 void MultiDoServerRobotFrame(int slot)
 {
 	int rcount = 0;
 	int m = 0;
 	ubyte rdata[MAX_GAME_DATA_SIZE];
+	int snap_offset = -1;	// MP_ROBOT_POS_DELTA being filled in Multi_send_buffer[slot]
+
+	//send robot information for any robots that have moved, most important first
+	int num_send = 0;
+	int num_kept = 0;
 
-	//send robot information for any robots that have moved.
 	for (m = 0; m < Num_moved_robots[slot]; m++)
 	{
-		int send_position = 0;
 		int objnum = Moved_robots[slot][m] & HANDLE_OBJNUM_MASK;
 
 		if (Moved_robots[slot][m] != Objects[objnum].handle)
 		{
 			mprintf((0, "Caught handle objnum problem!\n"));
+			Moved_robot_slots[objnum] &= ~(1 << slot);
 			continue;
 		}
 
+		Interest_stats[slot].considered++;
+
 		if (MultiIsGenericVisibleToPlayer(objnum, slot))
-			send_position = 1;
+		{
+			Interest_stats[slot].relevant++;
+			Robot_send_list[num_send].objnum = objnum;
+			Robot_send_list[num_send].priority = MultiInterestAddPriority(slot, &Objects[objnum]);
+			num_send++;
+		}
+		else
+		{
+			MultiSetupNonVisRobots(slot, &Objects[objnum]);
+			Moved_robot_slots[objnum] &= ~(1 << slot);
+		}
+	}
 
-		if (send_position)
+	qsort(Robot_send_list, num_send, sizeof(robot_send_entry), RobotSendCompare);
+
+	for (m = 0; m < num_send; m++)
+	{
+		int objnum = Robot_send_list[m].objnum;
+
+		// Out of budget, so this one waits with the priority it has built up.  The most
+		// important robot always goes so nothing is held back forever.
+		if (m > 0 && !MultiInterestHaveBudget(slot))
+		{
+			Interest_stats[slot].deferred++;
+			Moved_robots[slot][num_kept++] = Objects[objnum].handle;
+			continue;
+		}
+
+		if (MultiSnapshotsActive())
+			rcount = MultiStuffRobotSnapshot(slot, objnum, &snap_offset);
+		else
 		{
 			rcount = MultiStuffRobotPosition(objnum, rdata);
 			if (rcount > 0)
@@ -2052,15 +2016,15 @@ void MultiDoServerRobotFrame(int slot)
 				memcpy(&Multi_send_buffer[slot][Multi_send_size[slot]], rdata, rcount);
 				Multi_send_size[slot] += rcount;
 			}
-
-			Objects[objnum].generic_sent_nonvis &= ~(1 << slot);
 		}
-		else
-			MultiSetupNonVisRobots(slot, &Objects[objnum]);
+
+		MultiInterestSent(slot, objnum, rcount);
+		Moved_robot_slots[objnum] &= ~(1 << slot);
+		Objects[objnum].generic_sent_nonvis &= ~(1 << slot);
 	}
 
-	//clear the robot movement flag for this player
-	Num_moved_robots[slot] = 0;
+	//anything left over goes out next time
+	Num_moved_robots[slot] = num_kept;
 
 
 	//Now do anim changed stuff
@@ -2284,6 +2248,13 @@ void MultiDoServerFrame()
 
 	Player_count = 1;
 
+	// Find the robots that moved, once for everybody
+	MultiCollectMovedRobots();
+
+	// Everything we send this frame goes out together at the end, with small packets
+	// to the same player sharing a datagram
+	nw_BeginSendBatch();
+
 	// Send out data
 	for (i = 0; i < MAX_NET_PLAYERS; i++)
 	{
@@ -2407,6 +2378,9 @@ void MultiDoServerFrame()
 				// Figure out which robots moved this frame
 				MultiUpdateRobotMovedList(i);
 
+				// Work out what this player can see
+				MultiInterestUpdate(i);
+
 				Multi_last_sent_time[i][Player_num] += Frametime;
 				float last_client_update = Multi_last_sent_time[i][Player_num];
 
@@ -2434,6 +2408,8 @@ void MultiDoServerFrame()
 		}
 	}
 
+	nw_EndSendBatch();
+
 	for (i = 0; i < MAX_NET_PLAYERS; i++)
 		Player_fire_packet[i].fired_on_this_frame = PFP_NO_FIRED;
 
@@ -0,0 +1,1501 @@
+/*
+* Descent 3
+* Copyright (C) 2024 Parallax Software
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "multi_snapshot.h"
+#include "multi.h"
+#include "object.h"
+#include "room.h"
+#include "terrain.h"
+#include "mem.h"
+#include "mono.h"
+#include "pserror.h"
+#include "ddio.h"
+#include "game.h"
+
+// Positions are quantised to 1/16th of a unit, which is what MultiAddPositionData gave x and z
+#define SNAP_POS_SCALE			16.0f
+// Slack around a room's vertices, since object centers can poke a little way out
+#define SNAP_BOUNDS_PAD			8.0f
+#define SNAP_MAX_AXIS_BITS		24
+
+// Terrain positions are quantised against one fixed box
+#define SNAP_TERRAIN_BOUNDS		MAX_ROOMS
+#define SNAP_TERRAIN_MIN_Y		-1024.0f
+#define SNAP_TERRAIN_MAX_Y		3072.0f
+
+// Smallest three quaternion components
+#define SNAP_QUAT_BITS			12
+#define SNAP_QUAT_MAX			((1<<SNAP_QUAT_BITS)-1)
+#define SNAP_QUAT_RANGE			0.70710678f
+
+// Width of the escape code for big deltas
+#define SNAP_DELTA_BITS			26
+
+// Positions are predicted from the baseline's velocity, in ticks of 1/64th of a second
+#define SNAP_PREDICT_RATE		64.0f
+#define SNAP_MAX_PREDICT		255
+
+// How many states the client keeps for each object.  The server only deltas against a
+// baseline that can't have been pushed out of this window yet.
+#define SNAP_RECV_HISTORY		16
+// How many sent states the server remembers per client while it waits for acks
+#define SNAP_SENT_POOL			4096
+// How many sent packets the server remembers per client while it waits for acks
+#define SNAP_PACKET_RING		256
+// An object gets a full state every this many updates no matter what was acked
+#define SNAP_FULL_INTERVAL		64
+// Sequence numbers further than this from the latest are from some other game
+#define SNAP_SEQ_WINDOW			1024
+// How many packets one ack covers
+#define SNAP_ACK_BITS			64
+
+// A quantised object state, exactly as both ends reconstruct it
+typedef struct
+{
+	int roomnum;				// room, or MAKE_ROOMNUM(cell) on the terrain
+	int qpos[3];				// position in steps from the bounds origin, or the float bits if raw_pos
+	ubyte raw_pos;				// position was outside the bounds and went as floats
+	ubyte quat_index;			// which quaternion component was dropped
+	short quat[3];				// the other three
+	short vel[3];				// velocity*128, like MP_ROBOT_POS
+} snap_state;
+
+typedef struct
+{
+	vector origin;
+	ubyte bits[3];				// 0 if this room can't be quantised
+} snap_bounds;
+
+// A state the server sent that hasn't been acked yet
+typedef struct
+{
+	ushort seq;
+	ushort index;
+	ushort objnum;
+	float time;
+	snap_state state;
+} snap_sent_entry;
+
+typedef struct
+{
+	int handle;					// object the baseline belongs to
+	ushort sent;				// how many states went out for it
+	ushort base_seq;
+	ushort base_index;
+	ubyte has_base;
+	float base_time;
+	snap_state base;
+} snap_sent_object;
+
+typedef struct
+{
+	ushort seq;
+	ubyte used;
+	ubyte acked;
+	ubyte num_entries;
+	int entries[SNAP_MAX_PACKET_ENTRIES];	// positions in the client's sent pool
+} snap_sent_packet;
+
+// What the server knows about one client
+typedef struct
+{
+	ushort next_seq;
+	int open_seq;				// packet being built in Multi_send_buffer, or -1
+	int num_sent;				// states that have gone into the pool
+	snap_sent_object *objects;
+	snap_sent_packet *packets;
+	snap_sent_entry *pool;
+} snap_server_client;
+
+typedef struct
+{
+	ushort seq;
+	ushort age;
+	ubyte used;
+	snap_state state;
+} snap_recv_entry;
+
+typedef struct
+{
+	ushort protect_seq;			// baseline the server last used, which mustn't be thrown out
+	ubyte protect;
+	ubyte has_newest;
+	ushort newest_seq;
+	ushort inserted;
+	snap_recv_entry entries[SNAP_RECV_HISTORY];
+} snap_recv_object;
+
+// What a client knows about the server's packets
+typedef struct
+{
+	ubyte started;
+	ubyte need_ack;
+	ushort latest_seq;
+	unsigned long long received;	// bit n is set if latest_seq-n arrived and decoded
+	unsigned long long failed;		// bit n is set if something in latest_seq-n didn't decode
+	snap_recv_object *objects;
+} snap_client;
+
+typedef struct
+{
+	ubyte *data;
+	int bit;
+	int size_bits;
+	ubyte overrun;
+} snap_bits;
+
+snap_stats Snap_stats;
+
+static snap_bounds Snap_bounds[MAX_ROOMS+1];
+static snap_server_client Snap_server[MAX_NET_PLAYERS];
+static snap_client Snap_client;
+
+bool MultiSnapshotsActive ()
+{
+	return (Netgame.flags & NF_DELTA_SNAPSHOTS) && !(Netgame.flags & NF_PEER_PEER);
+}
+
+// Works out how many bits it takes to cover "extent" in quantisation steps
+static ubyte SnapAxisBits (float extent)
+{
+	float steps=ceil(extent*SNAP_POS_SCALE)+1;
+	int bits=1;
+
+	while ((float)(1<<bits)<steps && bits<SNAP_MAX_AXIS_BITS)
+		bits++;
+
+	return bits;
+}
+
+// Figures out the quantisation box for every room, plus one for the terrain
+static void SnapComputeBounds ()
+{
+	memset (Snap_bounds,0,sizeof(Snap_bounds));
+
+	for (int i=0;i<=Highest_room_index;i++)
+	{
+		room *rp=&Rooms[i];
+
+		if (!rp->used || rp->num_verts<1 || (rp->flags & RF_EXTERNAL))
+			continue;
+
+		vector min_xyz=rp->verts[0],max_xyz=rp->verts[0];
+		for (int t=1;t<rp->num_verts;t++)
+		{
+			vector *v=&rp->verts[t];
+			if (v->x<min_xyz.x) min_xyz.x=v->x;
+			if (v->y<min_xyz.y) min_xyz.y=v->y;
+			if (v->z<min_xyz.z) min_xyz.z=v->z;
+			if (v->x>max_xyz.x) max_xyz.x=v->x;
+			if (v->y>max_xyz.y) max_xyz.y=v->y;
+			if (v->z>max_xyz.z) max_xyz.z=v->z;
+		}
+
+		snap_bounds *b=&Snap_bounds[i];
+		b->origin.x=min_xyz.x-SNAP_BOUNDS_PAD;
+		b->origin.y=min_xyz.y-SNAP_BOUNDS_PAD;
+		b->origin.z=min_xyz.z-SNAP_BOUNDS_PAD;
+		b->bits[0]=SnapAxisBits (max_xyz.x-min_xyz.x+SNAP_BOUNDS_PAD*2);
+		b->bits[1]=SnapAxisBits (max_xyz.y-min_xyz.y+SNAP_BOUNDS_PAD*2);
+		b->bits[2]=SnapAxisBits (max_xyz.z-min_xyz.z+SNAP_BOUNDS_PAD*2);
+	}
+
+	snap_bounds *b=&Snap_bounds[SNAP_TERRAIN_BOUNDS];
+	b->origin.x=-SNAP_BOUNDS_PAD;
+	b->origin.y=SNAP_TERRAIN_MIN_Y;
+	b->origin.z=-SNAP_BOUNDS_PAD;
+	b->bits[0]=SnapAxisBits (TERRAIN_WIDTH*TERRAIN_SIZE+SNAP_BOUNDS_PAD*2);
+	b->bits[1]=SnapAxisBits (SNAP_TERRAIN_MAX_Y-SNAP_TERRAIN_MIN_Y);
+	b->bits[2]=SnapAxisBits (TERRAIN_DEPTH*TERRAIN_SIZE+SNAP_BOUNDS_PAD*2);
+}
+
+// Returns the quantisation box for a room, or NULL if there isn't one
+static snap_bounds *SnapGetBounds (int roomnum)
+{
+	if (ROOMNUM_OUTSIDE(roomnum))
+		return &Snap_bounds[SNAP_TERRAIN_BOUNDS];
+
+	if (roomnum<0 || roomnum>Highest_room_index || Snap_bounds[roomnum].bits[0]==0)
+		return NULL;
+
+	return &Snap_bounds[roomnum];
+}
+
+// Matrix to quaternion, keeping the three smallest components
+static void SnapPackOrient (matrix *m,snap_state *st)
+{
+	float q[4];		// x,y,z,w
+	float trace=m->rvec.x+m->uvec.y+m->fvec.z;
+
+	if (trace>0)
+	{
+		float s=0.5f/sqrt(trace+1.0f);
+		q[3]=0.25f/s;
+		q[0]=(m->fvec.y-m->uvec.z)*s;
+		q[1]=(m->rvec.z-m->fvec.x)*s;
+		q[2]=(m->uvec.x-m->rvec.y)*s;
+	}
+	else if (m->rvec.x>m->uvec.y && m->rvec.x>m->fvec.z)
+	{
+		float s=2.0f*sqrt(1.0f+m->rvec.x-m->uvec.y-m->fvec.z);
+		q[3]=(m->fvec.y-m->uvec.z)/s;
+		q[0]=0.25f*s;
+		q[1]=(m->rvec.y+m->uvec.x)/s;
+		q[2]=(m->rvec.z+m->fvec.x)/s;
+	}
+	else if (m->uvec.y>m->fvec.z)
+	{
+		float s=2.0f*sqrt(1.0f+m->uvec.y-m->rvec.x-m->fvec.z);
+		q[3]=(m->rvec.z-m->fvec.x)/s;
+		q[0]=(m->rvec.y+m->uvec.x)/s;
+		q[1]=0.25f*s;
+		q[2]=(m->uvec.z+m->fvec.y)/s;
+	}
+	else
+	{
+		float s=2.0f*sqrt(1.0f+m->fvec.z-m->rvec.x-m->uvec.y);
+		q[3]=(m->uvec.x-m->rvec.y)/s;
+		q[0]=(m->rvec.z+m->fvec.x)/s;
+		q[1]=(m->uvec.z+m->fvec.y)/s;
+		q[2]=0.25f*s;
+	}
+
+	int largest=0;
+	for (int i=1;i<4;i++)
+		if (fabs(q[i])>fabs(q[largest]))
+			largest=i;
+
+	// q and -q are the same rotation, so make the dropped one positive
+	float sign=(q[largest]<0)?-1.0f:1.0f;
+
+	st->quat_index=largest;
+	for (int i=0,t=0;i<4;i++)
+	{
+		if (i==largest)
+			continue;
+
+		float v=(q[i]*sign+SNAP_QUAT_RANGE)/(SNAP_QUAT_RANGE*2)*SNAP_QUAT_MAX+0.5f;
+		if (v<0)
+			v=0;
+		if (v>SNAP_QUAT_MAX)
+			v=SNAP_QUAT_MAX;
+		st->quat[t++]=(short)v;
+	}
+}
+
+static void SnapUnpackOrient (snap_state *st,matrix *m)
+{
+	float q[4];
+	float sum=0;
+
+	for (int i=0,t=0;i<4;i++)
+	{
+		if (i==st->quat_index)
+			continue;
+
+		q[i]=((float)st->quat[t++]/SNAP_QUAT_MAX)*(SNAP_QUAT_RANGE*2)-SNAP_QUAT_RANGE;
+		sum+=q[i]*q[i];
+	}
+	q[st->quat_index]=(sum<1.0f)?sqrt(1.0f-sum):0;
+
+	float x=q[0],y=q[1],z=q[2],w=q[3];
+
+	m->rvec.x=1-2*(y*y+z*z);
+	m->rvec.y=2*(x*y-z*w);
+	m->rvec.z=2*(x*z+y*w);
+	m->uvec.x=2*(x*y+z*w);
+	m->uvec.y=1-2*(x*x+z*z);
+	m->uvec.z=2*(y*z-x*w);
+	m->fvec.x=2*(x*z-y*w);
+	m->fvec.y=2*(y*z+x*w);
+	m->fvec.z=1-2*(x*x+y*y);
+}
+
+static short SnapQuantiseVel (float v)
+{
+	v*=128.0f;
+	if (v>32767.0f)
+		return 32767;
+	if (v<-32768.0f)
+		return -32768;
+	return (short)v;
+}
+
+// Turns an object's position, orientation, room and velocity into what goes over the wire
+static void SnapQuantise (vector *pos,int roomnum,matrix *orient,vector *vel,snap_state *st)
+{
+	memset (st,0,sizeof(snap_state));
+	st->roomnum=roomnum;
+
+	snap_bounds *b=SnapGetBounds (roomnum);
+	float v[3]={pos->x,pos->y,pos->z};
+
+	if (b==NULL)
+		st->raw_pos=1;
+	else
+	{
+		float o[3]={b->origin.x,b->origin.y,b->origin.z};
+		for (int a=0;a<3 && !st->raw_pos;a++)
+		{
+			float q=floor((v[a]-o[a])*SNAP_POS_SCALE+0.5f);
+			if (q<0 || q>=(float)(1<<b->bits[a]))
+				st->raw_pos=1;
+			else
+				st->qpos[a]=(int)q;
+		}
+	}
+
+	if (st->raw_pos)
+		memcpy (st->qpos,v,sizeof(st->qpos));
+
+	SnapPackOrient (orient,st);
+
+	st->vel[0]=SnapQuantiseVel (vel->x);
+	st->vel[1]=SnapQuantiseVel (vel->y);
+	st->vel[2]=SnapQuantiseVel (vel->z);
+}
+
+static void SnapDequantise (snap_state *st,vector *pos,matrix *orient,vector *vel)
+{
+	if (st->raw_pos)
+		memcpy (pos,st->qpos,sizeof(vector));
+	else
+	{
+		snap_bounds *b=SnapGetBounds (st->roomnum);
+		ASSERT (b);
+		pos->x=b->origin.x+st->qpos[0]/SNAP_POS_SCALE;
+		pos->y=b->origin.y+st->qpos[1]/SNAP_POS_SCALE;
+		pos->z=b->origin.z+st->qpos[2]/SNAP_POS_SCALE;
+	}
+
+	SnapUnpackOrient (st,orient);
+
+	vel->x=st->vel[0]/128.0f;
+	vel->y=st->vel[1]/128.0f;
+	vel->z=st->vel[2]/128.0f;
+}
+
+static bool SnapSameState (snap_state *a,snap_state *b)
+{
+	return a->roomnum==b->roomnum && a->raw_pos==b->raw_pos && a->quat_index==b->quat_index &&
+		!memcmp (a->qpos,b->qpos,sizeof(a->qpos)) && !memcmp (a->quat,b->quat,sizeof(a->quat)) &&
+		!memcmp (a->vel,b->vel,sizeof(a->vel));
+}
+
+static void SnapPutBits (snap_bits *b,uint value,int num)
+{
+	for (int i=num-1;i>=0;i--)
+	{
+		if (b->bit>=b->size_bits)
+		{
+			b->overrun=1;
+			return;
+		}
+
+		ubyte *byte=&b->data[b->bit>>3];
+		if ((b->bit & 7)==0)
+			*byte=0;
+		if (value & (1u<<i))
+			*byte|=0x80>>(b->bit & 7);
+		b->bit++;
+	}
+}
+
+static uint SnapGetBits (snap_bits *b,int num)
+{
+	uint value=0;
+
+	for (int i=0;i<num;i++)
+	{
+		value<<=1;
+		if (b->bit>=b->size_bits)
+		{
+			b->overrun=1;
+			continue;
+		}
+
+		if (b->data[b->bit>>3] & (0x80>>(b->bit & 7)))
+			value|=1;
+		b->bit++;
+	}
+
+	return value;
+}
+
+// Small deltas get short codes: 0 costs one bit, +-15 costs 7, +-511 costs 13
+static void SnapPutDelta (snap_bits *b,int delta)
+{
+	uint z=((uint)delta<<1)^(uint)(delta>>31);
+
+	if (z==0)
+		SnapPutBits (b,0,1);
+	else if (z<32)
+	{
+		SnapPutBits (b,2,2);
+		SnapPutBits (b,z,5);
+	}
+	else if (z<1024)
+	{
+		SnapPutBits (b,6,3);
+		SnapPutBits (b,z,10);
+	}
+	else
+	{
+		SnapPutBits (b,7,3);
+		SnapPutBits (b,z,SNAP_DELTA_BITS);
+	}
+}
+
+static int SnapGetDelta (snap_bits *b)
+{
+	uint z;
+
+	if (!SnapGetBits (b,1))
+		return 0;
+	if (!SnapGetBits (b,1))
+		z=SnapGetBits (b,5);
+	else if (!SnapGetBits (b,1))
+		z=SnapGetBits (b,10);
+	else
+		z=SnapGetBits (b,SNAP_DELTA_BITS);
+
+	return (int)(z>>1)^-(int)(z & 1);
+}
+
+// How far "vel" moves something in "ticks", in position steps
+// Done in integers so both ends come up with exactly the same thing
+static int SnapPredictSteps (short vel,int ticks)
+{
+	// vel is in 1/128ths of a unit per second, ticks are 1/64ths of a second and steps are 1/16ths of a unit
+	int v=vel*ticks;
+	return (v>=0)?((v+256)>>9):-((-v+256)>>9);
+}
+
+// Writes "cur" as a delta against "base" (or in full if base is NULL)
+// If ticks is non-zero, the position is a delta against where base's velocity would have taken it
+// The entry starts with its length in bytes so a client can always skip it
+static int SnapWriteEntry (ubyte *data,int *count,ushort seq,snap_state *cur,snap_state *base,ushort base_seq,int ticks)
+{
+	snap_bits b;
+	int a;
+
+	b.data=&data[*count+1];
+	b.bit=0;
+	b.size_bits=(SNAP_MAX_ENTRY_SIZE-1)*8;
+	b.overrun=0;
+
+	SnapPutBits (&b,base!=NULL,1);
+	if (base)
+	{
+		ushort dist=seq-base_seq;
+		if (dist<255)
+			SnapPutBits (&b,dist,8);
+		else
+		{
+			SnapPutBits (&b,255,8);
+			SnapPutBits (&b,base_seq,16);
+		}
+	}
+
+	// Room
+	bool same_room=(base && base->roomnum==cur->roomnum);
+	if (base)
+		SnapPutBits (&b,same_room,1);
+	if (!same_room)
+	{
+		SnapPutBits (&b,ROOMNUM_OUTSIDE(cur->roomnum)?1:0,1);
+		SnapPutBits (&b,CELLNUM(cur->roomnum),16);
+	}
+
+	// Position
+	SnapPutBits (&b,cur->raw_pos,1);
+	if (cur->raw_pos)
+	{
+		for (a=0;a<3;a++)
+			SnapPutBits (&b,cur->qpos[a],32);
+	}
+	else if (same_room && !base->raw_pos)
+	{
+		SnapPutBits (&b,ticks!=0,1);
+		if (ticks)
+			SnapPutBits (&b,ticks,8);
+
+		for (a=0;a<3;a++)
+			SnapPutDelta (&b,cur->qpos[a]-base->qpos[a]-SnapPredictSteps (base->vel[a],ticks));
+	}
+	else
+	{
+		snap_bounds *bounds=SnapGetBounds (cur->roomnum);
+		for (a=0;a<3;a++)
+			SnapPutBits (&b,cur->qpos[a],bounds->bits[a]);
+	}
+
+	// Orientation
+	bool changed=true;
+	if (base)
+	{
+		changed=(cur->quat_index!=base->quat_index || memcmp (cur->quat,base->quat,sizeof(cur->quat)));
+		SnapPutBits (&b,changed,1);
+	}
+	if (changed)
+	{
+		bool same_index=(base && base->quat_index==cur->quat_index);
+		if (base)
+			SnapPutBits (&b,same_index,1);
+
+		if (same_index)
+		{
+			for (a=0;a<3;a++)
+				SnapPutDelta (&b,cur->quat[a]-base->quat[a]);
+		}
+		else
+		{
+			SnapPutBits (&b,cur->quat_index,2);
+			for (a=0;a<3;a++)
+				SnapPutBits (&b,cur->quat[a],SNAP_QUAT_BITS);
+		}
+	}
+
+	// Velocity
+	if (base)
+	{
+		changed=(memcmp (cur->vel,base->vel,sizeof(cur->vel))!=0);
+		SnapPutBits (&b,changed,1);
+		if (changed)
+		{
+			for (a=0;a<3;a++)
+				SnapPutDelta (&b,cur->vel[a]-base->vel[a]);
+		}
+	}
+	else
+	{
+		for (a=0;a<3;a++)
+			SnapPutBits (&b,(ushort)cur->vel[a],16);
+	}
+
+	ASSERT (!b.overrun);
+
+	int bytes=(b.bit+7)>>3;
+	data[*count]=bytes;
+	*count+=bytes+1;
+
+	return bytes+1;
+}
+
+// Finds the state we got for this object in packet "seq"
+static snap_state *SnapFindRecv (snap_recv_object *ro,ushort seq)
+{
+	for (int i=0;i<SNAP_RECV_HISTORY;i++)
+	{
+		if (ro->entries[i].used && ro->entries[i].seq==seq)
+			return &ro->entries[i].state;
+	}
+
+	return NULL;
+}
+
+// Remembers a state we've received, throwing out the oldest one the server can't still be using
+static void SnapInsertRecv (snap_recv_object *ro,ushort seq,snap_state *st)
+{
+	int slot=-1;
+	int i;
+
+	for (i=0;i<SNAP_RECV_HISTORY && slot==-1;i++)
+	{
+		if (ro->entries[i].used && ro->entries[i].seq==seq)
+			slot=i;
+	}
+
+	for (i=0;i<SNAP_RECV_HISTORY && slot==-1;i++)
+	{
+		if (!ro->entries[i].used)
+			slot=i;
+	}
+
+	if (slot==-1)
+	{
+		for (i=0;i<SNAP_RECV_HISTORY;i++)
+		{
+			snap_recv_entry *e=&ro->entries[i];
+			if (ro->protect && e->seq==ro->protect_seq)
+				continue;
+			if (slot==-1 || (short)(e->age-ro->entries[slot].age)<0)
+				slot=i;
+		}
+	}
+
+	snap_recv_entry *e=&ro->entries[slot];
+	e->used=1;
+	e->seq=seq;
+	e->age=ro->inserted++;
+	e->state=*st;
+}
+
+// Reads an entry written by SnapWriteEntry
+static int SnapReadEntry (snap_recv_object *ro,ushort seq,ubyte *data,int *count,snap_state *st)
+{
+	int len=data[*count];
+	snap_bits b;
+	snap_state *base=NULL;
+	int a;
+
+	b.data=&data[*count+1];
+	b.bit=0;
+	b.size_bits=len*8;
+	b.overrun=0;
+	*count+=len+1;
+
+	memset (st,0,sizeof(snap_state));
+
+	if (SnapGetBits (&b,1))
+	{
+		ushort dist=SnapGetBits (&b,8);
+		ushort base_seq=(dist==255)?SnapGetBits (&b,16):(ushort)(seq-dist);
+
+		base=SnapFindRecv (ro,base_seq);
+		if (base==NULL)
+			return -1;
+
+		ro->protect=1;
+		ro->protect_seq=base_seq;
+	}
+
+	// Room
+	bool same_room=false;
+	if (base)
+		same_room=(SnapGetBits (&b,1)!=0);
+	if (same_room)
+		st->roomnum=base->roomnum;
+	else
+	{
+		int outside=SnapGetBits (&b,1);
+		st->roomnum=SnapGetBits (&b,16);
+		if (outside)
+			st->roomnum=MAKE_ROOMNUM(st->roomnum);
+	}
+
+	// Position
+	st->raw_pos=SnapGetBits (&b,1);
+	if (st->raw_pos)
+	{
+		for (a=0;a<3;a++)
+			st->qpos[a]=SnapGetBits (&b,32);
+	}
+	else if (same_room && !base->raw_pos)
+	{
+		int ticks=0;
+		if (SnapGetBits (&b,1))
+			ticks=SnapGetBits (&b,8);
+
+		for (a=0;a<3;a++)
+			st->qpos[a]=base->qpos[a]+SnapPredictSteps (base->vel[a],ticks)+SnapGetDelta (&b);
+	}
+	else
+	{
+		snap_bounds *bounds=SnapGetBounds (st->roomnum);
+		if (bounds==NULL)
+			return -1;
+		for (a=0;a<3;a++)
+			st->qpos[a]=SnapGetBits (&b,bounds->bits[a]);
+	}
+
+	// Orientation
+	bool changed=true;
+	if (base)
+		changed=(SnapGetBits (&b,1)!=0);
+	if (!changed)
+	{
+		st->quat_index=base->quat_index;
+		memcpy (st->quat,base->quat,sizeof(st->quat));
+	}
+	else
+	{
+		bool same_index=false;
+		if (base)
+			same_index=(SnapGetBits (&b,1)!=0);
+
+		if (same_index)
+		{
+			st->quat_index=base->quat_index;
+			for (a=0;a<3;a++)
+				st->quat[a]=base->quat[a]+SnapGetDelta (&b);
+		}
+		else
+		{
+			st->quat_index=SnapGetBits (&b,2);
+			for (a=0;a<3;a++)
+				st->quat[a]=SnapGetBits (&b,SNAP_QUAT_BITS);
+		}
+	}
+
+	// Velocity
+	if (base)
+	{
+		if (SnapGetBits (&b,1))
+		{
+			for (a=0;a<3;a++)
+				st->vel[a]=base->vel[a]+SnapGetDelta (&b);
+		}
+		else
+			memcpy (st->vel,base->vel,sizeof(st->vel));
+	}
+	else
+	{
+		for (a=0;a<3;a++)
+			st->vel[a]=(short)SnapGetBits (&b,16);
+	}
+
+	if (b.overrun)
+		return -1;
+
+	return 1;
+}
+
+static void SnapResetServerClient (snap_server_client *sc)
+{
+	sc->next_seq=0;
+	sc->open_seq=-1;
+	sc->num_sent=0;
+	if (sc->objects)
+		memset (sc->objects,0,sizeof(snap_sent_object)*MAX_OBJECTS);
+	if (sc->packets)
+		memset (sc->packets,0,sizeof(snap_sent_packet)*SNAP_PACKET_RING);
+}
+
+static void SnapResetClient (snap_client *cl)
+{
+	cl->started=0;
+	cl->need_ack=0;
+	cl->latest_seq=0;
+	cl->received=0;
+	cl->failed=0;
+	if (cl->objects)
+		memset (cl->objects,0,sizeof(snap_recv_object)*MAX_OBJECTS);
+}
+
+static snap_server_client *SnapGetServerClient (int slot)
+{
+	snap_server_client *sc=&Snap_server[slot];
+
+	if (sc->objects==NULL)
+	{
+		sc->objects=(snap_sent_object *)mem_malloc (sizeof(snap_sent_object)*MAX_OBJECTS);
+		sc->packets=(snap_sent_packet *)mem_malloc (sizeof(snap_sent_packet)*SNAP_PACKET_RING);
+		sc->pool=(snap_sent_entry *)mem_malloc (sizeof(snap_sent_entry)*SNAP_SENT_POOL);
+		SnapResetServerClient (sc);
+	}
+
+	return sc;
+}
+
+static snap_client *SnapGetClient ()
+{
+	if (Snap_client.objects==NULL)
+	{
+		Snap_client.objects=(snap_recv_object *)mem_malloc (sizeof(snap_recv_object)*MAX_OBJECTS);
+		SnapResetClient (&Snap_client);
+	}
+
+	return &Snap_client;
+}
+
+static ushort SnapOpenPacket (snap_server_client *sc)
+{
+	ushort seq=sc->next_seq++;
+	snap_sent_packet *sp=&sc->packets[seq % SNAP_PACKET_RING];
+
+	sp->used=1;
+	sp->acked=0;
+	sp->seq=seq;
+	sp->num_entries=0;
+
+	return seq;
+}
+
+// Encodes "cur" for one client and remembers it until that client acks it
+static int SnapServerAdd (snap_server_client *sc,ushort seq,int objnum,int handle,snap_state *cur,float time,ubyte *data,int *count)
+{
+	snap_sent_object *so=&sc->objects[objnum];
+
+	if (so->handle!=handle)
+	{
+		memset (so,0,sizeof(snap_sent_object));
+		so->handle=handle;
+	}
+
+	// Only delta against a baseline the client still has
+	snap_state *base=NULL;
+	if (so->has_base && (ushort)(so->sent-1-so->base_index)<=SNAP_RECV_HISTORY-2 && (ushort)(seq-so->base_seq)<SNAP_SEQ_WINDOW*16 && (so->sent % SNAP_FULL_INTERVAL)!=0)
+		base=&so->base;
+
+	// Predict from the baseline's velocity if it was moving
+	int ticks=0;
+	if (base && (base->vel[0] || base->vel[1] || base->vel[2]))
+	{
+		ticks=(int)((time-so->base_time)*SNAP_PREDICT_RATE+0.5f);
+		if (ticks<0 || ticks>SNAP_MAX_PREDICT)
+			ticks=0;
+	}
+
+	int bytes=SnapWriteEntry (data,count,seq,cur,base,so->base_seq,ticks);
+
+	if (base)
+		Snap_stats.deltas++;
+	else
+		Snap_stats.full++;
+
+	snap_sent_packet *sp=&sc->packets[seq % SNAP_PACKET_RING];
+	if (sp->used && sp->seq==seq && sp->num_entries<SNAP_MAX_PACKET_ENTRIES)
+	{
+		snap_sent_entry *e=&sc->pool[sc->num_sent % SNAP_SENT_POOL];
+		e->seq=seq;
+		e->index=so->sent;
+		e->objnum=objnum;
+		e->time=time;
+		e->state=*cur;
+		sp->entries[sp->num_entries++]=sc->num_sent++;
+	}
+	so->sent++;
+
+	return bytes;
+}
+
+// The client got packet "seq", so anything in it can become a baseline
+static void SnapServerAckPacket (snap_server_client *sc,ushort seq)
+{
+	snap_sent_packet *sp=&sc->packets[seq % SNAP_PACKET_RING];
+
+	if (!sp->used || sp->seq!=seq || sp->acked)
+		return;
+	sp->acked=1;
+
+	for (int i=0;i<sp->num_entries;i++)
+	{
+		// The pool may have wrapped if the ack took long enough
+		if (sc->num_sent-sp->entries[i]>SNAP_SENT_POOL)
+			continue;
+
+		snap_sent_entry *e=&sc->pool[sp->entries[i] % SNAP_SENT_POOL];
+		if (e->seq!=seq)
+			continue;
+
+		snap_sent_object *so=&sc->objects[e->objnum];
+		if (!so->has_base || (short)(e->index-so->base_index)>0)
+		{
+			so->has_base=1;
+			so->base=e->state;
+			so->base_seq=e->seq;
+			so->base_index=e->index;
+			so->base_time=e->time;
+			Snap_stats.promoted++;
+		}
+	}
+}
+
+static void SnapServerAck (snap_server_client *sc,ushort latest,unsigned long long received)
+{
+	for (int n=0;n<SNAP_ACK_BITS;n++)
+	{
+		if (received & (1ull<<n))
+			SnapServerAckPacket (sc,latest-n);
+	}
+}
+
+// Returns false if "seq" can't be from the game we're in
+static bool SnapClientInWindow (snap_client *cl,ushort seq)
+{
+	if (!cl->started)
+		return true;
+
+	short d=seq-cl->latest_seq;
+	return (d<=SNAP_SEQ_WINDOW && d>=-SNAP_SEQ_WINDOW);
+}
+
+// Moves the ack window up to "seq" if it's newer, and returns how far back "seq" is
+static int SnapClientAdvance (snap_client *cl,ushort seq)
+{
+	if (!cl->started)
+	{
+		cl->started=1;
+		cl->latest_seq=seq;
+		cl->received=0;
+		cl->failed=0;
+	}
+
+	short d=seq-cl->latest_seq;
+	if (d>0)
+	{
+		cl->received=(d>=SNAP_ACK_BITS)?0:(cl->received<<d);
+		cl->failed=(d>=SNAP_ACK_BITS)?0:(cl->failed<<d);
+		cl->latest_seq=seq;
+		d=0;
+	}
+
+	return -d;
+}
+
+static void SnapClientReceived (snap_client *cl,ushort seq)
+{
+	int n=SnapClientAdvance (cl,seq);
+
+	// A packet with an entry that didn't decode stays unacked, whatever else in it did
+	if (n<SNAP_ACK_BITS && !(cl->failed & (1ull<<n)))
+		cl->received|=1ull<<n;
+
+	cl->need_ack=1;
+}
+
+// Something in packet "seq" didn't decode, so don't let the server build on it
+static void SnapClientFailed (snap_client *cl,ushort seq)
+{
+	int n=SnapClientAdvance (cl,seq);
+
+	if (n<SNAP_ACK_BITS)
+	{
+		cl->failed|=1ull<<n;
+		cl->received&=~(1ull<<n);
+	}
+}
+
+static int SnapClientRead (snap_client *cl,ushort seq,int objnum,ubyte *data,int *count,snap_state *st)
+{
+	if (objnum<0 || objnum>=MAX_OBJECTS || !SnapClientInWindow (cl,seq))
+	{
+		*count+=data[*count]+1;
+		return -1;
+	}
+
+	snap_recv_object *ro=&cl->objects[objnum];
+	int result=SnapReadEntry (ro,seq,data,count,st);
+
+	if (result<0)
+	{
+		Snap_stats.failures++;
+		SnapClientFailed (cl,seq);
+		return -1;
+	}
+
+	SnapInsertRecv (ro,seq,st);
+	SnapClientReceived (cl,seq);
+
+	// Robots don't have timestamps, so drop anything older than what we've shown
+	if (ro->has_newest && (ushort)(cl->latest_seq-ro->newest_seq)<SNAP_SEQ_WINDOW && (short)(seq-ro->newest_seq)<0)
+		return 0;
+
+	ro->has_newest=1;
+	ro->newest_seq=seq;
+	return 1;
+}
+
+static bool SnapStuffAck (snap_client *cl,ushort *latest,unsigned long long *received)
+{
+	if (!cl->need_ack)
+		return false;
+
+	cl->need_ack=0;
+	*latest=cl->latest_seq;
+	*received=cl->received;
+	return true;
+}
+
+void MultiSnapshotStartLevel ()
+{
+	SnapComputeBounds ();
+
+	for (int i=0;i<MAX_NET_PLAYERS;i++)
+		SnapResetServerClient (&Snap_server[i]);
+	SnapResetClient (&Snap_client);
+
+	memset (&Snap_stats,0,sizeof(Snap_stats));
+}
+
+void MultiSnapshotResetClient (int slot)
+{
+	SnapResetServerClient (&Snap_server[slot]);
+}
+
+void MultiSnapshotFree ()
+{
+	for (int i=0;i<MAX_NET_PLAYERS;i++)
+	{
+		if (Snap_server[i].objects)
+		{
+			mem_free (Snap_server[i].objects);
+			mem_free (Snap_server[i].packets);
+			mem_free (Snap_server[i].pool);
+		}
+		Snap_server[i].objects=NULL;
+		Snap_server[i].packets=NULL;
+		Snap_server[i].pool=NULL;
+	}
+
+	if (Snap_client.objects)
+		mem_free (Snap_client.objects);
+	Snap_client.objects=NULL;
+}
+
+ushort MultiSnapshotNewPacket (int slot)
+{
+	return SnapOpenPacket (SnapGetServerClient (slot));
+}
+
+int MultiSnapshotBufferPacket (int slot)
+{
+	snap_server_client *sc=SnapGetServerClient (slot);
+
+	if (sc->open_seq==-1)
+		sc->open_seq=SnapOpenPacket (sc);
+	else if (sc->packets[sc->open_seq % SNAP_PACKET_RING].num_entries>=SNAP_MAX_PACKET_ENTRIES)
+		return -1;
+
+	return sc->open_seq;
+}
+
+void MultiSnapshotBufferSent (int slot)
+{
+	Snap_server[slot].open_seq=-1;
+}
+
+int MultiSnapshotAddObject (int slot,ushort seq,int objnum,ubyte *data,int *count)
+{
+	object *obj=&Objects[objnum];
+	snap_state cur;
+
+	SnapQuantise (&obj->pos,obj->roomnum,&obj->orient,&obj->mtype.phys_info.velocity,&cur);
+	return SnapServerAdd (SnapGetServerClient (slot),seq,objnum,obj->handle,&cur,Gametime,data,count);
+}
+
+int MultiSnapshotReadObject (ushort seq,int objnum,ubyte *data,int *count,vector *pos,int *roomnum,matrix *orient,vector *vel)
+{
+	snap_state st;
+
+	int result=SnapClientRead (SnapGetClient (),seq,objnum,data,count,&st);
+	if (result<0)
+		return result;
+
+	*roomnum=st.roomnum;
+	SnapDequantise (&st,pos,orient,vel);
+	return result;
+}
+
+int MultiStuffSnapshotAck (ubyte *data)
+{
+	ushort latest;
+	unsigned long long received;
+	int size;
+	int count=0;
+
+	if (!SnapStuffAck (SnapGetClient (),&latest,&received))
+		return 0;
+
+	size=START_DATA (MP_SNAPSHOT_ACK,data,&count);
+	MultiAddUshort (latest,data,&count);
+	MultiAddUint ((uint)received,data,&count);
+	MultiAddUint ((uint)(received>>32),data,&count);
+	END_DATA (count,data,size);
+
+	return count;
+}
+
+void MultiDoSnapshotAck (ubyte *data,int slot)
+{
+	int count=0;
+
+	SKIP_HEADER (data,&count);
+	ushort latest=MultiGetUshort (data,&count);
+	unsigned long long received=MultiGetUint (data,&count);
+	received|=(unsigned long long)MultiGetUint (data,&count)<<32;
+
+	if (slot<0 || slot>=MAX_NET_PLAYERS || Snap_server[slot].objects==NULL)
+		return;
+
+	Snap_stats.acks++;
+	SnapServerAck (&Snap_server[slot],latest,received);
+}
+
+#define TEST_SNAP_CLIENTS		16
+#define TEST_SNAP_OBJECTS		48
+#define TEST_SNAP_PPS			10
+#define TEST_SNAP_SECONDS		60
+#define TEST_SNAP_LOSS			5		// percent of packets lost in each direction
+#define TEST_SNAP_ACK_DELAY		2		// ticks before an ack gets back to the server
+#define TEST_SNAP_ROOM_CHANGE	20		// seconds between room changes for moving objects
+#define TEST_SNAP_MAX_EXTENT	40.0f	// how far objects wander from the middle of their room
+#define TEST_SNAP_DROP_OBJECTS	4		// robots in the batch that loses an entry
+#define TEST_SNAP_DROP_TICKS	8
+
+// MP_ROBOT_POS: header, objnum, position, angles, room, terrain flag, velocity
+#define TEST_SNAP_LEGACY_SIZE	(3+2+8+6+2+1+6)
+
+typedef struct
+{
+	int rooms[2];
+	float phase;
+	float speed;
+	int kind;			// 0 turns in place, 1 drifts, 2 and 3 fly around
+} test_snap_object;
+
+typedef struct
+{
+	ushort latest;
+	unsigned long long received;
+	ubyte valid;
+} test_snap_ack;
+
+static uint Test_snap_seed;
+
+static int TestSnapRand ()
+{
+	Test_snap_seed=Test_snap_seed*1103515245+12345;
+	return (Test_snap_seed>>16) & 0x7fff;
+}
+
+static void TestSnapRoomBox (int roomnum,vector *center,vector *extent)
+{
+	room *rp=&Rooms[roomnum];
+	vector min_xyz=rp->verts[0],max_xyz=rp->verts[0];
+
+	for (int t=1;t<rp->num_verts;t++)
+	{
+		vector *v=&rp->verts[t];
+		if (v->x<min_xyz.x) min_xyz.x=v->x;
+		if (v->y<min_xyz.y) min_xyz.y=v->y;
+		if (v->z<min_xyz.z) min_xyz.z=v->z;
+		if (v->x>max_xyz.x) max_xyz.x=v->x;
+		if (v->y>max_xyz.y) max_xyz.y=v->y;
+		if (v->z>max_xyz.z) max_xyz.z=v->z;
+	}
+
+	*center=(min_xyz+max_xyz)/2.0f;
+	*extent=(max_xyz-min_xyz)*0.3f;
+
+	// Keep speeds to something a robot would do
+	if (extent->x>TEST_SNAP_MAX_EXTENT) extent->x=TEST_SNAP_MAX_EXTENT;
+	if (extent->y>TEST_SNAP_MAX_EXTENT) extent->y=TEST_SNAP_MAX_EXTENT;
+	if (extent->z>TEST_SNAP_MAX_EXTENT) extent->z=TEST_SNAP_MAX_EXTENT;
+}
+
+// Where a test object is at time "t"
+static void TestSnapObjectState (test_snap_object *to,float t,vector *pos,int *roomnum,matrix *orient,vector *vel)
+{
+	vector center,extent;
+	int which=(int)(t/TEST_SNAP_ROOM_CHANGE) & 1;
+	float a=t*to->speed+to->phase;
+
+	*roomnum=(to->kind>=2)?to->rooms[which]:to->rooms[0];
+	TestSnapRoomBox (*roomnum,&center,&extent);
+
+	float move=(to->kind==0)?0.0f:(to->kind==1)?0.05f:1.0f;
+	pos->x=center.x+extent.x*move*sin(a);
+	pos->y=center.y+extent.y*move*0.5f*sin(a*0.7f+to->phase);
+	pos->z=center.z+extent.z*move*cos(a*1.3f);
+
+	vel->x=extent.x*move*to->speed*cos(a);
+	vel->y=extent.y*move*0.5f*to->speed*0.7f*cos(a*0.7f+to->phase);
+	vel->z=-extent.z*move*to->speed*1.3f*sin(a*1.3f);
+
+	vm_AnglesToMatrix (orient,(angle)(a*2000.0f),(angle)(a*4000.0f),(angle)(sin(a)*3000.0f));
+}
+
+// Sends one batch of robots in a single packet and has the client decode it, breaking the
+// first entry's baseline if "drop" is set. Returns how many entries decoded wrongly.
+static int TestSnapDropBatch (snap_server_client *sc,snap_client *cl,snap_state *states,int num,float t,bool drop)
+{
+	ubyte data[MAX_GAME_DATA_SIZE];
+	int count=0;
+	int errors=0;
+	int i;
+
+	ushort seq=SnapOpenPacket (sc);
+	int size_offset=START_DATA (MP_ROBOT_POS_DELTA,data,&count);
+	MultiAddUshort (seq,data,&count);
+	MultiAddUbyte (0,data,&count);
+
+	for (i=0;i<num;i++)
+	{
+		MultiAddUshort (i,data,&count);
+		SnapServerAdd (sc,seq,i,i+1,&states[i],t,data,&count);
+		data[size_offset+4]++;
+	}
+	END_DATA (count-(size_offset-1),data,size_offset);
+
+	int rcount=size_offset+2;
+	ushort rseq=MultiGetUshort (data,&rcount);
+	int n=MultiGetUbyte (data,&rcount);
+
+	for (i=0;i<n;i++)
+	{
+		ushort objnum=MultiGetUshort (data,&rcount);
+		snap_state st;
+
+		// Point the first entry at a baseline the client never had
+		bool broken=(drop && i==0);
+		if (broken)
+		{
+			if (!(data[rcount+1] & 0x80))
+				errors++;
+			data[rcount+1]=0xff;
+			data[rcount+2]&=0x7f;
+		}
+
+		int result=SnapClientRead (cl,rseq,objnum,data,&rcount,&st);
+		if (broken)
+		{
+			if (result>=0)
+				errors++;
+		}
+		else if (result<0 || !SnapSameState (&st,&states[objnum]))
+			errors++;
+	}
+
+	// The ack gets straight back
+	ushort latest;
+	unsigned long long received;
+	if (SnapStuffAck (cl,&latest,&received))
+		SnapServerAck (sc,latest,received);
+
+	return errors;
+}
+
+// One entry in a batch fails to decode while the rest of the batch is fine. The client
+// mustn't ack that packet, or the server would delta the next update against a state
+// the client never got.
+static int TestSnapDroppedEntry (snap_server_client *sc,snap_client *cl,test_snap_object *objects)
+{
+	int errors=0;
+
+	SnapResetServerClient (sc);
+	SnapResetClient (cl);
+
+	for (int tick=0;tick<TEST_SNAP_DROP_TICKS;tick++)
+	{
+		float t=(float)tick/TEST_SNAP_PPS;
+		snap_state states[TEST_SNAP_DROP_OBJECTS];
+
+		for (int i=0;i<TEST_SNAP_DROP_OBJECTS;i++)
+		{
+			vector pos,vel;
+			matrix orient;
+			int roomnum;
+
+			// Use the ones that fly around so every update is a real delta
+			TestSnapObjectState (&objects[i*4+2],t,&pos,&roomnum,&orient,&vel);
+			SnapQuantise (&pos,roomnum,&orient,&vel,&states[i]);
+		}
+
+		errors+=TestSnapDropBatch (sc,cl,states,TEST_SNAP_DROP_OBJECTS,t,tick==1);
+	}
+
+	return errors;
+}
+
+void TestSnapshots ()
+{
+	test_snap_object objects[TEST_SNAP_OBJECTS];
+	int rooms[MAX_ROOMS];
+	int num_rooms=0;
+	int i;
+
+	SnapComputeBounds ();
+
+	for (i=0;i<=Highest_room_index;i++)
+	{
+		if (Rooms[i].used && !(Rooms[i].flags & RF_EXTERNAL) && Rooms[i].num_verts>0)
+			rooms[num_rooms++]=i;
+	}
+
+	if (num_rooms==0)
+	{
+		mprintf ((0,"TestSnapshots: no rooms in this level\n"));
+		return;
+	}
+
+	Test_snap_seed=1;
+	for (i=0;i<TEST_SNAP_OBJECTS;i++)
+	{
+		test_snap_object *to=&objects[i];
+		to->rooms[0]=rooms[TestSnapRand () % num_rooms];
+		to->rooms[1]=rooms[TestSnapRand () % num_rooms];
+		to->phase=(TestSnapRand () % 1000)/100.0f;
+		to->speed=0.2f+(TestSnapRand () % 100)/100.0f;
+		to->kind=i & 3;
+	}
+
+	snap_stats old_stats=Snap_stats;
+	memset (&Snap_stats,0,sizeof(Snap_stats));
+
+	snap_server_client *servers=(snap_server_client *)mem_malloc (sizeof(snap_server_client)*TEST_SNAP_CLIENTS);
+	snap_client *clients=(snap_client *)mem_malloc (sizeof(snap_client)*TEST_SNAP_CLIENTS);
+	test_snap_ack acks[TEST_SNAP_CLIENTS][TEST_SNAP_ACK_DELAY+1];
+	memset (acks,0,sizeof(acks));
+
+	for (i=0;i<TEST_SNAP_CLIENTS;i++)
+	{
+		servers[i].objects=(snap_sent_object *)mem_malloc (sizeof(snap_sent_object)*MAX_OBJECTS);
+		servers[i].packets=(snap_sent_packet *)mem_malloc (sizeof(snap_sent_packet)*SNAP_PACKET_RING);
+		servers[i].pool=(snap_sent_entry *)mem_malloc (sizeof(snap_sent_entry)*SNAP_SENT_POOL);
+		clients[i].objects=(snap_recv_object *)mem_malloc (sizeof(snap_recv_object)*MAX_OBJECTS);
+		SnapResetServerClient (&servers[i]);
+		SnapResetClient (&clients[i]);
+	}
+
+	int legacy_bytes=0,snap_bytes=0;
+	int legacy_packets=0,snap_packets=0;
+	int mismatches=0;
+	float max_pos_error=0,max_orient_error=0;
+	double start=timer_GetTime64 ();
+
+	for (int tick=0;tick<TEST_SNAP_PPS*TEST_SNAP_SECONDS;tick++)
+	{
+		float t=(float)tick/TEST_SNAP_PPS;
+		snap_state states[TEST_SNAP_OBJECTS];
+
+		for (i=0;i<TEST_SNAP_OBJECTS;i++)
+		{
+			vector pos,vel,dpos,dvel;
+			matrix orient,dorient;
+			int roomnum;
+
+			TestSnapObjectState (&objects[i],t,&pos,&roomnum,&orient,&vel);
+			SnapQuantise (&pos,roomnum,&orient,&vel,&states[i]);
+
+			SnapDequantise (&states[i],&dpos,&dorient,&dvel);
+			float err=vm_VectorDistance (&pos,&dpos);
+			if (err>max_pos_error)
+				max_pos_error=err;
+			err=vm_VectorDistance (&orient.fvec,&dorient.fvec);
+			if (err>max_orient_error)
+				max_orient_error=err;
+		}
+
+		for (int c=0;c<TEST_SNAP_CLIENTS;c++)
+		{
+			snap_server_client *sc=&servers[c];
+			snap_client *cl=&clients[c];
+
+			// Acks that have made it back by now
+			test_snap_ack *ack=&acks[c][tick % (TEST_SNAP_ACK_DELAY+1)];
+			if (ack->valid)
+				SnapServerAck (sc,ack->latest,ack->received);
+			ack->valid=0;
+
+			// The old way: one MP_ROBOT_POS per moving object, packed into full packets
+			int size=0;
+			for (i=0;i<TEST_SNAP_OBJECTS;i++)
+			{
+				if (size+TEST_SNAP_LEGACY_SIZE>=MAX_GAME_DATA_SIZE)
+				{
+					legacy_packets++;
+					size=0;
+				}
+				size+=TEST_SNAP_LEGACY_SIZE;
+				legacy_bytes+=TEST_SNAP_LEGACY_SIZE;
+			}
+			if (size>0)
+				legacy_packets++;
+
+			// The new way, as MultiStuffRobotSnapshot batches it, pushed through the client decoder
+			ubyte data[MAX_GAME_DATA_SIZE];
+			int count=0;
+			int size_offset=-1;
+			ushort seq=0;
+
+			for (i=0;i<=TEST_SNAP_OBJECTS;i++)
+			{
+				if (size_offset!=-1 && (i==TEST_SNAP_OBJECTS || count+2+SNAP_MAX_ENTRY_SIZE>=MAX_GAME_DATA_SIZE || data[size_offset+4]==SNAP_MAX_PACKET_ENTRIES))
+				{
+					snap_packets++;
+					snap_bytes+=count;
+
+					if ((TestSnapRand () % 100)>=TEST_SNAP_LOSS)
+					{
+						int rcount=size_offset+2;
+						ushort rseq=MultiGetUshort (data,&rcount);
+						int num=MultiGetUbyte (data,&rcount);
+
+						for (int e=0;e<num;e++)
+						{
+							ushort objnum=MultiGetUshort (data,&rcount);
+							snap_state st;
+
+							if (SnapClientRead (cl,rseq,objnum,data,&rcount,&st)<0 || !SnapSameState (&st,&states[objnum]))
+								mismatches++;
+						}
+					}
+
+					count=0;
+					size_offset=-1;
+				}
+
+				if (i==TEST_SNAP_OBJECTS)
+					break;
+
+				if (size_offset==-1)
+				{
+					seq=SnapOpenPacket (sc);
+					size_offset=START_DATA (MP_ROBOT_POS_DELTA,data,&count);
+					MultiAddUshort (seq,data,&count);
+					MultiAddUbyte (0,data,&count);
+				}
+
+				MultiAddUshort (i,data,&count);
+				SnapServerAdd (sc,seq,i,i+1,&states[i],t,data,&count);
+				data[size_offset+4]++;
+				END_DATA (count-(size_offset-1),data,size_offset);
+			}
+
+			// The client acks on the back of its own position packet
+			ushort latest;
+			unsigned long long received;
+			if (SnapStuffAck (cl,&latest,&received) && (TestSnapRand () % 100)>=TEST_SNAP_LOSS)
+			{
+				ack=&acks[c][(tick+TEST_SNAP_ACK_DELAY) % (TEST_SNAP_ACK_DELAY+1)];
+				ack->valid=1;
+				ack->latest=latest;
+				ack->received=received;
+			}
+		}
+	}
+
+	double time=timer_GetTime64 ()-start;
+	float seconds=(float)TEST_SNAP_SECONDS*TEST_SNAP_CLIENTS;
+
+	mprintf ((0,"TestSnapshots: %d objects to %d clients at %d pps with %d%% loss\n",TEST_SNAP_OBJECTS,TEST_SNAP_CLIENTS,TEST_SNAP_PPS,TEST_SNAP_LOSS));
+	mprintf ((0,"TestSnapshots: old %.0f bytes (%.1f packets) per client per second, snapshots %.0f bytes (%.1f packets), %.1f%%\n",
+		legacy_bytes/seconds,legacy_packets/seconds,snap_bytes/seconds,snap_packets/seconds,snap_bytes*100.0f/legacy_bytes));
+	mprintf ((0,"TestSnapshots: %d full, %d delta, %d baselines acked, %d failures, %d mismatches, max error %.3f units %.4f orient, %.3f ms\n",
+		Snap_stats.full,Snap_stats.deltas,Snap_stats.promoted,Snap_stats.failures,mismatches,max_pos_error,max_orient_error,time*1000.0));
+
+	int drop_errors=TestSnapDroppedEntry (&servers[0],&clients[0],objects);
+	mprintf ((0,"TestSnapshots: %d bad decodes after one of %d robots in a batch failed\n",drop_errors,TEST_SNAP_DROP_OBJECTS));
+
+	for (i=0;i<TEST_SNAP_CLIENTS;i++)
+	{
+		mem_free (servers[i].objects);
+		mem_free (servers[i].packets);
+		mem_free (servers[i].pool);
+		mem_free (clients[i].objects);
+	}
+	mem_free (servers);
+	mem_free (clients);
+
+	Snap_stats=old_stats;
+}
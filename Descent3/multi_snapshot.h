@@ -0,0 +1,92 @@
+/*
+* Descent 3
+* Copyright (C) 2024 Parallax Software
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MULTI_SNAPSHOT_H
+#define MULTI_SNAPSHOT_H
+
+#include "pstypes.h"
+#include "vecmat.h"
+
+// Snapshot positional updates.  When the server runs with NF_DELTA_SNAPSHOTS, player and
+// robot positions going to a client are quantised (against the bounds of the room they're in)
+// and bit-packed as deltas against the last state that client acknowledged.  Each packet
+// carrying snapshot entries gets its own sequence number; clients ack them on the back of
+// their own position packets.
+
+// Largest snapshot entry, including its length byte
+#define SNAP_MAX_ENTRY_SIZE		48
+
+// Most snapshot entries that can go out in one packet
+#define SNAP_MAX_PACKET_ENTRIES	64
+
+typedef struct
+{
+	int full;				// entries sent without a baseline
+	int deltas;				// entries sent against a baseline
+	int acks;				// acks received
+	int promoted;			// baselines moved forward by an ack
+	int failures;			// entries a client couldn't decode
+	int bytes;				// bytes of positional data sent
+	int legacy_bytes;		// what the same updates would have cost as MP_PLAYER_POS/MP_ROBOT_POS
+} snap_stats;
+
+extern snap_stats Snap_stats;
+
+// Returns true if positional updates go out as snapshot deltas in this game
+bool MultiSnapshotsActive ();
+
+// Sets up the quantisation bounds for the current level and forgets all baselines
+void MultiSnapshotStartLevel ();
+
+// Server: forgets everything we know about what "slot" has received
+void MultiSnapshotResetClient (int slot);
+
+// Frees all the snapshot memory
+void MultiSnapshotFree ();
+
+// Server: returns the sequence number for a packet that goes straight out to "slot"
+ushort MultiSnapshotNewPacket (int slot);
+
+// Server: returns the sequence number for entries going into Multi_send_buffer[slot],
+// or -1 if that packet can't take any more entries and must be sent first
+int MultiSnapshotBufferPacket (int slot);
+
+// Server: Multi_send_buffer[slot] has gone out
+void MultiSnapshotBufferSent (int slot);
+
+// Server: adds the snapshot entry for object "objnum" to a packet going to "slot"
+// Returns the number of bytes added
+int MultiSnapshotAddObject (int slot,ushort seq,int objnum,ubyte *data,int *count);
+
+// Client: reads a snapshot entry for server object "objnum" that arrived in packet "seq"
+// Returns 1 if the state should be applied, 0 if it is older than one we already have,
+// and -1 if it couldn't be decoded.  The entry is always skipped over.
+int MultiSnapshotReadObject (ushort seq,int objnum,ubyte *data,int *count,vector *pos,int *roomnum,matrix *orient,vector *vel);
+
+// Client: adds an ack for the packets we've received if there are any new ones
+// Returns the number of bytes added
+int MultiStuffSnapshotAck (ubyte *data);
+
+// Server: a client is acknowledging snapshot packets
+void MultiDoSnapshotAck (ubyte *data,int slot);
+
+// Replays synthetic object motion for the current level through the old and new encodings
+// and reports the bytes per client per second
+void TestSnapshots ();
+
+#endif
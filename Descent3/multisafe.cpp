@@ -48,6 +48,7 @@
 #include "osiris_predefs.h"
 #include "viseffect.h"
 #include "levelgoal.h"
+#include "BOA.h"
 /*
 	The following functions have been added or modified by Matt and/or someone else other than Jason,
 	and thus Jason should check them out to make sure they're ok for multiplayer.
@@ -964,6 +965,9 @@ void msafe_CallFunction(ubyte type, msafe_struct* mstruct)
 			pp2->flags &= ~PF_BLOCK;
 		Rooms[pp->croom].room_change_flags |= RCF_PORTAL_BLOCK;
 		pp2->flags |= PF_CHANGED;
+
+		Room_physics_changes++;
+		BOA_MarkRoutesDirty();
 		break;
 	}
 	case MSAFE_ROOM_BREAK_GLASS:
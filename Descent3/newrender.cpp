@@ -17,6 +17,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <algorithm>
 #include "descent.h"
 #include "game.h"
@@ -32,6 +33,12 @@
 #include "lightmap_info.h"
 #include "TelComAutoMap.h"
 #include "config.h"
+#include "framealloc.h"
+#include "jobsystem.h"
+#include "roombatch.h"
+#include "args.h"
+#include "ddio.h"
+#include "dedicated_server.h"
 
 //[ISB] Checks if a face is completely static and therefore should be in the normal static meshes.
 //Portals need to be put into another pass because they may or may not be visible. 
@@ -111,7 +118,10 @@ struct RoomMesh
 	std::vector<RoomDrawElement> MirrorInteractions;
 	//One of these for each face.
 	//If the state of FacePrevStates[facenum] != roomptr->faces[facenum], remesh this part of the world. Sigh.
+	//Only checked for rooms in Room_remesh_pending.
 	std::vector<FacePrevState> FacePrevStates;
+	//Where each face's vertices start, relative to the room's first vertex, or -1 if the face isn't in the static mesh.
+	std::vector<int> FaceFirstVertex;
 
 	uint32_t FirstVertexOffset;
 	uint32_t FirstVertex;
@@ -129,6 +139,7 @@ struct RoomMesh
 	{
 		ResetInteractions();
 		FacePrevStates.clear();
+		FaceFirstVertex.clear();
 	}
 
 	void DrawLit()
@@ -276,24 +287,102 @@ struct RoomMesh
 //These are the meshes of all normal room geometry. 
 RoomMesh Room_meshes[MAX_ROOMS];
 
-void AddFacesToBuffer(MeshBuilder& mesh, std::vector<SortableElement>& elements, std::vector<RoomDrawElement>& interactions, room& rp, int indexOffset, int firstIndex)
+//Returns the texture a face is drawn with, which changes once a destroyable face is blown up.
+static inline int FaceDrawTexture(face& fp)
+{
+	int tmap = fp.tmap;
+	if (fp.flags & FF_DESTROYED && GameTextures[tmap].flags & TF_DESTROYABLE)
+		tmap = GameTextures[tmap].destroy_handle;
+	return tmap;
+}
+
+//Which list of a room mesh a static face is drawn from
+enum RoomFaceType
+{
+	ROOMFACE_LIT,
+	ROOMFACE_UNLIT,
+	ROOMFACE_SPECULAR,
+	ROOMFACE_MIRROR
+};
+
+static RoomFaceType GetRoomFaceType(room& rp, face& fp, int tmap)
+{
+	//Mirrors are defined as "the mirror face and every other face that happens to share the same texture"
+	if (rp.mirror_face != -1 && tmap == rp.faces[rp.mirror_face].tmap)
+		return ROOMFACE_MIRROR;
+
+	if (!(fp.flags & FF_LIGHTMAP))
+		return ROOMFACE_UNLIT;
+
+	//If the face is specular, add it for a post stage. 
+	//Specs have to be in a special pass like this so that the size of the room vertex buffer never changes
+	//External specular faces don't use a special face, and therefore can never be smooth. Heh. 
+	if (GameTextures[tmap].flags & TF_SPECULAR && (fp.special_handle != BAD_SPECIAL_FACE_INDEX || (rp.flags & RF_EXTERNAL)))
+		return ROOMFACE_SPECULAR;
+
+	return ROOMFACE_LIT;
+}
+
+//Adds the vertices of a static face to a mesh.
+static void AddFaceVertices(MeshBuilder& mesh, room& rp, face& fp)
+{
+	int tmap = FaceDrawTexture(fp);
+	RoomFaceType type = GetRoomFaceType(rp, fp, tmap);
+	bool smooth = type == ROOMFACE_SPECULAR && GameTextures[tmap].flags & TF_SMOOTH_SPECULAR && fp.special_handle != BAD_SPECIAL_FACE_INDEX;
+
+	RendVertex vert;
+	vert.roomnum = &rp - Rooms;
+	vert.uslide = GameTextures[tmap].slide_u;
+	vert.vslide = GameTextures[tmap].slide_v;
+	vert.r = vert.g = vert.b = 255;
+	if (type == ROOMFACE_SPECULAR)
+		vert.a = 255;
+	else
+		vert.a = (ubyte)(std::min(1.f, std::max(0.f, GameTextures[tmap].alpha)) * 255);
+
+	for (int i = 0; i < fp.num_verts; i++)
+	{
+		roomUVL uvs = fp.face_uvls[i];
+		vert.position = rp.verts[fp.face_verts[i]];
+		if (smooth)
+			vert.normal = SpecialFaces[fp.special_handle].vertnorms[i];
+		else
+			vert.normal = fp.normal; //oh no, no support for phong shading..
+		vert.u1 = uvs.u; vert.v1 = uvs.v;
+		vert.u2 = uvs.u2; vert.v2 = uvs.v2;
+
+		mesh.AddVertex(vert);
+	}
+}
+
+//Generates indicies for a face as a triangle fan
+static void AddFaceIndices(MeshBuilder& mesh, face& fp, int first_vertex)
+{
+	int triindices[3];
+	for (int i = 2; i < fp.num_verts; i++)
+	{
+		triindices[0] = first_vertex;
+		triindices[1] = first_vertex + i - 1;
+		triindices[2] = first_vertex + i;
+		mesh.SetIndicies(3, triindices);
+	}
+}
+
+void AddFacesToBuffer(MeshBuilder& mesh, std::vector<SortableElement, FrameAllocator<SortableElement>>& elements, std::vector<RoomDrawElement>& interactions, room& rp, int vertexBase, int firstIndex)
 {
 	if (elements.empty())
 		return;
 
+	RoomMesh& roommesh = Room_meshes[&rp - Rooms];
 	int lasttmap = -1;
 	int lastlm = -1;
 	bool firsttime = true;
-	int triindices[3];
-	RendVertex vert;
-	float alpha = 1;
 	for (SortableElement& element : elements)
 	{
 		if (element.texturehandle != lasttmap || element.lmhandle != lastlm)
 		{
 			if (!firsttime)
 			{
-				mesh.EndVertices();
 				RoomDrawElement element;
 				element.texturenum = lasttmap;
 				element.lmhandle = lastlm;
@@ -304,44 +393,14 @@ void AddFacesToBuffer(MeshBuilder& mesh, std::vector<SortableElement>& elements,
 			else
 				firsttime = false;
 
-			mesh.BeginVertices();
 			mesh.BeginIndices();
 			lasttmap = element.texturehandle;
 			lastlm = element.lmhandle;
-
-			vert.uslide = GameTextures[lasttmap].slide_u;
-			vert.vslide = GameTextures[lasttmap].slide_v;
-
-			alpha = GameTextures[element.texturehandle].alpha;
-		}
-
-		face& fp = rp.faces[element.element];
-
-		int first_index = mesh.NumVertices() + indexOffset;
-		for (int i = 0; i < fp.num_verts; i++)
-		{
-			roomUVL uvs = fp.face_uvls[i];
-			vert.position = rp.verts[fp.face_verts[i]];
-			vert.normal = fp.normal; //oh no, no support for phong shading..
-			vert.r = vert.g = vert.b = 255;
-			vert.a = (ubyte)(std::min(1.f, std::max(0.f, alpha)) * 255);
-			vert.u1 = uvs.u; vert.v1 = uvs.v;
-			vert.u2 = uvs.u2; vert.v2 = uvs.v2;
-
-			mesh.AddVertex(vert);
 		}
 
-		//Generate indicies as a triangle fan
-		for (int i = 2; i < fp.num_verts; i++)
-		{
-			triindices[0] = first_index;
-			triindices[1] = first_index + i - 1;
-			triindices[2] = first_index + i;
-			mesh.SetIndicies(3, triindices);
-		}
+		AddFaceIndices(mesh, rp.faces[element.element], vertexBase + roommesh.FaceFirstVertex[element.element]);
 	}
 
-	mesh.EndVertices();
 	RoomDrawElement element;
 	element.texturenum = lasttmap;
 	element.lmhandle = lastlm;
@@ -350,174 +409,137 @@ void AddFacesToBuffer(MeshBuilder& mesh, std::vector<SortableElement>& elements,
 	interactions.push_back(element);
 }
 
-void AddSpecFacesToBuffer(MeshBuilder& mesh, std::vector<SortableElement>& elements, std::vector<SpecularDrawElement>& interactions, room& rp, int indexOffset, int firstIndex)
+void AddSpecFacesToBuffer(MeshBuilder& mesh, std::vector<SortableElement, FrameAllocator<SortableElement>>& elements, std::vector<SpecularDrawElement>& interactions, room& rp, int vertexBase, int firstIndex)
 {
-	if (elements.empty())
-		return;
-
-	int lasttmap = -1;
-	int lastlm = -1;
-	bool firsttime = true;
-	int triindices[3];
-	RendVertex vert;
+	RoomMesh& roommesh = Room_meshes[&rp - Rooms];
 	for (SortableElement& element : elements)
 	{
-		mesh.BeginVertices();
-		mesh.BeginIndices();
-		lasttmap = element.texturehandle;
-		lastlm = element.lmhandle;
-
-		vert.uslide = GameTextures[lasttmap].slide_u;
-		vert.vslide = GameTextures[lasttmap].slide_v;
-
 		face& fp = rp.faces[element.element];
 
-		int first_index = mesh.NumVertices() + indexOffset;
-		if (GameTextures[element.texturehandle].flags & TF_SMOOTH_SPECULAR && fp.special_handle != BAD_SPECIAL_FACE_INDEX)
-		{
-			for (int i = 0; i < fp.num_verts; i++)
-			{
-				roomUVL uvs = fp.face_uvls[i];
-				vert.position = rp.verts[fp.face_verts[i]];
-				vert.normal = SpecialFaces[fp.special_handle].vertnorms[i];
-				vert.r = vert.g = vert.b = vert.a = 255;
-				vert.u1 = uvs.u; vert.v1 = uvs.v;
-				vert.u2 = uvs.u2; vert.v2 = uvs.v2;
-
-				mesh.AddVertex(vert);
-			}
-		}
-		else
-		{
-			for (int i = 0; i < fp.num_verts; i++)
-			{
-				roomUVL uvs = fp.face_uvls[i];
-				vert.position = rp.verts[fp.face_verts[i]];
-				vert.normal = fp.normal;
-				vert.r = vert.g = vert.b = vert.a = 255;
-				vert.u1 = uvs.u; vert.v1 = uvs.v;
-				vert.u2 = uvs.u2; vert.v2 = uvs.v2;
-
-				mesh.AddVertex(vert);
-			}
-		}
+		mesh.BeginIndices();
+		AddFaceIndices(mesh, fp, vertexBase + roommesh.FaceFirstVertex[element.element]);
+
+		SpecularDrawElement drawelement;
+		drawelement.texturenum = element.texturehandle;
+		drawelement.lmhandle = element.lmhandle;
+		drawelement.range = mesh.EndIndices();
+		drawelement.range.offset += firstIndex;
+		drawelement.special = &SpecialFaces[fp.special_handle];
+		interactions.push_back(drawelement);
+	}
+}
+
+//Adds the vertices for every static face of a room.
+//The vertices are kept in face order rather than draw order, so that when a face changes its vertices 
+//can be replaced in place without moving the rest of the room. 
+static void BuildRoomVertices(MeshBuilder& mesh, int roomnum)
+{
+	room& rp = Rooms[roomnum];
+	RoomMesh& roommesh = Room_meshes[roomnum];
+	int first_vertex = mesh.NumVertices();
 
-		//Generate indicies as a triangle fan
-		for (int i = 2; i < fp.num_verts; i++)
+	roommesh.FaceFirstVertex.resize(rp.num_faces);
+	mesh.BeginVertices();
+	for (int i = 0; i < rp.num_faces; i++)
+	{
+		face& fp = rp.faces[i];
+		if (!FaceIsStatic(rp, fp))
 		{
-			triindices[0] = first_index;
-			triindices[1] = first_index + i - 1;
-			triindices[2] = first_index + i;
-			mesh.SetIndicies(3, triindices);
+			roommesh.FaceFirstVertex[i] = -1;
+			continue;
 		}
 
-		mesh.EndVertices();
-		SpecularDrawElement element;
-		element.texturenum = lasttmap;
-		element.lmhandle = lastlm;
-		element.range = mesh.EndIndices();
-		element.range.offset += firstIndex;
-		element.special = &SpecialFaces[fp.special_handle];
-		interactions.push_back(element);
+		roommesh.FaceFirstVertex[i] = mesh.NumVertices() - first_vertex;
+		AddFaceVertices(mesh, rp, fp);
 	}
+	mesh.EndVertices();
 }
 
-//Meshes a given room. 
-//Index offset is added to all generated indicies, to allow updating a room at a specific place
-//later down the line, even with an empty MeshBuilder. 
+//Sorts the static faces of a room into draw lists and generates their indices.
+//vertexBase is the index of the room's first vertex in the vertex buffer.
 //First index is added to all interactions to indicate where the first index to draw is. 
-void UpdateRoomMesh(MeshBuilder& mesh, int roomnum, int indexOffset, int firstIndex)
+static void BuildRoomIndices(MeshBuilder& mesh, int roomnum, int vertexBase, int firstIndex)
 {
 	room& rp = Rooms[roomnum];
-	if (!rp.used)
-		return; //unused room
+	RoomMesh& roommesh = Room_meshes[roomnum];
 
 	//Maybe these should be changed into one pass using a white texture for unlit?
 	//But what happens if something silly like HDR lighting is added later?
-	std::vector<SortableElement> faces_lit;
-	std::vector<SortableElement> faces_unlit;
-	std::vector<SortableElement> faces_spec;
-	std::vector<SortableElement> faces_mirror;
-	std::vector<int> faces_special;
-
-	RoomMesh& roommesh = Room_meshes[roomnum];
-	if (roommesh.FacePrevStates.size() != rp.num_faces)
-		roommesh.FacePrevStates.resize(rp.num_faces);
-
-	roommesh.roomnum = roomnum;
+	//The lists live as long as the mesh does, so they use the same memory.
+	FrameAllocator<SortableElement> scratch = mesh.Allocator();
+	std::vector<SortableElement, FrameAllocator<SortableElement>> faces_lit(scratch);
+	std::vector<SortableElement, FrameAllocator<SortableElement>> faces_unlit(scratch);
+	std::vector<SortableElement, FrameAllocator<SortableElement>> faces_spec(scratch);
+	std::vector<SortableElement, FrameAllocator<SortableElement>> faces_mirror(scratch);
 
 	roommesh.ResetInteractions();
 
-	//Mirrors are defined as "the mirror face and every other face that happens to share the same texture"
-	uint32_t mirror_tex_hack = UINT32_MAX;
-	if (rp.mirror_face != -1)
-	{
-		mirror_tex_hack = rp.faces[rp.mirror_face].tmap;
-	}
-
 	//Build a sortable list of all faces
 	for (int i = 0; i < rp.num_faces; i++)
 	{
 		face& fp = rp.faces[i];
-		roommesh.FacePrevStates[i].flags = fp.flags;
-		roommesh.FacePrevStates[i].tmap = fp.tmap;
-		if (!FaceIsStatic(rp, fp))
-		{
-			faces_special.push_back(i);
+		if (roommesh.FaceFirstVertex[i] == -1)
 			continue;
-		}
 
-		//blarg
-		int bm_handle = GetTextureBitmap(fp.tmap, 0);
-		int alphatype = GetFaceAlpha(fp, -1);
-		/*if ((alphatype & (ATF_CONSTANT | ATF_TEXTURE)) != 0)
-			continue;
-		else*/
+		int tmap = FaceDrawTexture(fp);
+		switch (GetRoomFaceType(rp, fp, tmap))
 		{
-			int tmap = fp.tmap;
-			if (fp.flags & FF_DESTROYED && GameTextures[tmap].flags & TF_DESTROYABLE)
-				tmap = GameTextures[tmap].destroy_handle;
-
-			//Not a postrender, determine if it is unlit or lit. 
-			if (rp.mirror_face != -1 && tmap == mirror_tex_hack)
-			{
-				faces_mirror.push_back(SortableElement{ i, (ushort)tmap, LightmapInfo[fp.lmi_handle].lm_handle });
-			}
-			else if (fp.flags & FF_LIGHTMAP)
-			{
-				//If the face is specular, add it for a post stage. 
-				//Specs have to be in a special pass like this so that the size of the room vertex buffer never changes
-				//External specular faces don't use a special face, and therefore can never be smooth. Heh. 
-				if (GameTextures[tmap].flags & TF_SPECULAR && (fp.special_handle != BAD_SPECIAL_FACE_INDEX || (rp.flags & RF_EXTERNAL)))
-				{
-					faces_spec.push_back(SortableElement{ i, (ushort)tmap, LightmapInfo[fp.lmi_handle].lm_handle });
-				}
-				else
-				{
-					//TODO: Add field names when Piccu becomes C++20.
-					faces_lit.push_back(SortableElement{ i, (ushort)tmap, LightmapInfo[fp.lmi_handle].lm_handle });
-				}
-			}
-			else
-			{
-				faces_unlit.push_back(SortableElement{ i, (ushort)tmap, 0 });
-			}
+		case ROOMFACE_MIRROR:
+			faces_mirror.push_back(SortableElement{ i, (ushort)tmap, LightmapInfo[fp.lmi_handle].lm_handle });
+			break;
+		case ROOMFACE_SPECULAR:
+			faces_spec.push_back(SortableElement{ i, (ushort)tmap, LightmapInfo[fp.lmi_handle].lm_handle });
+			break;
+		case ROOMFACE_LIT:
+			//TODO: Add field names when Piccu becomes C++20.
+			faces_lit.push_back(SortableElement{ i, (ushort)tmap, LightmapInfo[fp.lmi_handle].lm_handle });
+			break;
+		default:
+			faces_unlit.push_back(SortableElement{ i, (ushort)tmap, 0 });
+			break;
 		}
 	}
 
 	std::sort(faces_lit.begin(), faces_lit.end());
-	AddFacesToBuffer(mesh, faces_lit, Room_meshes[roomnum].LitInteractions, rp, indexOffset, firstIndex);
+	AddFacesToBuffer(mesh, faces_lit, roommesh.LitInteractions, rp, vertexBase, firstIndex);
 
 	std::sort(faces_unlit.begin(), faces_unlit.end());
-	AddFacesToBuffer(mesh, faces_unlit, Room_meshes[roomnum].UnlitInteractions, rp, indexOffset, firstIndex);
+	AddFacesToBuffer(mesh, faces_unlit, roommesh.UnlitInteractions, rp, vertexBase, firstIndex);
 
 	std::sort(faces_mirror.begin(), faces_mirror.end());
-	AddFacesToBuffer(mesh, faces_mirror, Room_meshes[roomnum].MirrorInteractions, rp, indexOffset, firstIndex);
+	AddFacesToBuffer(mesh, faces_mirror, roommesh.MirrorInteractions, rp, vertexBase, firstIndex);
 
 	//Even though they're not batched up (may be fixable if I can quickly determine if they have identical light sources), 
 	//sort specular faces to try to minimize texture state thrashing. Even though that's trivial compared to the buffer state thrashing. 
 	std::sort(faces_spec.begin(), faces_spec.end());
-	AddSpecFacesToBuffer(mesh, faces_spec, Room_meshes[roomnum].SpecInteractions, rp, indexOffset, firstIndex);
+	AddSpecFacesToBuffer(mesh, faces_spec, roommesh.SpecInteractions, rp, vertexBase, firstIndex);
+}
+
+//Meshes a given room. 
+//Index offset is added to all generated indicies, to allow updating a room at a specific place
+//later down the line, even with an empty MeshBuilder. 
+//First index is added to all interactions to indicate where the first index to draw is. 
+void UpdateRoomMesh(MeshBuilder& mesh, int roomnum, int indexOffset, int firstIndex)
+{
+	room& rp = Rooms[roomnum];
+	if (!rp.used)
+		return; //unused room
+
+	RoomMesh& roommesh = Room_meshes[roomnum];
+	if (roommesh.FacePrevStates.size() != rp.num_faces)
+		roommesh.FacePrevStates.resize(rp.num_faces);
+
+	roommesh.roomnum = roomnum;
+
+	for (int i = 0; i < rp.num_faces; i++)
+	{
+		roommesh.FacePrevStates[i].flags = rp.faces[i].flags;
+		roommesh.FacePrevStates[i].tmap = rp.faces[i].tmap;
+	}
+
+	int vertexBase = mesh.NumVertices() + indexOffset;
+	BuildRoomVertices(mesh, roomnum);
+	BuildRoomIndices(mesh, roomnum, vertexBase, firstIndex);
 }
 
 void FreeRoomMeshes()
@@ -535,6 +557,8 @@ uint32_t lightmap_specular_handle = 0xFFFFFFFFu;
 uint32_t lightmap_room_fog_handle = 0xFFFFFFFFu;
 uint32_t lightmap_room_specular_fog_handle = 0xFFFFFFFFu;
 
+static void BuildRoomMeshes(MeshBuilder& mesh);
+
 //Called during LoadLevel, builds meshes for every room. 
 void MeshRooms()
 {
@@ -560,6 +584,16 @@ void MeshRooms()
 	}
 	MeshBuilder mesh;
 	FreeRoomMeshes();
+	BuildRoomMeshes(mesh);
+	memset(Room_remesh_pending, 0, Highest_room_index + 1);
+
+	mesh.BuildVertices(Room_VertexBuffer);
+	mesh.BuildIndicies(Room_IndexBuffer);
+}
+
+//Builds the meshes and draw lists for every room, without sending anything to the renderer.
+static void BuildRoomMeshes(MeshBuilder& mesh)
+{
 	for (int i = 0; i <= Highest_room_index; i++)
 	{
 		//These can be set here and should remain static, since the amount of vertices and indices should remain static across any room changes
@@ -570,36 +604,60 @@ void MeshRooms()
 
 		UpdateRoomMesh(mesh, i, 0, 0);
 	}
-
-	mesh.BuildVertices(Room_VertexBuffer);
-	mesh.BuildIndicies(Room_IndexBuffer);
 }
 
-//Returns true if the room at roomnum needs to have its static mesh regenerated. 
-//Because nothing can truly be static when the original rendering code was fully dynamic.
-static bool RoomNeedRemesh(int roomnum)
+//Updates the mesh of a room that has been marked for remeshing. Only the vertices of the faces that changed are sent again,
+//along with the room's indices, since a face changing texture moves it to a different draw list.
+//The number of vertices and indices in a room never changes, so everything stays where it was.
+static void RemeshRoom(MeshBuilder& mesh, int roomnum)
 {
 	room& rp = Rooms[roomnum];
-	RoomMesh& mesh = Room_meshes[roomnum];
+	RoomMesh& roommesh = Room_meshes[roomnum];
+	int num_changed = 0;
+	bool all_vertices = false;
+
 	for (int i = 0; i < rp.num_faces; i++)
 	{
-		if ((rp.faces[i].flags & FF_DESTROYED) != (mesh.FacePrevStates[i].flags & FF_DESTROYED))
-			return true;
+		face& fp = rp.faces[i];
+		FacePrevState& prev = roommesh.FacePrevStates[i];
+		if ((fp.flags & FF_DESTROYED) == (prev.flags & FF_DESTROYED) && fp.tmap == prev.tmap)
+			continue;
+
+		prev.flags = fp.flags;
+		prev.tmap = fp.tmap;
+		num_changed++;
 
-		if (rp.faces[i].tmap != mesh.FacePrevStates[i].tmap)
-			return true;
+		//Faces that aren't in the static mesh have nothing to update
+		if (roommesh.FaceFirstVertex[i] == -1)
+			continue;
+
+		//Changing the mirror's texture can change which list any face of the room is in
+		if (i == rp.mirror_face)
+			all_vertices = true;
+
+		if (all_vertices)
+			continue;
+
+		mesh.Reset();
+		AddFaceVertices(mesh, rp, fp);
+		mesh.UpdateVertices(Room_VertexBuffer, roommesh.FirstVertexOffset + roommesh.FaceFirstVertex[i] * sizeof(RendVertex));
 	}
-	return false;
-}
 
-static void RemeshRoom(MeshBuilder& mesh, int roomnum)
-{
-	mprintf((0, "RemeshRoom: Updating room %d\n", roomnum));
-	mesh.Destroy();
-	UpdateRoomMesh(mesh, roomnum, Room_meshes[roomnum].FirstVertex, Room_meshes[roomnum].FirstIndex);
+	if (num_changed == 0)
+		return;
+
+	mprintf((0, "RemeshRoom: Updating %d faces in room %d\n", num_changed, roomnum));
 
-	mesh.UpdateVertices(Room_VertexBuffer, Room_meshes[roomnum].FirstVertexOffset);
-	mesh.UpdateIndicies(Room_IndexBuffer, Room_meshes[roomnum].FirstIndexOffset);
+	if (all_vertices)
+	{
+		mesh.Reset();
+		BuildRoomVertices(mesh, roomnum);
+		mesh.UpdateVertices(Room_VertexBuffer, roommesh.FirstVertexOffset);
+	}
+
+	mesh.Reset();
+	BuildRoomIndices(mesh, roomnum, roommesh.FirstVertex, roommesh.FirstIndex);
+	mesh.UpdateIndicies(Room_IndexBuffer, roommesh.FirstIndexOffset);
 }
 
 struct NewRenderPassInfo
@@ -622,7 +680,7 @@ struct NewRenderPassInfo
 
 //I'm begging you please switch to a newer spec so you can use std::array with deduction guides. 
 //Actually would that work with a composite type here? Actually would this just be another use for a C#-like array class?
-#define NUM_NEWRENDERPASSES sizeof(renderpass_info) / sizeof(renderpass_info[0])
+#define NUM_NEWRENDERPASSES ((int)(sizeof(renderpass_info) / sizeof(renderpass_info[0])))
 
 void ComputeRoomPulseLight(room* rp);
 
@@ -632,10 +690,65 @@ void NewRender_Render(vector& vieweye, matrix& vieworientation, int roomnum)
 {
 	gRenderList.GatherVisible(vieweye, vieworientation, roomnum);
 	gRenderList.Draw();
+	mprintf_at((1, 6, 39, "Rr %03d, D %04d/%04d", (int)gRenderList.GetVisibleRooms().size(), gRenderList.GetNumDrawCalls(), gRenderList.GetNumRoomDraws()));
+}
+
+//Face planes for each room, kept as separate x, y, z and d arrays so the facing test vectorises.
+//d is the negative distance of the plane from the origin, so a face is facing the eye if n.eye + d > 0.
+struct RoomFacePlanes
+{
+	face* faces;
+	int num_faces;
+	std::vector<float> planes;
+};
+
+static RoomFacePlanes Room_face_planes[MAX_ROOMS];
+
+//If set, the visibility search is never split up onto the job pool. Useful for comparing against.
+static bool NewRender_serial_vis = false;
+
+static void ResetFacePlanes()
+{
+	for (int i = 0; i < MAX_ROOMS; i++)
+	{
+		Room_face_planes[i].faces = nullptr;
+		Room_face_planes[i].num_faces = 0;
+		Room_face_planes[i].planes.clear();
+	}
+}
+
+//Rebuilds the face planes for a room if its faces have changed. Main thread only.
+static void UpdateFacePlanes(int roomnum)
+{
+	room& rp = Rooms[roomnum];
+	RoomFacePlanes& cache = Room_face_planes[roomnum];
+	if (cache.faces == rp.faces && cache.num_faces == rp.num_faces)
+		return;
+
+	int num_faces = rp.num_faces;
+	cache.faces = rp.faces;
+	cache.num_faces = num_faces;
+	cache.planes.resize(num_faces * 4);
+
+	float* nx = cache.planes.data();
+	float* ny = nx + num_faces;
+	float* nz = ny + num_faces;
+	float* d = nz + num_faces;
+	for (int i = 0; i < num_faces; i++)
+	{
+		face& fp = rp.faces[i];
+		nx[i] = fp.normal.x;
+		ny[i] = fp.normal.y;
+		nz[i] = fp.normal.z;
+		d[i] = -vm_DotProduct(&fp.normal, &rp.verts[fp.face_verts[0]]);
+	}
 }
 
 void NewRender_InitNewLevel()
 {
+	ResetFacePlanes();
+	NewRender_serial_vis = FindArg("-serialvis") != 0;
+
 	MeshRooms();
 	MeshTerrain();
 }
@@ -751,6 +864,50 @@ void RenderList::MaybeUpdateFogPortal(int roomnum, face& fp)
 	}
 }
 
+void RenderList::EnterPortal(room& rp, portal& pp)
+{
+	face& fp = rp.faces[pp.portal_face];
+	int croomnum = pp.croom;
+	room& crp = Rooms[croomnum];
+
+	//Before the check if crp is already iterated, check if it is a fog room, and if it is, check if this portal is closer
+	if (crp.flags & RF_FOG)
+		MaybeUpdateFogPortal(croomnum, fp);
+
+	//Don't iterate into a room if it's already been added to the visible room list.
+	//Unlike the original code, this means that a room may not be iterated into by the closest portal, but that's okay.
+	//Render order shouldn't need to be precise in the world of Z buffers
+	if (RoomChecked[croomnum])
+		return;
+
+	//Add this room to the future check list
+	RoomChecked[croomnum] = 1;
+	PushRoom(croomnum);
+
+	//Is the room being checked external? If so, oops, gotta render that terrain
+	if (crp.flags & RF_EXTERNAL)
+	{
+		HasFoundTerrain = true;
+	}
+}
+
+void RenderList::CullRoomFaces(int roomnum, ubyte* facing) const
+{
+	const RoomFacePlanes& cache = Room_face_planes[roomnum];
+	int num_faces = cache.num_faces;
+	const float* nx = cache.planes.data();
+	const float* ny = nx + num_faces;
+	const float* nz = ny + num_faces;
+	const float* d = nz + num_faces;
+	float ex = EyePos.x, ey = EyePos.y, ez = EyePos.z;
+
+	//Kept simple so the compiler can vectorise it
+	for (int i = 0; i < num_faces; i++)
+	{
+		facing[i] = (nx[i] * ex + ny[i] * ey + nz[i] * ez + d[i]) > 0;
+	}
+}
+
 void RenderList::AddRoom(int roomnum, Frustum& frustum)
 {
 	//Mark it as visible
@@ -758,13 +915,15 @@ void RenderList::AddRoom(int roomnum, Frustum& frustum)
 
 	room& rp = Rooms[roomnum];
 
+	UpdateFacePlanes(roomnum);
+	RoomFacing[roomnum] = frame_AllocArray<ubyte>(rp.num_faces);
+	CullRoomFaces(roomnum, RoomFacing[roomnum]);
+
 	//Iterate all the portals to see if they're visible
 	for (int portalnum = 0; portalnum < rp.num_portals; portalnum++)
 	{
 		portal& pp = rp.portals[portalnum];
 		face& fp = rp.faces[pp.portal_face];
-		int croomnum = pp.croom;
-		room& crp = Rooms[croomnum];
 		
 		//Can you actually see through this portal?
 		if (!NewRenderPastPortal(rp, pp))
@@ -774,38 +933,105 @@ void RenderList::AddRoom(int roomnum, Frustum& frustum)
 		if (!CheckFace(rp, fp, frustum))
 			continue; 
 
-		//Before the check if crp is already iterated, check if it is a fog room, and if it is, check if this portal is closer
-		if (crp.flags & RF_FOG)
-			MaybeUpdateFogPortal(croomnum, fp);
+		EnterPortal(rp, pp);
+	}
+}
+
+//Work for one room of the parallel search. Everything that isn't thread safe is done beforehand on the main thread.
+struct GatherRoomTask
+{
+	int roomnum;
+	//Nonzero for each portal that can be seen through
+	ubyte* past_portal;
+	//Portals that can be seen through and are in the view, filled in by the job
+	short* visible_portals;
+	int num_visible;
+};
+
+struct GatherJobData
+{
+	const RenderList* list;
+	Frustum* frustum;
+	GatherRoomTask* tasks;
+	ubyte** facing;
+};
 
-		//Don't iterate into a room if it's already been added to the visible room list.
-		//Unlike the original code, this means that a room may not be iterated into by the closest portal, but that's okay.
-		//Render order shouldn't need to be precise in the world of Z buffers
-		if (RoomChecked[croomnum])
+void RenderList::GatherRoomJob(void* data, int index)
+{
+	GatherJobData* job = (GatherJobData*)data;
+	GatherRoomTask& task = job->tasks[index];
+	room& rp = Rooms[task.roomnum];
+
+	task.num_visible = 0;
+	for (int portalnum = 0; portalnum < rp.num_portals; portalnum++)
+	{
+		if (!task.past_portal[portalnum])
 			continue;
 
-		//Add this room to the future check list
-		RoomChecked[croomnum] = true;
-		PushRoom(croomnum);
+		face& fp = rp.faces[rp.portals[portalnum].portal_face];
+		if (job->list->CheckFace(rp, fp, *job->frustum))
+			task.visible_portals[task.num_visible++] = portalnum;
+	}
+
+	job->list->CullRoomFaces(task.roomnum, job->facing[task.roomnum]);
+}
 
-		//Is the room being checked external? If so, oops, gotta render that terrain
-		if (crp.flags & RF_EXTERNAL)
+void RenderList::GatherParallel(Frustum& frustum)
+{
+	while (PendingRooms())
+	{
+		//Everything in the queue right now is one level of the search
+		int level_start = RoomCheckHead;
+		int level_count = RoomCheckTail - RoomCheckHead;
+		GatherRoomTask* tasks = frame_AllocArray<GatherRoomTask>(level_count);
+
+		//Checking if a portal can be seen through may page in a texture, and neither the arena
+		//nor the face plane cache are thread safe, so set all that up here.
+		for (int i = 0; i < level_count; i++)
 		{
-			HasFoundTerrain = true;
+			GatherRoomTask& task = tasks[i];
+			int roomnum = RoomCheckList[level_start + i];
+			room& rp = Rooms[roomnum];
+
+			task.roomnum = roomnum;
+			task.past_portal = frame_AllocArray<ubyte>(rp.num_portals);
+			task.visible_portals = frame_AllocArray<short>(rp.num_portals);
+			task.num_visible = 0;
+			for (int portalnum = 0; portalnum < rp.num_portals; portalnum++)
+				task.past_portal[portalnum] = NewRenderPastPortal(rp, rp.portals[portalnum]);
+
+			UpdateFacePlanes(roomnum);
+			RoomFacing[roomnum] = frame_AllocArray<ubyte>(rp.num_faces);
+		}
+
+		GatherJobData job = { this, &frustum, tasks, RoomFacing };
+		job_ParallelFor(level_count, GatherRoomJob, &job);
+
+		//Merge the results in queue order, which gives the same visible list and next level as the serial search
+		RoomCheckHead = RoomCheckTail;
+		for (int i = 0; i < level_count; i++)
+		{
+			GatherRoomTask& task = tasks[i];
+			room& rp = Rooms[task.roomnum];
+
+			VisibleRoomNums.push_back(task.roomnum);
+			for (int j = 0; j < task.num_visible; j++)
+				EnterPortal(rp, rp.portals[task.visible_portals[j]]);
 		}
 	}
 }
 
 void RenderList::PreDraw()
 {
-	RoomBlock roomblocks[100];
-	int renderrooms = std::min(100, (int)VisibleRoomNums.size());
+	//Room blocks are indexed by room number, since that's what the room vertices have
+	int numblocks = Highest_room_index + 1;
+	RoomBlock* roomblocks = (RoomBlock*)frame_Calloc(numblocks * sizeof(RoomBlock));
 
-	for (int nn = 0; nn < renderrooms; nn++)
+	for (size_t nn = 0; nn < VisibleRoomNums.size(); nn++)
 	{
 		int roomnum = VisibleRoomNums[nn];
 		room& rp = Rooms[roomnum];
-		RoomBlock& roomblock = roomblocks[nn];
+		RoomBlock& roomblock = roomblocks[roomnum];
 
 		// Mark it visible for automap
 		AutomapVisMap[&rp - Rooms] = 1;
@@ -839,57 +1065,127 @@ void RenderList::PreDraw()
 		rp.last_render_time = Gametime;
 		rp.flags &= ~RF_MIRROR_VISIBLE;
 
+		//Only faces facing the eye are rendered, so only they get dynamic lighting
+		ubyte* facing = RoomFacing[roomnum];
 		for (int facenum = 0; facenum < rp.num_faces; facenum++)
 		{
 			face& fp = rp.faces[facenum];
-			if (!(fp.flags & FF_NOT_FACING))
+			if (!(fp.flags & FF_NOT_FACING) && facing[facenum])
 			{
 				fp.renderframe = FrameCount & 0xFF;
 			}
 		}
 	}
 
-	rend_UpdateFogBrightness(roomblocks, renderrooms);
+	rend_UpdateFogBrightness(roomblocks, numblocks);
 }
 
-void RenderList::DrawWorld(int passnum)
+//Returns true if a room is drawn in a pass. With fog turned off, every room goes through both the fog and normal passes.
+static bool RoomInPass(const NewRenderPassInfo& passinfo, const room& rp)
 {
-	assert(passnum >= 0 && passnum < NUM_NEWRENDERPASSES);
-	NewRenderPassInfo& passinfo = renderpass_info[passnum];
-	static RoomBlock roomblock;
-
-	rend_BindPipeline(passinfo.handle);
+	if (!Detail_settings.Fog_enabled)
+		return true;
 
-	//TODO: The max count should be obtained from the renderer, since some platforms don't have a limit of 100 UBOs. 
-	int renderrooms = std::min(100, (int)VisibleRoomNums.size());
+	return passinfo.fog == ((rp.flags & RF_FOG) != 0);
+}
 
-	for (int nn = 0; nn < renderrooms; nn++) //forward first to try to draw nearest rooms first. 
+//Adds the lit and mirror faces of the given rooms to a batch builder and builds the batches for a non specular pass.
+static void BuildRoomBatches(RoomBatchBuilder& batches, const std::vector<int>& roomnums, const NewRenderPassInfo& passinfo)
+{
+	batches.Reset();
+	for (int roomnum : roomnums)
 	{
-		int roomnum = VisibleRoomNums[nn];
 		room& rp = Rooms[roomnum];
-		ComputeRoomPulseLight(&Rooms[roomnum]);
+		if (!RoomInPass(passinfo, rp))
+			continue;
 
-		if (passinfo.fog)
+		RoomMesh& mesh = Room_meshes[roomnum];
+		for (RoomDrawElement& element : mesh.LitInteractions)
 		{
-			if (Detail_settings.Fog_enabled && !(Rooms[roomnum].flags & RF_FOG))
-				continue;
+			batches.Add(GetTextureBitmap(element.texturenum, 0), element.lmhandle, element.range.offset, element.range.count);
 		}
-		else
+
+		if (!mesh.MirrorInteractions.empty())
 		{
-			if (Detail_settings.Fog_enabled && Rooms[roomnum].flags & RF_FOG)
-				continue;
+			assert(rp.mirror_face != -1);
+			int bm_handle = GetTextureBitmap(rp.faces[rp.mirror_face].tmap, 0);
+			for (RoomDrawElement& element : mesh.MirrorInteractions)
+			{
+				batches.Add(bm_handle, element.lmhandle, element.range.offset, element.range.count);
+			}
 		}
+	}
 
-		rend_SetCurrentRoomNum(nn);
+	batches.Build();
+}
 
+void NewRender_CountRoomDraws(const std::vector<int>& roomnums, int* num_draws, int* num_batches)
+{
+	RoomBatchBuilder batches;
+	*num_draws = *num_batches = 0;
+	for (int passnum = 0; passnum < NUM_NEWRENDERPASSES; passnum++)
+	{
+		//Only the passes Draw uses
+		if (passnum == 1 || passnum == 4)
+			continue;
+
+		NewRenderPassInfo& passinfo = renderpass_info[passnum];
 		if (passinfo.specular)
-			Room_meshes[roomnum].DrawSpecular();
-		else
 		{
-			Room_meshes[roomnum].DrawLit();
-			Room_meshes[roomnum].DrawMirrorFaces();
+			//Speculars still go out one at a time, since each has its own lights
+			for (int roomnum : roomnums)
+			{
+				if (RoomInPass(passinfo, Rooms[roomnum]))
+				{
+					*num_draws += Room_meshes[roomnum].SpecInteractions.size();
+					*num_batches += Room_meshes[roomnum].SpecInteractions.size();
+				}
+			}
+			continue;
 		}
 
+		BuildRoomBatches(batches, roomnums, passinfo);
+		*num_draws += batches.NumDraws();
+		*num_batches += batches.NumBatches();
+	}
+}
+
+void RenderList::DrawWorld(int passnum)
+{
+	assert(passnum >= 0 && passnum < NUM_NEWRENDERPASSES);
+	NewRenderPassInfo& passinfo = renderpass_info[passnum];
+
+	rend_BindPipeline(passinfo.handle);
+
+	if (!passinfo.specular)
+	{
+		//Faces of all rooms with the same texture and lightmap go out together
+		BuildRoomBatches(Batches, VisibleRoomNums, passinfo);
+		for (int i = 0; i < Batches.NumBatches(); i++)
+		{
+			const RoomBatchBuilder::Batch& batch = Batches.GetBatch(i);
+			Room_VertexBuffer.BindBitmap(batch.bm_handle);
+			Room_VertexBuffer.BindLightmap(batch.lm_handle);
+			Room_VertexBuffer.DrawIndexedMulti(Batches.Offsets(batch), Batches.Counts(batch), batch.num_ranges);
+		}
+
+		NumRoomDraws += Batches.NumDraws();
+		NumDrawCalls += Batches.NumBatches();
+		return;
+	}
+
+	for (size_t nn = 0; nn < VisibleRoomNums.size(); nn++)
+	{
+		int roomnum = VisibleRoomNums[nn];
+		room& rp = Rooms[roomnum];
+
+		if (!RoomInPass(passinfo, rp))
+			continue;
+
+		Room_meshes[roomnum].DrawSpecular();
+		NumRoomDraws += Room_meshes[roomnum].SpecInteractions.size();
+		NumDrawCalls += Room_meshes[roomnum].SpecInteractions.size();
+
 		//TEMP mirror test
 		/*if (!passinfo.specular)
 		{
@@ -914,6 +1210,11 @@ RenderList::RenderList()
 {
 	HasFoundTerrain = false;
 	EyeRoomnum = 0;
+	RoomChecked = nullptr;
+	RoomCheckList = nullptr;
+	RoomFacing = nullptr;
+	NumRoomDraws = NumDrawCalls = 0;
+	RoomCheckHead = RoomCheckTail = 0;
 
 	//Reserve space in the vectors to their original limits, to establish a reasonable initial allocation
 	VisibleRoomNums.reserve(100);
@@ -922,9 +1223,17 @@ RenderList::RenderList()
 
 void RenderList::GatherVisible(vector& eye_pos, matrix& eye_orient, int viewroomnum)
 {
-	//Initialize the room checked list
-	RoomChecked.clear();
-	RoomChecked.resize(Highest_room_index + 1);
+	Frustum viewFrustum(gTransformFull);
+	GatherVisible(eye_pos, eye_orient, viewroomnum, viewFrustum, !NewRender_serial_vis && job_GetNumThreads() > 0);
+}
+
+void RenderList::GatherVisible(vector& eye_pos, matrix& eye_orient, int viewroomnum, Frustum& frustum, bool parallel)
+{
+	//Initialize the room checked list and the search queue. Each room is queued at most once, so the queue never needs more than one slot per room.
+	RoomChecked = (ubyte*)frame_Calloc(Highest_room_index + 1);
+	RoomCheckList = frame_AllocArray<int>(Highest_room_index + 1);
+	RoomCheckHead = RoomCheckTail = 0;
+	RoomFacing = (ubyte**)frame_Calloc((Highest_room_index + 1) * sizeof(ubyte*));
 	VisibleRoomNums.clear();
 	FogPortals.clear();
 
@@ -934,12 +1243,10 @@ void RenderList::GatherVisible(vector& eye_pos, matrix& eye_orient, int viewroom
 	EyeOrient = eye_orient;
 	EyeRoomnum = viewroomnum;
 
-	Frustum viewFrustum(gTransformFull);
-
 	if (viewroomnum >= 0) //is a room?
 	{
-		RoomChecked[viewroomnum] = true;
-		AddRoom(viewroomnum, viewFrustum);
+		RoomChecked[viewroomnum] = 1;
+		PushRoom(viewroomnum);
 	}
 	else
 	{
@@ -947,10 +1254,16 @@ void RenderList::GatherVisible(vector& eye_pos, matrix& eye_orient, int viewroom
 		//add external rooms here
 	}
 
+	if (parallel)
+	{
+		GatherParallel(frustum);
+		return;
+	}
+
 	while (PendingRooms())
 	{
 		int roomnum = PopRoom();
-		AddRoom(roomnum, viewFrustum);
+		AddRoom(roomnum, frustum);
 	}
 }
 
@@ -961,13 +1274,14 @@ void RenderList::Draw()
 	rend_SetWrapType(WT_WRAP);
 	rend_SetAlphaType(AT_ALWAYS);
 
-	//Walk the room render list for updates
+	//Walk the room render list for updates. The mesh is only needed for as long as it takes to upload it.
+	MeshBuilder mesh(true);
 	for (int nn = 0; nn < VisibleRoomNums.size(); nn++)
 	{
-		MeshBuilder mesh;
 		int roomnum = VisibleRoomNums[nn];
-		if (RoomNeedRemesh(roomnum))
+		if (Room_remesh_pending[roomnum])
 		{
+			Room_remesh_pending[roomnum] = 0;
 			RemeshRoom(mesh, roomnum);
 		}
 	}
@@ -975,6 +1289,7 @@ void RenderList::Draw()
 	Room_VertexBuffer.Bind();
 	Room_IndexBuffer.Bind();
 
+	NumRoomDraws = NumDrawCalls = 0;
 	PreDraw();
 	DrawWorld(0);
 	DrawWorld(2);
@@ -983,3 +1298,111 @@ void RenderList::Draw()
 
 	rendTEMP_UnbindVertexBuffer();
 }
+
+//Returns true if two render lists gathered the same rooms, in the same order, with the same fog portals and facing faces.
+static bool SameVisibility(const RenderList& a, const RenderList& b)
+{
+	if (a.GetVisibleRooms() != b.GetVisibleRooms() || a.FoundTerrain() != b.FoundTerrain())
+		return false;
+
+	const std::vector<FogPortalData>& fog_a = a.GetFogPortals();
+	const std::vector<FogPortalData>& fog_b = b.GetFogPortals();
+	if (fog_a.size() != fog_b.size())
+		return false;
+	for (size_t i = 0; i < fog_a.size(); i++)
+	{
+		if (fog_a[i].roomnum != fog_b[i].roomnum || fog_a[i].close_face != fog_b[i].close_face)
+			return false;
+	}
+
+	for (int roomnum : a.GetVisibleRooms())
+	{
+		if (memcmp(a.GetRoomFacing(roomnum), b.GetRoomFacing(roomnum), Rooms[roomnum].num_faces) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+void NewRender_TestVisibility()
+{
+	static vector directions[] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+
+	//Same projection as g3_GetProjectionMatrix for a 4:3 view at the default zoom, without asking the renderer for the viewport
+	float projection[16] = {};
+	float oOT = 1.0f / (D3_DEFAULT_ZOOM * 3.f / 4.f);
+	float znear = 1.0f;
+	float zfar = 10000.f;
+	projection[0] = oOT / (4.f / 3.f);
+	projection[5] = oOT;
+	projection[10] = -((zfar + znear) / (zfar - znear));
+	projection[11] = -1.0f;
+	projection[14] = -((2 * zfar * znear) / (zfar - znear));
+
+	ResetFacePlanes();
+	frame_Reset();
+
+	//The room draw lists are needed to count draws, and a dedicated server never builds them
+	if (Dedicated_server)
+	{
+		MeshBuilder mesh;
+		BuildRoomMeshes(mesh);
+	}
+
+	RenderList serial_list, parallel_list;
+	int num_views = 0, num_mismatches = 0, num_visible = 0;
+	int total_draws = 0, total_batches = 0;
+	double serial_time = 0, parallel_time = 0;
+
+	for (int roomnum = 0; roomnum <= Highest_room_index; roomnum++)
+	{
+		room& rp = Rooms[roomnum];
+		if (!rp.used || (rp.flags & RF_EXTERNAL))
+			continue;
+
+		vector center;
+		ComputeRoomCenter(&center, &rp);
+
+		for (vector& dir : directions)
+		{
+			matrix orient;
+			float modelview[16], transform[16];
+			vm_VectorToMatrix(&orient, &dir);
+			g3_GetModelViewMatrix(&center, &orient, modelview);
+			g3_Mat4Multiply(transform, projection, modelview);
+			Frustum frustum(transform);
+
+			double start = timer_GetTime64();
+			serial_list.GatherVisible(center, orient, roomnum, frustum, false);
+			double middle = timer_GetTime64();
+			parallel_list.GatherVisible(center, orient, roomnum, frustum, true);
+			double end = timer_GetTime64();
+
+			serial_time += middle - start;
+			parallel_time += end - middle;
+			num_views++;
+			num_visible += serial_list.GetVisibleRooms().size();
+
+			int num_draws, num_batches;
+			NewRender_CountRoomDraws(serial_list.GetVisibleRooms(), &num_draws, &num_batches);
+			total_draws += num_draws;
+			total_batches += num_batches;
+
+			if (!SameVisibility(serial_list, parallel_list))
+			{
+				num_mismatches++;
+				mprintf((0, "TestVisibility: room %d facing %.0f %.0f %.0f gave %d rooms serially and %d in parallel\n", roomnum, dir.x, dir.y, dir.z,
+					(int)serial_list.GetVisibleRooms().size(), (int)parallel_list.GetVisibleRooms().size()));
+			}
+
+			//Don't let the arena grow over the whole level
+			frame_Reset();
+		}
+	}
+
+	mprintf((0, "TestVisibility: %d views, %d mismatches, %.1f rooms visible on average\n", num_views, num_mismatches, num_views ? (float)num_visible / num_views : 0.0f));
+	mprintf((0, "TestVisibility: serial %.3f ms, parallel %.3f ms per view with %d worker threads\n", num_views ? serial_time * 1000 / num_views : 0.0,
+		num_views ? parallel_time * 1000 / num_views : 0.0, job_GetNumThreads()));
+	mprintf((0, "TestVisibility: %.1f draws per view, %.1f after batching\n", num_views ? (float)total_draws / num_views : 0.0f,
+		num_views ? (float)total_batches / num_views : 0.0f));
+}
@@ -23,6 +23,7 @@
 #include "3d.h"
 #include "pserror.h"
 #include "room.h"
+#include "roombatch.h"
 
 struct FogPortalData
 {
@@ -36,11 +37,21 @@ class RenderList
 	//List of all rooms that are currently visible
 	std::vector<int> VisibleRoomNums;
 	//Transiently sized and updated to check if a room has been iterated into. 
-	std::vector<bool> RoomChecked;
+	//Allocated from the frame arena by GatherVisible.
+	ubyte* RoomChecked;
 	std::vector<FogPortalData> FogPortals;
-	//Queue used for a room breadth first search
-	std::queue<int> RoomCheckList;
+	//Queue used for a room breadth first search, also from the frame arena.
+	int* RoomCheckList;
+	int RoomCheckHead, RoomCheckTail;
 	bool HasFoundTerrain;
+	//For each visible room, one byte per face that is nonzero if the face is facing the eye.
+	//Indexed by room number, from the frame arena. Rooms that aren't visible are left null.
+	ubyte** RoomFacing;
+
+	//Batches for the pass being drawn. Kept around so the lists don't need to be reallocated every frame.
+	RoomBatchBuilder Batches;
+	//Number of room face groups drawn last frame, and how many draw calls that took once batched.
+	int NumRoomDraws, NumDrawCalls;
 
 	vector EyePos;
 	matrix EyeOrient;
@@ -52,20 +63,17 @@ class RenderList
 	// and will check if each portal is visible and add linked rooms to the BFS queue. 
 	bool PendingRooms() const
 	{
-		return !RoomCheckList.empty();
+		return RoomCheckHead != RoomCheckTail;
 	}
 
 	void PushRoom(int roomnum)
 	{
-		RoomCheckList.push(roomnum);
+		RoomCheckList[RoomCheckTail++] = roomnum;
 	}
 
 	int PopRoom()
 	{
-		int check = RoomCheckList.front();
-		RoomCheckList.pop();
-
-		return check;
+		return RoomCheckList[RoomCheckHead++];
 	}
 
 	bool CheckFace(room& rp, face& fp, Frustum& frustum) const;
@@ -73,6 +81,14 @@ class RenderList
 	//Adds a room to the visible list. Will check visibility of all portal faces,
 	//and add all visibile connected rooms to the room check queue. 
 	void AddRoom(int roomnum, Frustum& frustum);
+	//Called for each portal that is seen through. Updates the fog portals, and queues the room on the other side.
+	void EnterPortal(room& rp, portal& pp);
+	//Fills in the facing array for a room. The face planes for the room must be up to date.
+	void CullRoomFaces(int roomnum, ubyte* facing) const;
+	//Breadth first search done one level at a time, with the rooms of each level checked on the job pool.
+	//Gives exactly the same results as the serial search through AddRoom.
+	void GatherParallel(Frustum& frustum);
+	static void GatherRoomJob(void* data, int index);
 
 	void PreDraw();
 	void DrawWorld(int passnum);
@@ -82,6 +98,41 @@ public:
 	//g3_StartFrame must have been called, this will use the current modelview and projection matricies loaded in the 3d system
 	//The search starts from the specified roomnum, unless it is negative, then iteration will start from the terrain. 
 	void GatherVisible(vector& eye_pos, matrix& eye_orient, int viewroomnum);
+	//As above, but using the given frustum instead of the 3d system's transforms, so it doesn't need a renderer.
+	//If parallel is false, the search is done entirely on the calling thread. 
+	void GatherVisible(vector& eye_pos, matrix& eye_orient, int viewroomnum, Frustum& frustum, bool parallel);
+
+	//Results of the last gather. These are only good until the end of the frame.
+	const std::vector<int>& GetVisibleRooms() const
+	{
+		return VisibleRoomNums;
+	}
+
+	const std::vector<FogPortalData>& GetFogPortals() const
+	{
+		return FogPortals;
+	}
+
+	bool FoundTerrain() const
+	{
+		return HasFoundTerrain;
+	}
+
+	int GetNumRoomDraws() const
+	{
+		return NumRoomDraws;
+	}
+
+	int GetNumDrawCalls() const
+	{
+		return NumDrawCalls;
+	}
+
+	//Returns the facing array for a visible room, or nullptr if the room isn't visible.
+	const ubyte* GetRoomFacing(int roomnum) const
+	{
+		return RoomFacing ? RoomFacing[roomnum] : nullptr;
+	}
 
 	//Draws the entire render list to the current view.
 	void Draw();
@@ -92,3 +143,11 @@ void NewRender_InitNewLevel();
 
 //Builds renderlists for the main camera, all mirrors, and so on
 void NewRender_Render(vector& vieweye, matrix& vieworientation, int roomnum);
+
+//Counts the draws needed for the given rooms, as the faces would be drawn one group at a time (num_draws),
+//and once they're merged into batches (num_batches). Doesn't draw anything.
+void NewRender_CountRoomDraws(const std::vector<int>& roomnums, int* num_draws, int* num_batches);
+
+//Checks the parallel visibility gather against the serial one from every room in the level and logs the timings.
+//Doesn't need a renderer, so it can be run on a dedicated server with -testnewvis.
+void NewRender_TestVisibility();
@@ -59,6 +59,7 @@
 #include "game2dll.h"
 #include "robot.h"
 #include "damage.h"
+#include "objgrid.h"
 #include "attach.h"
 #include "dedicated_server.h"
 #include "hud.h"
@@ -71,6 +72,9 @@
 #include "levelgoal.h"
 #include "psrand.h"
 #include "vibeinterface.h"
+#include "jobsystem.h"
+#include "args.h"
+#include "ddio.h"
 
 #ifdef EDITOR
 #include "editor\d3edit.h"
@@ -330,6 +334,11 @@ void InitObjects()
 		Rooms[i].vis_effects = -1;
 	}
 
+	ObjGridInit();
+
+	Obj_parallel_frame = FindArg("-parallelobjects") != 0;
+	Obj_check_frame = FindArg("-checkobjframe") != 0;
+
 	InitVisEffects();
 
 	atexit(FreeAllObjects);
@@ -369,6 +378,8 @@ void ObjLink(int objnum, int roomnum)
 		obj->next = Rooms[roomnum].objects;
 		Rooms[roomnum].objects = objnum;
 		ASSERT(obj->next != objnum);
+
+		ObjGridLink(objnum);
 	}
 
 	obj->prev = -1;
@@ -419,6 +430,8 @@ void ObjUnlink(int objnum)
 	{
 		room* rp = &Rooms[obj->roomnum];
 
+		ObjGridUnlink(objnum);
+
 		if (obj->prev == -1)
 			rp->objects = obj->next;
 		else
@@ -602,6 +615,9 @@ void ObjSetAABB(object* obj)
 
 		obj->max_xyz = obj->pos + object_rad;
 	}
+
+	//Keep the collision grid in step with the new box
+	ObjGridUpdate(OBJNUM(obj));
 }
 
 //-----------------------------------------------------------------------------
@@ -1729,7 +1745,7 @@ void ObjDoFrame(object* obj)
 	case CT_NONE:
 		break;
 	case CT_FLYING: { RTP_STARTINCTIME(ct_flying_time);			DoFlyingControl(obj);	RTP_ENDINCTIME(ct_flying_time); }break;
-	case CT_AI:				if (DoAI) { RTP_STARTINCTIME(ct_aidoframe_time); AIDoFrame(obj);		RTP_ENDINCTIME(ct_aidoframe_time); }break;
+	case CT_AI:				if (DoAI) { RTP_ZONE("AIDoFrame", RTZ_AI); RTP_STARTINCTIME(ct_aidoframe_time); AIDoFrame(obj);		RTP_ENDINCTIME(ct_aidoframe_time); }break;
 	case CT_WEAPON: { RTP_STARTINCTIME(ct_weaponframe_time);	WeaponDoFrame(obj);		RTP_ENDINCTIME(ct_weaponframe_time); }break;
 	case CT_EXPLOSION: { RTP_STARTINCTIME(ct_explosionframe_time); DoExplosionFrame(obj);	RTP_ENDINCTIME(ct_explosionframe_time); }break;
 	case CT_DEBRIS: { RTP_STARTINCTIME(ct_debrisframe_time);	DoDebrisFrame(obj);		RTP_ENDINCTIME(ct_debrisframe_time); }break;
@@ -1863,6 +1879,7 @@ void ObjDoFrame(object* obj)
 
 	case MT_PHYSICS:
 	{
+		RTP_ZONE("PhysicsSim", RTZ_PHYSICS);
 		RTP_STARTINCTIME(mt_physicsframe_time);
 
 		do_physics_sim(obj);
@@ -1874,6 +1891,7 @@ void ObjDoFrame(object* obj)
 
 	case MT_WALKING:
 	{
+		RTP_ZONE("WalkingSim", RTZ_PHYSICS);
 		RTP_STARTINCTIME(mt_walkingframe_time);
 		do_walking_sim(obj);
 		DebugBlockPrint("DW");
@@ -1986,6 +2004,102 @@ void ObjDoFrame(object* obj)
 	Frametime = save_frametime;
 }
 
+//--------------------------------------------------------------------
+// Parallel object frame prepass
+//
+// Most of an object's frame can touch other objects, play sounds or run scripts, so
+// ObjDoFrame still runs one object at a time.  Before it does, the prepass does the parts
+// that only read the world for every object at once, spread over the job pool.  Objects
+// are batched by room, so each batch works on the same few rooms.  Each object writes its
+// results into its own slot, and its ObjDoFrame uses them only if nothing they depend on changed
+// earlier in the frame.  So far this is the wall part of the AI target vision ray: a wall
+// lets the AI skip its ray, and a clear path lets its ray skip the walls.
+
+bool Obj_parallel_frame = false;
+bool Obj_check_frame = false;
+obj_frame_stats Obj_frame_stats;
+
+// Rooms are added to a batch until it has at least this many objects
+#define MIN_PREPASS_BATCH		8
+
+typedef struct
+{
+	short first, count;
+	short unsafe;			// Rays that couldn't be cast on a job thread
+} obj_prepass_batch;
+
+static short Prepass_objects[MAX_OBJECTS];
+static obj_prepass_batch Prepass_batches[MAX_OBJECTS];
+
+static int PrepassObjectCompare(const void *a, const void *b)
+{
+	const object *obj_a = &Objects[*(const short *)a];
+	const object *obj_b = &Objects[*(const short *)b];
+
+	if (obj_a->roomnum != obj_b->roomnum)
+		return obj_a->roomnum - obj_b->roomnum;
+
+	return *(const short *)a - *(const short *)b;
+}
+
+static void ObjDoPrepassBatch(void*, int index)
+{
+	RTP_ZONE("ObjPrepassBatch", RTZ_AI);
+	obj_prepass_batch* batch = &Prepass_batches[index];
+
+	for (int i = batch->first; i < batch->first + batch->count; i++)
+	{
+		if (!AIDoVisPrepass(&Objects[Prepass_objects[i]]))
+			batch->unsafe++;
+	}
+}
+
+static void ObjDoFramePrepass()
+{
+	int num_objects = 0;
+	int num_batches = 0;
+	int i;
+	double start_time = timer_GetTime64();
+
+	for (i = 0; i <= Highest_object_index; i++)
+	{
+		object* objp = &Objects[i];
+
+		if (objp->type != OBJ_NONE && !(objp->flags & OF_DEAD) && AIWantsVisPrepass(objp))
+			Prepass_objects[num_objects++] = i;
+	}
+
+	if (num_objects == 0)
+		return;
+
+	qsort(Prepass_objects, num_objects, sizeof(short), PrepassObjectCompare);
+
+	// Only split between rooms
+	for (i = 0; i < num_objects; i++)
+	{
+		if (num_batches == 0 || (Prepass_batches[num_batches - 1].count >= MIN_PREPASS_BATCH &&
+			Objects[Prepass_objects[i]].roomnum != Objects[Prepass_objects[i - 1]].roomnum))
+		{
+			Prepass_batches[num_batches].first = i;
+			Prepass_batches[num_batches].count = 0;
+			Prepass_batches[num_batches].unsafe = 0;
+			num_batches++;
+		}
+
+		Prepass_batches[num_batches - 1].count++;
+	}
+
+	job_ParallelFor(num_batches, ObjDoPrepassBatch, NULL);
+
+	for (i = 0; i < num_batches; i++)
+		Obj_frame_stats.rays_unsafe += Prepass_batches[i].unsafe;
+
+	Obj_frame_stats.prepass_frames++;
+	Obj_frame_stats.batches += num_batches;
+	Obj_frame_stats.rays += num_objects;
+	Obj_frame_stats.prepass_time += timer_GetTime64() - start_time;
+}
+
 int	Max_used_objects = MAX_OBJECTS - 20;
 float Last_position_history_update[MAX_POSITION_HISTORY];//gametime of the last position history update of the object
 float Last_position_history_update_time = 0.0f;
@@ -1999,6 +2113,7 @@ void ObjDoFrameAll()
 	object* objp;
 	int objs_live = 0;
 	bool update_position_history = false;
+	double start_time = timer_GetTime64();
 
 	if (Last_position_history_update_time > Gametime)
 	{
@@ -2023,6 +2138,13 @@ void ObjDoFrameAll()
 
 	Physics_NumLinked = 0;
 
+	// Without job threads the prepass would just cast the same rays serially
+	if (Obj_parallel_frame && job_GetNumThreads())
+	{
+		RTP_ZONE("ObjDoFramePrepass", RTZ_AI);
+		ObjDoFramePrepass();
+	}
+
 	//Process each object
 	for (i = 0, objp = Objects; i <= Highest_object_index; i++, objp++)
 	{
@@ -2053,6 +2175,7 @@ void ObjDoFrameAll()
 
 	// Move vis effects
 	{
+		RTP_ZONE("VisEffectMoveAll", RTZ_VISEFFECT);
 		RTP_STARTINCTIME(vis_eff_move);
 		VisEffectMoveAll();
 		RTP_ENDINCTIME(vis_eff_move);
@@ -2065,6 +2188,9 @@ void ObjDoFrameAll()
 
 	//Delete everything that died
 	ObjDeleteDead();
+
+	Obj_frame_stats.frames++;
+	Obj_frame_stats.frame_time += timer_GetTime64() - start_time;
 }
 
 #define FUELCEN_SOUND_DELAY	0.25		//play every quarter second
@@ -161,6 +161,26 @@ void ObjDeleteDead();
 //Process all objects for the current frame
 void ObjDoFrameAll();
 
+//Counters for the parallel object frame prepass, reset when a level starts
+typedef struct
+{
+	int frames;				// Object frames run
+	int prepass_frames;	// Frames that ran the prepass
+	int batches;			// Room batches handed to the job pool
+	int rays;				// AI vision rays cast in the prepass
+	int rays_used;			// Prepass rays that let an AI skip its own vision ray
+	int rays_clear;		// Prepass rays that let an AI's vision ray skip the walls
+	int rays_stale;		// Prepass rays thrown away because something changed before they were used
+	int rays_unsafe;		// Prepass rays that reached a face only the main thread can look at
+	int mismatches;		// Prepass rays the serial check disagreed with (-checkobjframe)
+	float prepass_time;	// Seconds spent in the prepass
+	float frame_time;		// Seconds spent in ObjDoFrameAll, prepass included
+} obj_frame_stats;
+
+extern obj_frame_stats Obj_frame_stats;
+extern bool Obj_parallel_frame;		// Run the prepass (-parallelobjects)
+extern bool Obj_check_frame;			// Check the prepass against the serial path (-checkobjframe)
+
 //set viewer object to next object in array
 void ObjGotoNextViewer();
 
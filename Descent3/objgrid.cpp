@@ -0,0 +1,333 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "objgrid.h"
+#include "object.h"
+#include "room.h"
+#include "args.h"
+#include "pserror.h"
+
+//Size of a grid cell, before it is stretched to keep the cell count down
+#define OBJGRID_CELL_SIZE		40.0f
+//Most cells along any one axis of a room
+#define OBJGRID_MAX_DIM			8
+//Objects covering more cells than this go on the room's list of large objects instead
+#define OBJGRID_MAX_OBJ_CELLS	8
+//Rooms with fewer objects than this just have their list walked
+#define OBJGRID_MIN_OBJECTS	8
+
+bool Obj_grid_enabled = true;
+bool Obj_grid_test = false;
+
+struct RoomObjGrid
+{
+	//Room bounds the grid was built for
+	vector min_xyz, max_xyz;
+	float inv_cell_size;
+	int dims[3];
+	int num_objects;
+	std::vector<std::vector<short>> cells;
+	std::vector<short> large;
+};
+
+struct ObjGridEntry
+{
+	short roomnum;	//-1 if not in a grid
+	bool large;
+	ubyte lo[3], hi[3];
+};
+
+static RoomObjGrid* Room_obj_grids[MAX_ROOMS];
+static ObjGridEntry Obj_grid_entries[MAX_OBJECTS];
+
+//Room object lists are in reverse link order, so the link sequence puts gathered objects back in list order
+static unsigned int Obj_link_seq[MAX_OBJECTS];
+static unsigned int Obj_link_counter = 0;
+
+//Marks objects already gathered by the current ObjGridGather() call
+static unsigned int Obj_gather_stamp[MAX_OBJECTS];
+static unsigned int Obj_gather_counter = 0;
+
+static void ObjGridFree()
+{
+	for (int i = 0; i < MAX_ROOMS; i++)
+	{
+		delete Room_obj_grids[i];
+		Room_obj_grids[i] = nullptr;
+	}
+}
+
+void ObjGridInit()
+{
+	static bool initted = false;
+
+	ObjGridClear();
+
+	if (initted)
+		return;
+	initted = true;
+
+	if (FindArg("-noobjgrid"))
+		Obj_grid_enabled = false;
+	if (FindArg("-testobjgrid"))
+		Obj_grid_test = true;
+
+	atexit(ObjGridFree);
+}
+
+void ObjGridClear()
+{
+	for (int i = 0; i < MAX_ROOMS; i++)
+	{
+		RoomObjGrid* grid = Room_obj_grids[i];
+		if (!grid)
+			continue;
+
+		for (std::vector<short>& cell : grid->cells)
+			cell.clear();
+		grid->large.clear();
+		grid->num_objects = 0;
+	}
+
+	for (int i = 0; i < MAX_OBJECTS; i++)
+		Obj_grid_entries[i].roomnum = -1;
+}
+
+//Sets up a room's grid for the room's current bounds
+static void ObjGridBuild(RoomObjGrid* grid, room* rp)
+{
+	grid->min_xyz = rp->min_xyz;
+	grid->max_xyz = rp->max_xyz;
+
+	vector extent = rp->max_xyz - rp->min_xyz;
+	float largest = std::max(extent.x, std::max(extent.y, extent.z));
+
+	float cell_size = OBJGRID_CELL_SIZE;
+	if (largest > cell_size * OBJGRID_MAX_DIM)
+		cell_size = largest / OBJGRID_MAX_DIM;
+	grid->inv_cell_size = 1.0f / cell_size;
+
+	float size[3] = { extent.x, extent.y, extent.z };
+	int num_cells = 1;
+	for (int i = 0; i < 3; i++)
+	{
+		int dim = 1;
+		if (size[i] > 0)
+			dim = (int)(size[i] / cell_size) + 1;
+		grid->dims[i] = std::min(dim, OBJGRID_MAX_DIM);
+		num_cells *= grid->dims[i];
+	}
+
+	grid->cells.clear();
+	grid->cells.resize(num_cells);
+	grid->large.clear();
+	grid->num_objects = 0;
+}
+
+//Clamps a coordinate to a cell along one axis. Coordinates outside the room land in the edge cells,
+//which keeps overlapping boxes in overlapping cells.
+static inline int ObjGridCoord(const RoomObjGrid* grid, float v, float min, int axis)
+{
+	float f = (v - min) * grid->inv_cell_size;
+	if (!(f >= 0))
+		return 0;
+	if (f >= grid->dims[axis])
+		return grid->dims[axis] - 1;
+	return (int)f;
+}
+
+static void ObjGridRange(const RoomObjGrid* grid, const vector* min_xyz, const vector* max_xyz, ubyte* lo, ubyte* hi)
+{
+	lo[0] = ObjGridCoord(grid, min_xyz->x, grid->min_xyz.x, 0);
+	lo[1] = ObjGridCoord(grid, min_xyz->y, grid->min_xyz.y, 1);
+	lo[2] = ObjGridCoord(grid, min_xyz->z, grid->min_xyz.z, 2);
+	hi[0] = ObjGridCoord(grid, max_xyz->x, grid->min_xyz.x, 0);
+	hi[1] = ObjGridCoord(grid, max_xyz->y, grid->min_xyz.y, 1);
+	hi[2] = ObjGridCoord(grid, max_xyz->z, grid->min_xyz.z, 2);
+}
+
+static inline int ObjGridCell(const RoomObjGrid* grid, int x, int y, int z)
+{
+	return (z * grid->dims[1] + y) * grid->dims[0] + x;
+}
+
+static void ObjGridRemoveFrom(std::vector<short>& list, int objnum)
+{
+	for (size_t i = 0; i < list.size(); i++)
+	{
+		if (list[i] == objnum)
+		{
+			list[i] = list.back();
+			list.pop_back();
+			return;
+		}
+	}
+	Int3();	//object wasn't where its entry says it is
+}
+
+//Puts an object in the cells covered by its AABB, and fills in the entry's range
+static void ObjGridInsert(RoomObjGrid* grid, ObjGridEntry* entry, int objnum)
+{
+	object* obj = &Objects[objnum];
+	ObjGridRange(grid, &obj->min_xyz, &obj->max_xyz, entry->lo, entry->hi);
+
+	int num_cells = (entry->hi[0] - entry->lo[0] + 1) * (entry->hi[1] - entry->lo[1] + 1) * (entry->hi[2] - entry->lo[2] + 1);
+	entry->large = (num_cells > OBJGRID_MAX_OBJ_CELLS);
+
+	if (entry->large)
+	{
+		grid->large.push_back(objnum);
+		return;
+	}
+
+	for (int z = entry->lo[2]; z <= entry->hi[2]; z++)
+		for (int y = entry->lo[1]; y <= entry->hi[1]; y++)
+			for (int x = entry->lo[0]; x <= entry->hi[0]; x++)
+				grid->cells[ObjGridCell(grid, x, y, z)].push_back(objnum);
+}
+
+static void ObjGridRemove(RoomObjGrid* grid, ObjGridEntry* entry, int objnum)
+{
+	if (entry->large)
+	{
+		ObjGridRemoveFrom(grid->large, objnum);
+		return;
+	}
+
+	for (int z = entry->lo[2]; z <= entry->hi[2]; z++)
+		for (int y = entry->lo[1]; y <= entry->hi[1]; y++)
+			for (int x = entry->lo[0]; x <= entry->hi[0]; x++)
+				ObjGridRemoveFrom(grid->cells[ObjGridCell(grid, x, y, z)], objnum);
+}
+
+void ObjGridLink(int objnum)
+{
+	object* obj = &Objects[objnum];
+	ObjGridEntry* entry = &Obj_grid_entries[objnum];
+
+	ASSERT(entry->roomnum == -1);
+	ASSERT(!ROOMNUM_OUTSIDE(obj->roomnum) && obj->roomnum >= 0 && obj->roomnum < MAX_ROOMS);
+
+	Obj_link_seq[objnum] = ++Obj_link_counter;
+
+	room* rp = &Rooms[obj->roomnum];
+	RoomObjGrid* grid = Room_obj_grids[obj->roomnum];
+	if (!grid)
+	{
+		grid = new RoomObjGrid;
+		Room_obj_grids[obj->roomnum] = grid;
+		ObjGridBuild(grid, rp);
+	}
+	else if (grid->num_objects == 0 && (grid->min_xyz != rp->min_xyz || grid->max_xyz != rp->max_xyz))
+	{
+		//New level or the room was changed, so fit the grid to it again
+		ObjGridBuild(grid, rp);
+	}
+
+	entry->roomnum = obj->roomnum;
+	ObjGridInsert(grid, entry, objnum);
+	grid->num_objects++;
+}
+
+void ObjGridUnlink(int objnum)
+{
+	ObjGridEntry* entry = &Obj_grid_entries[objnum];
+	if (entry->roomnum == -1)
+		return;
+
+	RoomObjGrid* grid = Room_obj_grids[entry->roomnum];
+	ObjGridRemove(grid, entry, objnum);
+	grid->num_objects--;
+	entry->roomnum = -1;
+}
+
+void ObjGridUpdate(int objnum)
+{
+	if (objnum < 0 || objnum >= MAX_OBJECTS)
+		return;
+
+	ObjGridEntry* entry = &Obj_grid_entries[objnum];
+	if (entry->roomnum == -1)
+		return;
+
+	RoomObjGrid* grid = Room_obj_grids[entry->roomnum];
+	object* obj = &Objects[objnum];
+	ubyte lo[3], hi[3];
+	ObjGridRange(grid, &obj->min_xyz, &obj->max_xyz, lo, hi);
+
+	//Most moves stay within the same cells
+	if (!memcmp(lo, entry->lo, sizeof(lo)) && !memcmp(hi, entry->hi, sizeof(hi)))
+		return;
+
+	ObjGridRemove(grid, entry, objnum);
+	ObjGridInsert(grid, entry, objnum);
+}
+
+int ObjGridGather(int roomnum, const vector* min_xyz, const vector* max_xyz, short* list)
+{
+	room* rp = &Rooms[roomnum];
+	RoomObjGrid* grid = Room_obj_grids[roomnum];
+	int num = 0;
+
+	if (!Obj_grid_enabled || !grid || grid->cells.size() == 1 || grid->num_objects < OBJGRID_MIN_OBJECTS)
+	{
+		for (int objnum = rp->objects; objnum != -1; objnum = Objects[objnum].next)
+			list[num++] = objnum;
+		return num;
+	}
+
+	if (++Obj_gather_counter == 0)
+	{
+		memset(Obj_gather_stamp, 0, sizeof(Obj_gather_stamp));
+		Obj_gather_counter = 1;
+	}
+
+	for (short objnum : grid->large)
+	{
+		Obj_gather_stamp[objnum] = Obj_gather_counter;
+		list[num++] = objnum;
+	}
+
+	ubyte lo[3], hi[3];
+	ObjGridRange(grid, min_xyz, max_xyz, lo, hi);
+
+	for (int z = lo[2]; z <= hi[2]; z++)
+	{
+		for (int y = lo[1]; y <= hi[1]; y++)
+		{
+			for (int x = lo[0]; x <= hi[0]; x++)
+			{
+				for (short objnum : grid->cells[ObjGridCell(grid, x, y, z)])
+				{
+					if (Obj_gather_stamp[objnum] == Obj_gather_counter)
+						continue;
+					Obj_gather_stamp[objnum] = Obj_gather_counter;
+					list[num++] = objnum;
+				}
+			}
+		}
+	}
+
+	std::sort(list, list + num, [](short l, short r) { return Obj_link_seq[l] > Obj_link_seq[r]; });
+
+	return num;
+}
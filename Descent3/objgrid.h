@@ -0,0 +1,58 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vecmat_external.h"
+
+//Broadphase for object collisions inside rooms.
+//Every room with objects in it gets a uniform grid over its bounding box, and each object linked
+//into the room is binned into the cells its AABB covers. The grid is kept up to date by ObjLink(),
+//ObjUnlink() and ObjSetAABB(), so it always matches the objects' min_xyz/max_xyz.
+//Terrain cells don't use this, they're already small enough.
+//Main thread only.
+
+//If false, ObjGridGather() just returns the whole room object list. The grid is still kept up
+//to date, so this can be flipped at any time. Cleared by -noobjgrid.
+extern bool Obj_grid_enabled;
+
+//Set by -testobjgrid. Every so often, the game records a frame's collision queries and replays them
+//with and without the grid to check the results match.
+extern bool Obj_grid_test;
+
+//Sets up the grid bookkeeping. Called by InitObjects().
+void ObjGridInit();
+
+//Drops every object from every grid. Use when the room object lists are reset wholesale
+//instead of through ObjUnlink().
+void ObjGridClear();
+
+//Adds an object to the grid of the room it was just linked into. Called by ObjLink().
+void ObjGridLink(int objnum);
+
+//Removes an object from its room's grid. Called by ObjUnlink().
+void ObjGridUnlink(int objnum);
+
+//Moves an object to the cells covered by its current AABB. Called by ObjSetAABB().
+void ObjGridUpdate(int objnum);
+
+//Fills list with the objects in a room whose AABBs might overlap the box from min_xyz to max_xyz.
+//Objects that do overlap are always returned, and they come out in the same order as the room's
+//object list, so walking the result gives the same answers as walking the list.
+//list must have room for MAX_OBJECTS entries. Returns the number of objects in the list.
+int ObjGridGather(int roomnum, const vector* min_xyz, const vector* max_xyz, short* list);
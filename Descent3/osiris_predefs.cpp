@@ -269,7 +269,10 @@ void osipf_RoomValue(int roomnum, char op, char vtype, void* ptr, int index)
 		break;
 	case RMSV_I_FACE_TEXTURE_ID:
 		if (op == VF_SET)
+		{
 			rp->faces[index].tmap = *(int*)ptr;
+			MarkRoomForRemesh(rp - Rooms);
+		}
 		else if (op == VF_GET)
 			*(int*)ptr = rp->faces[index].tmap;
 		break;
@@ -277,11 +280,20 @@ void osipf_RoomValue(int roomnum, char op, char vtype, void* ptr, int index)
 		if (op == VF_GET)
 			*(int*)ptr = rp->faces[index].flags;
 		else if (op == VF_SET)
+		{
 			rp->faces[index].flags = *(int*)ptr;
+			MarkRoomForRemesh(rp - Rooms);
+		}
 		else if (op == VF_SET_FLAGS)
+		{
 			rp->faces[index].flags |= *(int*)ptr;
+			MarkRoomForRemesh(rp - Rooms);
+		}
 		else if (op == VF_CLEAR_FLAGS)
+		{
 			rp->faces[index].flags &= ~(*(int*)ptr);
+			MarkRoomForRemesh(rp - Rooms);
+		}
 		break;
 	case RMSV_V_FACE_NORMAL:
 		if (op == VF_GET)
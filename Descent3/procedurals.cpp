@@ -16,6 +16,8 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <mutex>
+#include <condition_variable>
 #include "procedurals.h"
 #include "bitmap.h"
 #include "gr.h"
@@ -30,6 +32,21 @@
 #include <math.h>
 #include <memory.h>
 #include "psrand.h"
+#include "args.h"
+#include "jobsystem.h"
+
+// The SSE2 kernels are picked at run time, so the GCC build marks them with a target attribute
+// rather than needing -msse2 for the whole file
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PROC_SSE2
+#define PROC_SSE2_FUNC __attribute__((target("sse2")))
+#include <emmintrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#define PROC_SSE2
+#define PROC_SSE2_FUNC
+#include <emmintrin.h>
+#include <intrin.h>
+#endif
 
 #define BRIGHT_COLOR	254
 #define PROC_SIZE	128
@@ -56,6 +73,52 @@ char* WaterProcNames[] = { "None","Height blob","Sine Blob","Random Raindrops","
 static ubyte* ProcDestData;
 int pholdrand = 1;
 
+// A procedural update running on the job pool.  It steps the pages it was given and draws
+// the image into back, which is copied into the procedural bitmap when it is collected.
+struct proc_job
+{
+	bool water;
+	void* page;				// page the elements were drawn into
+	void* next_page;		// page that gets the next step
+	const ushort* src_data;	// palette for fire, source bitmap for water
+	int density;
+	int lightval;			// -1 for unlit water
+	ushort* dest;
+	bool queued;			// submitted and not collected yet
+	bool done;				// protected by Proc_job_mutex
+	ushort back[PROC_SIZE * PROC_SIZE];
+};
+
+static proc_job* Proc_jobs[MAX_TEXTURES];
+static std::mutex Proc_job_mutex;
+static std::condition_variable Proc_job_done;
+static bool Proc_serial = false;
+static bool Proc_simd = true;
+static bool Proc_has_sse2 = false;
+
+// How many visible procedurals are updated each frame before they start taking turns, 0 for no limit
+static int Proc_updates_per_frame = 8;
+static int Proc_visible_frame[MAX_TEXTURES];
+static int Proc_count_frame = -1;
+static int Proc_visible_count, Proc_visible_last;
+
+// Returns true if this CPU can run the SSE2 kernels
+static bool ProcCPUHasSSE2()
+{
+#if defined(PROC_SSE2) && defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") != 0;
+#elif defined(_M_X64)
+	return true;
+#elif defined(PROC_SSE2)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	return false;
+#endif
+}
+
 inline int prand()
 {
 	return(((pholdrand = pholdrand * 214013L + 2531011L) >> 16) & 0x7fff);
@@ -154,6 +217,16 @@ void InitProcedurals()
 
 	Num_proc_elements = 0;
 
+	for (i = 0; i < MAX_TEXTURES; i++)
+		Proc_visible_frame[i] = -1;
+
+	Proc_serial = FindArg("-serialprocedurals") != 0;
+	Proc_has_sse2 = ProcCPUHasSSE2();
+	Proc_simd = Proc_has_sse2 && FindArg("-noprocsimd") == 0;
+	int arg = FindArg("-procupdates");
+	if (arg)
+		Proc_updates_per_frame = atoi(GameArgs[arg + 1]);
+
 	// Init our fade table
 	for (i = 0; i < 32768; i++)
 	{
@@ -358,84 +431,165 @@ void DrawProceduralLine(int x1, int y1, int x2, int y2, ubyte color)
 	}
 }
 
+#ifdef PROC_SSE2
+// The SSE2 parts of the kernels below. Each does as much as it can 16 bytes at a time
+// and returns where the scalar code should carry on from.
+PROC_SSE2_FUNC static int ProcFadeSSE2(ubyte* data, int count, int fadeval)
+{
+	__m128i fade = _mm_set1_epi8((char)fadeval);
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i pix = _mm_loadu_si128((__m128i*)(data + i));
+		_mm_storeu_si128((__m128i*)(data + i), _mm_subs_epu8(pix, fade));
+	}
+	return i;
+}
+
+PROC_SSE2_FUNC static int ProcHeatSSE2(ubyte* data, int count, ubyte val, ubyte heat)
+{
+	__m128i lo = _mm_set1_epi8((char)val);
+	__m128i hi = _mm_set1_epi8((char)heat);
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i pix = _mm_loadu_si128((__m128i*)(data + i));
+		__m128i above_lo = _mm_cmpeq_epi8(_mm_max_epu8(pix, lo), pix);
+		__m128i above_hi = _mm_cmpeq_epi8(_mm_max_epu8(pix, hi), pix);
+		// The mask is -1 where the pixel is in range
+		_mm_storeu_si128((__m128i*)(data + i), _mm_sub_epi8(pix, _mm_andnot_si128(above_hi, above_lo)));
+	}
+	return i;
+}
+
+PROC_SSE2_FUNC static int ProcBlendRowSSE2(const ubyte* row, const ubyte* downrow, ubyte* out)
+{
+	__m128i zero = _mm_setzero_si128();
+	int x = 1;
+	for (; x + 16 <= PROC_SIZE - 1; x += 16)
+	{
+		__m128i c = _mm_loadu_si128((__m128i*)(row + x));
+		__m128i r = _mm_loadu_si128((__m128i*)(row + x + 1));
+		__m128i l = _mm_loadu_si128((__m128i*)(row + x - 1));
+		__m128i d = _mm_loadu_si128((__m128i*)(downrow + x));
+		__m128i sum_lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(r, zero)),
+			_mm_add_epi16(_mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(d, zero)));
+		__m128i sum_hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(r, zero)),
+			_mm_add_epi16(_mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(d, zero)));
+		_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(_mm_srli_epi16(sum_lo, 2), _mm_srli_epi16(sum_hi, 2)));
+	}
+	return x;
+}
+
+PROC_SSE2_FUNC static int ProcCalcWaterRowSSE2(const short* row, short* out, int density)
+{
+	__m128i shift = _mm_cvtsi32_si128(density);
+	int x = 1;
+	for (; x + 8 <= PROC_SIZE - 1; x += 8)
+	{
+		__m128i down = _mm_loadu_si128((__m128i*)(row + x + PROC_SIZE));
+		__m128i up = _mm_loadu_si128((__m128i*)(row + x - PROC_SIZE));
+		__m128i right = _mm_loadu_si128((__m128i*)(row + x + 1));
+		__m128i left = _mm_loadu_si128((__m128i*)(row + x - 1));
+		__m128i prev = _mm_loadu_si128((__m128i*)(out + x));
+		__m128i result[2];
+
+		// Done in 32 bits like the scalar code, so sums can't wrap
+		for (int half = 0; half < 2; half++)
+		{
+			__m128i d = half ? _mm_unpackhi_epi16(down, down) : _mm_unpacklo_epi16(down, down);
+			__m128i u = half ? _mm_unpackhi_epi16(up, up) : _mm_unpacklo_epi16(up, up);
+			__m128i r = half ? _mm_unpackhi_epi16(right, right) : _mm_unpacklo_epi16(right, right);
+			__m128i l = half ? _mm_unpackhi_epi16(left, left) : _mm_unpacklo_epi16(left, left);
+			__m128i p = half ? _mm_unpackhi_epi16(prev, prev) : _mm_unpacklo_epi16(prev, prev);
+			__m128i newh = _mm_add_epi32(_mm_add_epi32(_mm_srai_epi32(d, 16), _mm_srai_epi32(u, 16)),
+				_mm_add_epi32(_mm_srai_epi32(r, 16), _mm_srai_epi32(l, 16)));
+			newh = _mm_sub_epi32(_mm_srai_epi32(newh, 1), _mm_srai_epi32(p, 16));
+			newh = _mm_sub_epi32(newh, _mm_sra_epi32(newh, shift));
+			// Truncate to 16 bits the way the store to a short does
+			result[half] = _mm_srai_epi32(_mm_slli_epi32(newh, 16), 16);
+		}
+		_mm_storeu_si128((__m128i*)(out + x), _mm_packs_epi32(result[0], result[1]));
+	}
+	return x;
+}
+#endif
+
+// Fades a page of fire data by fadeval, stopping at black
+static void ProcFadeKernel(ubyte* data, int count, int fadeval)
+{
+	int i = 0;
+#ifdef PROC_SSE2
+	if (Proc_simd)
+		i = ProcFadeSSE2(data, count, fadeval);
+#endif
+	for (; i < count; i++)
+		data[i] = data[i] > fadeval ? data[i] - fadeval : 0;
+}
+
+// Raises every pixel in [255 - heat, heat) by one
+static void ProcHeatKernel(ubyte* data, int count, ubyte heat)
+{
+	ubyte val = 255 - heat;
+	int i = 0;
+#ifdef PROC_SSE2
+	if (Proc_simd)
+		i = ProcHeatSSE2(data, count, val, heat);
+#endif
+	for (; i < count; i++)
+		data[i] += (data[i] < heat && data[i] >= val);
+}
+
+// Averages each pixel of src with its left, right and lower neighbours into dest, wrapping at the edges
+static void ProcBlendKernel(const ubyte* src, ubyte* dest)
+{
+	for (int y = 0; y < PROC_SIZE; y++)
+	{
+		const ubyte* row = src + y * PROC_SIZE;
+		const ubyte* downrow = src + ((y + 1) & (PROC_SIZE - 1)) * PROC_SIZE;
+		ubyte* out = dest + y * PROC_SIZE;
+
+		out[0] = (row[0] + row[1] + row[PROC_SIZE - 1] + downrow[0]) >> 2;
+		out[PROC_SIZE - 1] = (row[PROC_SIZE - 1] + row[0] + row[PROC_SIZE - 2] + downrow[PROC_SIZE - 1]) >> 2;
+
+		int x = 1;
+#ifdef PROC_SSE2
+		if (Proc_simd)
+			x = ProcBlendRowSSE2(row, downrow, out);
+#endif
+		for (; x < PROC_SIZE - 1; x++)
+			out[x] = (row[x] + row[x + 1] + row[x - 1] + downrow[x]) >> 2;
+	}
+}
+
+// Looks a page of fire data up in a palette
+static void ProcPaletteKernel(const ubyte* src, const ushort* pal, ushort* dest)
+{
+	for (int i = 0; i < PROC_SIZE * PROC_SIZE; i++)
+		dest[i] = pal[src[i]];
+}
+
 // Fades an entire bitmap one step closer to black
 void FadeProcTexture(int tex_handle)
 {
-	int total = PROC_SIZE * PROC_SIZE;
-	ubyte* src_data = ProcDestData;
 	int fadeval;
 	fadeval = 255 - GameTextures[tex_handle].procedural->heat;
 	fadeval >>= 3;
 	fadeval++;
 
-	for (int i = 0; i < total; i++, src_data++)
-	{
-		int pix = *src_data;
-		if (pix)
-		{
-			if (pix - fadeval <= 0)
-				*src_data = 0;
-			else
-				*src_data = pix - fadeval;
-		}
-	}
+	ProcFadeKernel(ProcDestData, PROC_SIZE * PROC_SIZE, fadeval);
 }
 
 // Heats an entire bitmap 
 void HeatProcTexture(int tex_handle)
 {
-	int total = PROC_SIZE * PROC_SIZE;
-	ubyte* src_data = ProcDestData;
-	ubyte val;
-	ubyte heat = GameTextures[tex_handle].procedural->heat;
-	val = 255 - heat;
-
-	for (int i = 0; i < total; i++, src_data++)
-	{
-		int pix = *src_data;
-		if (pix < heat && pix >= val)
-			(*src_data)++;
-	}
+	ProcHeatKernel(ProcDestData, PROC_SIZE * PROC_SIZE, GameTextures[tex_handle].procedural->heat);
 }
 
 // Fades and entire bitmap one step closer to black
 void BlendProcTexture(int tex_handle)
 {
-	int total = PROC_SIZE * PROC_SIZE;
-	ubyte* src_data = (ubyte*)GameTextures[tex_handle].procedural->proc1;
-	ubyte* dest_data = (ubyte*)GameTextures[tex_handle].procedural->proc2;
-	ubyte* start_data = src_data;
-
-	for (int i = 0; i < PROC_SIZE; i++)
-	{
-		ubyte* downrow;
-		ubyte* start_row = src_data;
-		// Get row underneath
-		if (i != PROC_SIZE - 1)
-			downrow = src_data + PROC_SIZE;
-		else
-			downrow = start_data;
-		for (int t = 0; t < PROC_SIZE; t++, src_data++, dest_data++, downrow++)
-		{
-			// Get center
-			total = *src_data;
-			// Get right
-			if (t != PROC_SIZE - 1)
-				total += *(src_data + 1);
-			else
-				total += *(start_row);
-			// Get left
-			if (t)
-				total += *(src_data - 1);
-			else
-				total += *(start_row + PROC_SIZE - 1);
-
-			// Get below
-			total += *(downrow);
-			total >>= 2;
-			*dest_data = total;
-		}
-	}
+	ProcBlendKernel((ubyte*)GameTextures[tex_handle].procedural->proc1, (ubyte*)GameTextures[tex_handle].procedural->proc2);
 }
 
 // Draws lightning into a bitmap
@@ -946,232 +1100,125 @@ void DoDynamicFallLeft(int handle, dynamic_proc_element* proc)
 	}
 }
 
-void CalcWater2(int handle, int density)
+// Steps one edge pixel of the height field, wrapping around the texture
+static inline void ProcWaterEdge(const short* oldptr, short* newptr, int x, int y, int density, bool diagonals)
 {
+	const short* up = oldptr + ((y - 1) & (PROC_SIZE - 1)) * PROC_SIZE;
+	const short* row = oldptr + y * PROC_SIZE;
+	const short* down = oldptr + ((y + 1) & (PROC_SIZE - 1)) * PROC_SIZE;
+	int left = (x - 1) & (PROC_SIZE - 1);
+	int right = (x + 1) & (PROC_SIZE - 1);
 	int newh;
-	int count = PROC_SIZE + 1;
-	proc_struct* procedural = GameTextures[handle].procedural;
 
-	short* newptr = (short*)procedural->proc2;
-	short* oldptr = (short*)procedural->proc1;
+	newh = down[x] + up[x] + row[right] + row[left];
+	if (diagonals)
+	{
+		newh += up[left] + up[right] + down[left] + down[right];
+		newh >>= 2;
+	}
+	else
+		newh >>= 1;
+	newh -= newptr[y * PROC_SIZE + x];
+	newptr[y * PROC_SIZE + x] = newh - (newh >> density);
+}
 
+// Steps the edges of the height field, which wrap around to the other side
+static void ProcWaterEdges(const short* oldptr, short* newptr, int density, bool diagonals)
+{
 	int x, y;
-
-	// Do main block
-	for (y = 1; y < (PROC_SIZE - 1); y++, count += 2)
+	for (x = 0; x < PROC_SIZE; x++)
 	{
-		for (x = 1; x < PROC_SIZE - 1; x++, count++)
-		{
-			newh = ((oldptr[count + PROC_SIZE]
-				+ oldptr[count - PROC_SIZE]
-				+ oldptr[count + 1]
-				+ oldptr[count - 1]
-				+ oldptr[count - PROC_SIZE - 1]
-				+ oldptr[count - PROC_SIZE + 1]
-				+ oldptr[count + PROC_SIZE - 1]
-				+ oldptr[count + PROC_SIZE + 1]
-				) >> 2)
-				- newptr[count];
-			newptr[count] = newh - (newh >> density);
-		}
+		ProcWaterEdge(oldptr, newptr, x, 0, density, diagonals);
+		ProcWaterEdge(oldptr, newptr, x, PROC_SIZE - 1, density, diagonals);
 	}
-	int up, down, left, right;
-	count = 0;
-	for (y = 0; y < PROC_SIZE; y++)
+	for (y = 1; y < PROC_SIZE - 1; y++)
 	{
-		if (y == 0)
-			up = -((PROC_SIZE - 1) * PROC_SIZE);
-		else
-			up = PROC_SIZE;
-		if (y == PROC_SIZE - 1)
-			down = -((PROC_SIZE - 1) * PROC_SIZE);
-		else
-			down = PROC_SIZE;
-		for (x = 0; x < PROC_SIZE; x++, count++)
-		{
-			if ((y != 0 && y != PROC_SIZE - 1) && x != 0 && x != PROC_SIZE - 1)
-			{
-				if (x == 1)
-				{
-					x = PROC_SIZE - 2;
-					count += (PROC_SIZE - 3);
-				}
-				continue;
-			}
-			if (x == 0)
-				left = -(PROC_SIZE - 1);
-			else
-				left = 1;
-
-			if (x == PROC_SIZE - 1)
-				right = -(PROC_SIZE - 1);
-			else
-				right = 1;
-			newh = oldptr[count + down];
-			newh += oldptr[count - up];
-			newh += oldptr[count + right];
-			newh += oldptr[count - left];
-			newh += oldptr[count - up - left];
-			newh += oldptr[count - up + right];
-			newh += oldptr[count + down - left];
-			newh += oldptr[count + down + right];
-			newh >>= 2;
-			newh -= newptr[count];
-			newptr[count] = newh - (newh >> density);
-		}
+		ProcWaterEdge(oldptr, newptr, 0, y, density, diagonals);
+		ProcWaterEdge(oldptr, newptr, PROC_SIZE - 1, y, density, diagonals);
 	}
 }
 
-void CalcWater(int handle, int density)
+// Steps the height field from its four neighbours: newptr holds the page before oldptr, and gets the next one
+static void ProcCalcWaterKernel(const short* oldptr, short* newptr, int density)
 {
-	int newh;
-	int count = PROC_SIZE + 1;
-	proc_struct* procedural = GameTextures[handle].procedural;
-
-	short* newptr = (short*)procedural->proc2;
-	short* oldptr = (short*)procedural->proc1;
-
-	int x, y;
-
-	// Do main block
-	for (y = 1; y < (PROC_SIZE - 1); y++, count += 2)
+	for (int y = 1; y < PROC_SIZE - 1; y++)
 	{
-		for (x = 1; x < PROC_SIZE - 1; x++, count++)
+		const short* row = oldptr + y * PROC_SIZE;
+		short* out = newptr + y * PROC_SIZE;
+		int x = 1;
+#ifdef PROC_SSE2
+		if (Proc_simd)
+			x = ProcCalcWaterRowSSE2(row, out, density);
+#endif
+		for (; x < PROC_SIZE - 1; x++)
 		{
-			newh = ((oldptr[count + PROC_SIZE]
-				+ oldptr[count - PROC_SIZE]
-				+ oldptr[count + 1]
-				+ oldptr[count - 1]
-				) >> 1)
-				- newptr[count];
-			newptr[count] = newh - (newh >> density);
+			int newh = ((row[x + PROC_SIZE] + row[x - PROC_SIZE] + row[x + 1] + row[x - 1]) >> 1) - out[x];
+			out[x] = newh - (newh >> density);
 		}
 	}
-	int up, down, left, right;
-	count = 0;
-	for (y = 0; y < PROC_SIZE; y++)
+	ProcWaterEdges(oldptr, newptr, density, false);
+}
+
+// Same as ProcCalcWaterKernel, but uses all eight neighbours
+static void ProcCalcWater2Kernel(const short* oldptr, short* newptr, int density)
+{
+	for (int y = 1; y < PROC_SIZE - 1; y++)
 	{
-		if (y == 0)
-			up = -((PROC_SIZE - 1) * PROC_SIZE);
-		else
-			up = PROC_SIZE;
-		if (y == PROC_SIZE - 1)
-			down = -((PROC_SIZE - 1) * PROC_SIZE);
-		else
-			down = PROC_SIZE;
-		for (x = 0; x < PROC_SIZE; x++, count++)
+		const short* row = oldptr + y * PROC_SIZE;
+		const short* up = row - PROC_SIZE;
+		const short* down = row + PROC_SIZE;
+		short* out = newptr + y * PROC_SIZE;
+		for (int x = 1; x < PROC_SIZE - 1; x++)
 		{
-			if ((y != 0 && y != PROC_SIZE - 1) && x != 0 && x != PROC_SIZE - 1)
-			{
-				if (x == 1)
-				{
-					x = PROC_SIZE - 2;
-					count += (PROC_SIZE - 3);
-				}
-				continue;
-			}
-			if (x == 0)
-				left = -(PROC_SIZE - 1);
-			else
-				left = 1;
-
-			if (x == PROC_SIZE - 1)
-				right = -(PROC_SIZE - 1);
-			else
-				right = 1;
-			newh = oldptr[count + down];
-			newh += oldptr[count - up];
-			newh += oldptr[count + right];
-			newh += oldptr[count - left];
-			newh >>= 1;
-			newh -= newptr[count];
-			newptr[count] = newh - (newh >> density);
+			int newh = ((down[x] + up[x] + row[x + 1] + row[x - 1]
+				+ up[x - 1] + up[x + 1] + down[x - 1] + down[x + 1]) >> 2) - out[x];
+			out[x] = newh - (newh >> density);
 		}
 	}
+	ProcWaterEdges(oldptr, newptr, density, true);
 }
 
-void DrawWaterNoLight(int handle)
+// Refracts the source bitmap through the slope of the height field
+static void ProcDrawWaterNoLightKernel(const short* ptr, const ushort* src_data, ushort* dest_data)
 {
-	int dx, dy;
-	int x, y;
-	int offset = 0;
-	proc_struct* procedural = GameTextures[handle].procedural;
-	int dest_bitmap = procedural->procedural_bitmap;
-	ushort* dest_data = (ushort*)bm_data(dest_bitmap, 0);
-	ushort* src_data = (ushort*)bm_data(GameTextures[handle].bm_handle, 0);
-	short* ptr = (short*)procedural->proc1;
-	for (y = 0; y < PROC_SIZE; y++)
+	for (int y = 0; y < PROC_SIZE; y++)
 	{
-		for (x = 0; x < PROC_SIZE; x++, offset++)
+		const short* row = ptr + y * PROC_SIZE;
+		const short* down = ptr + ((y + 1) & (PROC_SIZE - 1)) * PROC_SIZE;
+		ushort* out = dest_data + y * PROC_SIZE;
+		for (int x = 0; x < PROC_SIZE; x++)
 		{
-			if (x == PROC_SIZE - 1)
-				dx = ptr[offset] - ptr[offset - (PROC_SIZE - 1)];
-			else
-				dx = ptr[offset] - ptr[offset + 1];
-			if (y == PROC_SIZE - 1)
-				dy = ptr[offset] - ptr[offset - ((PROC_SIZE - 1) * PROC_SIZE)];
-			else
-				dy = ptr[offset] - ptr[offset + PROC_SIZE];
+			int dx = row[x] - row[(x + 1) & (PROC_SIZE - 1)];
+			int dy = row[x] - down[x];
 			if (dy < 0)
 				dy = 0;
 			if (dx < 0)
 				dx = 0;
 
-			int yoffset = (y + (dy >> 3)) % PROC_SIZE;
-			int xoffset = (x + (dx >> 3)) % PROC_SIZE;
-			dest_data[offset] = src_data[yoffset * PROC_SIZE + xoffset];
-
+			int yoffset = (y + (dy >> 3)) & (PROC_SIZE - 1);
+			int xoffset = (x + (dx >> 3)) & (PROC_SIZE - 1);
+			out[x] = src_data[yoffset * PROC_SIZE + xoffset];
 		}
 	}
 }
 
-void DrawWaterWithLight(int handle, int lightval)
+// Refracts the source bitmap through the height field, and shades it by the slope
+static void ProcDrawWaterWithLightKernel(const short* ptr, const ushort* src_data, ushort* dest_data, int lightval)
 {
-	int dx, dy;
-	int x, y;
-	ushort c;
-	int offset = 0;
-	proc_struct* procedural = GameTextures[handle].procedural;
-	int dest_bitmap = procedural->procedural_bitmap;
-	ushort* dest_data = (ushort*)bm_data(dest_bitmap, 0);
-	ushort* src_data = (ushort*)bm_data(GameTextures[handle].bm_handle, 0);
-	short* ptr = (short*)procedural->proc1;
-	for (y = 0; y < PROC_SIZE; y++)
+	for (int y = 0; y < PROC_SIZE; y++)
 	{
-		int ychange, ychange2;
-		if (y == PROC_SIZE - 1)
-		{
-			ychange = PROC_SIZE;
-			ychange2 = ((PROC_SIZE - 1) * PROC_SIZE);
-		}
-		else if (y == 0)
-		{
-			ychange = -((PROC_SIZE - 1) * PROC_SIZE);
-			ychange2 = -PROC_SIZE;
-		}
-		else
+		const short* up = ptr + ((y - 1) & (PROC_SIZE - 1)) * PROC_SIZE;
+		const short* row = ptr + y * PROC_SIZE;
+		const short* down = ptr + ((y + 1) & (PROC_SIZE - 1)) * PROC_SIZE;
+		ushort* out = dest_data + y * PROC_SIZE;
+		for (int x = 0; x < PROC_SIZE; x++)
 		{
-			ychange = PROC_SIZE;
-			ychange2 = -PROC_SIZE;
-		}
+			int dx = row[(x - 1) & (PROC_SIZE - 1)] - row[(x + 1) & (PROC_SIZE - 1)];
+			int dy = up[x] - down[x];
 
-		for (x = 0; x < PROC_SIZE; x++, offset++)
-		{
-			if (x == PROC_SIZE - 1)
-				dx = ptr[offset - 1] - ptr[offset - (PROC_SIZE - 1)];
-			else if (x == 0)
-				dx = ptr[offset + (PROC_SIZE - 1)] - ptr[offset + 1];
-			else
-				dx = ptr[offset - 1] - ptr[offset + 1];
-			dy = ptr[offset - ychange] - ptr[offset - ychange2];
-
-			int yoffset = (y + (dy >> 3));
-			int xoffset = (x + (dx >> 3));
-			yoffset &= (PROC_SIZE - 1);
-			xoffset &= (PROC_SIZE - 1);
-			ASSERT(yoffset >= 0);
-			ASSERT(xoffset >= 0);
-			c = src_data[yoffset * PROC_SIZE + xoffset];
+			int yoffset = (y + (dy >> 3)) & (PROC_SIZE - 1);
+			int xoffset = (x + (dx >> 3)) & (PROC_SIZE - 1);
+			ushort c = src_data[yoffset * PROC_SIZE + xoffset];
 			int l = (NUM_WATER_SHADES / 2) - (dx >> lightval);
 			if (l > (NUM_WATER_SHADES - 1))
 				l = NUM_WATER_SHADES - 1;
@@ -1179,13 +1226,35 @@ void DrawWaterWithLight(int handle, int lightval)
 				l = 0;
 			c &= ~OPAQUE_FLAG;
 
-			c = WaterProcTableHi[l][c >> 8] + WaterProcTableLo[l][c & 0xFF];
-
-			dest_data[offset] = c;
+			out[x] = WaterProcTableHi[l][c >> 8] + WaterProcTableLo[l][c & 0xFF];
 		}
 	}
 }
 
+void CalcWater2(int handle, int density)
+{
+	proc_struct* procedural = GameTextures[handle].procedural;
+	ProcCalcWater2Kernel((short*)procedural->proc1, (short*)procedural->proc2, density);
+}
+
+void CalcWater(int handle, int density)
+{
+	proc_struct* procedural = GameTextures[handle].procedural;
+	ProcCalcWaterKernel((short*)procedural->proc1, (short*)procedural->proc2, density);
+}
+
+void DrawWaterNoLight(int handle)
+{
+	proc_struct* procedural = GameTextures[handle].procedural;
+	ProcDrawWaterNoLightKernel((short*)procedural->proc1, bm_data(GameTextures[handle].bm_handle, 0), bm_data(procedural->procedural_bitmap, 0));
+}
+
+void DrawWaterWithLight(int handle, int lightval)
+{
+	proc_struct* procedural = GameTextures[handle].procedural;
+	ProcDrawWaterWithLightKernel((short*)procedural->proc1, bm_data(GameTextures[handle].bm_handle, 0), bm_data(procedural->procedural_bitmap, 0), lightval);
+}
+
 void AddProcHeightBlob(static_proc_element* proc, int handle)
 {
 	int rquad;
@@ -1304,6 +1373,141 @@ void AddProcSineBlob(static_proc_element* proc, int handle)
 	}
 }
 
+// Steps a procedural's pages and draws its image, as set up by ProcStartJob
+static void ProcJobRun(proc_job* job)
+{
+	if (job->water)
+	{
+		if (job->lightval < 0)
+			ProcDrawWaterNoLightKernel((short*)job->page, job->src_data, job->dest);
+		else
+			ProcDrawWaterWithLightKernel((short*)job->page, job->src_data, job->dest, job->lightval);
+		ProcCalcWaterKernel((short*)job->page, (short*)job->next_page, job->density);
+	}
+	else
+	{
+		ProcBlendKernel((ubyte*)job->page, (ubyte*)job->next_page);
+		ProcPaletteKernel((ubyte*)job->next_page, job->src_data, job->dest);
+	}
+}
+
+static void ProcJobWorker(void* data)
+{
+	proc_job* job = (proc_job*)data;
+	ProcJobRun(job);
+
+	std::lock_guard<std::mutex> lock(Proc_job_mutex);
+	job->done = true;
+	Proc_job_done.notify_all();
+}
+
+// Runs the rest of a procedural's update once its elements have been drawn into proc1.
+// The pages are swapped for next time straight away, but aren't touched again until the
+// job has been collected.  Without worker threads the image goes straight into the bitmap.
+static void ProcStartJob(int handle, bool water, const ushort* src_data, int density, int lightval)
+{
+	proc_struct* procedural = GameTextures[handle].procedural;
+	proc_job* job = Proc_jobs[handle];
+	if (!job)
+	{
+		job = (proc_job*)mem_malloc(sizeof(proc_job));
+		ASSERT(job);
+		job->queued = false;
+		Proc_jobs[handle] = job;
+	}
+	ASSERT(!job->queued);
+
+	job->water = water;
+	job->page = procedural->proc1;
+	job->next_page = procedural->proc2;
+	job->src_data = src_data;
+	job->density = density;
+	job->lightval = lightval;
+
+	procedural->proc1 = job->next_page;
+	procedural->proc2 = job->page;
+
+	if (Proc_serial || !job_GetNumThreads())
+	{
+		job->dest = bm_data(procedural->procedural_bitmap, 0);
+		ProcJobRun(job);
+		return;
+	}
+
+	job->dest = job->back;
+	job->done = false;
+	job->queued = true;
+	job_Submit(ProcJobWorker, job);
+}
+
+// Copies a finished background update into the texture's procedural bitmap.
+// If wait is set, waits for an update that is still running, otherwise leaves it.
+// Returns true if the bitmap changed.
+bool CollectProcedural(int texnum, bool wait)
+{
+	proc_job* job = Proc_jobs[texnum];
+	if (!job || !job->queued)
+		return false;
+
+	{
+		std::unique_lock<std::mutex> lock(Proc_job_mutex);
+		if (!job->done && !wait)
+			return false;
+		Proc_job_done.wait(lock, [job] { return job->done; });
+	}
+
+	job->queued = false;
+	memcpy(bm_data(GameTextures[texnum].procedural->procedural_bitmap, 0), job->back, sizeof(job->back));
+	return true;
+}
+
+// Waits for any update still running on a texture and frees its job
+void FreeProceduralJob(int texnum)
+{
+	proc_job* job = Proc_jobs[texnum];
+	if (!job)
+		return;
+
+	if (job->queued)
+	{
+		std::unique_lock<std::mutex> lock(Proc_job_mutex);
+		Proc_job_done.wait(lock, [job] { return job->done; });
+	}
+
+	mem_free(job);
+	Proc_jobs[texnum] = NULL;
+}
+
+// Called each time a procedural texture is drawn.  Returns false if it should skip its update
+// this frame.  When more procedurals were on screen last frame than Proc_updates_per_frame, each
+// one only updates every few frames, staggered by handle so the updates are spread out.
+bool ProceduralUpdateDue(int texnum)
+{
+	if (Proc_count_frame != FrameCount)
+	{
+		Proc_visible_last = Proc_visible_count;
+		Proc_visible_count = 0;
+		Proc_count_frame = FrameCount;
+	}
+
+	if (Proc_visible_frame[texnum] != FrameCount)
+	{
+		Proc_visible_frame[texnum] = FrameCount;
+		Proc_visible_count++;
+	}
+
+	if (Proc_updates_per_frame <= 0 || Proc_visible_last <= Proc_updates_per_frame)
+		return true;
+
+	int interval = (Proc_visible_last + Proc_updates_per_frame - 1) / Proc_updates_per_frame;
+
+	// Textures that have just come into view are updated right away
+	if (FrameCount - GameTextures[texnum].procedural->last_procedural_frame > interval)
+		return true;
+
+	return ((FrameCount + texnum) % interval) == 0;
+}
+
 void AllocateMemoryForWaterProcedural(int handle)
 {
 	proc_struct* procedural = GameTextures[handle].procedural;
@@ -1381,11 +1585,6 @@ void EvaluateWaterProcedural(int handle)
 		EasterEgg = 0;
 	}
 
-	// Calculate the water on the current texture
-	if (!procedural->light)
-		DrawWaterNoLight(handle);
-	else
-		DrawWaterWithLight(handle, procedural->light - 1);
 	int thickness = procedural->thickness;
 	if (procedural->osc_time > 0)
 	{
@@ -1415,11 +1614,8 @@ void EvaluateWaterProcedural(int handle)
 		}
 	}
 
-	CalcWater(handle, thickness);
-	// Swap for next time
-	short* temp = (short*)procedural->proc1;
-	procedural->proc1 = procedural->proc2;
-	procedural->proc2 = temp;
+	// Draw the water from the current page and calculate the next one
+	ProcStartJob(handle, true, bm_data(GameTextures[handle].bm_handle, 0), thickness, procedural->light - 1);
 }
 
 void AllocateMemoryForFireProcedural(int handle)
@@ -1445,7 +1641,6 @@ void EvaluateFireProcedural(int handle)
 {
 	proc_struct* procedural = GameTextures[handle].procedural;
 
-	int dest_bitmap = procedural->procedural_bitmap;
 	if (procedural->memory_type != PROC_MEMORY_TYPE_FIRE)
 		AllocateMemoryForFireProcedural(handle);
 	
@@ -1532,21 +1727,8 @@ void EvaluateFireProcedural(int handle)
 		proc_num = DynamicProcElements[proc_num].next;
 	}
 
-	// blend the current texture
-	BlendProcTexture(handle);
-	ProcDestData = (ubyte*)procedural->proc2;
-	int total = PROC_SIZE * PROC_SIZE;
-	ushort* data = bm_data(dest_bitmap, 0);
-	ushort* pal = procedural->palette;
-	for (int i = 0; i < total; i++, data++, ProcDestData++)
-	{
-		*data = pal[*ProcDestData];
-	}
-
-	// Swap for next time
-	ubyte* temp = (ubyte*)procedural->proc1;
-	procedural->proc1 = procedural->proc2;
-	procedural->proc2 = temp;
+	// blend the current texture into the next page and draw it
+	ProcStartJob(handle, false, procedural->palette, 0, 0);
 }
 
 // Does a procedural for this texture
@@ -1561,8 +1743,159 @@ void EvaluateProcedural(int handle)
 		return;
 	}
 
+	// The last update has to be finished before this one can use the pages
+	CollectProcedural(handle, true);
+
 	if (GameTextures[handle].flags & TF_WATER_PROCEDURAL)
 		EvaluateWaterProcedural(handle);
 	else
 		EvaluateFireProcedural(handle);
 }
+
+#define TEST_PROC_TEXTURES	16
+#define TEST_PROC_STEPS		256
+
+// A made up procedural for TestProcedurals, half fire and half water
+struct test_procedural
+{
+	proc_job job;
+	unsigned int seed;
+	ubyte fire_pages[2][PROC_SIZE * PROC_SIZE];
+	short water_pages[2][PROC_SIZE * PROC_SIZE];
+};
+
+static ushort Test_water_source[PROC_SIZE * PROC_SIZE];
+static ushort Test_fire_palette[256];
+
+static int TestProcRand(test_procedural* tp)
+{
+	tp->seed = tp->seed * 214013 + 2531011;
+	return (tp->seed >> 16) & 0x7fff;
+}
+
+// Adds a few elements to one test procedural and runs its update, like EvaluateProcedural does
+static void TestProceduralStep(void* data, int index)
+{
+	test_procedural* tp = &((test_procedural*)data)[index];
+	proc_job* job = &tp->job;
+	int i;
+
+	if (job->water)
+	{
+		short* page = (short*)job->page;
+		for (i = 0; i < 2; i++)
+		{
+			int x = 2 + TestProcRand(tp) % (PROC_SIZE - 4);
+			int y = 2 + TestProcRand(tp) % (PROC_SIZE - 4);
+			for (int cy = -1; cy <= 1; cy++)
+				for (int cx = -1; cx <= 1; cx++)
+					page[(y + cy) * PROC_SIZE + x + cx] += 200;
+		}
+	}
+	else
+	{
+		ubyte* page = (ubyte*)job->page;
+		ProcFadeKernel(page, PROC_SIZE * PROC_SIZE, ((255 - 128) >> 3) + 1);
+		for (i = 0; i < 64; i++)
+			page[TestProcRand(tp) % (PROC_SIZE * PROC_SIZE)] = BRIGHT_COLOR;
+	}
+
+	ProcJobRun(job);
+
+	void* temp = job->page;
+	job->page = job->next_page;
+	job->next_page = temp;
+}
+
+static unsigned int HashProcData(const void* data, int size, unsigned int hash)
+{
+	const ubyte* bytes = (const ubyte*)data;
+	for (int i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 16777619;
+	return hash;
+}
+
+// Times the procedural kernels on made up fire and water textures, with and without SIMD and
+// with the textures spread over the job pool, and checks they all come out the same.
+// Runs at startup, so it doesn't count on InitProcedurals having been called.
+void TestProcedurals()
+{
+	static const char* mode_names[] = { "scalar", "SIMD", "SIMD on the job pool" };
+	test_procedural* textures = (test_procedural*)mem_malloc(sizeof(test_procedural) * TEST_PROC_TEXTURES);
+	unsigned int hashes[TEST_PROC_TEXTURES];
+	bool old_simd = Proc_simd;
+	bool has_sse2 = ProcCPUHasSSE2();
+	int i;
+
+	for (i = 0; i < PROC_SIZE * PROC_SIZE; i++)
+		Test_water_source[i] = OPAQUE_FLAG | (i * 37);
+	for (i = 0; i < 256; i++)
+		Test_fire_palette[i] = OPAQUE_FLAG | (i * 97);
+
+	for (int mode = 0; mode < 3; mode++)
+	{
+		Proc_simd = (mode != 0) && has_sse2;
+
+		for (i = 0; i < TEST_PROC_TEXTURES; i++)
+		{
+			test_procedural* tp = &textures[i];
+			proc_job* job = &tp->job;
+
+			memset(tp->fire_pages, 0, sizeof(tp->fire_pages));
+			memset(tp->water_pages, 0, sizeof(tp->water_pages));
+			tp->seed = i + 1;
+			job->water = (i & 1) != 0;
+			job->page = job->water ? (void*)tp->water_pages[0] : (void*)tp->fire_pages[0];
+			job->next_page = job->water ? (void*)tp->water_pages[1] : (void*)tp->fire_pages[1];
+			job->src_data = job->water ? Test_water_source : Test_fire_palette;
+			job->density = 4;
+			job->lightval = (i & 2) ? 0 : -1;
+			job->dest = job->back;
+		}
+
+		double start = timer_GetTime64();
+		for (int step = 0; step < TEST_PROC_STEPS; step++)
+		{
+			if (mode == 2)
+				job_ParallelFor(TEST_PROC_TEXTURES, TestProceduralStep, textures);
+			else
+			{
+				for (i = 0; i < TEST_PROC_TEXTURES; i++)
+					TestProceduralStep(textures, i);
+			}
+		}
+		double time = timer_GetTime64() - start;
+
+		int num_mismatches = 0;
+		for (i = 0; i < TEST_PROC_TEXTURES; i++)
+		{
+			test_procedural* tp = &textures[i];
+			unsigned int hash = 2166136261u;
+			hash = HashProcData(tp->fire_pages, sizeof(tp->fire_pages), hash);
+			hash = HashProcData(tp->water_pages, sizeof(tp->water_pages), hash);
+			hash = HashProcData(tp->job.back, sizeof(tp->job.back), hash);
+			if (mode == 0)
+				hashes[i] = hash;
+			else if (hash != hashes[i])
+			{
+				num_mismatches++;
+				mprintf((0, "TestProcedurals: texture %d came out different %s\n", i, mode_names[mode]));
+			}
+		}
+
+		mprintf((0, "TestProcedurals: %s %.4f ms per texture update, %d mismatches\n", mode_names[mode],
+			time * 1000 / (TEST_PROC_STEPS * TEST_PROC_TEXTURES), num_mismatches));
+	}
+
+#ifdef PROC_SSE2
+	if (!has_sse2)
+		mprintf((0, "TestProcedurals: %d textures, %d steps, no SSE2 on this CPU, %d worker threads\n", TEST_PROC_TEXTURES, TEST_PROC_STEPS, job_GetNumThreads()));
+	else
+		mprintf((0, "TestProcedurals: %d textures, %d steps, SSE2 kernels, %d worker threads\n", TEST_PROC_TEXTURES, TEST_PROC_STEPS, job_GetNumThreads()));
+#else
+	mprintf((0, "TestProcedurals: %d textures, %d steps, no SIMD kernels in this build, %d worker threads\n", TEST_PROC_TEXTURES, TEST_PROC_STEPS, job_GetNumThreads()));
+#endif
+
+	Proc_simd = old_simd;
+	mem_free(textures);
+}
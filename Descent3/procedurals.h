@@ -86,8 +86,24 @@ void ProcElementUnlink(int index,int texnum);
 void ClearAllProceduralsFromTexture (int texnum);
 
 // Does a procedural for this texture
+// The update finishes on the job pool, and shows up in the bitmap when it is collected
 void EvaluateProcedural (int texnum);
 
+// Copies a finished background update into the texture's procedural bitmap
+// If wait is set, waits for an update that is still running
+// Returns true if the bitmap changed
+bool CollectProcedural (int texnum,bool wait);
+
+// Waits for any update still running on this texture and frees its job
+void FreeProceduralJob (int texnum);
+
+// Called each time a procedural texture is drawn.  Returns false if the texture should
+// skip its update this frame because too many procedurals are on screen
+bool ProceduralUpdateDue (int texnum);
+
+// Times the procedural kernels with and without SIMD and the job pool
+void TestProcedurals ();
+
 // Returns the next free procelement
 int ProcElementAllocate ();
 
@@ -48,6 +48,8 @@
 //Global array of rooms
 room Rooms[MAX_ROOMS + MAX_PALETTE_ROOMS];
 room_changes Room_changes[MAX_ROOM_CHANGES];
+ubyte Room_remesh_pending[MAX_ROOMS + MAX_PALETTE_ROOMS];
+int Room_physics_changes = 0;
 
 extern int Cur_selected_room, Cur_selected_face;
 
@@ -938,9 +940,17 @@ bool ChangeRoomFaceTexture(int room_num, int face_num, int texture)
 	fp->tmap = texture;
 	fp->flags |= FF_TEXTURE_CHANGED;
 	rp->room_change_flags |= RCF_TEXTURE;
+	MarkRoomForRemesh(room_num);
 	return true;
 }
 
+// Tells the renderer that a face in a room has changed in a way that changes how it's drawn
+void MarkRoomForRemesh(int roomnum)
+{
+	Room_remesh_pending[roomnum] = 1;
+	Room_physics_changes++;
+}
+
 // Clears the data for room changes
 void ClearRoomChanges()
 {
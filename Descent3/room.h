@@ -59,6 +59,8 @@ struct room_changes
 //
 extern	room	 	Rooms[];					//global sparse array of rooms
 extern	int		Highest_room_index;	//index of highest-numbered room
+extern	ubyte		Room_remesh_pending[];	//set for rooms whose faces have changed since the renderer last built their meshes
+extern	int		Room_physics_changes;	//bumped when a face or portal changes in a way that can change what a ray hits
 
 //
 // Macros
@@ -244,6 +246,10 @@ extern void GetIJ(const vector *normal,int *ii,int *jj);
 //	returns true on successs
 bool ChangeRoomFaceTexture(int room_num,int face_num,int texture);
 
+// Tells the renderer that a face in a room has changed in a way that changes how it's drawn.
+// Must be called whenever a face's texture or FF_DESTROYED flag is changed after the level is loaded.
+void MarkRoomForRemesh(int roomnum);
+
 // Clears the data for room changes
 void ClearRoomChanges ();
 
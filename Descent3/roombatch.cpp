@@ -0,0 +1,77 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include "roombatch.h"
+
+void RoomBatchBuilder::Reset()
+{
+	m_draws.clear();
+	m_batches.clear();
+	m_offsets.clear();
+	m_counts.clear();
+}
+
+void RoomBatchBuilder::Add(int bm_handle, int lm_handle, uint32_t offset, uint32_t count)
+{
+	if (count == 0)
+		return;
+
+	Draw draw;
+	draw.bm_handle = bm_handle;
+	draw.lm_handle = lm_handle;
+	draw.offset = offset;
+	draw.count = count;
+	draw.order = m_draws.size();
+	m_draws.push_back(draw);
+}
+
+void RoomBatchBuilder::Build()
+{
+	m_batches.clear();
+	m_offsets.clear();
+	m_counts.clear();
+
+	std::sort(m_draws.begin(), m_draws.end());
+
+	for (Draw& draw : m_draws)
+	{
+		if (m_batches.empty() || m_batches.back().bm_handle != draw.bm_handle || m_batches.back().lm_handle != draw.lm_handle)
+		{
+			Batch batch;
+			batch.bm_handle = draw.bm_handle;
+			batch.lm_handle = draw.lm_handle;
+			batch.first_range = m_offsets.size();
+			batch.num_ranges = 0;
+			m_batches.push_back(batch);
+		}
+
+		Batch& batch = m_batches.back();
+
+		//Rooms are meshed one after another, so neighbouring ranges often join up
+		if (batch.num_ranges > 0 && m_offsets.back() + m_counts.back() == draw.offset)
+		{
+			m_counts.back() += draw.count;
+			continue;
+		}
+
+		m_offsets.push_back(draw.offset);
+		m_counts.push_back(draw.count);
+		batch.num_ranges++;
+	}
+}
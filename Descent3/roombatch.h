@@ -0,0 +1,107 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+//Collects the index ranges drawn for a set of rooms and merges the ones that share a texture and
+//lightmap into batches, each of which can go out as one multi-draw call. Since every room vertex
+//carries its room number, rooms no longer need to be drawn one at a time.
+//Doesn't touch the renderer, so it can be used to count draw calls without a GL context.
+class RoomBatchBuilder
+{
+public:
+	struct Batch
+	{
+		int bm_handle;
+		int lm_handle;
+		//Range of entries in the offset and count lists
+		int first_range;
+		int num_ranges;
+	};
+
+private:
+	struct Draw
+	{
+		int bm_handle;
+		int lm_handle;
+		uint32_t offset, count;
+		//Order the draw was added in, to keep the sort stable
+		int order;
+
+		friend bool operator<(const Draw& l, const Draw& r)
+		{
+			if (l.bm_handle != r.bm_handle)
+				return l.bm_handle < r.bm_handle;
+			if (l.lm_handle != r.lm_handle)
+				return l.lm_handle < r.lm_handle;
+			return l.order < r.order;
+		}
+	};
+
+	std::vector<Draw> m_draws;
+	std::vector<Batch> m_batches;
+	std::vector<uint32_t> m_offsets;
+	std::vector<int> m_counts;
+
+public:
+	//Clears everything for a new set of draws. The lists keep their memory.
+	void Reset();
+
+	//Adds a range of indices drawn with the given bitmap and lightmap.
+	void Add(int bm_handle, int lm_handle, uint32_t offset, uint32_t count);
+
+	//Sorts the draws and merges them into batches. Index ranges that follow each other in the same batch are joined.
+	void Build();
+
+	//Number of draws added since the last reset. This is how many draw calls drawing them one by one would take.
+	int NumDraws() const
+	{
+		return m_draws.size();
+	}
+
+	//Number of batches, and so draw calls, after Build().
+	int NumBatches() const
+	{
+		return m_batches.size();
+	}
+
+	//Number of index ranges in all batches after Build().
+	int NumRanges() const
+	{
+		return m_offsets.size();
+	}
+
+	const Batch& GetBatch(int num) const
+	{
+		return m_batches[num];
+	}
+
+	//Offsets into the index buffer, in indices, and counts for the ranges of a batch.
+	const uint32_t* Offsets(const Batch& batch) const
+	{
+		return &m_offsets[batch.first_range];
+	}
+
+	const int* Counts(const Batch& batch) const
+	{
+		return &m_counts[batch.first_range];
+	}
+};
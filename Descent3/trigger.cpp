@@ -159,7 +159,10 @@ void CheckTrigger(int roomnum,int facenum,object *objp,int event_type)
 			{
 				tp->flags |= TF_DEAD;
 				if (fp->portal_num == -1)		//don't destroy a portal face
+				{
 					fp->flags |= FF_DESTROYED;
+					MarkRoomForRemesh(roomnum);
+				}
 			}
 
 			if(tp->flags & TF_INFORM_ACTIVATE_TO_LG)
@@ -43,6 +43,37 @@ bms_bitmap GameBitmaps[MAX_BITMAPS];
 ulong Bitmap_memory_used = 0;
 ubyte Bitmaps_initted = 0;
 
+bm_residency_stats Bitmap_residency_stats;
+float Bitmap_evict_idle_time = 60.0f;
+longlong Bitmap_residency_budget = 0;
+bool Bitmap_lazy_mips = true;
+
+// Bitmaps used this recently are never evicted to get under the budget
+#define BM_MIN_EVICT_IDLE		2.0f
+// How often bm_UpdateResidency looks for bitmaps to evict, in seconds
+#define BM_RESIDENCY_INTERVAL	0.5f
+
+// Residency state for each bitmap
+struct bm_residency
+{
+	float last_used;		// Bm_residency_time when the bitmap's data or size was last asked for
+	int resident_size;		// bytes of data16 held by a pageable bitmap, 0 if it isn't resident
+	bool pageable;			// data16 can be freed and paged back in from the bitmap's file
+	bool evicted;			// data16 was freed by the residency manager
+	bool mips_pending;		// mip levels have been allocated but not built yet
+};
+
+static bm_residency Bm_residency[MAX_BITMAPS];
+static float Bm_residency_time;
+static float Bm_next_residency_check;
+
+static inline void bm_Touch(int handle)
+{
+	Bm_residency[handle].last_used = Bm_residency_time;
+}
+
+static void bm_BuildMipMaps(int handle);
+
 // modify these lines to establish data type 
 typedef bms_bitmap* bm_T;         // type of item to be stored
 typedef int bm_hashTableIndex;     // index into hash table
@@ -284,6 +315,7 @@ int bm_AllocBitmap(int w, int h, int add_mem)
 		return -1;
 	}
 	memset(&GameBitmaps[n], 0, sizeof(bms_bitmap));
+	memset(&Bm_residency[n], 0, sizeof(bm_residency));
 	int ret = bm_AllocateMemoryForIndex(n, w, h, add_mem);
 	if (ret >= 0)
 	{
@@ -322,6 +354,7 @@ int bm_AllocNoMemBitmap(int w, int h)
 	// If no go on the malloc, bail out with -1
 
 	memset(&GameBitmaps[n], 0, sizeof(bms_bitmap));
+	memset(&Bm_residency[n], 0, sizeof(bm_residency));
 
 	GameBitmaps[n].width = w;
 	GameBitmaps[n].height = h;
@@ -387,6 +420,13 @@ void bm_FreeBitmapData(int handle)
 		}
 		mem_free(GameBitmaps[handle].data16);
 	}
+	if (Bm_residency[handle].resident_size)
+	{
+		Bitmap_residency_stats.resident_bytes -= Bm_residency[handle].resident_size;
+		Bitmap_residency_stats.resident_bitmaps--;
+		Bm_residency[handle].resident_size = 0;
+	}
+	Bm_residency[handle].mips_pending = false;
 	GameBitmaps[handle].cache_slot = -1;
 	GameBitmaps[handle].flags |= BF_NOT_RESIDENT;
 	if (GameBitmaps[handle].flags & BF_MIPMAPPED)
@@ -399,6 +439,7 @@ void bm_FreeBitmapMain(int handle)
 {
 	bm_deleteNode(&GameBitmaps[handle]);
 	bm_FreeBitmapData(handle);
+	memset(&Bm_residency[handle], 0, sizeof(bm_residency));
 	GameBitmaps[handle].data16 = NULL;
 	GameBitmaps[handle].cache_slot = -1;
 	GameBitmaps[handle].used = 0;
@@ -725,6 +766,7 @@ int bm_AllocLoadFileNoMemBitmap(const char* fname, int mipped, int format)
 	}
 	n = bm_AllocNoMemBitmap(1, 1);
 	strcpy(GameBitmaps[n].name, name);
+	Bm_residency[n].pageable = true;
 	if (mipped)
 		GameBitmaps[n].flags |= BF_WANTS_MIP;
 	if (format == BITMAP_FORMAT_4444)
@@ -907,6 +949,11 @@ int bm_MakeBitmapResident(int handle)
 {
 	if (GameBitmaps[handle].flags & BF_NOT_RESIDENT)
 	{
+		bm_residency* res = &Bm_residency[handle];
+		double start = timer_GetTime64();
+		char name[BITMAP_NAME_LEN];
+		strcpy(name, GameBitmaps[handle].name);
+
 		if (bm_page_in_file(handle) > 0)	//DAJ -1FIX
 		{
 			GameBitmaps[handle].flags &= ~BF_NOT_RESIDENT;
@@ -917,10 +964,116 @@ int bm_MakeBitmapResident(int handle)
 			mprintf((0, "Error paging in bitmap %s!\n", GameBitmaps[handle].name));
 			return 0;
 		}
+
+		// Paging in renames the bitmap to the name stored in the file.  If that isn't the
+		// file's name, it can't be found again, so it has to stay resident.
+		if (res->pageable && stricmp(name, GameBitmaps[handle].name))
+			res->pageable = false;
+
+		if (res->pageable)
+		{
+			int size = GameBitmaps[handle].width * GameBitmaps[handle].height * 2;
+			if (GameBitmaps[handle].flags & BF_MIPMAPPED)
+				size += size / 3;
+			res->resident_size = size + 2;
+			Bitmap_residency_stats.resident_bytes += res->resident_size;
+			Bitmap_residency_stats.resident_bitmaps++;
+		}
+
+		if (res->evicted)
+		{
+			float time = timer_GetTime64() - start;
+			res->evicted = false;
+			Bitmap_residency_stats.reloads++;
+			Bitmap_residency_stats.reload_time += time;
+			if (time > Bitmap_residency_stats.max_reload_time)
+				Bitmap_residency_stats.max_reload_time = time;
+		}
 	}
 	return 1;
 }
 
+// Frees the data of a pageable bitmap.  The renderer keeps its own copy, so the bitmap
+// only gets paged back in if something asks for its texels or size again.
+static void bm_EvictBitmap(int handle)
+{
+	bm_residency* res = &Bm_residency[handle];
+	ASSERT(res->pageable && res->resident_size);
+
+	mem_free(GameBitmaps[handle].data16);
+	GameBitmaps[handle].data16 = NULL;
+	GameBitmaps[handle].flags |= BF_NOT_RESIDENT;
+	Bitmap_memory_used -= res->resident_size;
+
+	Bitmap_residency_stats.resident_bytes -= res->resident_size;
+	Bitmap_residency_stats.resident_bitmaps--;
+	Bitmap_residency_stats.evictions++;
+	res->resident_size = 0;
+	res->evicted = true;
+	res->mips_pending = false;
+}
+
+static int bm_SortLeastRecentlyUsed(const short* a, const short* b)
+{
+	float diff = Bm_residency[*a].last_used - Bm_residency[*b].last_used;
+	if (diff < 0)
+		return -1;
+	return diff > 0 ? 1 : 0;
+}
+
+// Called once a frame with the current time.  Frees pageable bitmaps that have gone unused
+// for Bitmap_evict_idle_time, then the least recently used ones until the resident data
+// fits in Bitmap_residency_budget.
+void bm_UpdateResidency(float time)
+{
+	static short candidates[MAX_BITMAPS];
+	int num_candidates = 0;
+	int old_evictions = Bitmap_residency_stats.evictions;
+	int i;
+
+	// Bitmaps used while no frames were running (a level load, say) were stamped with the
+	// time of the last frame, so count them as used now
+	if (time - Bm_residency_time > 1.0f)
+	{
+		for (i = 0; i < MAX_BITMAPS; i++)
+		{
+			if (Bm_residency[i].last_used == Bm_residency_time)
+				Bm_residency[i].last_used = time;
+		}
+	}
+
+	Bm_residency_time = time;
+	if (time < Bm_next_residency_check && Bm_next_residency_check - time <= BM_RESIDENCY_INTERVAL)
+		return;
+	Bm_next_residency_check = time + BM_RESIDENCY_INTERVAL;
+
+	for (i = 0; i < MAX_BITMAPS; i++)
+	{
+		if (!GameBitmaps[i].used || !Bm_residency[i].resident_size)
+			continue;
+
+		float idle = time - Bm_residency[i].last_used;
+		if (Bitmap_evict_idle_time > 0 && idle > Bitmap_evict_idle_time)
+			bm_EvictBitmap(i);
+		else if (idle >= BM_MIN_EVICT_IDLE)
+			candidates[num_candidates++] = i;
+	}
+
+	if (Bitmap_residency_budget > 0 && Bitmap_residency_stats.resident_bytes > Bitmap_residency_budget)
+	{
+		qsort(candidates, num_candidates, sizeof(*candidates), (int (*)(const void*, const void*))bm_SortLeastRecentlyUsed);
+		for (i = 0; i < num_candidates && Bitmap_residency_stats.resident_bytes > Bitmap_residency_budget; i++)
+		{
+			bm_EvictBitmap(candidates[i]);
+			Bitmap_residency_stats.budget_evictions++;
+		}
+	}
+
+	if (Bitmap_residency_stats.evictions != old_evictions)
+		mprintf((0, "Evicted %d bitmaps, %d KB of pageable bitmaps resident\n", Bitmap_residency_stats.evictions - old_evictions,
+			(int)(Bitmap_residency_stats.resident_bytes / 1024)));
+}
+
 // Saves a bitmap to a file.  Saves the bitmap as an OUTRAGE_COMPRESSED_OGF.
 // Returns -1 if something is wrong.
 int bm_SaveFileBitmap(const char* filename, int handle)
@@ -966,6 +1119,7 @@ int bm_w(int handle, int miplevel)
 		Int3();
 		return -1;
 	}
+	bm_Touch(handle);
 	if (GameBitmaps[handle].flags & BF_NOT_RESIDENT)
 		if (!bm_MakeBitmapResident(handle))
 			return NULL;
@@ -986,6 +1140,7 @@ int bm_h(int handle, int miplevel)
 		return -1;
 	}
 	// If this bitmap is not page in, do so!
+	bm_Touch(handle);
 	if (GameBitmaps[handle].flags & BF_NOT_RESIDENT)
 		if (!bm_MakeBitmapResident(handle))
 			return NULL;
@@ -1050,10 +1205,15 @@ ushort* bm_data(int handle, int miplevel)
 	}
 
 	// If this bitmap is not page in, do so!
+	bm_Touch(handle);
 	if (GameBitmaps[handle].flags & BF_NOT_RESIDENT)
 		if (!bm_MakeBitmapResident(handle))
 			return NULL;
 
+	// Mips are built the first time one is asked for
+	if (miplevel > 0 && Bm_residency[handle].mips_pending)
+		bm_BuildMipMaps(handle);
+
 	d = GameBitmaps[handle].data16;
 	for (i = 0; i < miplevel; i++) {
 		d += (GameBitmaps[handle].width >> i) * (GameBitmaps[handle].height >> i);
@@ -1062,17 +1222,38 @@ ushort* bm_data(int handle, int miplevel)
 }
 
 // Given a source bitmap, generates mipmaps for it
+// With Bitmap_lazy_mips set, the mips are only built when bm_data first asks for one
 void bm_GenerateMipMaps(int handle)
 {
+	ASSERT(GameBitmaps[handle].used);
+	GameBitmaps[handle].flags |= BF_MIPMAPPED;
+
+	if (Bitmap_lazy_mips)
+	{
+		if (!Bm_residency[handle].mips_pending)
+			Bitmap_residency_stats.mips_deferred++;
+		Bm_residency[handle].mips_pending = true;
+		return;
+	}
+
+	bm_BuildMipMaps(handle);
+}
+
+// Builds each mip level of a bitmap from the one above it
+static void bm_BuildMipMaps(int handle)
+{
+	if (Bm_residency[handle].mips_pending)
+	{
+		Bm_residency[handle].mips_pending = false;
+		Bitmap_residency_stats.mips_built++;
+	}
+
 	int width = bm_w(handle, 0);
 	int height = bm_h(handle, 0);
 	int jump = 2;	// how many pixels to jump in x and y on source
 
 	//mprintf ((0,"We got a mipper! %d \n",handle));
 
-	ASSERT(GameBitmaps[handle].used);
-	GameBitmaps[handle].flags |= BF_MIPMAPPED;
-
 	int levels = bm_miplevels(handle);
 
 	ushort* destdata;
@@ -1569,6 +1750,14 @@ void bm_DestroyChunkedBitmap(chunked_bitmap* chunk)
 void bm_ChangeSize(int handle, int new_w, int new_h)
 {
 	int mipped = bm_mipped(handle);
+	// The file has the old size, so this one can't be paged back in
+	if (Bm_residency[handle].resident_size)
+	{
+		Bitmap_residency_stats.resident_bytes -= Bm_residency[handle].resident_size;
+		Bitmap_residency_stats.resident_bitmaps--;
+		Bm_residency[handle].resident_size = 0;
+	}
+	Bm_residency[handle].pageable = false;
 	int n;
 	int mem_used = (GameBitmaps[handle].width * GameBitmaps[handle].height * 2);
 	n = bm_AllocBitmap(new_w, new_h, mipped * ((new_w * new_h * 2) / 3));
@@ -32,6 +32,7 @@ ubyte* Tga_file_data = NULL;
 int Fake_pos = 0;
 int Bad_tga = 0;
 int Fake_file_size = 0;
+bool Tga_file_mapped = false;	// Tga_file_data points into a mapped hog, don't free it
 
 inline char tga_read_byte()
 {
@@ -425,13 +426,23 @@ int bm_tga_alloc_file(CFILE* infile, char* name, int format)
 
 		cfseek(infile, savepos, SEEK_SET);
 
-		Tga_file_data = (ubyte*)mem_malloc(numleft);
-		ASSERT(Tga_file_data != NULL);
 		Fake_pos = 0;
 		Bad_tga = 0;
 		Fake_file_size = numleft;
 
-		cf_ReadBytes((ubyte*)Tga_file_data, numleft, infile);
+		// If the file is in a mapped hog, parse it in place
+		const ubyte* mapped_data;
+		if (cf_GetMappedData(infile, &mapped_data) >= numleft)
+		{
+			Tga_file_data = (ubyte*)mapped_data;
+			Tga_file_mapped = true;
+		}
+		else
+		{
+			Tga_file_data = (ubyte*)mem_malloc(numleft);
+			ASSERT(Tga_file_data != NULL);
+			cf_ReadBytes((ubyte*)Tga_file_data, numleft, infile);
+		}
 
 		read_ok = bm_tga_read_outrage_compressed16(infile, n, num_mips, image_type);
 	}
@@ -445,8 +456,10 @@ int bm_tga_alloc_file(CFILE* infile, char* name, int format)
 
 	if (Tga_file_data != NULL)
 	{
-		mem_free(Tga_file_data);
+		if (!Tga_file_mapped)
+			mem_free(Tga_file_data);
 		Tga_file_data = NULL;
+		Tga_file_mapped = false;
 		cfseek(infile, savepos + Fake_pos, SEEK_SET);
 	}
 
@@ -587,13 +600,23 @@ int bm_page_in_file(int n)
 
 		cfseek(infile, savepos, SEEK_SET);
 
-		Tga_file_data = (ubyte*)mem_malloc(numleft);
-		ASSERT(Tga_file_data != NULL);
 		Fake_pos = 0;
 		Bad_tga = 0;
 		Fake_file_size = numleft;
 
-		cf_ReadBytes((ubyte*)Tga_file_data, numleft, infile);
+		// If the file is in a mapped hog, parse it in place
+		const ubyte* mapped_data;
+		if (cf_GetMappedData(infile, &mapped_data) >= numleft)
+		{
+			Tga_file_data = (ubyte*)mapped_data;
+			Tga_file_mapped = true;
+		}
+		else
+		{
+			Tga_file_data = (ubyte*)mem_malloc(numleft);
+			ASSERT(Tga_file_data != NULL);
+			cf_ReadBytes((ubyte*)Tga_file_data, numleft, infile);
+		}
 
 		bm_tga_read_outrage_compressed16(infile, n, num_mips, image_type);
 	}
@@ -607,8 +630,10 @@ int bm_page_in_file(int n)
 
 	if (Tga_file_data != NULL)
 	{
-		mem_free(Tga_file_data);
+		if (!Tga_file_mapped)
+			mem_free(Tga_file_data);
 		Tga_file_data = NULL;
+		Tga_file_mapped = false;
 		cfseek(infile, savepos + Fake_pos, SEEK_SET);
 	}
 
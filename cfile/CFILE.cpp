@@ -23,12 +23,20 @@
 #include <errno.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <mutex>
+#include <condition_variable>
 #ifndef __LINUX__
 //Non-Linux Build Includes
 #include <io.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #else
 //Linux Build Includes
 #include "linux/linux_fix.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 #include "BYTESWAP.H"
 #include "pserror.h"
@@ -37,6 +45,9 @@
 #include "CFILE.H"
 #include "hogfile.h"		//info about library file
 #include "mem.h"
+#include "jobsystem.h"
+
+struct prefetch_entry;
 
 //Library structures
 struct library_entry
@@ -46,6 +57,19 @@ struct library_entry
 	int		length;					//length of this file
 	uint	timestamp;				//time and date of file
 	int		flags;					//misc flags
+	prefetch_entry *prefetch;		//read-ahead of this file requested by cf_Prefetch(), or NULL
+};
+
+//A library file being read in the background by cf_Prefetch().  Only the main thread
+//touches library_entry::prefetch; the worker only fills in data & done.
+struct prefetch_entry
+{
+	char		libname[_MAX_PATH];	//copy of the library name, so the worker doesn't walk the library list
+	int			offset;				//offset of the file in the library
+	int			length;				//length of the file
+	const ubyte	*map_data;			//if the library is mapped, the data to page in instead of reading
+	ubyte		*data;				//the file's data once read, or NULL if not read
+	bool		done;				//set by the worker when it's finished, protected by Prefetch_mutex
 };
 
 struct library 
@@ -56,6 +80,9 @@ struct library
 	library			*next;
 	int				handle;				//indentifier for this lib
 	FILE			*file;				//pointer to file for this lib, if no one using it
+	const ubyte		*map_data;			//the whole hog mapped into memory, or NULL if using stdio
+	int				map_size;			//size of the mapping in bytes
+	void			*map_handle;		//OS handle for the mapping (Windows only)
 };
 
 //entry in extension->path table
@@ -70,6 +97,17 @@ struct path_entry
 {
 	char	path[_MAX_PATH];
 	ubyte	specific;			//if non-zero, only for specific extensions
+	char	**files;			//names of the files in this directory, for the file index
+	int		nfiles;
+};
+
+//entry in the file index, which maps a filename to the place cfopen() would find it
+struct index_entry
+{
+	const char	*name;			//the real name of the file, or NULL if this slot is empty
+	uint		hash;			//hash of the lowercased name
+	library		*lib;			//the library the file is in, or NULL if on disk
+	int			num;			//the entry number in lib, or the path number if on disk
 };
 
 #define MAX_PATHS			100
@@ -80,6 +118,26 @@ ext_entry extensions[MAX_EXTENSIONS];
 int N_extensions;
 library *Libraries=NULL;
 int lib_handle=0;
+//If set, libraries opened with cf_OpenLibrary() are memory-mapped
+static bool Cfile_map_libraries = false;
+cfile_stats Cfile_stats;
+//The file index covers all search paths and libraries.  It's rebuilt on the next lookup
+//after a library or search path is added or removed.
+static index_entry *File_index = NULL;
+static int File_index_size = 0;			//number of slots, always a power of two
+static bool File_index_dirty = true;
+static bool Search_path_listings_stale = false;
+static void cf_ScanSearchPath(path_entry *pe);
+static void cf_FreeSearchPathListing(path_entry *pe);
+//Background reads queued by cf_Prefetch()
+#define PREFETCH_MAX_BYTES	(64*1024*1024)	//don't hold more than this much read-ahead data at once
+static bool Cfile_prefetch_enabled = true;
+static std::mutex Prefetch_mutex;
+static std::condition_variable Prefetch_done;
+static int Prefetch_pending = 0;		//queued reads that haven't finished, protected by Prefetch_mutex
+static int Prefetch_bytes = 0;			//size of the prefetched files that were read into memory and haven't been opened
+static int Prefetch_entries = 0;		//number of prefetched files that haven't been opened
+static ubyte *cf_TakePrefetch(library_entry *le);
 void cf_Close();
 //Structure thrown on disk error
 cfile_error cfe;
@@ -94,6 +152,75 @@ void ThrowCFileError(int type,CFILE *file,char *msg)
 	throw &cfe;
 }
 
+//Maps the entire library file into memory.  Reads from files in a mapped library
+//are served straight out of the mapping, without any stdio calls.
+//Returns true if the library was mapped
+static bool cf_MapLibrary(library *lib)
+{
+	lib->map_data = NULL;
+	lib->map_size = 0;
+	lib->map_handle = NULL;
+#ifdef __LINUX__
+	int fd = open(lib->name, O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size <= 0)
+	{
+		close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);		//the mapping stays valid after the descriptor is closed
+	if (data == MAP_FAILED)
+		return false;
+	lib->map_data = (const ubyte *) data;
+	lib->map_size = (int) st.st_size;
+#else
+	HANDLE fh = CreateFileA(lib->name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD size = GetFileSize(fh, NULL);
+	HANDLE mh = (size == INVALID_FILE_SIZE || size == 0) ? NULL : CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(fh);	//the mapping object keeps its own reference to the file
+	if (mh == NULL)
+		return false;
+	void *data = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL)
+	{
+		CloseHandle(mh);
+		return false;
+	}
+	lib->map_data = (const ubyte *) data;
+	lib->map_size = (int) size;
+	lib->map_handle = (void *) mh;
+#endif
+	return true;
+}
+
+//Releases the mapping created by cf_MapLibrary(), if any
+static void cf_UnmapLibrary(library *lib)
+{
+	if (!lib->map_data)
+		return;
+#ifdef __LINUX__
+	munmap((void *) lib->map_data, lib->map_size);
+#else
+	UnmapViewOfFile(lib->map_data);
+	CloseHandle((HANDLE) lib->map_handle);
+#endif
+	lib->map_data = NULL;
+	lib->map_size = 0;
+	lib->map_handle = NULL;
+}
+
+//Sets whether libraries opened from now on are memory-mapped.  Libraries that are
+//already open are not affected.
+void cf_SetLibraryMapping(bool enable)
+{
+	Cfile_map_libraries = enable;
+}
+
 //Opens a HOG file.  Future calls to cfopen(), etc. will look in this HOG.
 //Parameters:  libname - the path & filename of the HOG file 
 //NOTE:	libname must be valid for the entire execution of the program.  Therefore, it should either
@@ -133,6 +260,9 @@ int cf_OpenLibrary(const char *libname)
 	}
 	strncpy(lib->name, libname, sizeof(lib->name));
 	lib->name[sizeof(lib->name) - 1] = '\0';
+	lib->map_data = NULL;
+	lib->map_size = 0;
+	lib->map_handle = NULL;
 
 	//read HOG header
 	if (!ReadHogHeader(fp, &header)) 
@@ -174,12 +304,33 @@ int cf_OpenLibrary(const char *libname)
 		lib->entries[i].length = entry.len;
 		lib->entries[i].offset = offset;
 		lib->entries[i].timestamp  = entry.timestamp;
+		lib->entries[i].prefetch = NULL;
 		offset += lib->entries[i].length;
 	}
 	//assign a handle
 	lib->handle = ++lib_handle;
+	//If mapping, the stdio handle is no longer needed
+	if (Cfile_map_libraries && cf_MapLibrary(lib))
+	{
+		fclose(fp);
+		fp = NULL;
+		//Make sure the index is sane before handing out pointers into the mapping
+		for (i = 0; i < lib->nfiles; i++)
+		{
+			if (lib->entries[i].offset + lib->entries[i].length > lib->map_size)
+			{
+				mprintf((0,"CFILE: Library <%s> is truncated, not using mapping\n",libname));
+				cf_UnmapLibrary(lib);
+				fp = fopen(libname, "rb");
+				break;
+			}
+		}
+	}
+	else
+		lib->map_data = NULL;
 	//Save the file pointer
 	lib->file = fp;
+	File_index_dirty = true;
 	//Sucess.  Return the handle
 	return lib->handle;
 }
@@ -193,14 +344,17 @@ void cf_CloseLibrary(int handle)
 	{
 		if (lib->handle == handle) 
 		{
+			cf_ClearPrefetches();
 			if (prev)
 				prev->next = lib->next;
 			else
 				Libraries = lib->next;
 			if (lib->file)
 				fclose(lib->file);
+			cf_UnmapLibrary(lib);
 			mem_free(lib->entries);
 			mem_free(lib);
+			File_index_dirty = true;
 			return; //sucessful close
 		}
 	}
@@ -210,13 +364,21 @@ void cf_CloseLibrary(int handle)
 void cf_Close()
 {
 	library *next;
+	cf_ClearPrefetches();
 	while (Libraries) 
 	{
 		next = Libraries->next;
+		cf_UnmapLibrary(Libraries);
 		mem_free(Libraries->entries);
 		mem_free(Libraries);
 		Libraries = next;
 	}
+	cf_ClearAllSearchPaths();
+	if (File_index)
+		mem_free(File_index);
+	File_index = NULL;
+	File_index_size = 0;
+	File_index_dirty = true;
 }
 
 //Specify a directory to look in for files
@@ -249,16 +411,91 @@ int cf_SetSearchPath(const char *path,char *ext,...)
 			ep++;
 		}
 	}
+	//Read the directory for the file index
+	paths[N_paths].files = NULL;
+	paths[N_paths].nfiles = 0;
+	cf_ScanSearchPath(&paths[N_paths]);
+	File_index_dirty = true;
 	//This path successfully set
 	N_paths++;
 	return 1;
 }
 
+//Makes cfopen() reread the search path directories before its next lookup.  Call this after
+//creating, renaming or deleting files in a search path without going through cfopen().
+void cf_InvalidateSearchPaths(void)
+{
+	Search_path_listings_stale = true;
+}
+
 //Removes all search paths that have been added by cf_SetSearchPath
 void cf_ClearAllSearchPaths(void)
 {
+	for (int i = 0; i < N_paths; i++)
+		cf_FreeSearchPathListing(&paths[i]);
 	N_paths = 0;
 	N_extensions = 0;
+	File_index_dirty = true;
+}
+
+//Opens entry number i of the given library for reading
+static CFILE *open_lib_entry(library *lib,int i,const char *filename)
+{
+	CFILE *cfile;
+	FILE *fp = NULL;
+	ubyte *prefetched = NULL;
+	int r;
+
+	//If this file was read ahead of time, use that data
+	if (lib->entries[i].prefetch)
+		prefetched = cf_TakePrefetch(&lib->entries[i]);
+
+	if (!lib->map_data && !prefetched)
+	{
+		//See if there's an available FILE
+		if (lib->file) 
+		{
+			fp = lib->file;
+			lib->file = NULL;
+		}
+		else 
+		{
+			fp = fopen(lib->name,"rb");
+			if (!fp) 
+			{
+				mprintf((1,"Error opening library <%s> when opening file <%s>; errno=%d.",lib->name,filename,errno));
+				Int3();
+				return NULL;
+			}
+			Cfile_stats.lib_fopens++;
+		}
+	}
+
+	cfile = (CFILE *) mem_malloc(sizeof(*cfile));
+	if (!cfile)
+		Error("Out of memory in open_file_in_lib()");
+	cfile->name = lib->entries[i].name;
+	cfile->file = fp;
+	cfile->lib_handle = lib->handle;
+	cfile->size = lib->entries[i].length;
+	cfile->lib_offset = lib->entries[i].offset;
+	cfile->position = 0;
+	cfile->flags = 0;
+	if (prefetched)
+	{
+		cfile->map_data = prefetched;
+		cfile->flags |= CF_PREFETCHED;
+	}
+	else if (lib->map_data)
+		cfile->map_data = lib->map_data + cfile->lib_offset;
+	else
+	{
+		cfile->map_data = NULL;
+		r = fseek(fp,cfile->lib_offset,SEEK_SET);
+		ASSERT(r == 0);
+	}
+	Cfile_stats.lib_opens++;
+	return cfile;
 }
 
 // Opens a file for reading in a library, given the library id
@@ -268,7 +505,6 @@ CFILE *cf_OpenFileInLibrary(const char *filename,int libhandle)
 		return NULL;
 
 	library *lib;
-	CFILE *cfile;
 	lib = Libraries;
 
 	// find the library that we want to use
@@ -309,46 +545,13 @@ CFILE *cf_OpenFileInLibrary(const char *filename,int libhandle)
 	if(!found)
 		return NULL;	// file not in library
 
-	// open the file for reading
-  	FILE *fp;
-  	int r;
-	//See if there's an available FILE
-	if (lib->file) 
-	{
-		fp = lib->file;
-		lib->file = NULL;
-	}
-	else 
-	{
-	  	fp = fopen(lib->name,"rb");
-  		if (!fp) 
-		{
-			mprintf((1,"Error opening library <%s> when opening file <%s>; errno=%d.",lib->name,filename,errno));
-  			Int3();
-  			return NULL;
-	  	}
-	}
-
-  	cfile = (CFILE *)mem_malloc(sizeof(*cfile));
-  	if (!cfile)
-  		Error("Out of memory in open_file_in_lib()");
-  	cfile->name = lib->entries[i].name;
-  	cfile->file = fp;
-	cfile->lib_handle = lib->handle;
-  	cfile->size = lib->entries[i].length;
-  	cfile->lib_offset = lib->entries[i].offset;
-  	cfile->position = 0;
-  	cfile->flags = 0;
-  	r = fseek(fp,cfile->lib_offset,SEEK_SET);
-  	ASSERT(r == 0);
-  	return cfile;
+	return open_lib_entry(lib,i,filename);
 }
 
 //searches through the open HOG files, and opens a file if it finds it in any of the libs
 CFILE *open_file_in_lib(const char *filename)
 {
 	library *lib;
-	CFILE *cfile;
 	lib = Libraries;
 	while (lib) 
 	{
@@ -373,39 +576,7 @@ CFILE *open_file_in_lib(const char *filename)
 		}
 
 		if (found) 
-		{
-  			FILE *fp;
-  			int r;
-			//See if there's an available FILE
-			if (lib->file) 
-			{
-				fp = lib->file;
-				lib->file = NULL;
-			}
-			else 
-			{
-	  			fp = fopen(lib->name,"rb");
-  				if (!fp) 
-				{
-					mprintf((1,"Error opening library <%s> when opening file <%s>; errno=%d.",lib->name,filename,errno));
-  					Int3();
-  					return NULL;
-	  			}
-			}
-  			cfile = (CFILE *) mem_malloc(sizeof(*cfile));
-  			if (!cfile)
-  				Error("Out of memory in open_file_in_lib()");
-  			cfile->name = lib->entries[i].name;
-  			cfile->file = fp;
-			cfile->lib_handle = lib->handle;
-  			cfile->size = lib->entries[i].length;
-  			cfile->lib_offset = lib->entries[i].offset;
-  			cfile->position = 0;
-  			cfile->flags = 0;
-  			r = fseek(fp,cfile->lib_offset,SEEK_SET);
-  			ASSERT(r == 0);
-  			return cfile;
-		}
+			return open_lib_entry(lib,i,filename);
 		lib = lib->next;
 	}
 	return NULL;
@@ -706,6 +877,8 @@ CFILE *open_file_in_directory(const char *filename,const char *mode,const char *
 		cfile->lib_offset = 0;		//0 means on disk, not in HOG
 		cfile->position = 0;
 		cfile->flags=0;
+		cfile->map_data = NULL;
+		Cfile_stats.disk_opens++;
 		return cfile;
 	}else
 	{
@@ -733,6 +906,8 @@ CFILE *open_file_in_directory(const char *filename,const char *mode,const char *
 			cfile->lib_offset = 0;		//0 means on disk, not in HOG
 			cfile->position = 0;
 			cfile->flags=0;
+			cfile->map_data = NULL;
+			Cfile_stats.disk_opens++;
 			return cfile;
 		}
 	}
@@ -754,11 +929,414 @@ CFILE *open_file_in_directory(const char *filename,const char *mode,const char *
 		cfile->lib_offset = 0; //0 means on disk, not in HOG
 		cfile->position = 0;
 		cfile->flags=0;
+		cfile->map_data = NULL;
+		Cfile_stats.disk_opens++;
 		return cfile;
 	}
 #endif
 }
 
+//Frees the list of files read by cf_ScanSearchPath()
+static void cf_FreeSearchPathListing(path_entry *pe)
+{
+	for (int i = 0; i < pe->nfiles; i++)
+		mem_free(pe->files[i]);
+	if (pe->files)
+		mem_free(pe->files);
+	pe->files = NULL;
+	pe->nfiles = 0;
+}
+
+//Adds a name to the list of files in a search path
+static void cf_AddSearchPathFile(path_entry *pe, const char *name, int *max_files)
+{
+	if (!name[0])
+		return;		//a subdirectory
+	if (pe->nfiles == *max_files)
+	{
+		*max_files = (*max_files) ? (*max_files) * 2 : 64;
+		pe->files = (char **) mem_realloc(pe->files, sizeof(char *) * (*max_files));
+		if (!pe->files)
+			Error("Out of memory in cf_ScanSearchPath()");
+	}
+	pe->files[pe->nfiles++] = mem_strdup(name);
+}
+
+//Reads the names of all the files in a search path, for the file index
+static void cf_ScanSearchPath(path_entry *pe)
+{
+	char wildcard[_MAX_PATH*2];
+	int max_files = 0;
+
+	cf_FreeSearchPathListing(pe);
+	ddio_MakePath(wildcard, pe->path, "*", NULL);
+#ifdef __LINUX__
+	char namebuf[_MAX_PATH];
+	CFindFiles ff;
+	for (bool gotfile = ff.Start(wildcard, namebuf); gotfile; gotfile = ff.Next(namebuf))
+		cf_AddSearchPathFile(pe, namebuf, &max_files);
+	ff.Close();
+#else
+	struct _finddata_t fd;
+	intptr_t fh = _findfirst(wildcard, &fd);
+	if (fh != -1)
+	{
+		do
+		{
+			if (!(fd.attrib & _A_SUBDIR))
+				cf_AddSearchPathFile(pe, fd.name, &max_files);
+		} while (_findnext(fh, &fd) == 0);
+		_findclose(fh);
+	}
+#endif
+}
+
+//Hashes a filename without regard to case
+static uint cf_HashFilename(const char *name)
+{
+	uint hash = 2166136261u;
+	for (; *name; name++)
+		hash = (hash ^ (ubyte) tolower(*name)) * 16777619u;
+	return hash;
+}
+
+//Adds a file to the index, unless a file with the same name is already there.  Files must
+//be added in the order cfopen() would search for them, so the first one added wins.
+static void cf_AddToFileIndex(const char *name, library *lib, int num)
+{
+	uint hash = cf_HashFilename(name);
+	int mask = File_index_size - 1;
+	for (int slot = hash & mask; ; slot = (slot + 1) & mask)
+	{
+		index_entry *ie = &File_index[slot];
+		if (!ie->name)
+		{
+			ie->name = name;
+			ie->hash = hash;
+			ie->lib = lib;
+			ie->num = num;
+			return;
+		}
+		if (ie->hash == hash && !stricmp(ie->name, name))
+			return;		//already found earlier in the search order
+	}
+}
+
+//Rebuilds the file index from the search paths and open libraries
+static void cf_BuildFileIndex()
+{
+	library *lib;
+	int i, n, count = 0;
+
+	if (Search_path_listings_stale)
+	{
+		for (i = 0; i < N_paths; i++)
+			cf_ScanSearchPath(&paths[i]);
+		Search_path_listings_stale = false;
+	}
+
+	//Size the table to keep the load factor under one half
+	for (i = 0; i < N_paths; i++)
+		count += paths[i].nfiles;
+	for (lib = Libraries; lib; lib = lib->next)
+		count += lib->nfiles;
+	n = 256;
+	while (n < count * 2)
+		n *= 2;
+	if (n != File_index_size)
+	{
+		if (File_index)
+			mem_free(File_index);
+		File_index = (index_entry *) mem_malloc(sizeof(index_entry) * n);
+		if (!File_index)
+			Error("Out of memory in cf_BuildFileIndex()");
+		File_index_size = n;
+	}
+	memset(File_index, 0, sizeof(index_entry) * File_index_size);
+
+	//Same order as cfopen() searches: the extension-specific directories first...
+	for (i = 0; i < N_extensions; i++)
+	{
+		path_entry *pe = &paths[extensions[i].pathnum];
+		for (n = 0; n < pe->nfiles; n++)
+		{
+			char *ext = strrchr(pe->files[n], '.');
+			if (ext && !strnicmp(extensions[i].ext, ext + 1, _MAX_EXT))
+				cf_AddToFileIndex(pe->files[n], NULL, extensions[i].pathnum);
+		}
+	}
+	//...then the general directories...
+	for (i = 0; i < N_paths; i++)
+	{
+		if (!paths[i].specific)
+		{
+			for (n = 0; n < paths[i].nfiles; n++)
+				cf_AddToFileIndex(paths[i].files[n], NULL, i);
+		}
+	}
+	//...and lastly the libraries, most recently opened first
+	for (lib = Libraries; lib; lib = lib->next)
+	{
+		for (n = 0; n < lib->nfiles; n++)
+			cf_AddToFileIndex(lib->entries[n].name, lib, n);
+	}
+
+	File_index_dirty = false;
+}
+
+//Finds a file in the file index, rebuilding the index first if needed
+//Returns the index entry, or NULL if the file isn't in any search path or library
+static index_entry *cf_FindInFileIndex(const char *filename)
+{
+	if (File_index_dirty || Search_path_listings_stale)
+		cf_BuildFileIndex();
+
+	uint hash = cf_HashFilename(filename);
+	int mask = File_index_size - 1;
+	for (int slot = hash & mask; File_index[slot].name; slot = (slot + 1) & mask)
+	{
+		if (File_index[slot].hash == hash && !stricmp(File_index[slot].name, filename))
+			return &File_index[slot];
+	}
+	return NULL;
+}
+
+//Opens the file an index entry points to
+static CFILE *open_index_entry(index_entry *ie, const char *filename, const char *mode)
+{
+	if (ie->lib)
+		return open_lib_entry(ie->lib, ie->num, filename);
+	else
+		return open_file_in_directory(ie->name, mode, paths[ie->num].path);
+}
+
+//Looks for a file in the search path directories, in the order cfopen() searches them
+//Returns the opened file, or NULL if it isn't in any of them
+static CFILE *open_file_in_search_paths(const char *filename, const char *mode)
+{
+	const char *ext = strrchr(filename, '.');
+	CFILE *cfile;
+	int i;
+
+	//First look in the directories for this file's extension
+	if (ext)
+	{
+		for (i = 0; i < N_extensions; i++)
+		{
+			if (!strnicmp(extensions[i].ext, ext + 1, _MAX_EXT))
+			{
+				cfile = open_file_in_directory(filename, mode, paths[extensions[i].pathnum].path);
+				if (cfile)
+					return cfile;
+			}
+		}
+	}
+	//Next look in the general directories
+	for (i = 0; i < N_paths; i++)
+	{
+		if (!paths[i].specific)
+		{
+			cfile = open_file_in_directory(filename, mode, paths[i].path);
+			if (cfile)
+				return cfile;
+		}
+	}
+	return NULL;
+}
+
+//Opens a file for reading by looking it up in the file index
+//Returns the opened file, or NULL if it isn't in any search path or library
+static CFILE *open_file_from_index(const char *filename, const char *mode)
+{
+	double start_time = timer_GetTime64();
+	index_entry *ie = cf_FindInFileIndex(filename);
+	CFILE *cfile = NULL;
+
+	Cfile_stats.index_lookups++;
+	Cfile_stats.index_time += (float) (timer_GetTime64() - start_time);
+
+	if (!ie)
+	{
+		//The libraries are always fully indexed, but files written to a search path
+		//without going through cfopen() (downloaded or extracted missions, for instance)
+		//aren't in the directory listings yet.  Look for them the old way, and relist the
+		//directories if that finds one.
+		cfile = open_file_in_search_paths(filename, mode);
+		if (cfile)
+			Search_path_listings_stale = true;
+		else
+			errno = ENOENT;
+		return cfile;
+	}
+
+	cfile = open_index_entry(ie, filename, mode);
+
+	//A file deleted from a search path since it was listed won't open, so relist the
+	//directories and look again
+	if (!cfile && !ie->lib && errno == ENOENT)
+	{
+		Search_path_listings_stale = true;
+		ie = cf_FindInFileIndex(filename);
+		if (ie)
+			cfile = open_index_entry(ie, filename, mode);
+		else
+			errno = ENOENT;
+	}
+
+	if (cfile)
+		Cfile_stats.index_hits++;
+
+	return cfile;
+}
+
+//Worker job for cf_Prefetch().  Reads the file with its own FILE, so it never
+//competes with the main thread for a library's shared handle.
+static void cf_PrefetchWorker(void *arg)
+{
+	prefetch_entry *pe = (prefetch_entry *) arg;
+
+	if (pe->map_data)
+	{
+		//Touch every page so the OS reads it in now
+		volatile ubyte sum = 0;
+		for (int i = 0; i < pe->length; i += 4096)
+			sum += pe->map_data[i];
+	}
+	else
+	{
+		//malloc, not mem_malloc, since the memory library isn't thread safe
+		ubyte *data = (ubyte *) malloc(pe->length);
+		FILE *fp = fopen(pe->libname, "rb");
+		if (!data || !fp || fseek(fp, pe->offset, SEEK_SET) || fread(data, 1, pe->length, fp) != (size_t) pe->length)
+		{
+			free(data);
+			data = NULL;
+		}
+		if (fp)
+			fclose(fp);
+		pe->data = data;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(Prefetch_mutex);
+		pe->done = true;
+		Prefetch_pending--;
+	}
+	Prefetch_done.notify_all();
+}
+
+//Detaches the prefetch from a library entry, waiting for the read to finish if it hasn't
+//Returns the file data, which the caller must free(), or NULL if there isn't any
+static ubyte *cf_TakePrefetch(library_entry *le)
+{
+	prefetch_entry *pe = le->prefetch;
+	ubyte *data;
+
+	{
+		std::unique_lock<std::mutex> lock(Prefetch_mutex);
+		if (!pe->done)
+			Cfile_stats.prefetch_waits++;
+		Prefetch_done.wait(lock, [pe] { return pe->done; });
+	}
+
+	data = pe->data;
+	if (data)
+		Cfile_stats.prefetch_hits++;
+	//Mapped files were only paged in, so they don't count toward the read-ahead limit
+	if (!pe->map_data)
+		Prefetch_bytes -= pe->length;
+	Prefetch_entries--;
+	le->prefetch = NULL;
+	mem_free(pe);
+	return data;
+}
+
+//Sets whether cf_Prefetch() does anything
+void cf_SetPrefetching(bool enable)
+{
+	Cfile_prefetch_enabled = enable;
+	if (!enable)
+		cf_ClearPrefetches();
+}
+
+//Starts reading a file from a library in the background, so a later cfopen() of the file 
+//doesn't have to wait for the disk.  
+//Returns true if the file was queued or is already queued.  Files that aren't in a library
+//aren't prefetched.
+bool cf_Prefetch(const char *filename)
+{
+	if (!Cfile_prefetch_enabled || !job_GetNumThreads())
+		return false;
+
+	index_entry *ie = cf_FindInFileIndex(filename);
+	if (!ie || !ie->lib)
+		return false;
+
+	library *lib = ie->lib;
+	library_entry *le = &lib->entries[ie->num];
+	if (le->prefetch)
+		return true;
+	if (le->length <= 0 || (!lib->map_data && Prefetch_bytes + le->length > PREFETCH_MAX_BYTES))
+		return false;
+
+	prefetch_entry *pe = (prefetch_entry *) mem_malloc(sizeof(*pe));
+	if (!pe)
+		return false;
+	strcpy(pe->libname, lib->name);
+	pe->offset = le->offset;
+	pe->length = le->length;
+	pe->map_data = lib->map_data ? lib->map_data + le->offset : NULL;
+	pe->data = NULL;
+	pe->done = false;
+
+	le->prefetch = pe;
+	if (!pe->map_data)
+		Prefetch_bytes += le->length;
+	Prefetch_entries++;
+	{
+		std::lock_guard<std::mutex> lock(Prefetch_mutex);
+		Prefetch_pending++;
+	}
+	Cfile_stats.prefetch_queued++;
+	job_Submit(cf_PrefetchWorker, pe);
+	return true;
+}
+
+//Calls cf_Prefetch() on a list of files
+//Returns the number of files queued
+int cf_PrefetchBatch(const char **filenames, int count)
+{
+	int queued = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (cf_Prefetch(filenames[i]))
+			queued++;
+	}
+	return queued;
+}
+
+//Waits for any outstanding prefetches and throws away prefetched data that was never used
+void cf_ClearPrefetches()
+{
+	{
+		std::unique_lock<std::mutex> lock(Prefetch_mutex);
+		Prefetch_done.wait(lock, [] { return Prefetch_pending == 0; });
+	}
+
+	if (!Prefetch_entries)
+		return;
+
+	for (library *lib = Libraries; lib; lib = lib->next)
+	{
+		for (int i = 0; i < lib->nfiles; i++)
+		{
+			if (lib->entries[i].prefetch)
+				free(cf_TakePrefetch(&lib->entries[i]));
+		}
+	}
+	ASSERT(Prefetch_bytes == 0 && Prefetch_entries == 0);
+}
+
 //Opens a file for reading or writing
 //If a path is specified, will try to open the file only in that path.
 //If no path is specified, will look through search directories and library files.
@@ -769,7 +1347,6 @@ CFILE *cfopen(const char * filename, const char * mode)
 {
 	CFILE *cfile;
 	char path[_MAX_PATH*2], fname[_MAX_PATH*2], ext[_MAX_EXT];
-	int i;
 	//Check for valid mode
 	ASSERT((mode[0] == 'r') || (mode[0] == 'w'));
 	ASSERT((mode[1] == 'b') || (mode[1] == 't'));
@@ -781,31 +1358,14 @@ CFILE *cfopen(const char * filename, const char * mode)
 	if (strlen(path) || (mode[0]=='w')) 
 	{								//found a path
 		cfile = open_file_in_directory(filename,mode,NULL);	//use path specified with file
+		//a new file may have been created in one of the search paths
+		if (cfile && (mode[0]=='w'))
+			Search_path_listings_stale = true;
 		goto got_file;														//don't look in libs, etc.
 	}
 
-	//First look in the directories for this file's extension
-	for (i=0;i<N_extensions;i++) 
-	{
-		if (! strnicmp(extensions[i].ext,ext+1,_MAX_EXT)) //found ext
-		{
-			cfile = open_file_in_directory(filename,mode,paths[extensions[i].pathnum].path);
-			if (cfile)// || (errno != ENOENT)) //Tempoary fix so Kevin can run the game!
-				goto got_file;
-		}
-	}
-	//Next look in the general directories
-	for (i=0;i<N_paths;i++) 
-	{
-		if (!paths[i].specific) 
-		{
-			cfile = open_file_in_directory(filename,mode,paths[i].path);
-			if (cfile)// || (errno != ENOENT)) //Tempoary fix so Kevin can run the game!
-				goto got_file;
-		}
-	}
-	//Lastly, try the hog files
-	cfile = open_file_in_lib(filename);
+	//Look the file up in the index of search paths & libraries
+	cfile = open_file_from_index(filename,mode);
 
 got_file:;
 	if (cfile)
@@ -830,7 +1390,7 @@ int cfilelength( CFILE *cfp )
 void cfclose( CFILE * cfp )
 {
 	//Either give the file back to the library, or close it
-	if (cfp->lib_handle != -1) {
+	if (cfp->lib_handle != -1 && cfp->file) {
 		library *lib;
 		for (lib=Libraries;lib;lib=lib->next) 
 		{
@@ -849,6 +1409,9 @@ void cfclose( CFILE * cfp )
 	//If the file handle wasn't given back to library, close the file
 	if (cfp->file) 
 		fclose(cfp->file);
+	//free the data read by cf_Prefetch()
+	if (cfp->flags & CF_PREFETCHED)
+		free((void *) cfp->map_data);
 	//free the name, if allocated
 	if (!cfp->lib_offset)
 		mem_free(cfp->name);
@@ -863,6 +1426,19 @@ int cfgetc( CFILE * cfp )
 	int c;
 	static unsigned char ch[3] = "\0\0";
 	if (cfp->position >= cfp->size ) return EOF;
+
+	if (cfp->map_data)
+	{
+		c = cfp->map_data[cfp->position++];
+		//same newline handling as below for text files
+		if ((cfp->flags & CF_TEXT) && (c == 13))
+		{
+			if (cfp->position < cfp->size && cfp->map_data[cfp->position] == 10)
+				cfp->position++;
+			c = '\n';
+		}
+		return c;
+	}
 	
 	fread(ch,sizeof(char),1,cfp->file);
 	c = ch[0];
@@ -900,6 +1476,26 @@ int cfgetc( CFILE * cfp )
 	return c;
 }
 
+//Gets a pointer to the data of a file in a memory-mapped library, so it can be
+//parsed in place instead of being copied out with cf_ReadBytes().
+//Parameters:	cfp - the file pointer returned by cfopen()
+//				ptr - filled in with a pointer to the data at the current position
+//Returns:		the number of bytes left in the file from the current position, or 0 (and 
+//				*ptr set to NULL) if the file isn't in a mapped library.  
+//The pointer is only valid until cfclose(), since a prefetched file's buffer is freed
+//there.  The file position is not changed; use cfseek() to move past the data that
+//was consumed.
+int cf_GetMappedData(CFILE *cfp, const ubyte **ptr)
+{
+	if (!cfp->map_data || (cfp->flags & CF_WRITING))
+	{
+		*ptr = NULL;
+		return 0;
+	}
+	*ptr = cfp->map_data + cfp->position;
+	return cfp->size - cfp->position;
+}
+
 //Just like stdio fseek(), except works on a CFILE
 int cfseek( CFILE *cfp, long int offset, int where )
 {
@@ -917,6 +1513,13 @@ int cfseek( CFILE *cfp, long int offset, int where )
 		default:
 			return 1;
 	}	
+	if (cfp->map_data)
+	{
+		if (goal_position < 0 || goal_position > cfp->size)
+			return 1;
+		cfp->position = goal_position;
+		return 0;
+	}
 	c = fseek( cfp->file, cfp->lib_offset + goal_position, SEEK_SET );
 	cfp->position = ftell(cfp->file) - cfp->lib_offset;
 	return c;
@@ -965,10 +1568,17 @@ int cf_ReadBytes(ubyte *buf, int count, CFILE *cfp)
 	int i;
 	char *error_msg = eof_error;		//default error
 	ASSERT(! (cfp->flags & CF_TEXT));
+	if (cfp->map_data && cfp->position + count <= cfp->size) {
+		memcpy(buf, cfp->map_data + cfp->position, count);
+		cfp->position += count;
+		Cfile_stats.bytes_read += count;
+		return count;
+	}
 	if (cfp->position + count <= cfp->size) {
 		i = fread ( buf, 1, count, cfp->file );
 		if (i == count) {
 			cfp->position += i;
+			Cfile_stats.bytes_read += i;
 			return i;
 		}
 		//if not EOF, then get the error message
@@ -1287,7 +1897,9 @@ void cf_ChangeFileAttributes (const char *name,int attr)
 //	rewinds cfile position
 void cf_Rewind(CFILE *fp)
 {
-	if (fp->lib_offset) 
+	if (fp->map_data)
+		;	//nothing to do, reads come straight from the mapping
+	else if (fp->lib_offset) 
 	{
 		int r = fseek(fp->file,fp->lib_offset,SEEK_SET);
 		ASSERT(r==0);
@@ -18,24 +18,423 @@
 #include <memory.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <float.h>
+#include <algorithm>
 #include "mono.h"
 #include "ssl_lib.h"
 #include "mixer.h"
 #include "pserror.h"
+#include "ddio.h"
+#include "args.h"
+
+// The SIMD kernels are built with target attributes and picked at run time, so they don't
+// need the compiler to be targeting SSE2 (the 32 bit build isn't)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MIXER_X86
+#include <immintrin.h>
+#endif
 
 #define MIN_SOUND_MIX_VOLUME    0.0f
 #define MAX_WRITE_AHEAD         0.04f // Seconds to write ahead of the play position (in seconds)
 #define VOLUME_FIX_BITS			1024
 
-inline void	opti_8m_mix(unsigned char *cur_sample_8bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume);
-inline void	opti_8s_mix(unsigned char *cur_sample_8bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume);
-inline void	opti_16m_mix(short *cur_sample_16bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume);
-inline void	opti_16s_mix(short *cur_sample_16bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume);
+// Number of frames of a voice converted to float at a time
+#define MIX_CHUNK_FRAMES		256
+
+// Voices are summed into a float bus, which is clamped into the 16 bit output once all of them
+// are in. Each kernel set does the same float operations in the same order, so they all give
+// the same output, except that a scalar build using x87 math can round differently.
+typedef struct
+{
+	const char *name;
+	// Converts samples to float. 8 bit samples are unsigned and get scaled up to the 16 bit range
+	void (*convert8)(const unsigned char *src, float *dst, int count);
+	void (*convert16)(const short *src, float *dst, int count);
+	// Adds frames of a voice to the bus at the given volumes
+	void (*add_mono)(const float *src, int frames, float *bus, float l_volume, float r_volume);
+	void (*add_stereo)(const float *src, int frames, float *bus, float l_volume, float r_volume);
+	// Clamps bus values into 16 bit samples
+	void (*saturate)(const float *bus, short *out, int count);
+} tMixKernels;
+
+static void mix_Convert8_Scalar(const unsigned char *src, float *dst, int count)
+{
+	for (int i = 0; i < count; i++)
+		dst[i] = (float)(((int)src[i] - 128) << 8);
+}
+
+static void mix_Convert16_Scalar(const short *src, float *dst, int count)
+{
+	for (int i = 0; i < count; i++)
+		dst[i] = (float)src[i];
+}
+
+static void mix_AddMono_Scalar(const float *src, int frames, float *bus, float l_volume, float r_volume)
+{
+	for (int i = 0; i < frames; i++)
+	{
+		bus[i * 2] += src[i] * l_volume;
+		bus[i * 2 + 1] += src[i] * r_volume;
+	}
+}
+
+static void mix_AddStereo_Scalar(const float *src, int frames, float *bus, float l_volume, float r_volume)
+{
+	for (int i = 0; i < frames; i++)
+	{
+		bus[i * 2] += src[i * 2] * l_volume;
+		bus[i * 2 + 1] += src[i * 2 + 1] * r_volume;
+	}
+}
+
+static void mix_Saturate_Scalar(const float *bus, short *out, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		float sample = bus[i];
+		if (sample < -32767.0f) sample = -32767.0f;
+		if (sample > 32767.0f) sample = 32767.0f;
+		out[i] = (short)sample;
+	}
+}
+
+#ifdef MIXER_X86
+__attribute__((target("sse2"))) static void mix_Convert8_SSE2(const unsigned char *src, float *dst, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(128);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i bytes = _mm_loadl_epi64((const __m128i *)(src + i));
+		__m128i words = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(bytes, zero), bias), 8);
+		_mm_storeu_ps(dst + i, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16)));
+		_mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16)));
+	}
+
+	mix_Convert8_Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("sse2"))) static void mix_Convert16_SSE2(const short *src, float *dst, int count)
+{
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i words = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_ps(dst + i, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16)));
+		_mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16)));
+	}
+
+	mix_Convert16_Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("sse2"))) static void mix_AddMono_SSE2(const float *src, int frames, float *bus, float l_volume, float r_volume)
+{
+	const __m128 volume = _mm_setr_ps(l_volume, r_volume, l_volume, r_volume);
+	int i = 0;
+
+	for (; i + 4 <= frames; i += 4)
+	{
+		__m128 samples = _mm_loadu_ps(src + i);
+		float *out = bus + i * 2;
+		_mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(_mm_unpacklo_ps(samples, samples), volume)));
+		_mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(_mm_unpackhi_ps(samples, samples), volume)));
+	}
+
+	mix_AddMono_Scalar(src + i, frames - i, bus + i * 2, l_volume, r_volume);
+}
+
+__attribute__((target("sse2"))) static void mix_AddStereo_SSE2(const float *src, int frames, float *bus, float l_volume, float r_volume)
+{
+	const __m128 volume = _mm_setr_ps(l_volume, r_volume, l_volume, r_volume);
+	int i = 0;
+
+	for (; i + 2 <= frames; i += 2)
+	{
+		float *out = bus + i * 2;
+		_mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(_mm_loadu_ps(src + i * 2), volume)));
+	}
+
+	mix_AddStereo_Scalar(src + i * 2, frames - i, bus + i * 2, l_volume, r_volume);
+}
+
+__attribute__((target("sse2"))) static void mix_Saturate_SSE2(const float *bus, short *out, int count)
+{
+	const __m128 low = _mm_set1_ps(-32767.0f);
+	const __m128 high = _mm_set1_ps(32767.0f);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i a = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(bus + i), low), high));
+		__m128i b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(bus + i + 4), low), high));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+	}
+
+	mix_Saturate_Scalar(bus + i, out + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void mix_Convert8_AVX2(const unsigned char *src, float *dst, int count)
+{
+	const __m256i bias = _mm256_set1_epi32(128);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i ints = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_slli_epi32(_mm256_sub_epi32(ints, bias), 8)));
+	}
+
+	mix_Convert8_Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void mix_Convert16_AVX2(const short *src, float *dst, int count)
+{
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i ints = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(ints));
+	}
+
+	mix_Convert16_Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void mix_AddMono_AVX2(const float *src, int frames, float *bus, float l_volume, float r_volume)
+{
+	const __m256 volume = _mm256_setr_ps(l_volume, r_volume, l_volume, r_volume, l_volume, r_volume, l_volume, r_volume);
+	int i = 0;
+
+	for (; i + 8 <= frames; i += 8)
+	{
+		__m256 samples = _mm256_loadu_ps(src + i);
+		//unpack works within 128 bit lanes, so put the lanes back in order after
+		__m256 lo = _mm256_unpacklo_ps(samples, samples);
+		__m256 hi = _mm256_unpackhi_ps(samples, samples);
+		float *out = bus + i * 2;
+		_mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out), _mm256_mul_ps(_mm256_permute2f128_ps(lo, hi, 0x20), volume)));
+		_mm256_storeu_ps(out + 8, _mm256_add_ps(_mm256_loadu_ps(out + 8), _mm256_mul_ps(_mm256_permute2f128_ps(lo, hi, 0x31), volume)));
+	}
+
+	mix_AddMono_Scalar(src + i, frames - i, bus + i * 2, l_volume, r_volume);
+}
+
+__attribute__((target("avx2"))) static void mix_AddStereo_AVX2(const float *src, int frames, float *bus, float l_volume, float r_volume)
+{
+	const __m256 volume = _mm256_setr_ps(l_volume, r_volume, l_volume, r_volume, l_volume, r_volume, l_volume, r_volume);
+	int i = 0;
+
+	for (; i + 4 <= frames; i += 4)
+	{
+		float *out = bus + i * 2;
+		_mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out), _mm256_mul_ps(_mm256_loadu_ps(src + i * 2), volume)));
+	}
+
+	mix_AddStereo_Scalar(src + i * 2, frames - i, bus + i * 2, l_volume, r_volume);
+}
+
+__attribute__((target("avx2"))) static void mix_Saturate_AVX2(const float *bus, short *out, int count)
+{
+	const __m256 low = _mm256_set1_ps(-32767.0f);
+	const __m256 high = _mm256_set1_ps(32767.0f);
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i a = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(bus + i), low), high));
+		__m256i b = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(bus + i + 8), low), high));
+		//pack interleaves the lanes of a and b, so swap the middle quarters back
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8));
+	}
+
+	mix_Saturate_Scalar(bus + i, out + i, count - i);
+}
+#endif
+
+#define MIX_KERNELS_SCALAR	0
+#define MIX_KERNELS_SSE2	1
+#define MIX_KERNELS_AVX2	2
+
+static const tMixKernels Mix_kernels[] =
+{
+	{"scalar", mix_Convert8_Scalar, mix_Convert16_Scalar, mix_AddMono_Scalar, mix_AddStereo_Scalar, mix_Saturate_Scalar},
+#ifdef MIXER_X86
+	{"SSE2", mix_Convert8_SSE2, mix_Convert16_SSE2, mix_AddMono_SSE2, mix_AddStereo_SSE2, mix_Saturate_SSE2},
+	{"AVX2", mix_Convert8_AVX2, mix_Convert16_AVX2, mix_AddMono_AVX2, mix_AddStereo_AVX2, mix_Saturate_AVX2},
+#endif
+};
+
+static const tMixKernels *Mix_cur_kernels = &Mix_kernels[MIX_KERNELS_SCALAR];
+
+// Returns the number of kernel sets this CPU can run. They're in order of speed.
+static int mix_NumSupportedKernels(void)
+{
+#ifdef MIXER_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return MIX_KERNELS_AVX2 + 1;
+	if (__builtin_cpu_supports("sse2"))
+		return MIX_KERNELS_SSE2 + 1;
+	return MIX_KERNELS_SCALAR + 1;
+#else
+	return MIX_KERNELS_SCALAR + 1;
+#endif
+}
+
+// Returns the best kernel set this CPU can run. -nomixersimd forces the scalar one.
+static int mix_BestKernels(void)
+{
+	if (FindArg("-nomixersimd"))
+		return MIX_KERNELS_SCALAR;
+
+	return mix_NumSupportedKernels() - 1;
+}
+
+// Mixes frames of a voice into the bus, converting them to float a chunk at a time
+static void mix_Voice(const unsigned char *sample_8bit, const short *sample_16bit, bool f_mono, int frames, float *bus, float l_volume, float r_volume)
+{
+	float samples[MIX_CHUNK_FRAMES * 2];
+	const int channels = f_mono ? 1 : 2;
+
+	while (frames > 0)
+	{
+		int num = (frames < MIX_CHUNK_FRAMES) ? frames : MIX_CHUNK_FRAMES;
+
+		if (sample_8bit)
+		{
+			Mix_cur_kernels->convert8(sample_8bit, samples, num * channels);
+			sample_8bit += num * channels;
+		}
+		else
+		{
+			Mix_cur_kernels->convert16(sample_16bit, samples, num * channels);
+			sample_16bit += num * channels;
+		}
+
+		if (f_mono)
+			Mix_cur_kernels->add_mono(samples, num, bus, l_volume, r_volume);
+		else
+			Mix_cur_kernels->add_stereo(samples, num, bus, l_volume, r_volume);
+
+		bus += num * 2;
+		frames -= num;
+	}
+}
+
+// Returns a sample of a sound played at a lower sampling rate. Only every 2nd (skip_interval 1)
+// or 4th (skip_interval 2) sample is real, the ones in between are interpolated.
+static inline int mix_SkipSample(const short *sample_16bit, const unsigned char *sample_8bit, int skip_interval, int samples_played)
+{
+	int sample = 0;
+
+	if (skip_interval == 1)
+	{
+		if(sample_16bit)
+		{
+			if(samples_played & 0x0001)
+			{
+				sample = ((int)sample_16bit[samples_played ^ 0x0001] +
+							 (int)sample_16bit[samples_played + 1]) >> 1;
+			}
+			else
+				sample = sample_16bit[samples_played];
+		}
+		else
+		{
+			if(samples_played & 0x0001)
+			{
+				// Notes: (<<7) is from a (<<8) - (>>1)
+				// Notes: (-256) is from (-128) + (-128)
+				sample = ((int)sample_8bit[samples_played ^ 0x0001] + (int)sample_8bit[samples_played + 1] - 256) << 7;
+			}
+			else
+				sample = (((int)sample_8bit[samples_played]) - (int)128) << 8;
+		}
+
+		return sample;
+	}
+
+	const int mod_pos = samples_played % 4;
+
+	if(sample_16bit)
+	{
+		switch(mod_pos)
+		{
+		case 0:
+			sample = sample_16bit[samples_played];
+			break;
+		case 1:
+			sample = (sample_16bit[samples_played - 1]*3 +
+						 sample_16bit[samples_played + 3]) >> 2;
+			break;
+		case 2:
+			sample = (sample_16bit[samples_played - 2] +
+						 sample_16bit[samples_played + 2]) >> 1;
+			break;
+		case 3:
+			sample = (sample_16bit[samples_played - 3] +
+						 sample_16bit[samples_played + 1]*3) >> 2;
+			break;
+		}
+	}
+	else
+	{
+		switch(mod_pos)
+		{
+		case 0:
+			sample = ((((int)sample_8bit[samples_played]) - 128) << 8);
+			break;
+		case 1:
+			sample = (((((int)sample_8bit[samples_played - 1]) - 128) << 8)*3 +
+						 ((((int)sample_8bit[samples_played + 3]) - 128) << 8)) >> 2;
+			break;
+		case 2:
+			sample = (((((int)sample_8bit[samples_played - 2]) - 128) << 8) +
+						 ((((int)sample_8bit[samples_played + 2]) - 128) << 8)) >> 1;
+			break;
+		case 3:
+			sample = (((((int)sample_8bit[samples_played - 3]) - 128) << 8) +
+						 ((((int)sample_8bit[samples_played + 1]) - 128) << 8)*3) >> 2;
+			break;
+		}
+	}
+
+	return sample;
+}
+
+// Mixes frames of a lower sampling rate voice into the bus. These are always treated as mono.
+static void mix_VoiceSkip(const unsigned char *sample_8bit, const short *sample_16bit, int skip_interval, int samples_played, int frames, float *bus, float l_volume, float r_volume)
+{
+	float samples[MIX_CHUNK_FRAMES];
+
+	while (frames > 0)
+	{
+		int num = (frames < MIX_CHUNK_FRAMES) ? frames : MIX_CHUNK_FRAMES;
+
+		for (int i = 0; i < num; i++)
+			samples[i] = (float)mix_SkipSample(sample_16bit, sample_8bit, skip_interval, samples_played++);
+
+		Mix_cur_kernels->add_mono(samples, num, bus, l_volume, r_volume);
+
+		bus += num * 2;
+		frames -= num;
+	}
+}
 
 software_mixer::software_mixer()
 {
 	m_init = false;
 	m_buffer = NULL;
+	m_bus = NULL;
+	m_bus_len = 0;
+	m_max_voices_mixed = 0;
+	m_voice_mixed = NULL;
+	m_voice_ranks = NULL;
+	m_voice_list_len = 0;
+	memset(&m_voice_stats, 0, sizeof(m_voice_stats));
 }
 
 software_mixer::~software_mixer()
@@ -44,6 +443,12 @@ software_mixer::~software_mixer()
 	{
 		free(m_buffer);
 	}
+	if(m_bus)
+	{
+		free(m_bus);
+	}
+	free(m_voice_mixed);
+	free(m_voice_ranks);
 }
 
 bool software_mixer::Initialize(tMixerInit *mi)
@@ -76,6 +481,7 @@ bool software_mixer::Initialize(tMixerInit *mi)
 	}
 
 	m_max_sounds_available = mi->max_sounds_available;
+	m_max_voices_mixed = mi->max_voices_mixed;
 	m_sound_cache = mi->sound_cache;
 	m_primary_alignment = mi->primary_alignment;
 
@@ -87,9 +493,110 @@ bool software_mixer::Initialize(tMixerInit *mi)
 		m_buffer = (unsigned char *)malloc(m_BufferSize);
 	}
 
+	Mix_cur_kernels = &Mix_kernels[mix_BestKernels()];
+	mprintf((0,"Mixer: Using %s kernels, mixing up to %d voices\n",Mix_cur_kernels->name,m_max_voices_mixed));
+
 	return true;
 }
 
+void software_mixer::GetVoiceStats(tMixerVoiceStats *stats)
+{
+	*stats = m_voice_stats;
+	m_voice_stats.max_mix_time = 0;
+}
+
+void software_mixer::SelectVoices(void)
+{
+	const int num_slots = *m_max_sounds_available;
+	int num_active = 0;
+	int num_streams = 0;
+
+	if (num_slots > m_voice_list_len)
+	{
+		free(m_voice_mixed);
+		free(m_voice_ranks);
+		m_voice_list_len = num_slots;
+		m_voice_mixed = (unsigned char *)malloc(num_slots);
+		m_voice_ranks = (tVoiceRank *)malloc(num_slots * sizeof(tVoiceRank));
+	}
+
+	memset(m_voice_mixed, 0, num_slots);
+
+	for (int slot = 0; slot < num_slots; slot++)
+	{
+		sound_buffer_info *cur_buf = &m_sound_cache[slot];
+		if (cur_buf->m_status == SSF_UNUSED || (cur_buf->m_status & SSF_PAUSED))
+			continue;
+
+		// Streams can't skip ahead, so they're always mixed and don't count against the cap
+		if (cur_buf->m_status & SSF_PLAY_STREAMING)
+		{
+			m_voice_mixed[slot] = 1;
+			num_streams++;
+			continue;
+		}
+
+		play_information *play_info = cur_buf->play_info;
+		tVoiceRank *rank = &m_voice_ranks[num_active++];
+		rank->slot = slot;
+		rank->distance = cur_buf->m_distance;
+
+		// Critical sounds bump everything else anyways
+		if (play_info->priority >= SND_PRIORITY_CRITICAL)
+			rank->score = FLT_MAX;
+		else
+			rank->score = (play_info->priority + 1) * std::max(play_info->left_volume, play_info->right_volume);
+	}
+
+	int num_mixed = num_active;
+	if (m_max_voices_mixed > 0 && num_active > m_max_voices_mixed)
+	{
+		num_mixed = m_max_voices_mixed;
+		std::nth_element(m_voice_ranks, m_voice_ranks + num_mixed, m_voice_ranks + num_active, [](const tVoiceRank &l, const tVoiceRank &r)
+			{
+				if (l.score != r.score)
+					return l.score > r.score;
+				if (l.distance != r.distance)
+					return l.distance < r.distance;
+				return l.slot < r.slot;
+			});
+	}
+
+	for (int i = 0; i < num_mixed; i++)
+		m_voice_mixed[m_voice_ranks[i].slot] = 1;
+
+	m_voice_stats.active_voices = num_active + num_streams;
+	m_voice_stats.real_voices = num_mixed + num_streams;
+	m_voice_stats.virtual_voices = num_active - num_mixed;
+}
+
+void software_mixer::AdvanceVirtualVoice(sound_buffer_info *cur_buf, int num_samples)
+{
+	play_information *play_info = cur_buf->play_info;
+	int sound_index = cur_buf->m_sound_index;
+	int samples_played = play_info->m_samples_played + num_samples;
+
+	if (cur_buf->m_status & SSF_PLAY_LOOPING)
+	{
+		// Wrap by the same length StreamMixer takes off a position that's past loop_end,
+		// so the voice picks up where StreamMixer would have put it
+		int loop_start = Sounds[sound_index].loop_start;
+		int loop_end = Sounds[sound_index].loop_end;
+		int loop_len = loop_end - loop_start;
+
+		if (samples_played > loop_end && loop_len > 0)
+			samples_played -= loop_len * ((samples_played - loop_end + loop_len - 1) / loop_len);
+
+		play_info->m_samples_played = samples_played;
+		return;
+	}
+
+	play_info->m_samples_played = samples_played;
+
+	if (samples_played >= SoundFiles[Sounds[sound_index].sample_index].np_sample_length)
+		m_ll_sound_ptr->StopSound(cur_buf->m_unique_id);
+}
+
 // A peroidic mixer that uses the primary buffer as a stream buffer
 void software_mixer::DoFrame(void)
 {
@@ -106,8 +613,7 @@ void software_mixer::DoFrame(void)
 // mixing and effects (writes data to the locked primary buffer)
 void software_mixer::StreamMixer(char *ptr, int len)
 {
-	int i;
-	short *mixer_buffer16 = (short *) ptr;
+	float *mix_bus;
 	int current_slot = 0;
 	bool f_loop;
 	bool f_mono;
@@ -132,18 +638,36 @@ void software_mixer::StreamMixer(char *ptr, int len)
 		return;
 	}
 	
-	memset((char *)ptr, 0, len);
+	// The bus holds a float for each output sample. It's sized on the first call, the
+	// output length doesn't change after that.
+	if (buff_len * 2 > m_bus_len)
+	{
+		free(m_bus);
+		m_bus_len = buff_len * 2;
+		m_bus = (float *)malloc(m_bus_len * sizeof(float));
+	}
+	memset(m_bus, 0, buff_len * 2 * sizeof(float));
+
+	double start_time = timer_GetTime64();
+
+	SelectVoices();
 
 	// Mix the sound slots
 	while(current_slot < (*m_max_sounds_available) )
 	{
 		sound_buffer_info *cur_buf = &m_sound_cache[current_slot];
 		int num_samples = buff_len;
-		mixer_buffer16 = (short *) ptr;
+		mix_bus = m_bus;
 		f_mono = true;
 
+		// Voices that didn't make the cut this time just keep their place
+		if (!m_voice_mixed[current_slot])
+		{
+			if((cur_buf->m_status != SSF_UNUSED) && !(cur_buf->m_status & (SSF_PAUSED | SSF_PLAY_STREAMING)))
+				AdvanceVirtualVoice(cur_buf, num_samples);
+		}
 		// Find slots with sounds in them
-		if((cur_buf->m_status != SSF_UNUSED) && !(cur_buf->m_status & SSF_PAUSED))
+		else if((cur_buf->m_status != SSF_UNUSED) && !(cur_buf->m_status & SSF_PAUSED))
 		{
 			float l_volume = cur_buf->play_info->left_volume;
 			float r_volume = cur_buf->play_info->right_volume;
@@ -243,7 +767,7 @@ void software_mixer::StreamMixer(char *ptr, int len)
 					num_samples -= num_write;
 					ASSERT(num_samples > 0);
 
-					mixer_buffer16 += num_write << 1;  // update to the new start position 
+					mix_bus += num_write << 1;  // update to the new start position 
 					                                   // (2x because of left and right channels)
 					samples_played = loop_start;
 				}
@@ -313,151 +837,21 @@ void software_mixer::StreamMixer(char *ptr, int len)
 			// Mix at 16 bits per sample 
 			if(skip_interval == 0)
 			{
-				short *cur_sample_16bit = sample_16bit;
-				unsigned char *cur_sample_8bit = sample_8bit;
-
 				if(f_mono)
-				{
-					if(sample_8bit)
-					{
-						cur_sample_8bit += samples_played;
-						opti_8m_mix(cur_sample_8bit, num_write, samples_played, mixer_buffer16, l_volume, r_volume);
-					}
-					else
-					{
-						cur_sample_16bit += samples_played;
-						opti_16m_mix(cur_sample_16bit, num_write, samples_played, mixer_buffer16, l_volume, r_volume);
-					}
-				}
+					mix_Voice(sample_8bit ? sample_8bit + samples_played : NULL, sample_16bit ? sample_16bit + samples_played : NULL,
+						true, num_write, mix_bus, l_volume, r_volume);
 				else
-				{
-					if(sample_8bit)
-					{
-						cur_sample_8bit += (samples_played<<1);
-						opti_8s_mix(cur_sample_8bit, num_write, samples_played, mixer_buffer16, l_volume, r_volume);
-					}
-					else
-					{
-						cur_sample_16bit += (samples_played<<1);
-						opti_16s_mix(cur_sample_16bit, num_write, samples_played, mixer_buffer16, l_volume, r_volume);
-					}
-				}
+					mix_Voice(sample_8bit ? sample_8bit + (samples_played<<1) : NULL, sample_16bit ? sample_16bit + (samples_played<<1) : NULL,
+						false, num_write, mix_bus, l_volume, r_volume);
 			}
 			else
 			// Account for lower-sampling rate
 			{
-				if(skip_interval == 1)
-				{
-					for(i = 0; i < (num_write << 1); i += 2)
-					{
-						int sample; 
-							
-						if(sample_16bit)
-						{
-							if(samples_played & 0x0001)
-							{
-								sample = ((int)sample_16bit[samples_played ^ 0x0001] +
-											 (int)sample_16bit[samples_played + 1]) >> 1;
-							}
-							else
-								sample = sample_16bit[samples_played];
-						}
-						else
-						{
-							if(samples_played & 0x0001)
-							{
-								// Notes: (<<7) is from a (<<8) - (>>1)
-								// Notes: (-256) is from (-128) + (-128)
-								sample = ((int)sample_8bit[samples_played ^ 0x0001] + (int)sample_8bit[samples_played + 1] - 256) << 7;
-							}
-							else
-								sample = (((int)sample_8bit[samples_played]) - (int)128) << 8;
-						}
-
-						samples_played++;
-
-						ASSERT(i >= 0 && (i + 1 < num_samples * 2));
-
-						int l_sample = mixer_buffer16[i] + (sample * l_volume);
-						int r_sample =	mixer_buffer16[i + 1] + (sample * r_volume);
-
-						if(l_sample < -32767) l_sample = -32767;
-						if(l_sample > 32767) l_sample = 32767;
-						if(r_sample < -32767) r_sample = -32767;
-						if(r_sample > 32767) r_sample = 32767;
-
-						mixer_buffer16[i] = (short)l_sample;
-						mixer_buffer16[i + 1] = (short)r_sample;
-					}
-				}
-				else
-				{
-					for(i = 0; i < (num_write << 1); i += 2)
-					{
-						int sample; 
-						const int mod_pos = samples_played % 4;
-
-						if(sample_16bit)
-						{
-							switch(mod_pos)
-							{
-							case 0:
-								sample = sample_16bit[samples_played];
-								break;
-							case 1:
-								sample = (sample_16bit[samples_played - 1]*3 +
-											 sample_16bit[samples_played + 3]) >> 2;
-								break;
-							case 2:
-								sample = (sample_16bit[samples_played - 2] +
-											 sample_16bit[samples_played + 2]) >> 1;
-								break;
-							case 3:
-								sample = (sample_16bit[samples_played - 3] +
-											 sample_16bit[samples_played + 1]*3) >> 2;
-								break;
-							}
-						}
-						else
-						{
-							switch(mod_pos)
-							{
-							case 0:
-								sample = ((((int)sample_8bit[samples_played]) - 128) << 8);
-								break;
-							case 1:
-								sample = (((((int)sample_8bit[samples_played - 1]) - 128) << 8)*3 +
-											 ((((int)sample_8bit[samples_played + 3]) - 128) << 8)) >> 2;
-								break;
-							case 2:
-								sample = (((((int)sample_8bit[samples_played - 2]) - 128) << 8) +
-											 ((((int)sample_8bit[samples_played + 2]) - 128) << 8)) >> 1;
-								break;
-							case 3:
-								sample = (((((int)sample_8bit[samples_played - 3]) - 128) << 8) +
-											 ((((int)sample_8bit[samples_played + 1]) - 128) << 8)*3) >> 2;
-								break;
-							}
-						}
-
-						samples_played++;
-
-						ASSERT(i >= 0 && (i + 1 < num_samples * 2));
-
-						int l_sample = mixer_buffer16[i] + (sample * l_volume);
-						int r_sample =	mixer_buffer16[i + 1] + (sample * r_volume);
-
-						if(l_sample < -32767) l_sample = -32767;
-						if(l_sample > 32767) l_sample = 32767;
-						if(r_sample < -32767) r_sample = -32767;
-						if(r_sample > 32767) r_sample = 32767;
-
-						mixer_buffer16[i] = (short)l_sample;
-						mixer_buffer16[i + 1] = (short)r_sample;
-					}
-				}
+				mix_VoiceSkip(sample_8bit, sample_16bit, skip_interval, samples_played, num_write, mix_bus, l_volume, r_volume);
 			}
 
+			samples_played += num_write;
+
 stream_done:
 
 			cur_buf->play_info->m_samples_played = samples_played;
@@ -529,134 +923,138 @@ stream_done:
 	error_bail:
 		current_slot++;
 	}
-}
 
-inline void	opti_8m_mix(unsigned char *cur_sample_8bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume)
-{
-	int i;
-	short *mb = mixer_buffer16;
-
-	for(i = 0; i < (num_write << 1); i += 2)
-	{
-		short sample; 
-		int l_sample;
-		int r_sample;
+	// Everything is in, clamp the bus into the output
+	Mix_cur_kernels->saturate(m_bus, (short *)ptr, buff_len * 2);
 
-		sample = (((short)(*cur_sample_8bit)) - (short)128) << 8;
-		cur_sample_8bit++;
-
-		l_sample = *mb + (sample * l_volume);
-		r_sample =	*(mb + 1) + (sample * r_volume);
+	m_voice_stats.mix_time = (float)(timer_GetTime64() - start_time);
+	if (m_voice_stats.mix_time > m_voice_stats.max_mix_time)
+		m_voice_stats.max_mix_time = m_voice_stats.mix_time;
+}
 
-		samples_played++;
+#define MIX_BENCH_FRAMES		1024	// frames per mixer call, the default SDL buffer size
+#define MIX_BENCH_SECONDS		10		// seconds of audio mixed with each kernel set
+#define MIX_BENCH_SOUND_FRAMES	22050	// length of each test stream
+#define MIX_BENCH_RATE			22050
 
-		if(l_sample < -32767) l_sample = -32767;
-		if(l_sample > 32767) l_sample = 32767;
-		if(r_sample < -32767) r_sample = -32767;
-		if(r_sample > 32767) r_sample = 32767;
+typedef struct
+{
+	void *data;
+	int size;
+} tMixBenchStream;
 
-		*mb = (short)l_sample;
-		mb++;
-		*mb = (short)r_sample;
-		mb++;
-	}
+// Hands the same data back, so the test streams never end
+static void *mix_BenchStreamCallback(void *user_data, int, int *size)
+{
+	tMixBenchStream *stream = (tMixBenchStream *)user_data;
+	*size = stream->size;
+	return stream->data;
 }
 
-inline void	opti_8s_mix(unsigned char *cur_sample_8bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume)
+static void mix_BenchSetError(int)
 {
-	int i;
-	short *mb = mixer_buffer16;
-
-	for(i = 0; i < (num_write << 1); i += 2)
-	{
-		short lsample; 
-		short rsample;
-		int l_sample;
-		int r_sample;
-
-		lsample = (((short)(*cur_sample_8bit)) - (short)128) << 8;
-		cur_sample_8bit++;
-		rsample = (((short)(*cur_sample_8bit)) - (short)128) << 8;
-		cur_sample_8bit++;
-		
-		l_sample = *mb + (lsample * l_volume);
-		r_sample =	*(mb + 1) + (rsample * r_volume);
-
-		samples_played++;
-
-		if(l_sample < -32767) l_sample = -32767;
-		if(l_sample > 32767) l_sample = 32767;
-		if(r_sample < -32767) r_sample = -32767;
-		if(r_sample > 32767) r_sample = 32767;
+}
 
-		*mb = (short)l_sample;
-		mb++;
-		*mb = (short)r_sample;
-		mb++;
-	}
+static void mix_BenchErrorText(char *, ...)
+{
 }
 
-inline void	opti_16m_mix(short *cur_sample_16bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume)
+void software_mixer::Benchmark(int num_voices)
 {
-	int i;
-	short *mb = mixer_buffer16;
+	static const ushort formats[4] = {SIF_STREAMING_8_M, SIF_STREAMING_16_M, SIF_STREAMING_8_S, SIF_STREAMING_16_S};
+	static const int frame_sizes[4] = {1, 2, 2, 4};
+	tMixBenchStream streams[4];
+
+	// Fill a stream of each format with noise. The padding covers the interpolation of
+	// lower rate voices reading past the end.
+	unsigned int seed = 1;
+	for (int i = 0; i < 4; i++)
+	{
+		int size = MIX_BENCH_SOUND_FRAMES * frame_sizes[i];
+		unsigned char *data = (unsigned char *)malloc(size + 16);
+		for (int j = 0; j < size + 16; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+			data[j] = (unsigned char)(seed >> 16);
+		}
+		streams[i].data = data;
+		streams[i].size = size;
+	}
 
-	for(i = 0; i < (num_write << 1); i += 2)
+	sound_buffer_info *voices = new sound_buffer_info[num_voices];
+	play_information *play_info = new play_information[num_voices];
+	short *output = (short *)malloc(MIX_BENCH_FRAMES * 2 * sizeof(short));
+	int error_code = SSL_OK;
+
+	software_mixer mixer;
+	mixer.m_init = true;
+	mixer.m_ll_sound_ptr = NULL;	// the streams never end, so the mixer never stops a sound
+	mixer.m_primary_buffer = NULL;
+	mixer.m_primary_alignment = 2 * sizeof(short);
+	mixer.m_max_sounds_available = &num_voices;
+	mixer.m_sound_cache = voices;
+	mixer.m_error_code = &error_code;
+	mixer.m_fpSetError = mix_BenchSetError;
+	mixer.m_fpErrorText = mix_BenchErrorText;
+
+	const int num_calls = MIX_BENCH_SECONDS * MIX_BENCH_RATE / MIX_BENCH_FRAMES;
+	const tMixKernels *save_kernels = Mix_cur_kernels;
+	unsigned int scalar_checksum = 0;
+
+	mprintf((0, "Mixer benchmark: %d voices, %d calls of %d frames\n", num_voices, num_calls, MIX_BENCH_FRAMES));
+
+	int num_kernels = mix_NumSupportedKernels();
+	for (int k = 0; k < num_kernels; k++)
 	{
-		short sample; 
-		int l_sample;
-		int r_sample;
+		Mix_cur_kernels = &Mix_kernels[k];
 
-		sample = *cur_sample_16bit;
-		cur_sample_16bit++;
+		// Start every voice from the beginning. Some of the mono ones play at lower rates.
+		for (int i = 0; i < num_voices; i++)
+		{
+			int format = i % 4;
+			play_information *pi = &play_info[i];
+
+			memset(pi, 0, sizeof(play_information));
+			pi->m_stream_cback = mix_BenchStreamCallback;
+			pi->m_stream_data = streams[format].data;
+			pi->m_stream_size = streams[format].size;
+			pi->m_stream_format = formats[format];
+			pi->user_data = &streams[format];
+			pi->sample_skip_interval = (format < 2 && (i % 3) == 2) ? 1 + (i / 3) % 2 : 0;
+			pi->left_volume = 0.2f + 0.6f * ((i * 7) % 11) / 10.0f;
+			pi->right_volume = 1.0f - pi->left_volume * 0.5f;
+
+			voices[i].play_info = pi;
+			voices[i].m_sound_index = 0;
+			voices[i].m_unique_id = i;
+			voices[i].m_status = SSF_PLAY_STREAMING;
+		}
 
-		l_sample = *mb + (sample * l_volume);
-		r_sample =	*(mb + 1) + (sample * r_volume);
+		unsigned int checksum = 0;
+		double mix_time = 0;
+		for (int call = 0; call < num_calls; call++)
+		{
+			double start = timer_GetTime64();
+			mixer.StreamMixer((char *)output, MIX_BENCH_FRAMES * 2 * sizeof(short));
+			mix_time += timer_GetTime64() - start;
 
-		samples_played++;
+			for (int i = 0; i < MIX_BENCH_FRAMES * 2; i++)
+				checksum = checksum * 31 + (unsigned short)output[i];
+		}
 
-		if(l_sample < -32767) l_sample = -32767;
-		if(l_sample > 32767) l_sample = 32767;
-		if(r_sample < -32767) r_sample = -32767;
-		if(r_sample > 32767) r_sample = 32767;
+		if (k == MIX_KERNELS_SCALAR)
+			scalar_checksum = checksum;
 
-		*mb = (short)l_sample;
-		mb++;
-		*mb = (short)r_sample;
-		mb++;
+		mprintf((0, "Mixer benchmark: %-6s %8.3f ms per call, %7.1fx realtime, checksum %08x%s\n", Mix_cur_kernels->name,
+			mix_time * 1000.0 / num_calls, mix_time > 0 ? MIX_BENCH_SECONDS / mix_time : 0.0, checksum,
+			checksum == scalar_checksum ? "" : " MISMATCH"));
 	}
-}
 
-inline void	opti_16s_mix(short *cur_sample_16bit, const int num_write, int &samples_played, short *mixer_buffer16, const float l_volume, const float r_volume)
-{
-	int i;
-	short *mb = mixer_buffer16;
+	Mix_cur_kernels = save_kernels;
 
-	for(i = 0; i < (num_write << 1); i += 2)
-	{
-		short lsample; 
-		short rsample;
-		int l_sample;
-		int r_sample;
-
-		lsample = *cur_sample_16bit;
-		cur_sample_16bit++;
-		rsample = *cur_sample_16bit;
-		cur_sample_16bit++;
-		
-		l_sample = *mb + (lsample * l_volume);
-		r_sample =	*(mb + 1) + (rsample * r_volume);
-
-		samples_played++;
-
-		if(l_sample < -32767) l_sample = -32767;
-		if(l_sample > 32767) l_sample = 32767;
-		if(r_sample < -32767) r_sample = -32767;
-		if(r_sample > 32767) r_sample = 32767;
-
-		*mb = (short)l_sample;
-		mb++;
-		*mb = (short)r_sample;
-		*mb++;
-	}
+	free(output);
+	delete[] play_info;
+	delete[] voices;
+	for (int i = 0; i < 4; i++)
+		free(streams[i].data);
 }
@@ -50,7 +50,11 @@
 #define SOUNDLIB_DEFAULT_SAMPLES 1024
 
 // ===============================
-#define MAX_SOUNDS_PLAYING_AT_ONCE	256
+// Sounds that can be playing at once. Only the loudest and highest priority of these are
+// mixed (see max_voices_mixed), the rest are virtual voices that just keep their place.
+#define MAX_SOUNDS_PLAYING_AT_ONCE	1024
+#define SOUND_SLOT_BITS				10
+#define SOUND_SLOT_MASK				((1 << SOUND_SLOT_BITS) - 1)
 static sound_buffer_info sound_cache[MAX_SOUNDS_PLAYING_AT_ONCE];
 static int sound_buffer_size = MAX_SOUNDS_PLAYING_AT_ONCE;
 
@@ -84,6 +88,7 @@ int lnxsound::InitSoundLib(char mixer_type, oeApplication *sos, unsigned char ma
 	mi.primary_buffer = NULL;
 	mi.primary_frequency = SOUNDLIB_SAMPLE_RATE;
 	mi.max_sounds_available = &sound_buffer_size;
+	mi.max_voices_mixed = max_sounds_played;
 	mi.sound_cache = sound_cache;
 	mi.primary_alignment = SOUNDLIB_CHANNELS*(SOUNDLIB_SAMPLE_SIZE>>3);
 	mi.fp_SetError = lnxsound_SetError;
@@ -91,6 +96,13 @@ int lnxsound::InitSoundLib(char mixer_type, oeApplication *sos, unsigned char ma
 	mi.p_error_code = &m_lib_error_code;
 	mi.ll_sound_ptr = ll_sound_ptr;
 
+	// -mixvoices <n> overrides how many voices get mixed at once, 0 mixes them all
+	int voicesArgIndex = FindArg("-mixvoices");
+	if( voicesArgIndex != 0 && GetArg( voicesArgIndex + 1 ) )
+	{
+		mi.max_voices_mixed = atoi( GetArg( voicesArgIndex + 1 ) );
+	}
+
 	if(!m_mixer.Initialize(&mi))
     {
         return false;
@@ -362,6 +374,7 @@ int lnxsound::PlaySound2d(play_information *play_info, int sound_index, float f_
 	sb->m_unique_id = MakeUniqueId(sound_slot);
 	sb->m_buffer_type = SBT_2D;
 	sb->m_sound_index = sound_index;
+	sb->m_distance = 0.0f;
 	sb->m_status = SSF_UNUSED;
 
 	ASSERT(sb->m_unique_id != -1);
@@ -371,19 +384,20 @@ int lnxsound::PlaySound2d(play_information *play_info, int sound_index, float f_
 	return sb->m_unique_id; 
 }
 
-// This function limits the number of sounds cached to 255(8bits) and 256 bit is for invalid channel
+// The low SOUND_SLOT_BITS bits of the id are the slot, the rest count up with each sound played.
 // The purpose is to create unique signatures for each sound played (and allow for
 // the slot_number to be quickly determined)
 inline int lnxsound::MakeUniqueId(int sound_slot)
 {
-	return ((((int)m_total_sounds_played)<<8) + sound_slot);
+	// keep the id positive, -1 means no sound
+	return (((m_total_sounds_played & (0x7FFFFFFF >> SOUND_SLOT_BITS))<<SOUND_SLOT_BITS) + sound_slot);
 }
 
 inline int lnxsound::ValidateUniqueId(int sound_uid) 
 {
-	if(sound_uid == sound_cache[sound_uid & 0x00FF].m_unique_id) 
+	if(sound_uid >= 0 && sound_uid == sound_cache[sound_uid & SOUND_SLOT_MASK].m_unique_id) 
 	{
-		return sound_uid & 0x00FF;
+		return sound_uid & SOUND_SLOT_MASK;
 	}
 	else 
 	{
@@ -420,6 +434,7 @@ int lnxsound::PlayStream(play_information *play_info)
 	ASSERT(sound_cache[sound_slot].m_unique_id != -1);
 
 	sound_cache[sound_slot].m_buffer_type = SBT_2D;
+	sound_cache[sound_slot].m_distance = 0.0f;
 	sound_cache[sound_slot].m_status = SSF_PLAY_STREAMING;
 
 	m_cur_sounds_played++;
@@ -480,7 +495,13 @@ int lnxsound::PlaySound3d(play_information *play_info, int sound_index, pos_stat
 	else if(pan > 1.0f)
 		pan = 1.0f;
 
-	return PlaySound2d(play_info, sound_index, volume, pan, f_looped);
+	int sound_uid = PlaySound2d(play_info, sound_index, volume, pan, f_looped);
+	if (sound_uid != -1)
+	{
+		sound_cache[sound_uid & SOUND_SLOT_MASK].m_distance = dist;
+	}
+
+	return sound_uid;
 }
 
 void lnxsound::AdjustSound(int sound_uid, float f_volume, float f_pan, unsigned short frequency)
@@ -547,6 +568,7 @@ void lnxsound::AdjustSound(int sound_uid, pos_state *cur_pos, float adjusted_vol
 	else if(pan > 1.0f)
 		pan = 1.0f;
 
+	sound_cache[current_slot].m_distance = dist;
 	AdjustSound(sound_cache[current_slot].m_unique_id, volume, pan, 22050);
 }
 
@@ -787,13 +809,18 @@ void lnxsound::SoundStartFrame(void)
 	}
 
 #ifdef _DEBUG
-	mprintf_at((3,2,0, "LNS: %02d/%02d", counter, MAX_SOUNDS_PLAYING_AT_ONCE));
+	mprintf_at((3,2,0, "LNS: %03d/%04d", counter, MAX_SOUNDS_PLAYING_AT_ONCE));
 	mprintf_at((3,3,1, "Lp: %02d", loop_counter));
 	mprintf_at((3,4,1, "St: %02d", stream_counter));
 	mprintf_at((3,5,0, " Ot: %02d", counter-loop_counter-stream_counter));
 
 	mprintf_at((3,2,20, "P5:%02d P4:%02d P3:%02d", n_p5,n_p4,n_p3));
 	mprintf_at((3,3,20, "P2:%02d P1:%02d P0:%02d", n_p2,n_p1,n_p0));
+
+	tMixerVoiceStats voice_stats;
+	m_mixer.GetVoiceStats(&voice_stats);
+	mprintf_at((3,4,20, "Real:%03d Virt:%03d", voice_stats.real_voices, voice_stats.virtual_voices));
+	mprintf_at((3,5,20, "Mix:%.2fms Max:%.2fms", voice_stats.mix_time * 1000.0f, voice_stats.max_mix_time * 1000.0f));
 #endif
 
 }
@@ -18,8 +18,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <math.h>
 #include "mono.h"
 #include "pserror.h"
+#include "args.h"
+#include "ddio.h"
+#include "vecmat.h"
 
 #include "llsopenal.h"
 #include "ddsndgeometry.h"
@@ -123,7 +127,13 @@ int llsOpenAL::InitSoundLib(char mixer_type, oeApplication* sos, unsigned char m
 
 	alDistanceModel(AL_LINEAR_DISTANCE_CLAMPED);
 
-	NumSoundChannels = max_sounds_played;
+	//-mixvoices <n> sets how many sounds are actually mixed, 0 for all of them
+	NumRealVoices = max_sounds_played;
+	int voicesArg = FindArg("-mixvoices");
+	if (voicesArg && GetArg(voicesArg + 1))
+		NumRealVoices = atoi(GetArg(voicesArg + 1));
+	NumSoundChannels = std::min(max_sounds_played * VIRTUAL_VOICES_PER_VOICE, 256);
+	NumVirtualVoices = 0;
 	SoundEntries = (llsOpenALSoundEntry*)malloc(sizeof(llsOpenALSoundEntry) * NumSoundChannels);
 	if (!SoundEntries)
 	{
@@ -177,7 +187,7 @@ int llsOpenAL::InitSoundLib(char mixer_type, oeApplication* sos, unsigned char m
 		}
 	}
 
-	mprintf((0, "OpenAL LLS started successfully. %d channels specified.", max_sounds_played));
+	mprintf((0, "OpenAL LLS started successfully. %d channels specified, %d sound slots.", max_sounds_played, NumSoundChannels));
 	Initalized = true;
 
 	return 1;
@@ -272,6 +282,7 @@ int llsOpenAL::PlaySound2d(play_information* play_info, int sound_index, float v
 	SoundEntries[sound_uid].info = play_info;
 	SoundEntries[sound_uid].soundNum = sound_index;
 	SoundEntries[sound_uid].soundUID = NextUID * 256 + sound_uid;
+	InitVoice(sound_uid, sound_index, looped, nullptr);
 	//PutLog(LogLevel::Info, "Starting 2D sound %s with uid %d (slot %d)", pSoundFiles[pSounds[sound_index].sample_index].name, SoundEntries[sound_uid].soundUID, sound_uid);
 
 	NumSoundsPlaying++;
@@ -324,6 +335,7 @@ int llsOpenAL::PlayStream(play_information* play_info)
 	SoundEntries[sound_uid].playing = true;
 	SoundEntries[sound_uid].streaming = true;
 	SoundEntries[sound_uid].terminate = false;
+	SoundEntries[sound_uid].isVirtual = false;
 	SoundEntries[sound_uid].volume = peakVolume;
 	SoundEntries[sound_uid].info = play_info;
 	SoundEntries[sound_uid].soundUID = NextUID * 256 + sound_uid;
@@ -392,6 +404,7 @@ int llsOpenAL::PlaySound3d(play_information* play_info, int sound_index, pos_sta
 	SoundEntries[sound_uid].info = play_info;
 	SoundEntries[sound_uid].soundNum = sound_index;
 	SoundEntries[sound_uid].soundUID = NextUID * 256 + sound_uid;
+	InitVoice(sound_uid, sound_index, looped, cur_pos);
 	//PutLog(LogLevel::Info, "Starting 3D sound %s with uid %d (slot %d)", pSoundFiles[pSounds[sound_index].sample_index].name, SoundEntries[sound_uid].soundUID, sound_uid);
 
 	NumSoundsPlaying++;
@@ -408,6 +421,7 @@ void llsOpenAL::AdjustSound(int sound_uid, float f_volume, float f_pan, unsigned
 	ALuint handle = SoundEntries[id].handle;
 	alSourcef(handle, AL_GAIN, f_volume);
 	ALErrorCheck("Adjusting sound volume.");
+	SoundEntries[id].volume = f_volume;
 	//TODO: pan, frequency. Are these used?
 }
 
@@ -430,6 +444,8 @@ void llsOpenAL::AdjustSound(int sound_uid, pos_state* cur_pos, float adjusted_vo
 		mprintf((0, "\t(%f %f %f) (%f %f %f)", -cur_pos->velocity->x, cur_pos->velocity->y, cur_pos->velocity->z, -cur_pos->position->x, cur_pos->position->y, cur_pos->position->z));
 	alSourcef(handle, AL_GAIN, adjusted_volume);
 	ALErrorCheck("Adjusting sound gain.");
+	SoundEntries[id].volume = adjusted_volume;
+	SoundEntries[id].distance = vm_VectorDistance(cur_pos->position, &ListenerPosition);
 }
 
 void llsOpenAL::StopAllSounds(void)
@@ -522,6 +538,8 @@ void llsOpenAL::ResumeSound(int sound_uid)
 	int id = sound_uid & 255;
 	if (!Initalized) return;
 	if (!SoundEntries || id < 0 || id >= NumSoundChannels || SoundEntries[id].soundUID != sound_uid) return;
+	//Virtual voices stay paused until SelectVoices makes them real
+	if (SoundEntries[id].isVirtual) return;
 	alSourcePlay(SoundEntries[id].handle);
 }
 
@@ -590,6 +608,8 @@ void llsOpenAL::SoundEndFrame(void)
 			}
 		}
 	}
+
+	SelectVoices();
 }
 
 bool llsOpenAL::SetGlobalReverbProperties(const EAX2Reverb* reverb)
@@ -873,6 +893,173 @@ short llsOpenAL::FindSoundSlot(float volume, int priority)
 	return -1;
 }
 
+//Remembers what SelectVoices needs to know to rank a sound and to keep time for it while it's virtual
+void llsOpenAL::InitVoice(int soundID, int sound_index, bool looped, pos_state* posInfo)
+{
+	llsOpenALSoundEntry* entry = &SoundEntries[soundID];
+	int numSamples = SoundFiles[Sounds[sound_index].sample_index].np_sample_length;
+
+	entry->isVirtual = false;
+	entry->length = numSamples / 22050.0f;
+	entry->loopStart = 0.0f;
+	entry->loopEnd = entry->length;
+
+	//Same loop points as BindBufferData gives OpenAL
+	if (looped && LoopPointsSupported)
+	{
+		int loopStart = Sounds[sound_index].loop_start;
+		int loopEnd = Sounds[sound_index].loop_end;
+		if (Quality != SQT_HIGH)
+		{
+			loopStart >>= 1;
+			loopEnd >>= 1;
+		}
+		if (loopStart > numSamples) loopStart = 0;
+		if (loopEnd > numSamples) loopEnd = numSamples;
+		entry->loopStart = loopStart / 22050.0f;
+		entry->loopEnd = loopEnd / 22050.0f;
+	}
+
+	if (posInfo)
+	{
+		entry->distance = vm_VectorDistance(posInfo->position, &ListenerPosition);
+		entry->minDistance = Sounds[sound_index].min_distance;
+		entry->maxDistance = Sounds[sound_index].max_distance;
+	}
+	else
+		entry->distance = entry->minDistance = entry->maxDistance = 0.0f;
+}
+
+//How much a sound should win a real voice: its priority, times its gain after the same
+//linear distance falloff OpenAL gives it
+float llsOpenAL::VoiceAudibility(int soundID)
+{
+	llsOpenALSoundEntry* entry = &SoundEntries[soundID];
+	float gain = entry->volume;
+
+	if (entry->distance > entry->minDistance)
+	{
+		if (entry->distance >= entry->maxDistance || entry->maxDistance <= entry->minDistance)
+			gain = 0.0f;
+		else
+			gain *= 1.0f - (entry->distance - entry->minDistance) / (entry->maxDistance - entry->minDistance);
+	}
+
+	return (entry->info->priority + 1) * gain;
+}
+
+//Moves a virtual voice's play position up to now, following its loop like OpenAL would
+//Returns false if it's played to the end
+bool llsOpenAL::UpdateVirtualVoice(int soundID, double now)
+{
+	llsOpenALSoundEntry* entry = &SoundEntries[soundID];
+	float offset = entry->virtualOffset + (float)(now - entry->virtualTime);
+	ALint looping;
+
+	alGetSourcei(entry->handle, AL_LOOPING, &looping);
+	if (looping && entry->loopEnd > entry->loopStart)
+	{
+		if (offset >= entry->loopEnd)
+			offset = entry->loopStart + fmodf(offset - entry->loopStart, entry->loopEnd - entry->loopStart);
+	}
+	else if (offset >= entry->length)
+		return false;
+
+	entry->virtualOffset = offset;
+	entry->virtualTime = now;
+	return true;
+}
+
+//Lets the NumRealVoices most audible sounds play and pauses the rest as virtual voices.
+//Streams and critical sounds are always real, since a stream can't skip ahead.
+void llsOpenAL::SelectVoices()
+{
+	static short ranked[256];
+	static float audibility[256];
+	double now = timer_GetTime64();
+	int numRanked = 0;
+	int budget = NumRealVoices > 0 ? NumRealVoices : NumSoundChannels;
+	int i;
+
+	NumVirtualVoices = 0;
+
+	for (i = 0; i < NumSoundChannels; i++)
+	{
+		llsOpenALSoundEntry* entry = &SoundEntries[i];
+		if (!entry->playing)
+			continue;
+
+		if (entry->isVirtual)
+		{
+			if (!UpdateVirtualVoice(i, now))
+			{
+				alSourceStop(entry->handle);
+				SoundCleanup(i);
+				continue;
+			}
+		}
+		else
+		{
+			//Leave sounds the game paused alone
+			ALint state;
+			alGetSourcei(entry->handle, AL_SOURCE_STATE, &state);
+			if (state != AL_PLAYING)
+				continue;
+		}
+
+		if (entry->streaming || entry->info->priority >= SND_PRIORITY_CRITICAL)
+		{
+			budget--;
+			if (entry->isVirtual)
+			{
+				alSourcef(entry->handle, AL_SEC_OFFSET, entry->virtualOffset);
+				alSourcePlay(entry->handle);
+				entry->isVirtual = false;
+			}
+			continue;
+		}
+
+		audibility[i] = VoiceAudibility(i);
+		ranked[numRanked++] = i;
+	}
+
+	std::sort(ranked, ranked + numRanked, [](short l, short r)
+		{
+			if (audibility[l] != audibility[r])
+				return audibility[l] > audibility[r];
+			return l < r;
+		});
+
+	for (i = 0; i < numRanked; i++)
+	{
+		llsOpenALSoundEntry* entry = &SoundEntries[ranked[i]];
+		if (i < budget)
+		{
+			if (entry->isVirtual)
+			{
+				alSourcef(entry->handle, AL_SEC_OFFSET, entry->virtualOffset);
+				alSourcePlay(entry->handle);
+				entry->isVirtual = false;
+			}
+		}
+		else
+		{
+			if (!entry->isVirtual)
+			{
+				ALfloat offset;
+				alGetSourcef(entry->handle, AL_SEC_OFFSET, &offset);
+				alSourcePause(entry->handle);
+				entry->isVirtual = true;
+				entry->virtualOffset = offset;
+				entry->virtualTime = now;
+			}
+			NumVirtualVoices++;
+		}
+	}
+
+	ALErrorCheck("Selecting real voices");
+}
+
 void llsOpenAL::InitSource2D(uint32_t handle, sound_info* soundInfo, float volume)
 {
 	ALErrorCheck("Clearing entry error in 2d source properties.");
@@ -1003,6 +1190,7 @@ void llsOpenAL::BindBufferData(uint32_t handle, int sound_index, bool looped)
 void llsOpenAL::SoundCleanup(int soundID)
 {
 	SoundEntries[soundID].playing = false;
+	SoundEntries[soundID].isVirtual = false;
 	SoundFiles[Sounds[SoundEntries[soundID].soundNum].sample_index].use_count--;
 	//PutLog(LogLevel::Info, "Sound %d (%s) has been stopped", SoundEntries[i].soundUID, pSoundFiles[pSounds[SoundEntries[i].soundNum].sample_index].name);
 	if (NumSoundsPlaying > 0)
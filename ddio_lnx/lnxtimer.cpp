@@ -48,6 +48,7 @@
 
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pserror.h"
@@ -115,6 +116,13 @@ float timer_GetTime()
     return((float) SDL_GetTicks() / 1000.0);
 }
 
+double timer_GetTime64()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (double)t.tv_sec + ((double)t.tv_nsec/1000000000.0);
+}
+
 longlong timer_GetMSTime()
 {
 //rcg06292000 not used with SDL.
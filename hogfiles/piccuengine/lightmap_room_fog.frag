@@ -3,25 +3,42 @@
 uniform sampler2D colortexture;
 uniform sampler2D lightmaptexture;
 
-layout(std140) uniform RoomBlock
+struct RoomBlock
 {
 	vec4 fog_color;
 	float fog_distance;
 	float brightness;
 	int not_in_room;
 	vec4 fog_plane;
-} room;
+};
+
+//Per room data, packed three texels to a room
+uniform samplerBuffer roomdata;
+
+RoomBlock GetRoomBlock(int roomnum)
+{
+	RoomBlock block;
+	vec4 params = texelFetch(roomdata, roomnum * 3 + 1);
+	block.fog_color = texelFetch(roomdata, roomnum * 3);
+	block.fog_distance = params.x;
+	block.brightness = params.y;
+	block.not_in_room = floatBitsToInt(params.z);
+	block.fog_plane = texelFetch(roomdata, roomnum * 3 + 2);
+	return block;
+}
 
 in vec2 outuv;
 in vec2 outuv2;
 in vec3 outpt;
 in float outlight;
 flat in vec4 outplane;
+flat in int outroomnum;
 
 out vec4 color;
 
 void main()
 {
+	RoomBlock room = GetRoomBlock(outroomnum);
 	vec4 basecolor = texture(colortexture, outuv);
 	vec4 lmcolor = texture(lightmaptexture, outuv2);
 	
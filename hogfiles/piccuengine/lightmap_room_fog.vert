@@ -6,33 +6,52 @@ layout(std140) uniform CommonBlock
 	mat4 modelview;
 } commons;
 
-layout(std140) uniform RoomBlock
+struct RoomBlock
 {
 	vec4 fog_color;
 	float fog_distance;
 	float brightness;
 	int not_in_room;
 	vec4 fog_plane;
-} room;
+};
+
+//Per room data, packed three texels to a room
+uniform samplerBuffer roomdata;
+
+RoomBlock GetRoomBlock(int roomnum)
+{
+	RoomBlock block;
+	vec4 params = texelFetch(roomdata, roomnum * 3 + 1);
+	block.fog_color = texelFetch(roomdata, roomnum * 3);
+	block.fog_distance = params.x;
+	block.brightness = params.y;
+	block.not_in_room = floatBitsToInt(params.z);
+	block.fog_plane = texelFetch(roomdata, roomnum * 3 + 2);
+	return block;
+}
 
 layout(location = 0) in vec3 position;
 layout(location = 4) in vec2 uv;
 layout(location = 5) in vec2 uv2;
+layout(location = 7) in int roomnum;
 
 out vec2 outuv;
 out vec2 outuv2;
 out vec3 outpt;
 out float outlight;
 flat out vec4 outplane;
+flat out int outroomnum;
 
 void main()
 {
+	RoomBlock room = GetRoomBlock(roomnum);
 	vec4 temp = commons.modelview * vec4(position, 1.0);
 	gl_Position = commons.projection * temp;
 	outuv = uv;
 	outuv2 = uv2;
 	outpt = temp.xyz;
 	outlight = room.brightness;
+	outroomnum = roomnum;
 	
 	//fog plane nonsense
 	//This will take the room's fog plane and translate it into view space, so that the position doesn't need to be extracted from the modelview matrix.	
@@ -17,14 +17,29 @@ layout(std140) uniform SpecularBlock
 	specular speculars[4];
 } specular_data;
 
-layout(std140) uniform RoomBlock
+struct RoomBlock
 {
 	vec4 fog_color;
 	float fog_distance;
 	float brightness;
 	int not_in_room;
 	vec4 fog_plane;
-} room;
+};
+
+//Per room data, packed three texels to a room
+uniform samplerBuffer roomdata;
+
+RoomBlock GetRoomBlock(int roomnum)
+{
+	RoomBlock block;
+	vec4 params = texelFetch(roomdata, roomnum * 3 + 1);
+	block.fog_color = texelFetch(roomdata, roomnum * 3);
+	block.fog_distance = params.x;
+	block.brightness = params.y;
+	block.not_in_room = floatBitsToInt(params.z);
+	block.fog_plane = texelFetch(roomdata, roomnum * 3 + 2);
+	return block;
+}
 
 in vec2 outuv;
 in vec2 outuv2;
@@ -33,11 +48,13 @@ in vec3 outnormal;
 flat in vec3[4] outlightpos;
 in float outlight;
 flat in vec4 outplane;
+flat in int outroomnum;
 
 out vec4 color;
 
 void main()
 {
+	RoomBlock room = GetRoomBlock(outroomnum);
 	const float[4] weights = float[4](1.0, 0.66, 0.33, 0.25);
 	vec4 basecolor = texture(colortexture, outuv);
 	vec4 lmcolor = texture(lightmaptexture, outuv2);
@@ -20,30 +20,48 @@ layout(std140) uniform SpecularBlock
 	specular speculars[4];
 } specular_data;
 
-layout(std140) uniform RoomBlock
+struct RoomBlock
 {
 	vec4 fog_color;
 	float fog_distance;
 	float brightness;
 	int not_in_room;
 	vec4 fog_plane;
-} room;
+};
+
+//Per room data, packed three texels to a room
+uniform samplerBuffer roomdata;
+
+RoomBlock GetRoomBlock(int roomnum)
+{
+	RoomBlock block;
+	vec4 params = texelFetch(roomdata, roomnum * 3 + 1);
+	block.fog_color = texelFetch(roomdata, roomnum * 3);
+	block.fog_distance = params.x;
+	block.brightness = params.y;
+	block.not_in_room = floatBitsToInt(params.z);
+	block.fog_plane = texelFetch(roomdata, roomnum * 3 + 2);
+	return block;
+}
 
 layout(location = 0) in vec3 position;
 layout(location = 2) in vec3 normal;
 layout(location = 4) in vec2 uv;
 layout(location = 5) in vec2 uv2;
+layout(location = 7) in int roomnum;
 
 out vec2 outuv;
 out vec2 outuv2;
 out vec3 outpt;
 out vec3 outnormal;
 flat out vec4 outplane;
+flat out int outroomnum;
 flat out vec3[4] outlightpos;
 out float outlight;
 
 void main()
 {
+	RoomBlock room = GetRoomBlock(roomnum);
 	vec4 temp = commons.modelview * vec4(position, 1.0);
 	gl_Position = commons.projection * temp;
 	outuv = uv;
@@ -51,6 +69,7 @@ void main()
 	outpt = temp.xyz;
 	outnormal = mat3(commons.modelview) * normal;
 	outlight = room.brightness;
+	outroomnum = roomnum;
 	
 	//Need to transform the light positions too..
 	for (int i = 0; i < specular_data.num_specular; i++)
@@ -71,6 +71,26 @@ typedef struct chunked_bitmap
 chunked_bitmap;
 extern bms_bitmap GameBitmaps[MAX_BITMAPS];
 extern ulong Bitmap_memory_used;
+// Counters kept by the bitmap residency manager
+typedef struct
+{
+	longlong resident_bytes;	// data held by pageable bitmaps, which can be evicted and paged back in
+	int resident_bitmaps;	// pageable bitmaps that are resident
+	int evictions;			// pageable bitmaps whose data was freed because they weren't being used
+	int budget_evictions;	// evictions made to get under Bitmap_residency_budget
+	int reloads;			// evicted bitmaps that had to be paged back in
+	float reload_time;		// total time spent paging evicted bitmaps back in, in seconds
+	float max_reload_time;	// longest single reload
+	int mips_deferred;		// mip chains left until a mip level is asked for
+	int mips_built;			// deferred mip chains that have been built since
+} bm_residency_stats;
+extern bm_residency_stats Bitmap_residency_stats;
+// Seconds a pageable bitmap can go unused before its data is freed, 0 to keep it
+extern float Bitmap_evict_idle_time;
+// Bytes of pageable bitmap data to keep resident, 0 for no limit
+extern longlong Bitmap_residency_budget;
+// Build mip levels the first time they're asked for, rather than at load
+extern bool Bitmap_lazy_mips;
 extern ubyte Memory_map[];
 // Sets all the bitmaps to unused
 void bm_InitBitmaps();
@@ -156,4 +176,8 @@ void bm_FreeBitmapData(int handle);
 int bm_format (int handle);
 // Returns the number of mipmap levels
 int bm_miplevels (int handle);
+// Called once a frame with the current time.  Frees pageable bitmaps that haven't been used
+// for Bitmap_evict_idle_time, then the least recently used ones until the resident data fits
+// in Bitmap_residency_budget.  Evicted bitmaps are paged back in when they're next used.
+void bm_UpdateResidency (float time);
 #endif
@@ -40,6 +40,12 @@ typedef struct
 
 extern bool Dedicated_server;
 
+// Most ticks per second the server can be set to run at
+#define DEDICATED_MAX_TICK_RATE	200
+
+// Ticks per second when the server runs on its own schedule, 0 to run at the frame cap
+extern int Dedicated_tick_rate;
+
 // Sets the value for a cvar INT type
 void SetCVarInt (int index,int val);
 
@@ -85,4 +91,17 @@ void ListenDedicatedSocket (void);
 //Init the socket and start listening
 void InitDedicatedSocket(ushort port);
 
+// Waits for the tick after "last_tick", handling network and console traffic as it comes in
+// Returns the time the tick was due
+double DedicatedServerWaitForTick(double last_tick);
+
+// Clears the tick time histograms
+void DedicatedResetTickStats();
+
+// Prints the tick time histograms to the console
+void DedicatedPrintTickStats();
+
+// Compares CPU use and tick accuracy of the frame cap and the tick scheduler on an idle server
+void TestDedicatedTick();
+
 #endif
\ No newline at end of file
@@ -387,6 +387,11 @@ typedef struct fvi_query
 //Returns the hit_data->hit_type
 extern int fvi_FindIntersection(fvi_query *fq,fvi_info *hit_data,  bool no_subdivision = false);
 
+// Same as fvi_FindIntersection, but safe to call from a job thread while the main thread waits.
+// The query can't check objects, record faces or look at texture transparency.
+// Returns -1 if the ray reached a face whose texture can only be looked at on the main thread.
+extern int fvi_FindWallIntersection(fvi_query *fq,fvi_info *hit_data);
+
 // Face/Room list for some fvi call(s)
 typedef struct fvi_face_room_list
 {
@@ -409,6 +414,19 @@ extern int fvi_QuickDistCellList(int init_cell_index, vector *pos, float rad, in
 // Returns the number of objects that are approximately within the specified radius
 int fvi_QuickDistObjectList(vector *pos, int init_roomnum, float rad, short *object_index_list, int max_elements, bool f_lightmap_only, bool f_only_players_and_ais = false, bool f_include_non_collide_objects = false, bool f_stop_at_closed_doors = false);
 
+// Most rooms the quick distance searches will walk through
+#define MAX_QUICK_ROOMS 20
+
+// Returns the number of rooms that fvi_QuickDistObjectList would search for objects within the specified radius.
+// Doesn't stop at closed doors.  init_roomnum must be inside the mine.
+int fvi_QuickDistRoomList(vector *pos, int init_roomnum, float rad, short *room_list, int max_elements);
+
+// Starts recording the queries passed to fvi_FindIntersection()
+void fvi_StartQueryRecording();
+// Stops recording and replays the recorded queries twice, walking the room object lists and then
+// using the object grid, and logs any differences in the results along with the time each took.
+void fvi_ReplayRecordedQueries();
+
 //finds the uv coords of the given point on the given seg & side
 //fills in u & v. if l is non-NULL fills it in also
 //extern void fvi_FindHitpointUV(float *u,float *v,float *l, vector *pnt,segment *seg,int sidenum,int facenum);
@@ -421,11 +439,11 @@ extern int FVI_room_counter;
 
 bool fvi_QuickRoomCheck(vector *pos, room *cur_room, bool try_again = false);
 
-extern fvi_info * fvi_hit_data_ptr;
-extern fvi_query * fvi_query_ptr;
-extern float fvi_collision_dist;
-extern int fvi_curobj;
-extern int fvi_moveobj;
+extern thread_local fvi_info * fvi_hit_data_ptr;
+extern thread_local fvi_query * fvi_query_ptr;
+extern thread_local float fvi_collision_dist;
+extern thread_local int fvi_curobj;
+extern thread_local int fvi_moveobj;
 
 bool PolyCollideObject(object *obj);
 
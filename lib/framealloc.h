@@ -0,0 +1,89 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <new>
+
+//Per-frame linear allocator for scratch data.
+//Memory from the frame arena is never freed individually. Everything allocated during a frame
+//is released at once by frame_Reset(), which GameFrame() calls at the end of every frame, so
+//pointers into the arena must not be kept past the end of the frame.
+//Main thread only.
+
+//Allocates size bytes, aligned to align bytes (which must be a power of 2).
+void* frame_Alloc(int size, int align = 16);
+
+//Allocates size bytes and clears them to zero.
+void* frame_Calloc(int size, int align = 16);
+
+//Allocates an array of count Ts. The elements aren't constructed, so use this for plain data only.
+template <typename T>
+inline T* frame_AllocArray(int count)
+{
+	return (T*)frame_Alloc(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16);
+}
+
+//Releases everything allocated since the last reset.
+//If the frame needed more than the arena had, the arena is regrown to fit, so that
+//once the game reaches a steady state no frame touches the system allocator.
+void frame_Reset();
+
+//Bytes allocated from the arena so far this frame.
+int frame_GetBytesUsed();
+
+//Most bytes allocated from the arena in any one frame.
+int frame_GetHighWater();
+
+//Number of times the arena had to get memory from the system allocator last frame.
+//This should be 0 in a steady state.
+int frame_GetSystemAllocs();
+
+//Allocator for std containers that can draw from the frame arena. A default constructed
+//allocator uses the normal heap, so a container type can be used either way.
+//Containers using the frame arena must be gone by the end of the frame.
+template <typename T>
+struct FrameAllocator
+{
+	typedef T value_type;
+	bool use_frame;
+
+	FrameAllocator(bool frame = false) noexcept : use_frame(frame) {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>& other) noexcept : use_frame(other.use_frame) {}
+
+	T* allocate(size_t n)
+	{
+		if (use_frame)
+			return (T*)frame_Alloc(n * sizeof(T), alignof(T) > 16 ? alignof(T) : 16);
+		return (T*)::operator new(n * sizeof(T));
+	}
+
+	void deallocate(T* p, size_t)
+	{
+		//Frame memory goes away in frame_Reset()
+		if (!use_frame)
+			::operator delete(p);
+	}
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U>& other) const { return use_frame == other.use_frame; }
+	template <typename U>
+	bool operator!=(const FrameAllocator<U>& other) const { return use_frame != other.use_frame; }
+};
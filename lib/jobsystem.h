@@ -0,0 +1,39 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+//Pool of worker threads for running engine work off the main thread.
+//Jobs must not call into systems that aren't thread safe (the renderer, sound, mprintf, etc).
+
+//Starts the worker threads. If num_threads is 0, one thread is started per core, less one for the main thread.
+void job_Init(int num_threads = 0);
+
+//Waits for all queued jobs to finish and stops the worker threads.
+void job_Shutdown();
+
+//Returns the number of worker threads, or 0 if the pool isn't running.
+int job_GetNumThreads();
+
+//Queues func(data) to be run by a worker thread. If the pool isn't running, the job is run immediately.
+void job_Submit(void (*func)(void* data), void* data);
+
+//Runs func(data, i) for every i in [0, count), spread over the worker threads and the calling thread.
+//Indices are handed out one at a time as threads finish, so uneven work balances itself.
+//Returns once every call has finished. Safe to call when the pool isn't running.
+void job_ParallelFor(int count, void (*func)(void* data, int index), void* data);
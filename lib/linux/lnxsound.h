@@ -131,7 +131,7 @@ protected:
 #else
 	short FindFreeSoundSlot(float volume, int priority); 
 #endif
-	// This function limits the number of sounds cached to 255(8bits) and 256 bit is for invalid channel
+	// The slot number is kept in the low bits of the id, the rest count up with each sound played.
 	// The purpose is to create unique signatures for each sound played (and allow for
 	// the slot_number to be quickly determined)
 	inline int MakeUniqueId(int sound_slot);
@@ -81,7 +81,7 @@ typedef struct DSLOOPSTREAM
 class sound_buffer_info 
 {
 public:
-	sound_buffer_info() {m_status = SSF_UNUSED;s=NULL; }
+	sound_buffer_info() {m_status = SSF_UNUSED;s=NULL;m_distance=0.0f; }
 	
 	play_information *play_info;
 
@@ -98,6 +98,7 @@ public:
 	int sample_length;			// used for storage purposes.
 
 	float m_volume;
+	float m_distance;			// Distance from the listener, 0 for 2d sounds
 	
 	bool stereo;
 	sbyte bps;
@@ -111,6 +112,7 @@ typedef struct
 	int primary_frequency;
 	int primary_alignment;
 	int *max_sounds_available;		// pointer to the variable that is updated with the # of sounds in the sound_cache
+	int max_voices_mixed;			// most sounds actually mixed at once, the rest are virtual (0 for no limit)
 	sound_buffer_info *sound_cache;	// the array of sound information
 
 	void (*fp_SetError)(int code);
@@ -120,6 +122,16 @@ typedef struct
 	llsSystem *ll_sound_ptr;
 }tMixerInit;
 
+// Voice counts and timing of the last mixer callback
+typedef struct
+{
+	int active_voices;		// sounds playing
+	int real_voices;		// sounds that were mixed
+	int virtual_voices;		// sounds that only had their position moved along
+	float mix_time;			// seconds spent in the last callback
+	float max_mix_time;		// longest callback since the stats were last read
+}tMixerVoiceStats;
+
 class software_mixer
 {
 public:
@@ -133,7 +145,21 @@ public:
 	// mixing and effects (writes data to the locked primary buffer)
 	void StreamMixer(char *ptr, int len);
 
+	// Times mixing num_voices streams of each sample format into a buffer, with each set of mixer
+	// kernels the CPU supports, and checks they all give the same output. Doesn't need a sound
+	// device.  Results go to the mono window.
+	static void Benchmark(int num_voices);
+
+	// Gets the voice counts and mixer time for the debug display, and resets the max time.
+	// Read without locking, so the values can be a callback apart.
+	void GetVoiceStats(tMixerVoiceStats *stats);
+
 private:
+	// Marks the voices that get mixed this callback, the loudest and highest priority ones
+	void SelectVoices(void);
+	// Moves a voice that isn't mixed along as if it had been
+	void AdvanceVirtualVoice(sound_buffer_info *cur_buf, int num_samples);
+
 	llsSystem *m_ll_sound_ptr;
 	bool m_init;
 	sound_buffer *m_primary_buffer;
@@ -144,6 +170,25 @@ private:
 
 	unsigned char *m_buffer;
 
+	// Voices are summed here before being clamped into the output
+	float *m_bus;
+	int m_bus_len;
+
+	struct tVoiceRank
+	{
+		float score;		// volume weighted by priority
+		float distance;		// closer voices win ties
+		int slot;
+	};
+
+	int m_max_voices_mixed;
+	// Per slot flag, set if the voice is mixed this callback
+	unsigned char *m_voice_mixed;
+	// Scratch list for ranking the playing voices
+	tVoiceRank *m_voice_ranks;
+	int m_voice_list_len;
+	tMixerVoiceStats m_voice_stats;
+
 	int *m_max_sounds_available;
 	sound_buffer_info *m_sound_cache;
 
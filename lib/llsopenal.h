@@ -32,6 +32,11 @@
 
 #define NUM_MOVIE_BUFFERS 80
 
+//How many sounds can be playing for each voice that's actually mixed. The ones that don't fit
+//are virtual voices: their sources are paused, and they're resumed at the right place if they
+//become audible enough again. Sound uids keep the slot in 8 bits, so this is capped to 256 slots.
+#define VIRTUAL_VOICES_PER_VOICE 4
+
 struct llsOpenALSoundEntry
 {
 	uint32_t handle, bufferHandle;
@@ -57,6 +62,14 @@ struct llsOpenALSoundEntry
 	uint32_t streamFormat;
 
 	t3dEnvironmentValues envValues;
+
+	//Virtual voice state. Times are in seconds of the sound.
+	bool isVirtual;
+	float length, loopStart, loopEnd;
+	float virtualOffset;		//play position as of virtualTime
+	double virtualTime;
+	//Distance from the listener, for ranking 3D sounds. 2D sounds use 0.
+	float distance, minDistance, maxDistance;
 };
 
 
@@ -73,6 +86,8 @@ class llsOpenAL : public llsSystem
 	char Quality;
 
 	int NumSoundChannels;
+	int NumRealVoices;		//sounds that can be mixed at once, 0 for all of them
+	int NumVirtualVoices;
 	int NumSoundsPlaying;
 	int NextUID;
 	llsOpenALSoundEntry* SoundEntries;
@@ -103,6 +118,11 @@ class llsOpenAL : public llsSystem
 	void BindBufferData(uint32_t handle, int sound_index, bool looped);
 	void SoundCleanup(int soundID);
 
+	void InitVoice(int soundID, int sound_index, bool looped, pos_state* posInfo);
+	float VoiceAudibility(int soundID);
+	bool UpdateVirtualVoice(int soundID, double now);
+	void SelectVoices();
+
 	void ServiceStream(int soundID);
 
 public:
@@ -112,6 +132,8 @@ public:
 		LoopPointsSupported = EffectsSupported = false;
 		Quality = SQT_HIGH;
 		NumSoundChannels = 0;
+		NumRealVoices = 0;
+		NumVirtualVoices = 0;
 		NumSoundsPlaying = 0;
 		NextUID = 0;
 		SoundEntries = nullptr;
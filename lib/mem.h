@@ -98,6 +98,10 @@
 
 extern bool Mem_low_memory_mode;
 extern bool Mem_superlow_memory_mode; //DAJ
+//Set before mem_Init() to allocate small blocks from size-class pools, with per-call-site stats
+extern bool Mem_use_pool;
+//Set to time every call to the memory library.  The totals are written by mem_dumpmallocstofile().
+extern bool Mem_stats;
 
 //	use if you want to manually print out a memory error
 #define mem_error() mem_error_msg(__FILE__, __LINE__)		
@@ -126,6 +130,8 @@ void * mem_realloc_sub(void * memblock,int size);
 
 int mem_size_sub(void *memblock);
 
+//Writes the current allocations to a file.  With the pool allocator, this is the size classes
+//and the live bytes and allocation rate of each call site.
 bool mem_dumpmallocstofile(char *filename);
 
 void mem_heapcheck(void);
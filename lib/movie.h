@@ -35,6 +35,11 @@ int mve_Init( const char *dir, const char *sndcard );
 // simply plays a movie.
 int mve_PlayMovie( const char *mvename, oeApplication *app );
 
+// decodes every frame of a movie with each decoder mode, without showing it.  frame rates are logged and
+// frame checksums written to checksum_file if not NULL.  returns the number of frames that differ from the
+// original decoder, or an MVELIB error code.
+int mve_Benchmark( const char *mvename, const char *checksum_file );
+
 // used to copy movie data to a pointer, looping will loop, fhandle will be a pointer to a file handle to be returned
 // handle to movie sequence is returned by function.
 unsigned int mve_SequenceStart( const char *mvename, int *fhandle, oeApplication *app, bool looping = false );
@@ -394,6 +394,16 @@ int nw_psnet_buffer_get_next_by_dpid(ubyte *data, int *length, unsigned long dpi
 #define MAXRELIABLESOCKETS		40		//Max reliable sockets to open at once...
 #define NETBUFFERSIZE			600	//Max size of a network packet
 
+#define NW_RELIABLE_QUEUE		512		//Packets that can be waiting to go out or be acked (must divide 65536)
+#define NW_RELIABLE_WINDOW		128		//Most packets in flight at once.  Kept under MAXNETBUFFERS-1
+										//so that older peers take everything we send
+#define NW_RELIABLE_RECV		256		//Packets we hold on to until the ones before them arrive (must divide 65536)
+#define NW_MAX_RETRYTIME		(NETRETRYTIME*4)	//Longest we wait before resending
+#define NW_INITIAL_CWND			32		//Packets we let out before we know anything about the link
+#define NW_MIN_CWND				8		//Fewest packets we cut back to after a loss
+#define NW_DUP_THRESH			3		//Later packets that must be acked before we call one lost
+#define NW_PACE_BURST			4		//Packets that can go out back to back on a paced connection
+
 //Network Types
 #define RNT_ACK				1		//ACK Packet
 #define RNT_DATA				2		//Data Packet
@@ -461,6 +471,10 @@ void nw_HandleUnreliableData(ubyte *data,int len,network_address *from_addr);
 void nw_ReliableResend(void);
 int nw_CheckReliableSocket(int socknum);
 
+// Fills in the sockets nw_DoReceiveCallbacks reads from, so a caller can wait on them
+// Returns how many there are, or 0 while the packet buffers are too full to read more
+int nw_GetReceiveSockets(SOCKET *socks,int max);
+
 typedef struct
 {
 	// TCP/IP Status lines
@@ -494,6 +508,55 @@ typedef struct
 // pass NULL to reset the stats
 void nw_GetNetworkStats(tNetworkStatus *stats);
 
+typedef struct
+{
+	int recv_calls;			// system calls made reading the IP socket
+	int recv_datagrams;		// datagrams they returned
+	int send_calls;			// system calls made writing the IP socket
+	int send_datagrams;		// datagrams they sent
+	int coalesced;			// packets that were joined onto another datagram
+}nw_batch_stats;
+
+// Between these calls, IP packets are held back and sent together at the end, with
+// unreliable packets to the same address joined into one datagram where they fit.
+// Calls can be nested; the packets go out at the outermost nw_EndSendBatch.
+void nw_BeginSendBatch();
+void nw_EndSendBatch();
+
+typedef struct
+{
+	float rtt;				// smoothed round trip time
+	float rttvar;			// ...and how much it varies
+	float rto;				// how long we wait for an ack before resending
+	float cwnd;				// packets we let out per round trip
+	int queued;				// packets waiting to go out or be acked
+	int sent;				// packets sent for the first time
+	int resent;				// packets sent again after a timeout
+	int fast_resent;		// packets sent again because later ones were acked
+	int sacked;				// packets acked out of order
+}nw_reliable_stats;
+
+// fills in the transport state of a reliable socket
+// returns 0 if the socket isn't connected
+int nw_GetReliableStats(int socknum,nw_reliable_stats *stats);
+
+// Simulates a bad connection on everything we send over IP.  "loss" is the fraction of
+// packets to drop, "latency" is how many seconds to hold the rest.  Both ends need it
+// to get loss both ways.  Pass 0,0 to turn it off.
+void nw_SetNetworkSimulation(float loss,float latency);
+
+// fills in the buffer with batched I/O stats
+// pass NULL to reset the stats
+void nw_GetBatchStats(nw_batch_stats *stats);
+
+// Runs a synthetic client load over loopback through the batched and unbatched socket paths
+// and reports the system calls and time each one took
+void nw_TestBatchedIO();
+
+// Joins a client to a server over loopback through the reliable layer with simulated
+// loss and latency, and reports how long the join took
+void nw_TestReliable();
+
 #endif
 
 
@@ -520,9 +520,9 @@ struct SpecularBlock
 //Updates specular components
 void rend_UpdateSpecular(SpecularBlock* specularstate);
 
-//Updates brightness/fog components
+//Updates brightness/fog components.
+//roomstate is indexed by room number, and room shaders find their block from the room number in each vertex.
 void rend_UpdateFogBrightness(RoomBlock* roomstate, int numrooms);
-void rend_SetCurrentRoomNum(int roomblocknum);
 
 #if defined(DD_ACCESS_RING) 
 #if defined(WIN32)
@@ -19,12 +19,12 @@
 #define _RUN_TIME_PROFILING_
 
 //uncomment the following if you want to enable Run-time Profiling
-#ifndef RELEASE
+//Release builds leave it out unless USE_RTP is defined (-DPICCU_RTP=ON in CMake)
+#if !defined(RELEASE) && !defined(USE_RTP)
 #define USE_RTP
 #endif
 
-#if defined(__LINUX__) || defined(MACINTOSH)
-//#if defined(__LINUX__)
+#if defined(MACINTOSH)
 	#ifdef USE_RTP
 		#undef USE_RTP	//no rtp for now
 	#endif
@@ -45,6 +45,19 @@
 	#define LARGE_INTEGER long long
 #endif
 
+//		Subsystems that zone times are totaled into for the summary
+// -----------------------------------------------------------------
+enum
+{
+	RTZ_GAME,				//general game frame work that doesn't fit below
+	RTZ_RENDER,
+	RTZ_MULTI,
+	RTZ_AI,
+	RTZ_PHYSICS,
+	RTZ_VISEFFECT,
+	RTZ_NUM_SUBSYSTEMS
+};
+
 //		struct of information to be saved per frame (note: use INT64 for timer info)
 // -----------------------------------------------------------------------------------
 typedef struct{
@@ -80,6 +93,9 @@ typedef struct{
 	INT64 phys_link;
 	INT64 obj_do_frm;
 	INT64 fvi_time;
+	INT64 frame_start;						//clock when the frame started, used internally
+	INT64 frame_clocks;						//clock length of the whole frame, used internally
+	INT64 zone_time[RTZ_NUM_SUBSYSTEMS];	//time spent in the outermost zones of each subsystem, summed over all threads
 
 	int	texture_uploads;
 	int polys_drawn;
@@ -125,6 +141,7 @@ typedef struct{
 #define RTP_ENDINCTIME(member)
 #define RTP_ENABLEFLAGS(flags)
 #define RTP_DISABLEFLAGS(flags)
+#define RTP_ZONE(name,subsystem)
 
 #else
 
@@ -197,6 +214,15 @@ typedef struct{
 // Ends a frame time calculation and increments the member by the time for that frame
 #define RTP_ENDINCTIME(member) do{ if(Runtime_performance_enabled){RTP_SingleFrame.member += (rtp_GetClock() - __start_time_); }} while(0)
 
+// Times from here to the end of the enclosing scope as a zone in the trace. Zones can nest, and can be
+// used from any thread. The outermost zone of each subsystem on a thread adds to that subsystem's time
+// for the frame.
+// name = string literal naming the zone in the trace
+// subsystem = one of RTZ_*
+#define RTP_ZONE(name,subsystem) rtp_ScopedZone RTP_ZONE_VAR(__LINE__)(name,subsystem)
+#define RTP_ZONE_VAR(line) RTP_ZONE_VAR2(line)
+#define RTP_ZONE_VAR2(line) __rtp_zone_##line
+
 
 #endif
 
@@ -269,6 +295,48 @@ void rtp_WriteBufferLog
 */
 void rtp_WriteBufferLog(void);
 
+/*
+void rtp_WriteTraceLog
+	Writes the zones recorded since the log started to file, in the Chrome trace event format
+	(load it in chrome://tracing or Perfetto)
+*/
+void rtp_WriteTraceLog(void);
+
+/*
+int rtp_GetSummary
+	Fills buffer with a few lines giving the time per frame of each subsystem over the frames
+	recorded so far.  Returns the number of frames summarized.
+*/
+int rtp_GetSummary(char *buffer,int size);
+
+/*
+INT64 rtp_ZoneBegin / void rtp_ZoneEnd
+	Start and end a zone on the calling thread.  Use RTP_ZONE instead of calling these.
+*/
+INT64 rtp_ZoneBegin(int subsystem);
+void rtp_ZoneEnd(const char *name,int subsystem,INT64 start);
+
+#ifdef USE_RTP
+class rtp_ScopedZone
+{
+	const char *m_name;
+	int m_subsystem;
+	INT64 m_start;
+
+public:
+	rtp_ScopedZone(const char *name,int subsystem) : m_name(name), m_subsystem(subsystem)
+	{
+		m_start = Runtime_performance_enabled ? rtp_ZoneBegin(subsystem) : 0;
+	}
+
+	~rtp_ScopedZone()
+	{
+		if (m_start)
+			rtp_ZoneEnd(m_name,m_subsystem,m_start);
+	}
+};
+#endif
+
 
 
 
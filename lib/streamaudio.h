@@ -137,6 +137,7 @@
 #ifndef  __STREAMAUDIO_H_
 #define  __STREAMAUDIO_H_
 
+#include <atomic>
 #include "Adecode.h"
 
 #include "ssl_lib.h"
@@ -216,11 +217,15 @@ public:
 };
 //////////////////////////////////////////////////////////////////////////////
 //	streamaudio constants.
+//	STRM_BUFCOUNT is the smallest ring a stream gets, -streamlatency can grow it up to STRM_MAX_BUFCOUNT.
 #ifdef MACINTOSH
 #define STRM_BUFCOUNT		2				// MUST be a power of 2.
+#define STRM_MAX_BUFCOUNT	2
 #else
 #define STRM_BUFCOUNT		4
+#define STRM_MAX_BUFCOUNT	16
 #endif
+#define STRM_DEFAULT_LATENCY	2000		// ms of audio the decode thread tries to keep ahead of playback
 #define STRM_BUFSIZE			STREAM_BUFFER_SIZE
 #define STRM_LIMIT			4
 #define STRM_STOPPED			0x0
@@ -238,6 +243,11 @@ public:
 #define STRM_BUFF_USED				0x1	// allocated buffer with data
 #define STRM_BUFF_TERMINAL			0x2	// terminates on this buffer
 #define STRM_BUFF_LOOPEND			0x4	// marks last buffer in measure
+
+//	The mixing buffers of a stream form a single producer, single consumer ring. The decode thread (or
+//	the caller, when opening or predecoding) fills the buffer after m_fbufidx and publishes it by setting
+//	STRM_BUFF_USED last. The sound system's stream callback plays m_sbufidx and hands a buffer back by
+//	clearing its flags. Neither side takes a lock, so the sound system never waits on the decoder.
 class AudioStream
 {
 	OSFArchive m_archive;					// audio stream archive object.
@@ -249,28 +259,32 @@ class AudioStream
 	struct {										// mixing buffers
 		ubyte *data;
 		int nbytes;								// number of bytes of valid data.
-		int flags;
+		std::atomic<int> flags;				// STRM_BUFF_XXX, hands the buffer between decoder and sound system.
 		int id;
 	}
-	m_buffer[STRM_BUFCOUNT];
+	m_buffer[STRM_MAX_BUFCOUNT];
 	int m_bufsize;								// size of each buffer.
+	int m_nslots;								// number of buffers in the ring, sized by stream latency.
+	int m_bytes_per_sec;						// bytes of decoded data per second of playback.
+	int m_predecode_bytes;					// while stopped, decode this far ahead for Play.
 	float m_measure_timer;					// timer for measure checking.
 	float m_measure_time;					// amount of time per measure.
 	float m_last_frametime;
-	ubyte m_sbufidx;							// stream position markers
+	std::atomic<ubyte> m_sbufidx;			// stream position markers
 	ubyte m_fbufidx;							// file position markers
 	ubyte m_curbufidx;						// current buffer in measure index
 	ubyte m_playcount;
-	bool m_readahead;							// if stream is currently reading from disk
-	bool m_readahead_finished_loop;		// if a loop's readahead has finished
+	std::atomic<bool> m_readahead;		// if stream is currently reading from disk
+	std::atomic<bool> m_readahead_finished_loop;	// if a loop's readahead has finished
 	short m_nbufs;								// number of buffers streamed so far.
 	play_information m_playinfo;			// used by llsSystem
 	float m_volume;							// volume of stream.
-	short m_state, m_laststate;			// current state of stream playing
+	std::atomic<short> m_state;			// current state of stream playing
+	short m_laststate;
 	int m_llshandle;							// internal sound handle.
 	int m_flags;								// stream playing options.
 	short m_streamindex;						// index into active stream table.
-	short m_loopcount;						// loop counter.
+	std::atomic<short> m_loopcount;		// loop counter.
 	int m_bytesleft;							// number of bytes left in file
 	int m_curmeasure;							// current measure.
 	int m_playbytesleft, m_playbytestotal;
@@ -278,16 +292,19 @@ class AudioStream
 	int *m_stopflag;							// location of stop flag used in stop function
 	osMutex m_loopmutex;						// stop flag is manipulated by caller and stream thread.
 	bool m_loop;								// are we looping?
-	bool m_stopnextmeasure;					// stop on next measure.
+	std::atomic<bool> m_stopnextmeasure;	// stop on next measure.
 	bool m_start_on_frame;					// we will play this stream on the next ::Frame call.
 	bool m_start_on_frame_looped;			// the stream that will play on next frame is looped.
+	std::atomic<int> m_underruns;			// times the sound system ran out of decoded data.
+	AudioStream *m_nextstream;				// next in the list of all streams, walked by the decode thread.
 private:
 	friend void *AudioStreamCB(void *user_data, int handle, int *size);
 	friend int ADecodeFileRead(void *data, void *buf, unsigned int qty);
 	void *StreamCallback(int *size);		// invoked by omsStreamCB.
 	int ReadFileData(int buf, int len);	// reads in decompressed raw data.
 	int ReadFileDirect(char * buf, int len);	// reads in decompressed raw data.
-	void UpdateData();						// updates file buffers
+	bool UpdateData();						// decodes into the next free buffer, returns false if there was nothing to do
+	int BufferedBytes();						// bytes decoded and not yet played.
 	void End();									// cleans up after a stop.
 	void Reset();								// resets to start of stream.
 	bool OpenDigitalStream();				// opens and prepares a digital stream 
@@ -298,6 +315,12 @@ private:
 //	list of all currently played streams
 	static AudioStream *m_streams[STRM_LIMIT];
 	static int m_thisid;
+//	list of all stream objects, opened or not.
+	static AudioStream *m_firststream;
+	static std::atomic<int> m_totalunderruns;
+	static int m_latency;
+	static void DecodeThread();
+	static void StopDecodeThread();
 // allocates a stream slot for a stream
 	bool ActivateStream(AudioStream *stream);
 	void DeactivateStream(AudioStream *stream);
@@ -326,6 +349,7 @@ public:
 	void Close();
 // simple requests
 	bool Play(bool start_on_frame=false);	//	plays a stream
+	bool Predecode(int ms);					// decodes the first ms of a stopped stream now, so Play starts without waiting.
 	void Stop(bool on_measure=false,int *stop_flag=NULL);	// causes a rewind to start of stream, if on_measure is true, stop occurs when measure ends
 	void SetVolume(float vol);				// sets volume
 	float GetVolume();						// returns volume																		   
@@ -339,6 +363,8 @@ public:
 	bool ReadAhead();							// are we still reading from disk?
 	bool ReadAheadFinishedLoop();			// has stream finished with its readahead of current loop?
 	bool IsReady();							// is this stopped stream ready to play?
+	int Underruns() const { return m_underruns; };	// times playback ran ahead of decoding.
+	static int TotalUnderruns() { return m_totalunderruns; };
 	int State() const {						// returns current state
 		return m_state;
 	};	
@@ -211,6 +211,7 @@
 #include "mem.h"
 #include "pserror.h"
 #include "pstypes.h"
+#include "mempool.h"
 //#include "args.h"
 //#include "ddio.h"
 //
@@ -249,6 +250,38 @@ bool Mem_low_memory_mode = false;
 bool Mem_superlow_memory_mode = false;
 //If this is set, the mem library ignores mem_free() calls.  All the memory is then freed at once oon exit.
 bool Mem_quick_exit = 0;
+//Set before mem_Init() to use the size-class pool allocator
+bool Mem_use_pool = false;
+//Set to time the allocator calls
+bool Mem_stats = false;
+
+//Writes the pool and timing stats, or returns false if there's nothing to write
+static bool mem_DumpPoolStats(char *filename)
+{
+	if (!Mem_use_pool && !Mem_stats)
+		return false;
+
+	FILE *file = fopen(filename,"wt");
+	if (!file)
+		return false;
+
+	fprintf(file,"Memory library stats (%s allocator)\n",Mem_use_pool ? "pool" : "system");
+	mem_DumpTiming(file);
+#if defined(__LINUX__) && !defined(MACOSX) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2,33)
+	//mallinfo() is deprecated from glibc 2.33, and its counters wrap past 2GB
+	struct mallinfo2 mi = mallinfo2();
+	fprintf(file,"System heap: %zu bytes in use, %zu bytes free in heap\n",mi.uordblks,mi.fordblks);
+#else
+	struct mallinfo mi = mallinfo();
+	fprintf(file,"System heap: %d bytes in use, %d bytes free in heap\n",mi.uordblks,mi.fordblks);
+#endif
+#endif
+	if (Mem_use_pool)
+		mempool_DumpStats(file);
+	fclose(file);
+	return true;
+}
 #if defined (__LINUX__)
 //Linux memory management
 int LnxTotalMemUsed;
@@ -258,31 +291,52 @@ void mem_shutdown(void)
 void mem_Init(void)
 {
 	LnxTotalMemUsed = 0;
+	if(Mem_use_pool)
+	{
+		mprintf((0,"Using pool allocator\n"));
+		mempool_Init();
+	}
 }
 int mem_GetTotalMemoryUsed(void)
 {
+	if(Mem_use_pool)
+		return mempool_GetLiveBytes();
 	return LnxTotalMemUsed;
 }
 void *mem_malloc_sub(int size,const char *file,int line)
 {
-	void *new_mem = malloc(size);
+	longlong start = Mem_stats ? mem_Clock() : 0;
+	void *new_mem;
+	if(Mem_use_pool)
+		new_mem = mempool_Alloc(size,file,line);
+	else
+		new_mem = malloc(size);
 	if(!new_mem){
 		mprintf((0,"Out of memory allocating %d bytes: line %d in %s\n",size,line,file));
 		Int3();
 		return NULL;
 	}
 	LnxTotalMemUsed += size;
+	if(Mem_stats)
+		mem_AddCallTime(mem_Clock() - start);
 	return new_mem;		
 }
 void mem_free_sub(void *memblock)
 {
 	if(memblock){
+		longlong start = Mem_stats ? mem_Clock() : 0;
+		//Blocks from before mem_Init() or from realloc() of a system block aren't in the pool
+		if(!Mem_use_pool || !mempool_Free(memblock))
+		{
 #if defined(MACOSX)
-	       LnxTotalMemUsed -= malloc_size(memblock);
+			LnxTotalMemUsed -= malloc_size(memblock);
 #else
-		LnxTotalMemUsed -= malloc_usable_size(memblock);
+			LnxTotalMemUsed -= malloc_usable_size(memblock);
 #endif
-		free(memblock);
+			free(memblock);
+		}
+		if(Mem_stats)
+			mem_AddCallTime(mem_Clock() - start);
 	}
 }
 void mem_error_msg(const char *file,int line,int size)
@@ -292,21 +346,33 @@ void mem_error_msg(const char *file,int line,int size)
 }
 char *mem_strdup_sub(const char *string,char *file,int line)
 {
-	char *ret = strdup(string);
+	//Go through mem_malloc_sub so the copy is counted against the caller
+	char *ret = (char *)mem_malloc_sub(strlen(string)+1,file,line);
 	if(!ret)
-	{
-		mprintf((0,"Out of memory allocating %d bytes: line %d in %s\n",strlen(string)+1,line,file));
-		Int3();
 		return NULL;
-	}
+	strcpy(ret,string);
 	return ret;
 }
 void *mem_realloc_sub(void *mem,int size)
 {
-	return realloc(mem,size);
+	longlong start = Mem_stats ? mem_Clock() : 0;
+	void *new_mem;
+	if(Mem_use_pool && mem && mempool_Owns(mem))
+		new_mem = mempool_Realloc(mem,size);
+	else
+		new_mem = realloc(mem,size);
+	if(Mem_stats)
+		mem_AddCallTime(mem_Clock() - start);
+	return new_mem;
 }
 int mem_size_sub(void *memblock)
 {
+	if(Mem_use_pool)
+	{
+		int size = mempool_Size(memblock);
+		if(size >= 0)
+			return size;
+	}
 #if defined(MACOSX)
   return malloc_size(memblock);
 #else
@@ -315,7 +381,7 @@ int mem_size_sub(void *memblock)
 }
 bool mem_dumpmallocstofile(char *filename)
 {
-	return false;
+	return mem_DumpPoolStats(filename);
 }
 #pragma mark -
 #elif defined (MACINTOSH)
@@ -616,6 +682,14 @@ void mem_Init()
 	}
 #endif
 	
+#ifndef MEM_DEBUG
+	if(Mem_use_pool)
+	{
+		mprintf((0,"Using pool allocator\n"));
+		mempool_Init();
+	}
+#endif
+
 	GlobalMemoryStatus(&ms);
 	Heap = HeapCreate(HEAP_NO_SERIALIZE,16000000,0);//GetProcessHeap();
 	if(!Heap)
@@ -725,6 +799,22 @@ void *mem_malloc_sub (int size, const char *file, int line)
 		Int3();
 		return (void *)MEM_NO_MEMORY_PTR;
 	}
+#ifndef MEM_DEBUG
+	if(Mem_use_pool)
+	{
+		retp = mempool_Alloc(size,file,line);
+		if(!retp)
+		{
+			mprintf((0,"Unable to alloc memory in mem_malloc_sub()!\n"));
+			Error("Out of memory, unable to continue.");
+			return 0;
+		}
+		Total_mem_used+=size;
+		if(Mem_high_water_mark<Total_mem_used)
+			Mem_high_water_mark = Total_mem_used;
+		return retp;
+	}
+#endif
 	mem_alloc_info * mi = NULL;
 	mem_alloc_info no_track_mi;
 	bool track_node = true;
@@ -868,6 +958,17 @@ void mem_free_sub (void *memblock)
 		HeapFree(Heap,HEAP_NO_SERIALIZE,memblock);	
 		return;
 	}
+#else
+	if(Mem_use_pool)
+	{
+		int size = mempool_Size(memblock);
+		if(size >= 0)
+		{
+			Total_mem_used-=size;
+			mempool_Free(memblock);
+			return;
+		}
+	}
 #endif
 	HeapFree(Heap,HEAP_NO_SERIALIZE,memblock);	
 #endif
@@ -939,6 +1040,9 @@ void * mem_realloc_sub(void * memblock,int size)
 			return mem_info[i].ptr;
 		}
 	}
+#else
+	if(Mem_use_pool && mempool_Owns(memblock))
+		return mempool_Realloc(memblock,size);
 #endif
 #ifdef MACINTOSH
 	HeapFree(Heap, HEAP_NO_SERIALIZE, memblock);
@@ -961,6 +1065,14 @@ int mem_size_sub(void *memblock)
 	{
 		return 0;
 	}
+#ifndef MEM_DEBUG
+	if(Mem_use_pool)
+	{
+		int size = mempool_Size(memblock);
+		if(size >= 0)
+			return size;
+	}
+#endif
 	return HeapSize(Heap,0,memblock);
 }
 void mem_shutdown();
@@ -1154,7 +1266,7 @@ bool mem_dumpmallocstofile(char *filename)
 	fclose(file);
 	return true;
 #else
-	return false;
+	return mem_DumpPoolStats(filename);
 #endif
 
 }
@@ -0,0 +1,585 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#ifdef WIN32
+#include <malloc.h>
+#endif
+#include "mempool.h"
+#include "pserror.h"
+
+#define MEMPOOL_CHUNK_SHIFT		16
+#define MEMPOOL_CHUNK_SIZE		(1 << MEMPOOL_CHUNK_SHIFT)
+#define MEMPOOL_MAX_BLOCK			2048		//larger blocks go to the system allocator
+#define MEMPOOL_GRANULARITY		16			//all pool sizes are a multiple of this
+#define MEMPOOL_MAX_SITES			4096		//must be a power of 2
+
+//Block sizes of the size classes. Spaced so that no more than about a third of a block is wasted.
+static const int Mempool_class_sizes[] = {16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 640, 768, 1024, 1280, 1536, 2048};
+#define MEMPOOL_NUM_CLASSES	(int)(sizeof(Mempool_class_sizes) / sizeof(Mempool_class_sizes[0]))
+
+//A chunk holds blocks of one size class. The header is at the start of the chunk, followed
+//by the call site of each block and then the blocks themselves.
+struct mempool_chunk
+{
+	mempool_chunk* next, * prev;	//in the size class's list of chunks with free blocks
+	int size_class;
+	int num_blocks;
+	int num_used;
+	int num_touched;					//blocks past this have never been handed out, so aren't on the free list
+	void* free_list;
+	ubyte* blocks;
+	ushort* sizes;						//size asked for, for each block
+	ushort* sites;						//call site index, for each block
+};
+
+struct mempool_class
+{
+	int block_size;
+	mempool_chunk* partial;			//chunks with at least one free block
+	mempool_chunk* empty;			//one spare chunk kept around so alloc/free at a chunk boundary doesn't thrash
+	int num_chunks;
+	int num_used;						//blocks handed out
+	longlong used_bytes;				//bytes asked for in those blocks
+};
+
+//Allocations tracked per call site
+struct mempool_site
+{
+	const char* file;
+	int line;
+	int live_blocks;
+	longlong live_bytes;
+	longlong peak_bytes;
+	uint num_allocs;
+	uint num_allocs_at_dump;		//num_allocs the last time stats were dumped, to get the rate
+};
+
+struct mempool_large
+{
+	int size;
+	int site;
+};
+
+static std::mutex Mempool_mutex;
+static mempool_class Mempool_classes[MEMPOOL_NUM_CLASSES];
+static sbyte Mempool_class_lookup[MEMPOOL_MAX_BLOCK / MEMPOOL_GRANULARITY + 1];
+
+//Open-addressed set of chunk addresses, so any pointer can be checked against the pool
+static mempool_chunk** Mempool_chunk_table;
+static int Mempool_chunk_table_size;
+static int Mempool_num_chunks;
+
+static std::unordered_map<void*, mempool_large>* Mempool_large_blocks;
+static longlong Mempool_large_bytes;
+
+//Site 0 is used when the site table is full
+static mempool_site Mempool_sites[MEMPOOL_MAX_SITES];
+static int Mempool_num_sites;
+
+static longlong Mempool_live_bytes;
+static double Mempool_last_dump_time;
+static bool Mempool_initted;
+
+static std::atomic<longlong> Mem_call_time;
+static std::atomic<uint> Mem_num_calls;
+
+longlong mem_Clock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void mem_AddCallTime(longlong ns)
+{
+	Mem_call_time += ns;
+	Mem_num_calls++;
+}
+
+void mem_DumpTiming(FILE* file)
+{
+	uint calls = Mem_num_calls;
+	longlong ns = Mem_call_time;
+	fprintf(file, "Allocator calls: %u, total time %.3f ms, %.1f ns per call\n", calls, ns / 1000000.0, calls ? (double)ns / calls : 0.0);
+}
+
+void mempool_Init()
+{
+	int c = 0;
+	for (int i = 0; i <= MEMPOOL_MAX_BLOCK / MEMPOOL_GRANULARITY; i++)
+	{
+		while (Mempool_class_sizes[c] < i * MEMPOOL_GRANULARITY)
+			c++;
+		Mempool_class_lookup[i] = c;
+	}
+
+	for (c = 0; c < MEMPOOL_NUM_CLASSES; c++)
+	{
+		memset(&Mempool_classes[c], 0, sizeof(mempool_class));
+		Mempool_classes[c].block_size = Mempool_class_sizes[c];
+	}
+
+	Mempool_chunk_table_size = 256;
+	Mempool_chunk_table = (mempool_chunk**)calloc(Mempool_chunk_table_size, sizeof(mempool_chunk*));
+	Mempool_large_blocks = new std::unordered_map<void*, mempool_large>;
+
+	Mempool_sites[0].file = "(other)";
+	Mempool_num_sites = 1;
+	Mempool_last_dump_time = mem_Clock() / 1.0e9;
+	Mempool_initted = true;
+}
+
+static inline uint mempool_HashChunk(const void* chunk)
+{
+	uintptr_t key = (uintptr_t)chunk >> MEMPOOL_CHUNK_SHIFT;
+	return (uint)(key * 2654435761u);
+}
+
+//Returns the chunk that a pointer is in, or NULL if it's not in the pool
+static mempool_chunk* mempool_FindChunk(const void* ptr)
+{
+	mempool_chunk* chunk = (mempool_chunk*)((uintptr_t)ptr & ~(uintptr_t)(MEMPOOL_CHUNK_SIZE - 1));
+	int mask = Mempool_chunk_table_size - 1;
+	for (int slot = mempool_HashChunk(chunk) & mask; Mempool_chunk_table[slot]; slot = (slot + 1) & mask)
+	{
+		if (Mempool_chunk_table[slot] == chunk)
+			return chunk;
+	}
+	return NULL;
+}
+
+static void mempool_InsertChunk(mempool_chunk** table, int table_size, mempool_chunk* chunk)
+{
+	int mask = table_size - 1;
+	int slot = mempool_HashChunk(chunk) & mask;
+	while (table[slot])
+		slot = (slot + 1) & mask;
+	table[slot] = chunk;
+}
+
+static void mempool_RegisterChunk(mempool_chunk* chunk)
+{
+	//Keep the table at most half full
+	if ((Mempool_num_chunks + 1) * 2 > Mempool_chunk_table_size)
+	{
+		int new_size = Mempool_chunk_table_size * 2;
+		mempool_chunk** new_table = (mempool_chunk**)calloc(new_size, sizeof(mempool_chunk*));
+		for (int i = 0; i < Mempool_chunk_table_size; i++)
+		{
+			if (Mempool_chunk_table[i])
+				mempool_InsertChunk(new_table, new_size, Mempool_chunk_table[i]);
+		}
+		free(Mempool_chunk_table);
+		Mempool_chunk_table = new_table;
+		Mempool_chunk_table_size = new_size;
+	}
+	mempool_InsertChunk(Mempool_chunk_table, Mempool_chunk_table_size, chunk);
+	Mempool_num_chunks++;
+}
+
+static void mempool_UnregisterChunk(mempool_chunk* chunk)
+{
+	int mask = Mempool_chunk_table_size - 1;
+	int slot = mempool_HashChunk(chunk) & mask;
+	while (Mempool_chunk_table[slot] != chunk)
+		slot = (slot + 1) & mask;
+	Mempool_chunk_table[slot] = NULL;
+	Mempool_num_chunks--;
+
+	//Reinsert the rest of the cluster so lookups don't stop at the hole
+	for (slot = (slot + 1) & mask; Mempool_chunk_table[slot]; slot = (slot + 1) & mask)
+	{
+		mempool_chunk* moved = Mempool_chunk_table[slot];
+		Mempool_chunk_table[slot] = NULL;
+		mempool_InsertChunk(Mempool_chunk_table, Mempool_chunk_table_size, moved);
+	}
+}
+
+static mempool_chunk* mempool_NewChunk(int size_class)
+{
+	void* mem;
+#ifdef WIN32
+	mem = _aligned_malloc(MEMPOOL_CHUNK_SIZE, MEMPOOL_CHUNK_SIZE);
+#else
+	if (posix_memalign(&mem, MEMPOOL_CHUNK_SIZE, MEMPOOL_CHUNK_SIZE))
+		mem = NULL;
+#endif
+	if (!mem)
+		return NULL;
+
+	mempool_chunk* chunk = (mempool_chunk*)mem;
+	int block_size = Mempool_classes[size_class].block_size;
+	int header_size = sizeof(mempool_chunk);
+
+	//Each block needs a size and a site entry in the header
+	int num_blocks = (MEMPOOL_CHUNK_SIZE - header_size - MEMPOOL_GRANULARITY) / (block_size + 2 * sizeof(ushort));
+	header_size += num_blocks * 2 * sizeof(ushort);
+	header_size = (header_size + MEMPOOL_GRANULARITY - 1) & ~(MEMPOOL_GRANULARITY - 1);
+
+	chunk->next = chunk->prev = NULL;
+	chunk->size_class = size_class;
+	chunk->num_blocks = num_blocks;
+	chunk->num_used = 0;
+	chunk->num_touched = 0;
+	chunk->free_list = NULL;
+	chunk->sizes = (ushort*)(chunk + 1);
+	chunk->sites = chunk->sizes + num_blocks;
+	chunk->blocks = (ubyte*)chunk + header_size;
+	ASSERT(chunk->blocks + num_blocks * block_size <= (ubyte*)chunk + MEMPOOL_CHUNK_SIZE);
+
+	mempool_RegisterChunk(chunk);
+	Mempool_classes[size_class].num_chunks++;
+	return chunk;
+}
+
+static void mempool_FreeChunk(mempool_chunk* chunk)
+{
+	mempool_UnregisterChunk(chunk);
+	Mempool_classes[chunk->size_class].num_chunks--;
+#ifdef WIN32
+	_aligned_free(chunk);
+#else
+	free(chunk);
+#endif
+}
+
+static inline void mempool_LinkChunk(mempool_chunk** list, mempool_chunk* chunk)
+{
+	chunk->prev = NULL;
+	chunk->next = *list;
+	if (*list)
+		(*list)->prev = chunk;
+	*list = chunk;
+}
+
+static inline void mempool_UnlinkChunk(mempool_chunk** list, mempool_chunk* chunk)
+{
+	if (chunk->prev)
+		chunk->prev->next = chunk->next;
+	else
+		*list = chunk->next;
+	if (chunk->next)
+		chunk->next->prev = chunk->prev;
+	chunk->next = chunk->prev = NULL;
+}
+
+//Finds or adds the site table entry for a call site
+static int mempool_GetSite(const char* file, int line)
+{
+	//__FILE__ strings are compared by address. The same file can end up with more
+	//than one entry if the compiler doesn't merge the strings, which only splits the stats.
+	uint hash = ((uint)(uintptr_t)file * 31 + line) * 2654435761u;
+	int mask = MEMPOOL_MAX_SITES - 1;
+	for (int slot = (hash >> 8) & mask, tries = 0; tries < MEMPOOL_MAX_SITES; slot = (slot + 1) & mask, tries++)
+	{
+		if (slot == 0)
+			continue;
+		mempool_site* site = &Mempool_sites[slot];
+		if (site->file == file && site->line == line)
+			return slot;
+		if (!site->file)
+		{
+			if (Mempool_num_sites >= MEMPOOL_MAX_SITES * 3 / 4)
+				break;
+			site->file = file;
+			site->line = line;
+			Mempool_num_sites++;
+			return slot;
+		}
+	}
+	return 0;
+}
+
+static inline void mempool_CountAlloc(int site, int size)
+{
+	mempool_site* sp = &Mempool_sites[site];
+	sp->live_blocks++;
+	sp->live_bytes += size;
+	sp->num_allocs++;
+	if (sp->live_bytes > sp->peak_bytes)
+		sp->peak_bytes = sp->live_bytes;
+	Mempool_live_bytes += size;
+}
+
+static inline void mempool_CountFree(int site, int size)
+{
+	mempool_site* sp = &Mempool_sites[site];
+	sp->live_blocks--;
+	sp->live_bytes -= size;
+	Mempool_live_bytes -= size;
+}
+
+void* mempool_Alloc(int size, const char* file, int line)
+{
+	std::lock_guard<std::mutex> lock(Mempool_mutex);
+	int site = mempool_GetSite(file, line);
+
+	if (size > MEMPOOL_MAX_BLOCK)
+	{
+		void* ptr = malloc(size);
+		if (!ptr)
+			return NULL;
+		mempool_large& lb = (*Mempool_large_blocks)[ptr];
+		lb.size = size;
+		lb.site = site;
+		Mempool_large_bytes += size;
+		mempool_CountAlloc(site, size);
+		return ptr;
+	}
+
+	int size_class = Mempool_class_lookup[(size + MEMPOOL_GRANULARITY - 1) / MEMPOOL_GRANULARITY];
+	mempool_class* cp = &Mempool_classes[size_class];
+	mempool_chunk* chunk = cp->partial;
+
+	if (!chunk)
+	{
+		if (cp->empty)
+		{
+			chunk = cp->empty;
+			cp->empty = NULL;
+		}
+		else
+		{
+			chunk = mempool_NewChunk(size_class);
+			if (!chunk)
+				return NULL;
+		}
+		mempool_LinkChunk(&cp->partial, chunk);
+	}
+
+	void* ptr;
+	if (chunk->free_list)
+	{
+		ptr = chunk->free_list;
+		chunk->free_list = *(void**)ptr;
+	}
+	else
+	{
+		ASSERT(chunk->num_touched < chunk->num_blocks);
+		ptr = chunk->blocks + chunk->num_touched * cp->block_size;
+		chunk->num_touched++;
+	}
+
+	chunk->num_used++;
+	if (chunk->num_used == chunk->num_blocks)
+		mempool_UnlinkChunk(&cp->partial, chunk);
+
+	int block_num = ((ubyte*)ptr - chunk->blocks) / cp->block_size;
+	chunk->sizes[block_num] = size;
+	chunk->sites[block_num] = site;
+
+	cp->num_used++;
+	cp->used_bytes += size;
+	mempool_CountAlloc(site, size);
+	return ptr;
+}
+
+bool mempool_Owns(void* memblock)
+{
+	std::lock_guard<std::mutex> lock(Mempool_mutex);
+	if (!Mempool_initted)
+		return false;
+	if (mempool_FindChunk(memblock))
+		return true;
+	return Mempool_large_blocks->find(memblock) != Mempool_large_blocks->end();
+}
+
+bool mempool_Free(void* memblock)
+{
+	std::lock_guard<std::mutex> lock(Mempool_mutex);
+	if (!Mempool_initted)
+		return false;
+
+	mempool_chunk* chunk = mempool_FindChunk(memblock);
+	if (!chunk)
+	{
+		auto it = Mempool_large_blocks->find(memblock);
+		if (it == Mempool_large_blocks->end())
+			return false;
+		mempool_CountFree(it->second.site, it->second.size);
+		Mempool_large_bytes -= it->second.size;
+		Mempool_large_blocks->erase(it);
+		free(memblock);
+		return true;
+	}
+
+	mempool_class* cp = &Mempool_classes[chunk->size_class];
+	int block_num = ((ubyte*)memblock - chunk->blocks) / cp->block_size;
+	ASSERT(chunk->blocks + block_num * cp->block_size == memblock);
+
+	mempool_CountFree(chunk->sites[block_num], chunk->sizes[block_num]);
+	cp->num_used--;
+	cp->used_bytes -= chunk->sizes[block_num];
+
+	*(void**)memblock = chunk->free_list;
+	chunk->free_list = memblock;
+
+	if (chunk->num_used == chunk->num_blocks)
+		mempool_LinkChunk(&cp->partial, chunk);
+	chunk->num_used--;
+
+	//Give empty chunks back, except for one spare
+	if (chunk->num_used == 0)
+	{
+		mempool_UnlinkChunk(&cp->partial, chunk);
+		chunk->free_list = NULL;
+		chunk->num_touched = 0;
+		if (cp->empty)
+			mempool_FreeChunk(chunk);
+		else
+			cp->empty = chunk;
+	}
+	return true;
+}
+
+int mempool_Size(void* memblock)
+{
+	std::lock_guard<std::mutex> lock(Mempool_mutex);
+	if (!Mempool_initted)
+		return -1;
+
+	mempool_chunk* chunk = mempool_FindChunk(memblock);
+	if (!chunk)
+	{
+		auto it = Mempool_large_blocks->find(memblock);
+		return (it != Mempool_large_blocks->end()) ? it->second.size : -1;
+	}
+
+	int block_num = ((ubyte*)memblock - chunk->blocks) / Mempool_classes[chunk->size_class].block_size;
+	return chunk->sizes[block_num];
+}
+
+void* mempool_Realloc(void* memblock, int size)
+{
+	const char* file;
+	int line, old_size;
+
+	{
+		std::lock_guard<std::mutex> lock(Mempool_mutex);
+		mempool_chunk* chunk = mempool_FindChunk(memblock);
+		int site;
+
+		if (chunk)
+		{
+			mempool_class* cp = &Mempool_classes[chunk->size_class];
+			int block_num = ((ubyte*)memblock - chunk->blocks) / cp->block_size;
+			old_size = chunk->sizes[block_num];
+			site = chunk->sites[block_num];
+
+			//Grow or shrink in place if it stays in the same size class
+			if (size <= MEMPOOL_MAX_BLOCK && Mempool_class_lookup[(size + MEMPOOL_GRANULARITY - 1) / MEMPOOL_GRANULARITY] == chunk->size_class)
+			{
+				mempool_CountFree(site, old_size);
+				mempool_CountAlloc(site, size);
+				Mempool_sites[site].num_allocs--;
+				cp->used_bytes += size - old_size;
+				chunk->sizes[block_num] = size;
+				return memblock;
+			}
+		}
+		else
+		{
+			auto it = Mempool_large_blocks->find(memblock);
+			ASSERT(it != Mempool_large_blocks->end());
+			old_size = it->second.size;
+			site = it->second.site;
+		}
+		file = Mempool_sites[site].file;
+		line = Mempool_sites[site].line;
+	}
+
+	void* new_block = mempool_Alloc(size, file, line);
+	if (!new_block)
+		return NULL;
+	memcpy(new_block, memblock, std::min(old_size, size));
+	mempool_Free(memblock);
+	return new_block;
+}
+
+int mempool_GetLiveBytes()
+{
+	std::lock_guard<std::mutex> lock(Mempool_mutex);
+	return (int)Mempool_live_bytes;
+}
+
+static int mempool_CompareSites(const void* a, const void* b)
+{
+	const mempool_site* sa = &Mempool_sites[*(const int*)a];
+	const mempool_site* sb = &Mempool_sites[*(const int*)b];
+	if (sa->live_bytes != sb->live_bytes)
+		return (sa->live_bytes > sb->live_bytes) ? -1 : 1;
+	return (int)sb->num_allocs - (int)sa->num_allocs;
+}
+
+void mempool_DumpStats(FILE* file)
+{
+	std::lock_guard<std::mutex> lock(Mempool_mutex);
+	double now = mem_Clock() / 1.0e9;
+	double interval = now - Mempool_last_dump_time;
+	longlong reserved = (longlong)Mempool_num_chunks * MEMPOOL_CHUNK_SIZE;
+	longlong pool_used = 0;
+	int i;
+
+	fprintf(file, "\nSize classes:\n");
+	fprintf(file, "%8s %8s %10s %12s %12s %8s\n", "Block", "Chunks", "Blocks", "Bytes used", "Reserved", "Used %");
+	for (i = 0; i < MEMPOOL_NUM_CLASSES; i++)
+	{
+		mempool_class* cp = &Mempool_classes[i];
+		longlong class_reserved = (longlong)cp->num_chunks * MEMPOOL_CHUNK_SIZE;
+		pool_used += cp->used_bytes;
+		if (!cp->num_chunks)
+			continue;
+		fprintf(file, "%8d %8d %10d %12lld %12lld %7.1f%%\n", cp->block_size, cp->num_chunks, cp->num_used,
+			cp->used_bytes, class_reserved, 100.0 * cp->used_bytes / class_reserved);
+	}
+
+	//Fragmentation is the part of the pool's memory that isn't holding anything asked for
+	fprintf(file, "\nPool: %lld bytes used in %lld bytes reserved (%.1f%% fragmentation)\n", pool_used, reserved,
+		reserved ? 100.0 * (reserved - pool_used) / reserved : 0.0);
+	fprintf(file, "Large blocks: %d blocks, %lld bytes\n", (int)Mempool_large_blocks->size(), Mempool_large_bytes);
+	fprintf(file, "Live: %lld bytes\n", Mempool_live_bytes);
+
+	//Sort the sites by live bytes
+	int* order = (int*)malloc(MEMPOOL_MAX_SITES * sizeof(int));
+	int num = 0;
+	for (i = 0; i < MEMPOOL_MAX_SITES; i++)
+	{
+		if (Mempool_sites[i].file && (Mempool_sites[i].num_allocs || Mempool_sites[i].live_blocks))
+			order[num++] = i;
+	}
+	qsort(order, num, sizeof(int), mempool_CompareSites);
+
+	fprintf(file, "\nCall sites (allocs/sec over the last %.1f seconds):\n", interval);
+	fprintf(file, "%12s %8s %12s %10s %10s  %s\n", "Live bytes", "Blocks", "Peak bytes", "Allocs", "Allocs/s", "Site");
+	for (i = 0; i < num; i++)
+	{
+		mempool_site* sp = &Mempool_sites[order[i]];
+		uint recent = sp->num_allocs - sp->num_allocs_at_dump;
+		fprintf(file, "%12lld %8d %12lld %10u %10.1f  %s line %d\n", sp->live_bytes, sp->live_blocks, sp->peak_bytes,
+			sp->num_allocs, interval > 0 ? recent / interval : 0.0, sp->file, sp->line);
+		sp->num_allocs_at_dump = sp->num_allocs;
+	}
+	free(order);
+	Mempool_last_dump_time = now;
+}
@@ -0,0 +1,61 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include "pstypes.h"
+
+//Size-class allocator used by the memory library when Mem_use_pool is set.
+//Small blocks are carved out of 64K chunks, one size class per chunk. Larger blocks
+//go to the system allocator, but are still counted against the call site that made them.
+//All functions are thread safe.
+
+//Sets up the size classes. Called by mem_Init(). The pool is never shut down, since
+//blocks can be freed by static destructors after the memory library has shut down.
+void mempool_Init();
+
+//Allocates a block, recording it against the given call site.
+void* mempool_Alloc(int size, const char* file, int line);
+
+//Returns true if the block was allocated by mempool_Alloc().
+bool mempool_Owns(void* memblock);
+
+//Frees a block from mempool_Alloc().
+//Returns false, without doing anything, if the block isn't from the pool.
+bool mempool_Free(void* memblock);
+
+//Returns the size that was asked for when the block was allocated, or -1 if the block isn't from the pool.
+int mempool_Size(void* memblock);
+
+//Resizes a block from mempool_Alloc(), keeping its call site.
+void* mempool_Realloc(void* memblock, int size);
+
+//Returns the number of bytes allocated by callers and not yet freed.
+int mempool_GetLiveBytes();
+
+//Writes the size class and per-call-site tables to a file.
+void mempool_DumpStats(FILE* file);
+
+//Timing of the allocator entry points, kept when Mem_stats is set, in both pool and system modes.
+//Returns a timestamp in nanoseconds.
+longlong mem_Clock();
+//Adds the time taken by one call to mem_malloc/mem_free/mem_realloc.
+void mem_AddCallTime(longlong ns);
+//Writes the call count and time totals to a file.
+void mem_DumpTiming(FILE* file);
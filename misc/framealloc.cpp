@@ -0,0 +1,134 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "framealloc.h"
+#include "mem.h"
+#include "pserror.h"
+
+#define FRAME_ARENA_INITIAL_SIZE	(1024 * 1024)
+
+//Arena memory comes in blocks. Normally there is only one; more are chained on when a frame
+//runs out of room, and they're merged into one bigger block at the next reset.
+struct FrameBlock
+{
+	FrameBlock* next;
+	int size;
+	int used;
+	alignas(16) unsigned char data[1];
+};
+
+static FrameBlock* Frame_block = nullptr;
+static int Frame_bytes_used = 0;
+static int Frame_high_water = 0;
+static int Frame_system_allocs = 0;
+static int Frame_last_system_allocs = 0;
+
+static FrameBlock* frame_NewBlock(int size, FrameBlock* next)
+{
+	FrameBlock* block = (FrameBlock*)mem_malloc(offsetof(FrameBlock, data) + size);
+	if (!block)
+		Error("Unable to allocate %d bytes for the frame arena.", size);
+	block->next = next;
+	block->size = size;
+	block->used = 0;
+	Frame_system_allocs++;
+	return block;
+}
+
+void* frame_Alloc(int size, int align)
+{
+	ASSERT(size >= 0 && (align & (align - 1)) == 0);
+
+	if (!Frame_block)
+		Frame_block = frame_NewBlock(FRAME_ARENA_INITIAL_SIZE, nullptr);
+
+	uintptr_t base = (uintptr_t)Frame_block->data;
+	uintptr_t start = (base + Frame_block->used + (align - 1)) & ~(uintptr_t)(align - 1);
+	if (start + size > base + Frame_block->size)
+	{
+		//Out of room, chain on a new block big enough for this and then some
+		int new_size = Frame_block->size * 2;
+		if (new_size < size + align)
+			new_size = size + align;
+		Frame_block = frame_NewBlock(new_size, Frame_block);
+
+		base = (uintptr_t)Frame_block->data;
+		start = (base + (align - 1)) & ~(uintptr_t)(align - 1);
+	}
+
+	Frame_block->used = (int)(start + size - base);
+	Frame_bytes_used += size;
+	return (void*)start;
+}
+
+void* frame_Calloc(int size, int align)
+{
+	void* ptr = frame_Alloc(size, align);
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+void frame_Reset()
+{
+	if (Frame_bytes_used > Frame_high_water)
+		Frame_high_water = Frame_bytes_used;
+	Frame_bytes_used = 0;
+
+	Frame_last_system_allocs = Frame_system_allocs;
+	Frame_system_allocs = 0;
+
+	if (!Frame_block)
+		return;
+
+	//If the frame overflowed, replace the blocks with one that holds all of them
+	if (Frame_block->next)
+	{
+		int total_size = 0;
+		while (Frame_block)
+		{
+			FrameBlock* next = Frame_block->next;
+			total_size += Frame_block->size;
+			mem_free(Frame_block);
+			Frame_block = next;
+		}
+		mprintf((0, "Frame arena grown to %d bytes\n", total_size));
+		Frame_block = frame_NewBlock(total_size, nullptr);
+		//Don't count the regrow against the next frame
+		Frame_system_allocs = 0;
+	}
+
+	Frame_block->used = 0;
+}
+
+int frame_GetBytesUsed()
+{
+	return Frame_bytes_used;
+}
+
+int frame_GetHighWater()
+{
+	return Frame_high_water > Frame_bytes_used ? Frame_high_water : Frame_bytes_used;
+}
+
+int frame_GetSystemAllocs()
+{
+	return Frame_last_system_allocs;
+}
@@ -0,0 +1,181 @@
+/*
+* Descent 3: Piccu Engine
+* Copyright (C) 2024 SaladBadger
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "jobsystem.h"
+
+struct QueuedJob
+{
+	void (*func)(void* data);
+	void* data;
+};
+
+//State shared between the threads running one job_ParallelFor call
+struct ParallelForState
+{
+	void (*func)(void* data, int index);
+	void* data;
+	int count;
+	std::atomic<int> next_index;
+	int helpers_left; //helper jobs queued or running, protected by Job_mutex
+};
+
+static std::vector<std::thread> Job_threads;
+static std::deque<QueuedJob> Job_queue;
+static std::mutex Job_mutex;
+static std::condition_variable Job_wake;
+static std::condition_variable Job_done;
+static bool Job_shutdown = false;
+
+static void JobWorker()
+{
+	std::unique_lock<std::mutex> lock(Job_mutex);
+	for (;;)
+	{
+		Job_wake.wait(lock, [] { return Job_shutdown || !Job_queue.empty(); });
+		if (Job_queue.empty())
+			return; //shutting down and nothing left to do
+
+		QueuedJob job = Job_queue.front();
+		Job_queue.pop_front();
+
+		lock.unlock();
+		job.func(job.data);
+		lock.lock();
+	}
+}
+
+void job_Init(int num_threads)
+{
+	if (!Job_threads.empty())
+		return;
+
+	if (num_threads <= 0)
+	{
+		num_threads = (int)std::thread::hardware_concurrency() - 1;
+		if (num_threads < 1)
+			num_threads = 1;
+	}
+
+	Job_shutdown = false;
+	for (int i = 0; i < num_threads; i++)
+		Job_threads.emplace_back(JobWorker);
+}
+
+void job_Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(Job_mutex);
+		Job_shutdown = true;
+	}
+	Job_wake.notify_all();
+
+	for (std::thread& thread : Job_threads)
+		thread.join();
+	Job_threads.clear();
+}
+
+int job_GetNumThreads()
+{
+	return (int)Job_threads.size();
+}
+
+void job_Submit(void (*func)(void* data), void* data)
+{
+	if (Job_threads.empty())
+	{
+		func(data);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(Job_mutex);
+		Job_queue.push_back({ func, data });
+	}
+	Job_wake.notify_one();
+}
+
+//Pulls indices off a ParallelForState until there are none left
+static void ParallelForRun(ParallelForState* state)
+{
+	int index;
+	while ((index = state->next_index.fetch_add(1)) < state->count)
+		state->func(state->data, index);
+}
+
+static void ParallelForJob(void* data)
+{
+	ParallelForState* state = (ParallelForState*)data;
+	ParallelForRun(state);
+
+	std::lock_guard<std::mutex> lock(Job_mutex);
+	state->helpers_left--;
+	Job_done.notify_all();
+}
+
+void job_ParallelFor(int count, void (*func)(void* data, int index), void* data)
+{
+	if (count <= 0)
+		return;
+
+	int num_helpers = std::min((int)Job_threads.size(), count - 1);
+	if (num_helpers <= 0)
+	{
+		for (int i = 0; i < count; i++)
+			func(data, i);
+		return;
+	}
+
+	ParallelForState state;
+	state.func = func;
+	state.data = data;
+	state.count = count;
+	state.next_index = 0;
+	state.helpers_left = num_helpers;
+
+	{
+		std::lock_guard<std::mutex> lock(Job_mutex);
+		for (int i = 0; i < num_helpers; i++)
+			Job_queue.push_front({ ParallelForJob, &state });
+	}
+	Job_wake.notify_all();
+
+	//Do our share of the work
+	ParallelForRun(&state);
+
+	//Helpers that never got started (workers busy with other jobs) are taken back out of the queue,
+	//then wait for the ones that are still finishing their last index.
+	std::unique_lock<std::mutex> lock(Job_mutex);
+	for (auto it = Job_queue.begin(); it != Job_queue.end();)
+	{
+		if (it->data == &state)
+		{
+			it = Job_queue.erase(it);
+			state.helpers_left--;
+		}
+		else
+			++it;
+	}
+	Job_done.wait(lock, [&] { return state.helpers_left == 0; });
+}
@@ -1026,8 +1026,33 @@ int ReadNewModelFile (int polynum,CFILE *infile)
 
 				ubyte tempbuf[2000];
 				
+				// If the file is in a mapped hog, walk the face headers in place
+				const ubyte *mapped_data;
+				int mapped_left=cf_GetMappedData (infile,&mapped_data);
 
-				for (i=0;i<nfaces;i++)
+				for (i=0;i<nfaces && mapped_data;i++)
+				{
+					int num_verts,textured;
+
+					ASSERT (mapped_left>=20);
+					memcpy (&num_verts,mapped_data+12,sizeof(int));
+					memcpy (&textured,mapped_data+16,sizeof(int));
+					num_verts=INTEL_INT(num_verts);
+					textured=INTEL_INT(textured);
+
+					ASSERT (num_verts<100);
+					ASSERT (num_verts>0);
+					start_index[i]=current_count;
+					current_count+=num_verts;
+
+					int skip=20+(textured?4:3)+12*num_verts;
+					if (version_major>=21)
+						skip+=8;
+					mapped_data+=skip;
+					mapped_left-=skip;
+				}
+
+				for (i=0;i<nfaces && !mapped_data;i++)
 				{
 					ReadModelVector (&tvec,infile);
 					int num_verts=cf_ReadInt (infile);
@@ -50,6 +50,7 @@
 #include "bitmap.h"
 #include "gamefont.h"
 #include "game.h"
+#include "args.h"
 
 #include "../mve/libmve.h"
 #include "llsopenal.h"
@@ -564,6 +565,13 @@ int mve_Init( const char *dir, const char *sndcard )
 #ifndef NO_MOVIES
 	strcpy( MovieDir, dir );
 	strcpy( SoundCardName, sndcard );	
+
+	// -mvereference decodes movies with the original per-pixel decoder, for comparison
+	if( FindArg( "-mvereference" ) )
+		MVE_SetDecodeFlags( 0 );
+	else
+		MVE_SetDecodeFlags( MVE_DECODE_FAST | MVE_DECODE_PARALLEL );
+
 	return MVELIB_NOERROR;
 #else
 	return MVELIB_INIT_ERROR;
@@ -671,6 +679,23 @@ int mve_PlayMovie( const char *pMovieName, oeApplication *pApp )
 #endif
 }
 
+// decodes a movie with each decoder mode, logging the frame rates and writing frame checksums to checksumFile
+int mve_Benchmark( const char *pMovieName, const char *checksumFile )
+{
+#ifndef NO_MOVIES
+	int mismatches = MVE_Benchmark( pMovieName, checksumFile );
+	if( mismatches < 0 )
+	{
+		mprintf(( 0, "MOVIE: Unable to open %s\n", pMovieName ));
+		return MVELIB_FILE_ERROR;
+	}
+
+	return mismatches;
+#else
+	return MVELIB_INIT_ERROR;
+#endif
+}
+
 void* CallbackAlloc( unsigned int size )
 {
 	return mem_malloc( size );
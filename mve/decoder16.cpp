@@ -3,14 +3,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <pserror.h>
 
 #include "decoders.h"
+#include "libmve.h"
+#include "jobsystem.h"
 
 static unsigned short *backBuf1, *backBuf2;
 static int lookup_initialized;
 
 static void dispatchDecoder16(unsigned short **pFrame, unsigned char codeType, unsigned char **pData, unsigned char **pOffData, int *pDataRemain, int *curXb, int *curYb);
+static void decodeBlock16(unsigned short *pFrame, unsigned char codeType, unsigned char **pData, unsigned char **pOffData);
+static unsigned char *decodeRows16(unsigned short *pFrame, unsigned char *pMap, unsigned char *pData, unsigned char *pOffData, int firstRow, int lastRow);
+static unsigned char *decodeBands16(unsigned short *pFrame, unsigned char *pMap, unsigned char *pData, unsigned char *pOffData);
 static void genLoopkupTable();
 
 void decodeFrame16(unsigned char *pFrame, unsigned char *pMap, int mapRemain, unsigned char *pData, int dataRemain)
@@ -19,9 +25,7 @@ void decodeFrame16(unsigned char *pFrame, unsigned char *pMap, int mapRemain, un
     unsigned char *pOffData, *pEnd;
     unsigned short offset;
     int length;
-    int op;
-    int i, j;
-    int xb, yb;
+    int yb;
 
 	if (!lookup_initialized) {
 		genLoopkupTable();
@@ -30,53 +34,80 @@ void decodeFrame16(unsigned char *pFrame, unsigned char *pMap, int mapRemain, un
     backBuf1 = (unsigned short *)g_vBackBuf1;
     backBuf2 = (unsigned short *)g_vBackBuf2;
 
-    xb = g_width >> 3;
     yb = g_height >> 3;
 
+    /* each map byte holds the opcodes for two blocks */
+    if (mapRemain < (g_width >> 4) * yb || dataRemain < 2)
+    {
+        fprintf(stderr, "DEBUG: map or data too short for frame: %d,%d\n", mapRemain, dataRemain);
+        return;
+    }
+
     offset = pData[0]|(pData[1]<<8);
+    if (offset > dataRemain)
+    {
+        fprintf(stderr, "DEBUG: offset data past end of frame: %d,%d\n", offset, dataRemain);
+        return;
+    }
 
     pOffData = pData + offset;
-    pEnd = pData + offset;
 
     pData += 2;
 
     pOrig = pData;
     length = offset - 2; /*dataRemain-2;*/
 
-    for (j=0; j<yb; j++)
+    pEnd = NULL;
+    if ((g_decodeFlags & MVE_DECODE_PARALLEL) && job_GetNumThreads() > 0)
+        pEnd = decodeBands16((unsigned short *)pFrame, pMap, pData, pOffData);
+
+    if (!pEnd)
+        pEnd = decodeRows16((unsigned short *)pFrame, pMap, pData, pOffData, 0, yb);
+
+    if ((length-(pEnd-pOrig)) != 0) {
+    	fprintf(stderr, "DEBUG: junk left over: %d,%d,%d\n", (int)(pEnd-pOrig), length, (int)(length-(pEnd-pOrig)));
+    }
+}
+
+/* decodes block rows [firstRow, lastRow), returns the end of the data used */
+static unsigned char *decodeRows16(unsigned short *pFrame, unsigned char *pMap, unsigned char *pData, unsigned char *pOffData, int firstRow, int lastRow)
+{
+    int dataRemain = 0;
+    int fast = g_decodeFlags & MVE_DECODE_FAST;
+    int xb = g_width >> 3;
+    int op;
+    int i, j;
+
+    for (j=firstRow; j<lastRow; j++)
     {
         for (i=0; i<xb/2; i++)
         {
+            /* opcode 6 moves on to other blocks, only the original decoder handles it */
             op = (*pMap) & 0xf;
-            dispatchDecoder16((unsigned short **)&pFrame, op, &pData, &pOffData, &dataRemain, &i, &j);
-
-			/*
-			  if ((unsigned short *)pFrame < backBuf1)
-			  fprintf(stderr, "danger!  pointing out of bounds below after dispatch decoder: %d, %d (1) [%x]\n", i, j, (*pMap) & 0xf);
-			  else if ((unsigned short *)pFrame >= backBuf1 + g_width*g_height)
-			  fprintf(stderr, "danger!  pointing out of bounds above after dispatch decoder: %d, %d (1) [%x]\n", i, j, (*pMap) & 0xf);
-			*/
-
-			op = ((*pMap) >> 4) & 0xf;
-            dispatchDecoder16((unsigned short **)&pFrame, op, &pData, &pOffData, &dataRemain, &i, &j);
-
-			/*
-			  if ((unsigned short *)pFrame < backBuf1)
-			  fprintf(stderr, "danger!  pointing out of bounds below after dispatch decoder: %d, %d (2) [%x]\n", i, j, (*pMap) >> 4);
-			  else if ((unsigned short *)pFrame >= backBuf1 + g_width*g_height)
-			  fprintf(stderr, "danger!  pointing out of bounds above after dispatch decoder: %d, %d (2) [%x]\n", i, j, (*pMap) >> 4);
-			*/
+            if (fast && op != 0x6)
+            {
+                decodeBlock16(pFrame, op, &pData, &pOffData);
+                pFrame += 8;
+            }
+            else
+                dispatchDecoder16(&pFrame, op, &pData, &pOffData, &dataRemain, &i, &j);
+
+            op = ((*pMap) >> 4) & 0xf;
+            if (fast && op != 0x6)
+            {
+                decodeBlock16(pFrame, op, &pData, &pOffData);
+                pFrame += 8;
+            }
+            else
+                dispatchDecoder16(&pFrame, op, &pData, &pOffData, &dataRemain, &i, &j);
 
             ++pMap;
-            --mapRemain;
         }
 
-        pFrame += 7*g_width*2;
+        pFrame += 7*g_width;
     }
 
-    if ((length-(pData-pOrig)) != 0) {
-    	fprintf(stderr, "DEBUG: junk left over: %d,%d,%d\n", (pData-pOrig), length, (length-(pData-pOrig)));
-    }
+    return pData;
 }
 
 static unsigned short GETPIXEL(unsigned char **buf, int off)
@@ -716,3 +747,519 @@ static void dispatchDecoder16(unsigned short **pFrame, unsigned char codeType, u
 
     *pFrame = pDstBak+8;
 }
+
+/* Fast path. Each row of a block is built up locally and written with a
+   single 16 byte store instead of a store per pixel. The output is the same
+   as dispatchDecoder16, quirks included. */
+
+static void copyBlock16(unsigned short *pDest, unsigned short *pSrc, int width)
+{
+    int i;
+
+    for (i=0; i<8; i++)
+    {
+        memcpy(pDest, pSrc, 16);
+        pDest += width;
+        pSrc += width;
+    }
+}
+
+static void storeRows16(unsigned short *pDest, const unsigned short *row, int count, int width)
+{
+    int i;
+
+    for (i=0; i<count; i++)
+    {
+        memcpy(pDest, row, 16);
+        pDest += width;
+    }
+}
+
+/* 8 pixels, p[1] where the bit is set */
+static void row2Colors16(unsigned short *row, unsigned int pat, const unsigned short *p)
+{
+    int k;
+
+    for (k=0; k<8; k++)
+        row[k] = p[(pat >> k) & 1];
+}
+
+/* 4 pixel pairs, p[1] where the bit is set */
+static void row2Colors2x16(unsigned short *row, unsigned int pat, const unsigned short *p)
+{
+    int k;
+
+    for (k=0; k<4; k++)
+        row[2*k] = row[2*k+1] = p[(pat >> k) & 1];
+}
+
+/* 8 pixels picked by 2 bits each */
+static void row4Colors16(unsigned short *row, unsigned int pat, const unsigned short *p)
+{
+    int k;
+
+    for (k=0; k<8; k++)
+        row[k] = p[(pat >> (2*k)) & 3];
+}
+
+/* 4 pixel pairs picked by 2 bits each */
+static void row4Colors2x16(unsigned short *row, unsigned int pat, const unsigned short *p)
+{
+    int k;
+
+    for (k=0; k<4; k++)
+        row[2*k] = row[2*k+1] = p[(pat >> (2*k)) & 3];
+}
+
+/* quadrants are stored top left, bottom left, top right, bottom right */
+static unsigned short *quadrant16(unsigned short *pFrame, int q, int width)
+{
+    return pFrame + (q >> 1)*4 + (q & 1)*4*width;
+}
+
+static void quad2Colors16(unsigned short *pFrame, unsigned int pat, const unsigned short *p, int width)
+{
+    unsigned short row[4];
+    int i, k;
+
+    for (i=0; i<4; i++)
+    {
+        for (k=0; k<4; k++)
+            row[k] = p[(pat >> (4*i + k)) & 1];
+        memcpy(pFrame, row, 8);
+        pFrame += width;
+    }
+}
+
+static void quad4Colors16(unsigned short *pFrame, uint32_t pat, const unsigned short *p, int width)
+{
+    unsigned short row[4];
+    int i, k;
+
+    for (i=0; i<4; i++)
+    {
+        for (k=0; k<4; k++)
+            row[k] = p[(pat >> (8*i + 2*k)) & 3];
+        memcpy(pFrame, row, 8);
+        pFrame += width;
+    }
+}
+
+static void decodeBlock16(unsigned short *pFrame, unsigned char codeType, unsigned char **pData, unsigned char **pOffData)
+{
+    const int width = g_width;
+    unsigned char *d = *pData;
+    unsigned short p[4];
+    unsigned short row[8];
+    uint32_t pat;
+    int i, k, q;
+
+    switch(codeType)
+    {
+	case 0x0:
+		copyBlock16(pFrame, pFrame + (backBuf2 - backBuf1), width);
+		break;
+	case 0x1:
+		break;
+	case 0x2:
+		k = *(*pOffData)++;
+		copyBlock16(pFrame, pFrame + far_p_table[k*2+0] + far_p_table[k*2+1]*width, width);
+		break;
+	case 0x3:
+		k = *(*pOffData)++;
+		copyBlock16(pFrame, pFrame + far_n_table[k*2+0] + far_n_table[k*2+1]*width, width);
+		break;
+	case 0x4:
+		k = *(*pOffData)++;
+		copyBlock16(pFrame, pFrame + (backBuf2 - backBuf1) + close_table[k*2+0] + close_table[k*2+1]*width, width);
+		break;
+	case 0x5:
+		copyBlock16(pFrame, pFrame + (backBuf2 - backBuf1) + (char)d[0] + (char)d[1]*width, width);
+		d += 2;
+		break;
+
+	case 0x7:
+		p[0] = GETPIXEL(&d, 0);
+		p[1] = GETPIXEL(&d, 2);
+		d += 4;
+
+		if (!(p[0] & 0x8000))
+		{
+			for (i=0; i<8; i++)
+			{
+				row2Colors16(row, d[i], p);
+				memcpy(pFrame + i*width, row, 16);
+			}
+			d += 8;
+		}
+		else
+		{
+			for (q=0; q<4; q++)
+			{
+				row2Colors2x16(row, d[q >> 1] >> ((q & 1)*4), p);
+				storeRows16(pFrame + 2*q*width, row, 2, width);
+			}
+			d += 2;
+		}
+		break;
+
+	case 0x8:
+		if (!(GETPIXEL(&d, 0) & 0x8000))
+		{
+			for (q=0; q<4; q++)
+			{
+				p[0] = GETPIXEL(&d, 0);
+				p[1] = GETPIXEL(&d, 2);
+				quad2Colors16(quadrant16(pFrame, q, width), d[4] | (d[5] << 8), p, width);
+				d += 6;
+			}
+		}
+		else if (!(GETPIXEL(&d, 8) & 0x8000))
+		{
+			for (q=0; q<4; q++)
+			{
+				if ((q & 1) == 0)
+				{
+					p[0] = GETPIXEL(&d, 0);
+					p[1] = GETPIXEL(&d, 2);
+					d += 4;
+				}
+				quad2Colors16(quadrant16(pFrame, q, width), d[0] | (d[1] << 8), p, width);
+				d += 2;
+			}
+		}
+		else
+		{
+			for (i=0; i<8; i++)
+			{
+				if ((i & 3) == 0)
+				{
+					p[0] = GETPIXEL(&d, 0);
+					p[1] = GETPIXEL(&d, 2);
+					d += 4;
+				}
+				row2Colors16(row, *d++, p);
+				memcpy(pFrame + i*width, row, 16);
+			}
+		}
+		break;
+
+	case 0x9:
+		p[0] = GETPIXEL(&d, 0);
+		p[1] = GETPIXEL(&d, 2);
+		p[2] = GETPIXEL(&d, 4);
+		p[3] = GETPIXEL(&d, 6);
+		d += 8;
+
+		if (!(p[0] & 0x8000))
+		{
+			if (!(p[2] & 0x8000))
+			{
+				for (i=0; i<8; i++)
+				{
+					row4Colors16(row, d[0] | (d[1] << 8), p);
+					memcpy(pFrame + i*width, row, 16);
+					d += 2;
+				}
+			}
+			else
+			{
+				for (q=0; q<4; q++)
+				{
+					row4Colors2x16(row, d[q], p);
+					storeRows16(pFrame + 2*q*width, row, 2, width);
+				}
+				d += 4;
+			}
+		}
+		else
+		{
+			if (!(p[2] & 0x8000))
+			{
+				for (i=0; i<8; i++)
+				{
+					row4Colors2x16(row, d[i], p);
+					memcpy(pFrame + i*width, row, 16);
+				}
+				d += 8;
+			}
+			else
+			{
+				for (q=0; q<4; q++)
+				{
+					row4Colors16(row, d[0] | (d[1] << 8), p);
+					storeRows16(pFrame + 2*q*width, row, 2, width);
+					d += 2;
+				}
+			}
+		}
+		break;
+
+	case 0xa:
+		if (!(GETPIXEL(&d, 0) & 0x8000))
+		{
+			for (q=0; q<4; q++)
+			{
+				p[0] = GETPIXEL(&d, 0);
+				p[1] = GETPIXEL(&d, 2);
+				p[2] = GETPIXEL(&d, 4);
+				p[3] = GETPIXEL(&d, 6);
+				pat = d[8] | (d[9] << 8) | (d[10] << 16) | ((uint32_t)d[11] << 24);
+				quad4Colors16(quadrant16(pFrame, q, width), pat, p, width);
+				d += 12;
+			}
+		}
+		else if (!(GETPIXEL(&d, 16) & 0x8000))
+		{
+			for (q=0; q<4; q++)
+			{
+				if ((q & 1) == 0)
+				{
+					p[0] = GETPIXEL(&d, 0);
+					p[1] = GETPIXEL(&d, 2);
+					p[2] = GETPIXEL(&d, 4);
+					p[3] = GETPIXEL(&d, 6);
+					d += 8;
+				}
+				pat = d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+				quad4Colors16(quadrant16(pFrame, q, width), pat, p, width);
+				d += 4;
+			}
+		}
+		else
+		{
+			for (i=0; i<8; i++)
+			{
+				if ((i & 3) == 0)
+				{
+					p[0] = GETPIXEL(&d, 0);
+					p[1] = GETPIXEL(&d, 2);
+					p[2] = GETPIXEL(&d, 4);
+					p[3] = GETPIXEL(&d, 6);
+					d += 8;
+				}
+				row4Colors16(row, d[0] | (d[1] << 8), p);
+				memcpy(pFrame + i*width, row, 16);
+				d += 2;
+			}
+		}
+		break;
+
+	case 0xb:
+		for (i=0; i<8; i++)
+			memcpy(pFrame + i*width, d + i*16, 16);
+		d += 128;
+		break;
+
+	case 0xc:
+		/* The original decoder writes the odd columns of each pair of rows one
+		   row late. The first row keeps its old odd columns, and the last
+		   pair's odd columns land in the top row of the block below. */
+		for (i=0; i<4; i++)
+		{
+			for (k=0; k<4; k++)
+				p[k] = GETPIXEL(&d, 2*k);
+
+			if (i == 0)
+			{
+				for (k=0; k<4; k++)
+					pFrame[2*k] = p[k];
+			}
+			else
+			{
+				/* odd columns still hold the previous pair's colours */
+				for (k=0; k<4; k++)
+					row[2*k] = p[k];
+				memcpy(pFrame + 2*i*width, row, 16);
+			}
+
+			for (k=0; k<4; k++)
+				row[2*k] = row[2*k+1] = p[k];
+			memcpy(pFrame + (2*i+1)*width, row, 16);
+			d += 8;
+		}
+		for (k=0; k<4; k++)
+			pFrame[8*width + 2*k+1] = row[2*k+1];
+		break;
+
+	case 0xd:
+		for (i=0; i<2; i++)
+		{
+			p[0] = GETPIXEL(&d, 0);
+			p[1] = GETPIXEL(&d, 2);
+			for (k=0; k<4; k++)
+			{
+				row[k] = p[0];
+				row[k+4] = p[1];
+			}
+			storeRows16(pFrame + 4*i*width, row, 4, width);
+			d += 4;
+		}
+		break;
+
+	case 0xe:
+		p[0] = GETPIXEL(&d, 0);
+		for (k=0; k<8; k++)
+			row[k] = p[0];
+		storeRows16(pFrame, row, 8, width);
+		d += 2;
+		break;
+
+	case 0xf:
+		/* the second colour starts one byte in, like the original decoder */
+		p[0] = GETPIXEL(&d, 0);
+		p[1] = GETPIXEL(&d, 1);
+		for (i=0; i<2; i++)
+		{
+			for (k=0; k<8; k++)
+				row[k] = p[(i+k)&1];
+			for (q=i; q<8; q+=2)
+				memcpy(pFrame + q*width, row, 16);
+		}
+		d += 4;
+		break;
+
+	default:
+		break;
+    }
+
+    *pData = d;
+}
+
+/* Parallel decoding. A scan pass finds where each block row's data starts and
+   which rows reference their neighbours, then bands of rows that don't are
+   decoded on the job pool. */
+
+static unsigned char *rowData[MAX_DECODE_ROWS];
+static unsigned char *rowOffData[MAX_DECODE_ROWS];
+static int rowReachMin[MAX_DECODE_ROWS];
+static int rowReachMax[MAX_DECODE_ROWS];
+static int bandStart[MAX_DECODE_ROWS + 1];
+
+/* returns how many bytes of pData a block uses and sets *offBytes to how many of pOffData */
+static int blockSize16(unsigned char codeType, unsigned char *pData, int *offBytes)
+{
+    *offBytes = 0;
+
+    switch(codeType)
+    {
+	case 0x2:
+	case 0x3:
+	case 0x4:
+		*offBytes = 1;
+		return 0;
+	case 0x5:
+		return 2;
+	case 0x7:
+		return (GETPIXEL(&pData, 0) & 0x8000) ? 6 : 12;
+	case 0x8:
+		return (GETPIXEL(&pData, 0) & 0x8000) ? 16 : 24;
+	case 0x9:
+		if (GETPIXEL(&pData, 0) & 0x8000)
+			return 16;
+		return (GETPIXEL(&pData, 4) & 0x8000) ? 12 : 24;
+	case 0xa:
+		return (GETPIXEL(&pData, 0) & 0x8000) ? 32 : 48;
+	case 0xb:
+		return 128;
+	case 0xc:
+		return 32;
+	case 0xd:
+		return 8;
+	case 0xe:
+		return 2;
+	case 0xf:
+		return 4;
+	default:
+		return 0;
+    }
+}
+
+/* fills in the row tables, returns the end of the data or NULL if the frame can't be split */
+static unsigned char *scanRows16(unsigned char *pMap, unsigned char *pData, unsigned char *pOffData, int numRows)
+{
+    int blocksPerRow = (g_width >> 3) & ~1;
+    int offBytes;
+    int op, k, pos;
+    int i, j;
+
+    for (j=0; j<numRows; j++)
+    {
+        rowData[j] = pData;
+        rowOffData[j] = pOffData;
+        rowReachMin[j] = j;
+        rowReachMax[j] = j;
+
+        for (i=0; i<blocksPerRow; i++)
+        {
+            op = (i & 1) ? (*pMap++ >> 4) & 0xf : (*pMap) & 0xf;
+            pos = j*8*g_width + i*8;
+
+            if (op == 0x6)
+                return NULL;
+            else if (op == 0x2)
+            {
+                k = *pOffData;
+                addDecodeReach(pos + far_p_table[k*2+0] + far_p_table[k*2+1]*g_width, numRows, &rowReachMin[j], &rowReachMax[j]);
+            }
+            else if (op == 0x3)
+            {
+                k = *pOffData;
+                addDecodeReach(pos + far_n_table[k*2+0] + far_n_table[k*2+1]*g_width, numRows, &rowReachMin[j], &rowReachMax[j]);
+            }
+            else if (op == 0xc)
+            {
+                /* spills into the next row, or past the frame into the previous one which other rows read */
+                if (j + 1 == numRows)
+                    return NULL;
+                rowReachMax[j] = j + 1;
+            }
+
+            pData += blockSize16(op, pData, &offBytes);
+            pOffData += offBytes;
+        }
+    }
+
+    return pData;
+}
+
+typedef struct
+{
+    unsigned short *pFrame;
+    unsigned char *pMap;
+} bandJob16;
+
+static void decodeBandJob16(void *data, int index)
+{
+    bandJob16 *job = (bandJob16 *)data;
+    int first = bandStart[index];
+    int last = bandStart[index + 1];
+
+    decodeRows16(job->pFrame + first*8*g_width, job->pMap + first*(g_width >> 4), rowData[first], rowOffData[first], first, last);
+}
+
+/* returns the end of the data, or NULL if the frame has to be decoded serially */
+static unsigned char *decodeBands16(unsigned short *pFrame, unsigned char *pMap, unsigned char *pData, unsigned char *pOffData)
+{
+    int numRows = g_height >> 3;
+    unsigned char *pEnd;
+    bandJob16 job;
+    int numBands;
+
+    if (numRows > MAX_DECODE_ROWS || ((g_width >> 3) & 1))
+        return NULL;
+
+    pEnd = scanRows16(pMap, pData, pOffData, numRows);
+    if (!pEnd)
+        return NULL;
+
+    numBands = splitDecodeBands(rowReachMin, rowReachMax, numRows, bandStart);
+    if (numBands < 2)
+        return NULL;
+
+    job.pFrame = pFrame;
+    job.pMap = pMap;
+    job_ParallelFor(numBands, decodeBandJob16, &job);
+
+    return pEnd;
+}
@@ -7,20 +7,58 @@
 #include "pstypes.h"
 
 #include "decoders.h"
+#include "libmve.h"
+#include "jobsystem.h"
 
 static void dispatchDecoder(unsigned char **pFrame, unsigned char codeType, unsigned char **pData, int *pDataRemain, int *curXb, int *curYb);
+static void decodeBlock8(unsigned char *pFrame, unsigned char codeType, unsigned char **pData);
+static unsigned char *decodeRows8(unsigned char *pFrame, unsigned char *pMap, unsigned char *pData, int firstRow, int lastRow);
+static unsigned char *decodeBands8(unsigned char *pFrame, unsigned char *pMap, unsigned char *pData);
 
 void decodeFrame8(unsigned char *pFrame, unsigned char *pMap, int mapRemain, unsigned char *pData, int dataRemain)
 {
+	unsigned char *pEnd = NULL;
+
+	/* each map byte holds the opcodes for two blocks */
+	if (mapRemain < (g_width >> 4) * (g_height >> 3))
+	{
+		fprintf(stderr, "DEBUG: map too short for frame: %d\n", mapRemain);
+		return;
+	}
+
+	if ((g_decodeFlags & MVE_DECODE_PARALLEL) && job_GetNumThreads() > 0)
+		pEnd = decodeBands8(pFrame, pMap, pData);
+
+	if (!pEnd)
+		pEnd = decodeRows8(pFrame, pMap, pData, 0, g_height >> 3);
+
+	if (pEnd - pData > dataRemain)
+		fprintf(stderr, "DEBUG: frame read past its data: %d,%d\n", (int)(pEnd - pData), dataRemain);
+}
+
+/* decodes block rows [firstRow, lastRow), returns the end of the data used */
+static unsigned char *decodeRows8(unsigned char *pFrame, unsigned char *pMap, unsigned char *pData, int firstRow, int lastRow)
+{
+	int dataRemain = 0;
+	int fast = g_decodeFlags & MVE_DECODE_FAST;
 	int i, j;
-	int xb, yb;
+	int xb;
 
 	xb = g_width >> 3;
-	yb = g_height >> 3;
-	for (j=0; j<yb; j++)
+	for (j=firstRow; j<lastRow; j++)
 	{
 		for (i=0; i<xb/2; i++)
 		{
+			/* opcode 6 moves on to other blocks, only the original decoder handles it */
+			if (fast && ((*pMap) & 0xf) != 0x6 && ((*pMap) >> 4) != 0x6)
+			{
+				decodeBlock8(pFrame, (*pMap) & 0xf, &pData);
+				decodeBlock8(pFrame + 8, (*pMap) >> 4, &pData);
+				pFrame += 16;
+				++pMap;
+				continue;
+			}
+
 			dispatchDecoder(&pFrame, (*pMap) & 0xf, &pData, &dataRemain, &i, &j);
 			if (pFrame < (unsigned char *)g_vBackBuf1)
 				fprintf(stderr, "danger!  pointing out of bounds below after dispatch decoder: %d, %d (1) [%x]\n", i, j, (*pMap) & 0xf);
@@ -33,11 +71,12 @@ void decodeFrame8(unsigned char *pFrame, unsigned char *pMap, int mapRemain, uns
 				fprintf(stderr, "danger!  pointing out of bounds above after dispatch decoder: %d, %d (2) [%x]\n", i, j, (*pMap) >> 4);
 
 			++pMap;
-			--mapRemain;
 		}
 
 		pFrame += 7*g_width;
 	}
+
+	return pData;
 }
 
 static void relClose(int i, int *x, int *y)
@@ -872,3 +911,462 @@ static void dispatchDecoder(unsigned char **pFrame, unsigned char codeType, unsi
 		break;
 	}
 }
+
+/* Fast path. Each row of a block is built up locally and written with a
+   single 8 byte store instead of a store per pixel. The output is the same
+   as dispatchDecoder. */
+
+static void copyBlock8(unsigned char *pDest, unsigned char *pSrc, int width)
+{
+	int i;
+
+	for (i=0; i<8; i++)
+	{
+		memcpy(pDest, pSrc, 8);
+		pDest += width;
+		pSrc += width;
+	}
+}
+
+static void storeRows8(unsigned char *pDest, const unsigned char *row, int count, int width)
+{
+	int i;
+
+	for (i=0; i<count; i++)
+	{
+		memcpy(pDest, row, 8);
+		pDest += width;
+	}
+}
+
+// 8 pixels, p[1] where the bit is set
+static void row2Colors8(unsigned char *row, unsigned int pat, const unsigned char *p)
+{
+	int k;
+
+	for (k=0; k<8; k++)
+		row[k] = p[(pat >> k) & 1];
+}
+
+// 4 pixel pairs, p[1] where the bit is set
+static void row2Colors2x8(unsigned char *row, unsigned int pat, const unsigned char *p)
+{
+	int k;
+
+	for (k=0; k<4; k++)
+		row[2*k] = row[2*k+1] = p[(pat >> k) & 1];
+}
+
+// 8 pixels picked by 2 bits each
+static void row4Colors8(unsigned char *row, unsigned int pat, const unsigned char *p)
+{
+	int k;
+
+	for (k=0; k<8; k++)
+		row[k] = p[(pat >> (2*k)) & 3];
+}
+
+// 4 pixel pairs picked by 2 bits each
+static void row4Colors2x8(unsigned char *row, unsigned int pat, const unsigned char *p)
+{
+	int k;
+
+	for (k=0; k<4; k++)
+		row[2*k] = row[2*k+1] = p[(pat >> (2*k)) & 3];
+}
+
+// quadrants are stored top left, bottom left, top right, bottom right
+static unsigned char *quadrant8(unsigned char *pFrame, int q, int width)
+{
+	return pFrame + (q >> 1)*4 + (q & 1)*4*width;
+}
+
+static void quad2Colors8(unsigned char *pFrame, unsigned int pat, const unsigned char *p, int width)
+{
+	unsigned char row[4];
+	int i, k;
+
+	for (i=0; i<4; i++)
+	{
+		for (k=0; k<4; k++)
+			row[k] = p[(pat >> (4*i + k)) & 1];
+		memcpy(pFrame, row, 4);
+		pFrame += width;
+	}
+}
+
+static void quad4Colors8(unsigned char *pFrame, uint32_t pat, const unsigned char *p, int width)
+{
+	unsigned char row[4];
+	int i, k;
+
+	for (i=0; i<4; i++)
+	{
+		for (k=0; k<4; k++)
+			row[k] = p[(pat >> (8*i + 2*k)) & 3];
+		memcpy(pFrame, row, 4);
+		pFrame += width;
+	}
+}
+
+static void decodeBlock8(unsigned char *pFrame, unsigned char codeType, unsigned char **pData)
+{
+	const int width = g_width;
+	unsigned char *d = *pData;
+	unsigned char p[4];
+	unsigned char row[8];
+	uint32_t pat;
+	int i, k, q;
+	int x, y;
+
+	switch(codeType)
+	{
+	case 0x0:
+		copyBlock8(pFrame, pFrame + ((uint8_t*)g_vBackBuf2 - (uint8_t*)g_vBackBuf1), width);
+		break;
+	case 0x1:
+		break;
+	case 0x2:
+		relFar(*d++, 1, &x, &y);
+		copyBlock8(pFrame, pFrame + x + y*width, width);
+		break;
+	case 0x3:
+		relFar(*d++, -1, &x, &y);
+		copyBlock8(pFrame, pFrame + x + y*width, width);
+		break;
+	case 0x4:
+		relClose(*d++, &x, &y);
+		copyBlock8(pFrame, pFrame + ((uint8_t*)g_vBackBuf2 - (uint8_t*)g_vBackBuf1) + x + y*width, width);
+		break;
+	case 0x5:
+		x = (signed char)d[0];
+		y = (signed char)d[1];
+		copyBlock8(pFrame, pFrame + ((uint8_t*)g_vBackBuf2 - (uint8_t*)g_vBackBuf1) + x + y*width, width);
+		d += 2;
+		break;
+
+	case 0x7:
+		p[0] = d[0];
+		p[1] = d[1];
+		d += 2;
+		if (p[0] <= p[1])
+		{
+			for (i=0; i<8; i++)
+			{
+				row2Colors8(row, d[i], p);
+				memcpy(pFrame + i*width, row, 8);
+			}
+			d += 8;
+		}
+		else
+		{
+			for (q=0; q<4; q++)
+			{
+				row2Colors2x8(row, d[q >> 1] >> ((q & 1)*4), p);
+				storeRows8(pFrame + 2*q*width, row, 2, width);
+			}
+			d += 2;
+		}
+		break;
+
+	case 0x8:
+		if (d[0] <= d[1])
+		{
+			for (q=0; q<4; q++)
+			{
+				p[0] = d[0];
+				p[1] = d[1];
+				quad2Colors8(quadrant8(pFrame, q, width), d[2] | (d[3] << 8), p, width);
+				d += 4;
+			}
+		}
+		else if (d[6] <= d[7])
+		{
+			for (q=0; q<4; q++)
+			{
+				if ((q & 1) == 0)
+				{
+					p[0] = d[0];
+					p[1] = d[1];
+					d += 2;
+				}
+				quad2Colors8(quadrant8(pFrame, q, width), d[0] | (d[1] << 8), p, width);
+				d += 2;
+			}
+		}
+		else
+		{
+			for (i=0; i<8; i++)
+			{
+				if ((i & 3) == 0)
+				{
+					p[0] = d[0];
+					p[1] = d[1];
+					d += 2;
+				}
+				row2Colors8(row, *d++, p);
+				memcpy(pFrame + i*width, row, 8);
+			}
+		}
+		break;
+
+	case 0x9:
+		p[0] = d[0];
+		p[1] = d[1];
+		p[2] = d[2];
+		p[3] = d[3];
+		d += 4;
+		if (p[0] <= p[1])
+		{
+			if (p[2] <= p[3])
+			{
+				for (i=0; i<8; i++)
+				{
+					row4Colors8(row, d[0] | (d[1] << 8), p);
+					memcpy(pFrame + i*width, row, 8);
+					d += 2;
+				}
+			}
+			else
+			{
+				for (q=0; q<4; q++)
+				{
+					row4Colors2x8(row, d[q], p);
+					storeRows8(pFrame + 2*q*width, row, 2, width);
+				}
+				d += 4;
+			}
+		}
+		else
+		{
+			if (p[2] <= p[3])
+			{
+				for (i=0; i<8; i++)
+				{
+					row4Colors2x8(row, d[i], p);
+					memcpy(pFrame + i*width, row, 8);
+				}
+				d += 8;
+			}
+			else
+			{
+				for (q=0; q<4; q++)
+				{
+					row4Colors8(row, d[0] | (d[1] << 8), p);
+					storeRows8(pFrame + 2*q*width, row, 2, width);
+					d += 2;
+				}
+			}
+		}
+		break;
+
+	case 0xa:
+		if (d[0] <= d[1])
+		{
+			for (q=0; q<4; q++)
+			{
+				memcpy(p, d, 4);
+				pat = d[4] | (d[5] << 8) | (d[6] << 16) | ((uint32_t)d[7] << 24);
+				quad4Colors8(quadrant8(pFrame, q, width), pat, p, width);
+				d += 8;
+			}
+		}
+		else if (d[12] <= d[13])
+		{
+			for (q=0; q<4; q++)
+			{
+				if ((q & 1) == 0)
+				{
+					memcpy(p, d, 4);
+					d += 4;
+				}
+				pat = d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+				quad4Colors8(quadrant8(pFrame, q, width), pat, p, width);
+				d += 4;
+			}
+		}
+		else
+		{
+			for (i=0; i<8; i++)
+			{
+				if ((i & 3) == 0)
+				{
+					memcpy(p, d, 4);
+					d += 4;
+				}
+				row4Colors8(row, d[0] | (d[1] << 8), p);
+				memcpy(pFrame + i*width, row, 8);
+				d += 2;
+			}
+		}
+		break;
+
+	case 0xb:
+		for (i=0; i<8; i++)
+			memcpy(pFrame + i*width, d + i*8, 8);
+		d += 64;
+		break;
+
+	case 0xc:
+		for (i=0; i<4; i++)
+		{
+			for (k=0; k<4; k++)
+				row[2*k] = row[2*k+1] = d[k];
+			storeRows8(pFrame + 2*i*width, row, 2, width);
+			d += 4;
+		}
+		break;
+
+	case 0xd:
+		for (i=0; i<2; i++)
+		{
+			memset(row, d[0], 4);
+			memset(row + 4, d[1], 4);
+			storeRows8(pFrame + 4*i*width, row, 4, width);
+			d += 2;
+		}
+		break;
+
+	case 0xe:
+		memset(row, d[0], 8);
+		storeRows8(pFrame, row, 8, width);
+		d += 1;
+		break;
+
+	case 0xf:
+		for (i=0; i<2; i++)
+		{
+			for (k=0; k<8; k++)
+				row[k] = d[(i+k)&1];
+			for (q=i; q<8; q+=2)
+				memcpy(pFrame + q*width, row, 8);
+		}
+		d += 2;
+		break;
+
+	default:
+		break;
+	}
+
+	*pData = d;
+}
+
+/* Parallel decoding. A scan pass finds where each block row's data starts and
+   which rows reference their neighbours, then bands of rows that don't are
+   decoded on the job pool. */
+
+static unsigned char *rowData[MAX_DECODE_ROWS];
+static int rowReachMin[MAX_DECODE_ROWS];
+static int rowReachMax[MAX_DECODE_ROWS];
+static int bandStart[MAX_DECODE_ROWS + 1];
+
+// returns how many bytes of data a block uses
+static int blockSize8(unsigned char codeType, const unsigned char *pData)
+{
+	switch(codeType)
+	{
+	case 0x2:
+	case 0x3:
+	case 0x4:
+		return 1;
+	case 0x5:
+		return 2;
+	case 0x7:
+		return (pData[0] <= pData[1]) ? 10 : 4;
+	case 0x8:
+		return (pData[0] <= pData[1]) ? 16 : 12;
+	case 0x9:
+		if (pData[0] <= pData[1])
+			return (pData[2] <= pData[3]) ? 20 : 8;
+		return 12;
+	case 0xa:
+		return (pData[0] <= pData[1]) ? 32 : 24;
+	case 0xb:
+		return 64;
+	case 0xc:
+		return 16;
+	case 0xd:
+		return 4;
+	case 0xe:
+		return 1;
+	case 0xf:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+// fills in the row tables, returns the end of the data or NULL if the frame can't be split
+static unsigned char *scanRows8(unsigned char *pMap, unsigned char *pData, int numRows)
+{
+	int blocksPerRow = (g_width >> 3) & ~1;
+	int op, pos;
+	int x, y;
+	int i, j;
+
+	for (j=0; j<numRows; j++)
+	{
+		rowData[j] = pData;
+		rowReachMin[j] = j;
+		rowReachMax[j] = j;
+
+		for (i=0; i<blocksPerRow; i++)
+		{
+			op = (i & 1) ? (*pMap++ >> 4) & 0xf : (*pMap) & 0xf;
+
+			if (op == 0x6)
+				return NULL;
+			else if (op == 0x2 || op == 0x3)
+			{
+				relFar(*pData, (op == 0x2) ? 1 : -1, &x, &y);
+				pos = j*8*g_width + i*8 + x + y*g_width;
+				addDecodeReach(pos, numRows, &rowReachMin[j], &rowReachMax[j]);
+			}
+
+			pData += blockSize8(op, pData);
+		}
+	}
+
+	return pData;
+}
+
+typedef struct
+{
+	unsigned char *pFrame;
+	unsigned char *pMap;
+} bandJob8;
+
+static void decodeBandJob8(void *data, int index)
+{
+	bandJob8 *job = (bandJob8 *)data;
+	int first = bandStart[index];
+	int last = bandStart[index + 1];
+
+	decodeRows8(job->pFrame + first*8*g_width, job->pMap + first*(g_width >> 4), rowData[first], first, last);
+}
+
+// returns the end of the data, or NULL if the frame has to be decoded serially
+static unsigned char *decodeBands8(unsigned char *pFrame, unsigned char *pMap, unsigned char *pData)
+{
+	int numRows = g_height >> 3;
+	unsigned char *pEnd;
+	bandJob8 job;
+	int numBands;
+
+	if (numRows > MAX_DECODE_ROWS || ((g_width >> 3) & 1))
+		return NULL;
+
+	pEnd = scanRows8(pMap, pData, numRows);
+	if (!pEnd)
+		return NULL;
+
+	numBands = splitDecodeBands(rowReachMin, rowReachMax, numRows, bandStart);
+	if (numBands < 2)
+		return NULL;
+
+	job.pFrame = pFrame;
+	job.pMap = pMap;
+	job_ParallelFor(numBands, decodeBandJob8, &job);
+
+	return pEnd;
+}
@@ -0,0 +1,65 @@
+/* decoding routines shared by the 8 and 16 bit decoders */
+
+#include "decoders.h"
+#include "libmve.h"
+
+int g_decodeFlags = MVE_DECODE_FAST | MVE_DECODE_PARALLEL;
+
+void MVE_SetDecodeFlags(int flags)
+{
+	g_decodeFlags = flags;
+}
+
+int MVE_GetDecodeFlags()
+{
+	return g_decodeFlags;
+}
+
+void addDecodeReach(int pos, int numRows, int *reachMin, int *reachMax)
+{
+	int rowSize = g_width * 8;
+	int first, last;
+
+	/* blocks past the left or right edge wrap onto the neighbouring line */
+	first = (pos >= 0) ? pos / rowSize : -1;
+	last = (pos + 7*g_width + 7) / rowSize;
+
+	if (first < 0)
+		first = 0;
+	if (last > numRows - 1)
+		last = numRows - 1;
+
+	if (first < *reachMin)
+		*reachMin = first;
+	if (last > *reachMax)
+		*reachMax = last;
+}
+
+int splitDecodeBands(const int *rowReachMin, const int *rowReachMax, int numRows, int *bandStart)
+{
+	static int minBelow[MAX_DECODE_ROWS + 1];
+	int maxAbove;
+	int count = 0;
+	int row;
+
+	/* a band can start at a row if nothing above it reaches down to it and
+	   nothing from it down reaches up past it */
+	minBelow[numRows] = numRows;
+	for (row = numRows - 1; row >= 0; row--)
+		minBelow[row] = (rowReachMin[row] < minBelow[row + 1]) ? rowReachMin[row] : minBelow[row + 1];
+
+	bandStart[count++] = 0;
+	maxAbove = rowReachMax[0];
+
+	for (row = 1; row < numRows; row++)
+	{
+		if (maxAbove < row && minBelow[row] >= row)
+			bandStart[count++] = row;
+
+		if (rowReachMax[row] > maxAbove)
+			maxAbove = rowReachMax[row];
+	}
+
+	bandStart[count] = numRows;
+	return count;
+}
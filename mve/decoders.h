@@ -10,6 +10,22 @@
 extern int g_width, g_height;
 extern void *g_vBackBuf1, *g_vBackBuf2;
 
+/* MVE_DECODE_* flags picked with MVE_SetDecodeFlags */
+extern int g_decodeFlags;
+
+/* Frames are split into bands of block rows that are decoded in parallel.
+   Opcodes 2 and 3 copy from the frame being decoded, from blocks that come
+   after (not yet overwritten) or before (already decoded) the one being
+   decoded, and these may be in other rows. Rows that reach each other's
+   pixels have to stay in the same band. */
+#define MAX_DECODE_ROWS 256
+
+/* Widens [*reachMin, *reachMax] to the block rows touched by an 8x8 block at pixel offset pos */
+extern void addDecodeReach(int pos, int numRows, int *reachMin, int *reachMax);
+
+/* Fills bandStart with the first row of each band and bandStart[count] with numRows, returns count */
+extern int splitDecodeBands(const int *rowReachMin, const int *rowReachMax, int numRows, int *bandStart);
+
 extern void decodeFrame8(unsigned char *pFrame, unsigned char *pMap, int mapRemain, unsigned char *pData, int dataRemain);
 extern void decodeFrame16(unsigned char *pFrame, unsigned char *pMap, int mapRemain, unsigned char *pData, int dataRemain);
 
@@ -5,6 +5,11 @@
 
 #define MVE_ERR_EOF 1
 
+/* Decoder modes for MVE_SetDecodeFlags. With neither flag set frames go
+   through the original per-pixel decoder, the results are identical. */
+#define MVE_DECODE_FAST     1 /* decode blocks a row at a time with wide stores */
+#define MVE_DECODE_PARALLEL 2 /* decode independent bands of block rows on the job pool */
+
 int  MVE_rmPrepMovie(int filehandle, int x, int y, int track);
 int  MVE_rmStepMovie();
 void MVE_rmHoldMovie();
@@ -19,4 +24,13 @@ void MVE_ioCallbacks(mve_cb_FileRead* func);
 void MVE_memCallbacks(mve_cb_Malloc* alloc, mve_cb_Free* free);
 void MVE_ReleaseMem();
 
+void MVE_SetDecodeFlags(int flags);
+int  MVE_GetDecodeFlags();
+
+/* Decodes every frame of a movie once per decoder mode without playing it.
+   Logs frames per second for each mode and writes a checksum of every frame
+   per mode to checksum_file, if given. Returns the number of frames that
+   didn't match the original decoder, or -1 if the movie can't be read. */
+int  MVE_Benchmark(const char *filename, const char *checksum_file);
+
 #endif /* _LIBMVE_H */
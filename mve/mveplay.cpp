@@ -5,6 +5,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <thread>
+#include <vector>
 
 #include "mvelib.h"
 #include "mve_audio.h"
@@ -614,3 +615,135 @@ void MVE_ReleaseMem()
 {
 	hackBuf1 = hackBuf2 = NULL;
 }
+
+/*************************
+ * decode benchmark
+ *************************/
+#define NUM_BENCH_MODES 4
+
+static const int bench_modes[NUM_BENCH_MODES] = { 0, MVE_DECODE_FAST, MVE_DECODE_PARALLEL, MVE_DECODE_FAST | MVE_DECODE_PARALLEL };
+static const char *bench_mode_names[NUM_BENCH_MODES] = { "original", "fast", "parallel", "fast+parallel" };
+
+static std::vector<unsigned int> *bench_checksums;
+static uint64_t bench_decode_us;
+
+static int bench_video_data_handler(unsigned char major, unsigned char minor, unsigned char *data, int len, void *context)
+{
+	uint64_t start = GetClockTimeUS();
+	video_data_handler(major, minor, data, len, context);
+	bench_decode_us += GetClockTimeUS() - start;
+	return 1;
+}
+
+static int bench_display_video_handler(unsigned char major, unsigned char minor, unsigned char *data, int len, void *context)
+{
+	// FNV-1a over the frame as it would be shown
+	unsigned char *pixels = (unsigned char *)g_vBackBuf1;
+	int size = g_width * g_height * (g_truecolor ? 2 : 1);
+	unsigned int checksum = 2166136261u;
+
+	for (int i = 0; i < size; i++)
+		checksum = (checksum ^ pixels[i]) * 16777619u;
+
+	bench_checksums->push_back(checksum);
+	return 1;
+}
+
+int MVE_Benchmark(const char *filename, const char *checksum_file)
+{
+	std::vector<unsigned int> checksums[NUM_BENCH_MODES];
+	double fps[NUM_BENCH_MODES];
+	int save_flags = g_decodeFlags;
+	void *save_buf1 = hackBuf1, *save_buf2 = hackBuf2;
+	mve_cb_SetPalette *save_palette = SetPaletteCallback;
+	int mismatches = 0;
+	int i, mode;
+
+	// decode into our own buffers and keep the palette to ourselves
+	hackBuf1 = hackBuf2 = NULL;
+	SetPaletteCallback = NULL;
+
+	for (mode = 0; mode < NUM_BENCH_MODES; mode++)
+	{
+		MVESTREAM *bench = mve_open(filename);
+		if (!bench)
+		{
+			mismatches = -1;
+			break;
+		}
+
+		for (i = 0; i < 32; i++)
+			mve_set_handler(bench, i, default_seg_handler);
+
+		mve_set_handler(bench, MVE_OPCODE_ENDOFSTREAM,      end_movie_handler);
+		mve_set_handler(bench, MVE_OPCODE_ENDOFCHUNK,       end_chunk_handler);
+		mve_set_handler(bench, MVE_OPCODE_INITVIDEOBUFFERS, create_videobuf_handler);
+		mve_set_handler(bench, MVE_OPCODE_DISPLAYVIDEO,     bench_display_video_handler);
+		mve_set_handler(bench, MVE_OPCODE_INITVIDEOMODE,    init_video_handler);
+		mve_set_handler(bench, MVE_OPCODE_SETPALETTE,       video_palette_handler);
+		mve_set_handler(bench, MVE_OPCODE_SETDECODINGMAP,   video_codemap_handler);
+		mve_set_handler(bench, MVE_OPCODE_VIDEODATA,        bench_video_data_handler);
+
+		g_decodeFlags = bench_modes[mode];
+		bench_checksums = &checksums[mode];
+		bench_decode_us = 0;
+
+		while (mve_play_next_chunk(bench))
+			;
+
+		mve_close(bench);
+
+		if (g_vBuffers != NULL)
+			mem_free(g_vBuffers);
+		g_vBuffers = NULL;
+		g_pCurMap = NULL;
+		g_nMapLength = 0;
+		videobuf_created = 0;
+		video_initialized = 0;
+
+		int frames = (int)checksums[mode].size();
+		int mode_mismatches = 0;
+		for (i = 0; i < frames; i++)
+		{
+			if (i >= (int)checksums[0].size() || checksums[mode][i] != checksums[0][i])
+				mode_mismatches++;
+		}
+		mismatches += mode_mismatches;
+
+		fps[mode] = bench_decode_us ? frames * 1000000.0 / bench_decode_us : 0.0;
+		mprintf((0, "MVE benchmark: %-13s %d frames, %.1f fps, %d frames differ from the original decoder\n", bench_mode_names[mode], frames,
+			fps[mode], mode_mismatches));
+	}
+
+	if (mismatches >= 0 && checksum_file)
+	{
+		FILE *fp = fopen(checksum_file, "wt");
+		if (fp)
+		{
+			fprintf(fp, "# %s\n", filename);
+			for (mode = 0; mode < NUM_BENCH_MODES; mode++)
+				fprintf(fp, "# %-13s %.1f fps\n", bench_mode_names[mode], fps[mode]);
+
+			fprintf(fp, "# frame");
+			for (mode = 0; mode < NUM_BENCH_MODES; mode++)
+				fprintf(fp, " %s", bench_mode_names[mode]);
+			fprintf(fp, "\n");
+
+			for (i = 0; i < (int)checksums[0].size(); i++)
+			{
+				fprintf(fp, "%d", i);
+				for (mode = 0; mode < NUM_BENCH_MODES; mode++)
+					fprintf(fp, " %08x", i < (int)checksums[mode].size() ? checksums[mode][i] : 0);
+				fprintf(fp, "\n");
+			}
+			fclose(fp);
+		}
+	}
+
+	g_decodeFlags = save_flags;
+	hackBuf1 = save_buf1;
+	hackBuf2 = save_buf2;
+	SetPaletteCallback = save_palette;
+
+	return mismatches;
+}
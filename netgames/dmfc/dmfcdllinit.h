@@ -578,6 +578,7 @@
 	Inven_GetTypeIDCount = (dInven_GetTypeIDCount_fp)API.fp[i++];
 	Inven_FindPos = (dInven_FindPos_fp)API.fp[i++];
 	Inven_GetInventoryItemList = (dInven_GetInventoryItemList_fp)API.fp[i++];
+	DLLMarkRoomForRemesh = (dMarkRoomForRemesh_fp)API.fp[i++];
 
 	// Do variables
 	Player_num=(int *)API.vp[0];
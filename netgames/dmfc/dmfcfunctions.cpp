@@ -500,3 +500,4 @@ DMFCFUNCTION bool (*Inven_IsUsable)(Inventory *inven);
 DMFCFUNCTION int (*Inven_GetTypeIDCount)(Inventory *inven,int type,int id);
 DMFCFUNCTION bool (*Inven_FindPos)(Inventory *inven,int type,int id);
 DMFCFUNCTION int (*Inven_GetInventoryItemList)(Inventory *inven,tInvenList *list,int max_amount,int *cur_sel);
+DMFCFUNCTION void (*DLLMarkRoomForRemesh)(int roomnum);
@@ -104,6 +104,7 @@ bool PaintRoomWithTexture(int text,int roomnum)
 			}
 		}
 	}
+	DLLMarkRoomForRemesh(roomnum);
 	return true;
 }
 
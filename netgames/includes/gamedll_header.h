@@ -1743,5 +1743,9 @@ DMFCDLLOUT(dInven_FindPos_fp Inven_FindPos;)
 typedef int (*dInven_GetInventoryItemList_fp)(Inventory *inven,tInvenList *list,int max_amount,int *cur_sel);
 DMFCDLLOUT(dInven_GetInventoryItemList_fp Inven_GetInventoryItemList;)
 
+//tells the renderer a room's faces changed and its cached mesh needs rebuilding
+typedef void (*dMarkRoomForRemesh_fp)(int roomnum);
+DMFCDLLOUT(dMarkRoomForRemesh_fp DLLMarkRoomForRemesh;)
+
 
 #endif
@@ -40,6 +40,15 @@ typedef int socklen_t;
 #include <sys/time.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+
+// Linux can move a whole batch of datagrams in one system call
+#if !MACOSX
+#define NW_USE_MMSG	1
+#endif
 
 #define TRUE true
 #define FALSE false
@@ -190,6 +199,41 @@ NetworkReceiveCallback Netcallbacks[16];
 int Net_connect_socket_id = INVALID_SOCKET;
 int Net_connect_sequence = R_NET_SEQUENCE_NONE;
 
+// ------------------------------------------------------------------------------------------------------
+// BATCHED SOCKET I/O
+//
+
+#define NW_MAX_DATAGRAM			1500
+
+// How many datagrams we read from the socket at a time
+#ifdef NW_USE_MMSG
+#define NW_RECV_BATCH			32
+#else
+#define NW_RECV_BATCH			1
+#endif
+
+// How many datagrams can be waiting to go out in a send batch
+#define NW_SEND_BATCH			64
+
+// Unreliable game data to the same place is joined up to this size.  It's what the game
+// itself fills a packet up to (MAX_GAME_DATA_SIZE), so anybody can receive it.
+#define NW_COALESCE_SIZE		(MAX_PACKET_SIZE-4)
+
+typedef struct
+{
+	SOCKADDR_IN addr;
+	int len;
+	ubyte coalesce;					// more unreliable game data can go on the end
+	ubyte data[NW_MAX_DATAGRAM];	// packet id, then the data
+} nw_datagram;
+
+static nw_datagram Nw_recv_ring[NW_RECV_BATCH];
+static nw_datagram Nw_send_batch[NW_SEND_BATCH];
+static int Nw_num_send_batch = 0;
+static int Nw_send_batching = 0;
+
+static nw_batch_stats Nw_batch_stats;
+
 // ------------------------------------------------------------------------------------------------------
 // PACKET BUFFERING FUNCTIONS
 //
@@ -200,6 +244,8 @@ int Psnet_seq_number = 0;
 int Psnet_lowest_id = 0;
 int Psnet_highest_id = 0;
 
+static int nw_psnet_buffer_count();
+
 
 //Reliable UDP stuff
 //*******************************
@@ -218,7 +264,6 @@ typedef struct
 }reliable_header;
 
 #define RELIABLE_PACKET_HEADER_ONLY_SIZE (sizeof(reliable_header)-NETBUFFERSIZE)
-#define MAX_PING_HISTORY	10
 
 typedef struct
 {
@@ -246,34 +291,50 @@ unsigned int serverconn = UINT_MAX;
 #pragma pack()
 #endif
 
+// Sending works on a ring of packets indexed by sequence number.  Packets from send_base up
+// to send_next have gone out and are waiting to be acked (sbuffers[] is NULL once they are),
+// packets from send_next up to theirsequence haven't gone out yet.  Acks carry the next
+// packet the peer is waiting for and a bitfield of the ones after it that it already has,
+// so a lost packet shows up as a hole and can be resent before its timer runs out.
 typedef struct
 {
-	
-	float timesent[MAXNETBUFFERS];
-	short send_len[MAXNETBUFFERS];
-	short recv_len[MAXNETBUFFERS];
+	float timesent[NW_RELIABLE_QUEUE];						//When each packet last went out
+	short send_len[NW_RELIABLE_QUEUE];
+	ubyte retries[NW_RELIABLE_QUEUE];						//Times each packet has been resent
+	ubyte lost[NW_RELIABLE_QUEUE];							//Acks say this packet needs resending
+	short recv_len[NW_RELIABLE_RECV];
 	float last_packet_received;								//For a given connection, this is the last packet we received
 	float last_packet_sent;
-	float pings[MAX_PING_HISTORY];
-	unsigned int num_ping_samples;
-	float mean_ping;
+	float srtt;														//Smoothed round trip time, 0 until we have a sample
+	float rttvar;													//Round trip variance
+	float rto;														//Retransmit timeout
+	float cwnd;														//Congestion window, in packets
+	float ssthresh;												//Window size where we stop doubling it
+	float pace_tokens;											//Packets we can send right now
+	float pace_time;												//When pace_tokens was last topped up
 	float last_sent;												//The last time we sent a packet (used for NAGLE emulation)
 	int waiting_packet_number;									//Which packet has data in it that is waiting for the interval to send
 
 	ushort status;													//Status of this connection
 	unsigned short oursequence;								//This is the next sequence number the application is expecting
 	unsigned short theirsequence;								//This is the next sequence number the peer is expecting
-	unsigned short rsequence[MAXNETBUFFERS];				//This is the sequence number of the given packet
-
-	ubyte ping_pos;
+	unsigned short send_base;									//Oldest packet that hasn't been acked
+	unsigned short send_next;									//Next packet to go out for the first time
+	unsigned short high_ack;									//Highest packet the peer has acked
+	unsigned short recover_seq;								//We don't cut the window again for losses before this
 	
 	network_address	net_addr;								//A D3 network address structure
 	network_protocol connection_type;						//IPX, IP, modem, etc.
-	reliable_net_rcvbuffer  *rbuffers[MAXNETBUFFERS];
+	reliable_net_rcvbuffer  *rbuffers[NW_RELIABLE_RECV];	//Indexed by sequence number
 	SOCKADDR addr;													//SOCKADDR of our peer
-	reliable_net_sendbuffer *sbuffers[MAXNETBUFFERS];	//This is an array of pointers for quick sorting
-	unsigned short ssequence[MAXNETBUFFERS];				//This is the sequence number of the given packet
+	reliable_net_sendbuffer *sbuffers[NW_RELIABLE_QUEUE];	//Indexed by sequence number
 	ubyte send_urgent;
+	ubyte in_recovery;
+
+	int num_sent;
+	int num_resent;
+	int num_fast_resent;
+	int num_sacked;
 }reliable_socket;
 
 reliable_socket reliable_sockets[MAXRELIABLESOCKETS];
@@ -388,6 +449,17 @@ void nw_InitNetworking (int iReadBufSizeOverride)
 		cfprintf (NetDebugFile,"NetDebug.log opened at %f seconds\n",timer_GetTime());
 	}
 
+	// Simulate a bad connection for testing
+	float sim_loss = 0,sim_latency = 0;
+	iparg = FindArg("-netsimloss");
+	if(iparg)
+		sim_loss = atof(GameArgs[iparg+1])/100;
+	iparg = FindArg("-netsimlatency");
+	if(iparg)
+		sim_latency = atof(GameArgs[iparg+1])/1000;
+	if((sim_loss>0) || (sim_latency>0))
+		nw_SetNetworkSimulation(sim_loss,sim_latency);
+
 	iparg = FindArg("-useip");
 	if(!iparg)
 	{
@@ -935,8 +1007,9 @@ int nw_Receive( void * data, network_address *from_addr )
 		dp_DirectPlayDispatch();
 #endif
 	}
-	else
+	else if(nw_psnet_buffer_count() == 0)
 	{
+		// Only go back to the socket once everything we read last time has been handed out
 	//	nw_ReceiveFromSocket();
 		nw_DoReceiveCallbacks();
 	}
@@ -997,18 +1070,15 @@ int nw_ReceiveReliable(SOCKET socketid, ubyte *buffer, int max_len)
 	//If the buffer position is the position we are waiting for, fill in 
 	//the buffer we received in the call to this function and return true			
 
-	for(i=0;i<MAXNETBUFFERS;i++)
+	i = rsocket->oursequence & (NW_RELIABLE_RECV-1);
+	if(rsocket->rbuffers[i])
 	{
-		if((rsocket->rsequence[i]==rsocket->oursequence)&&(rsocket->rbuffers[i]))
-		{
-			memcpy(buffer,rsocket->rbuffers[i]->buffer,rsocket->recv_len[i]);
-			mem_free(rsocket->rbuffers[i]);
-			rsocket->rbuffers[i] = NULL;
-			rsocket->rsequence[i] = 0;
-			//mprintf((0,"Found packet for upper layer in nw_ReceiveReliable() %d bytes. seq:%d.\n",rsocket->recv_len[i],rsocket->oursequence));
-			rsocket->oursequence++;
-			return rsocket->recv_len[i];
-		}
+		memcpy(buffer,rsocket->rbuffers[i]->buffer,rsocket->recv_len[i]);
+		mem_free(rsocket->rbuffers[i]);
+		rsocket->rbuffers[i] = NULL;
+		//mprintf((0,"Found packet for upper layer in nw_ReceiveReliable() %d bytes. seq:%d.\n",rsocket->recv_len[i],rsocket->oursequence));
+		rsocket->oursequence++;
+		return rsocket->recv_len[i];
 	}
 
 	return 0;
@@ -1109,14 +1179,388 @@ int nw_CheckListenSocket(network_address *from_addr)
 }
 
 
+// ------------------------------------------------------------------------------------------------------
+// RELIABLE TRANSPORT
+//
+
+// Size of an ack from a peer that does selective acks: the packet being acked, the next
+// packet the peer is waiting for, and a bit for each of the 32 packets after that.  Older
+// peers only look at the first part.
+#define RELIABLE_SACK_SIZE		(sizeof(unsigned int)+sizeof(unsigned short)+sizeof(unsigned int))
+
+// Set while nw_DoNetworkIdle runs, which is once a frame
+static bool Nw_reliable_idle = false;
+
+// Fills in the address of a reliable socket's peer
+static void nw_ReliableAddress(reliable_socket *rsocket,network_address *send_address)
+{
+	memset(send_address,0,sizeof(network_address));
+	send_address->connection_type = rsocket->connection_type;
+
+	if(NP_TCP==rsocket->connection_type)
+	{
+		SOCKADDR_IN *inaddr = (SOCKADDR_IN *)&rsocket->addr;
+		memcpy(send_address->address,&inaddr->sin_addr, 4);
+		send_address->port = htons(inaddr->sin_port);
+	}
+    #if __SUPPORT_IPX
+	else if(NP_IPX==rsocket->connection_type)
+	{
+		SOCKADDR_IPX *ipxaddr = (SOCKADDR_IPX *)&rsocket->addr;
+		#if (defined(WIN32) || defined(MACINTOSH))
+		memcpy(send_address->address,ipxaddr->sa_nodenum, 6);
+		memcpy(send_address->net_id,ipxaddr->sa_netnum, 4);				
+		send_address->port = htons(ipxaddr->sa_socket);
+		#else
+		memcpy(send_address->address,ipxaddr->sipx_node, 6);
+		memcpy(send_address->net_id,&ipxaddr->sipx_network, 4);
+		send_address->port = htons(ipxaddr->sipx_port);
+		#endif
+	}
+    #endif
+}
+
+// Gets an unused socket ready for a new connection
+static void nw_ReliableResetSocket(reliable_socket *rsocket)
+{
+	memset(rsocket,0,sizeof(reliable_socket));
+	rsocket->rto = NETRETRYTIME;
+	rsocket->cwnd = NW_INITIAL_CWND;
+	rsocket->ssthresh = NW_RELIABLE_WINDOW;
+	rsocket->waiting_packet_number = -1;
+}
+
+// Takes a round trip time sample and works out a new retransmit timeout from it
+static void nw_ReliableUpdateRTT(reliable_socket *rsocket,float rtt)
+{
+	if((rtt<0) || (rtt>NETTIMEOUT))
+		return;
+	if(rtt<0.001f)
+		rtt = 0.001f;
+
+	if(rsocket->srtt==0)
+	{
+		rsocket->srtt = rtt;
+		rsocket->rttvar = rtt/2;
+	}
+	else
+	{
+		float err = rtt-rsocket->srtt;
+		rsocket->rttvar += ((float)fabs(err)-rsocket->rttvar)/4;
+		rsocket->srtt += err/8;
+	}
+
+	rsocket->rto = rsocket->srtt+(4*rsocket->rttvar);
+	if(rsocket->rto<MIN_NET_RETRYTIME)
+		rsocket->rto = (float)MIN_NET_RETRYTIME;
+	else if(rsocket->rto>NW_MAX_RETRYTIME)
+		rsocket->rto = (float)NW_MAX_RETRYTIME;
+}
+
+// Packet "seq" went missing, so cut the window back.  This only happens once per window
+// of packets, so a burst of losses doesn't shut the connection down.
+static void nw_ReliableLoss(reliable_socket *rsocket,unsigned short seq,bool timeout)
+{
+	if(rsocket->in_recovery && ((short)(seq-rsocket->recover_seq)<0))
+		return;
+
+	rsocket->ssthresh = rsocket->cwnd*(timeout?0.5f:0.7f);
+	if(rsocket->ssthresh<NW_MIN_CWND)
+		rsocket->ssthresh = NW_MIN_CWND;
+	rsocket->cwnd = rsocket->ssthresh;
+	rsocket->in_recovery = 1;
+	rsocket->recover_seq = rsocket->send_next;
+}
+
+// Sends packet "seq" out of the send ring
+// Returns false if the socket wouldn't take it
+static bool nw_ReliableTransmit(reliable_socket *rsocket,unsigned short seq,bool resend)
+{
+	int i = seq & (NW_RELIABLE_QUEUE-1);
+	int len = RELIABLE_PACKET_HEADER_ONLY_SIZE+rsocket->send_len[i];
+	float now = timer_GetTime();
+	reliable_header send_header;
+	network_address send_address;
+
+	send_header.type = RNT_DATA;
+	send_header.compressed = 0;
+	send_header.seq = INTEL_SHORT(seq);
+	send_header.data_len = INTEL_SHORT(rsocket->send_len[i]);
+	send_header.send_time = INTEL_FLOAT(now);
+	memcpy(send_header.data,rsocket->sbuffers[i]->buffer,rsocket->send_len[i]);
+
+	nw_ReliableAddress(rsocket,&send_address);
+
+	//mprintf((0,"Sending reliable packet! Sequence %d\n",seq));
+	if(!nw_SendWithID(NWT_RELIABLE,(ubyte *)&send_header,len,&send_address))
+		return false;
+
+	if(resend)
+	{
+		if(NP_TCP==rsocket->connection_type)
+		{
+			NetStatistics.tcp_total_packets_sent--;//decrement because nw_SendWithID counted it
+			NetStatistics.tcp_total_bytes_sent -= len;//see above
+			NetStatistics.tcp_total_packets_resent++;
+			NetStatistics.tcp_total_bytes_resent += len;
+		}
+        #if __SUPPORT_IPX
+		else if(NP_IPX==rsocket->connection_type)
+		{
+			NetStatistics.spx_total_packets_sent--;//decrement because nw_SendWithID counted it
+			NetStatistics.spx_total_bytes_sent -= len;//see above
+			NetStatistics.spx_total_packets_resent++;
+			NetStatistics.spx_total_bytes_resent += len;
+		}
+        #endif
+		if(rsocket->retries[i]<255)
+			rsocket->retries[i]++;
+		rsocket->num_resent++;
+	}
+	else
+		rsocket->num_sent++;
+
+	rsocket->timesent[i] = now;
+	rsocket->lost[i] = 0;
+	rsocket->last_packet_sent = now;
+	rsocket->pace_tokens -= 1;
+	return true;
+}
+
+// Resends anything that has been lost, then sends new packets as far as the window
+// and pacing let us.  Packets are spread out over the round trip time rather than all
+// going out at once, which is what overflows queues and loses packets in the first place.
+static void nw_ReliableSendPending(reliable_socket *rsocket)
+{
+	float now = timer_GetTime();
+	unsigned short seq;
+
+	// Until we know the round trip time, the window is the only limit
+	if(rsocket->srtt==0)
+		rsocket->pace_tokens = rsocket->cwnd;
+	else
+	{
+		float burst = NW_PACE_BURST+(rsocket->cwnd/4);
+
+		rsocket->pace_tokens += (now-rsocket->pace_time)*rsocket->cwnd/rsocket->srtt;
+		if(rsocket->pace_tokens>burst)
+			rsocket->pace_tokens = burst;
+	}
+	rsocket->pace_time = now;
+
+	for(seq=rsocket->send_base;seq!=rsocket->send_next;seq++)
+	{
+		int i = seq & (NW_RELIABLE_QUEUE-1);
+
+		if(!rsocket->sbuffers[i])
+			continue;
+
+		// Each time a packet times out we wait twice as long for it
+		float timeout = rsocket->rto*(1<<(rsocket->retries[i]<3?rsocket->retries[i]:3));
+		if(timeout>NW_MAX_RETRYTIME)
+			timeout = NW_MAX_RETRYTIME;
+
+		if(!rsocket->lost[i] && ((now-rsocket->timesent[i])<timeout))
+			continue;
+
+		if(rsocket->pace_tokens<1)
+			return;
+
+		if(rsocket->lost[i])
+			rsocket->num_fast_resent++;
+		else
+			nw_ReliableLoss(rsocket,seq,true);
+
+		if(!nw_ReliableTransmit(rsocket,seq,true))
+			return;
+	}
+
+	// The packet still collecting data goes once it has waited long enough.  On a fast
+	// link that's the end of the frame.
+	if(-1 != rsocket->waiting_packet_number)
+	{
+		if(rsocket->send_urgent || ((now-rsocket->last_sent)>R_NET_PACKET_QUEUE_TIME) 
+			|| (Nw_reliable_idle && (rsocket->srtt>0) && (rsocket->srtt<R_NET_PACKET_QUEUE_TIME)))
+		{
+			//mprintf((0,"Sending delayed packet...\n"));
+			rsocket->waiting_packet_number = -1;
+			rsocket->last_sent = now;
+		}
+	}
+
+	while(rsocket->send_next!=rsocket->theirsequence)
+	{
+		unsigned short in_flight = rsocket->send_next-rsocket->send_base;
+
+		if((rsocket->send_next & (NW_RELIABLE_QUEUE-1))==rsocket->waiting_packet_number)
+			break;
+		if((in_flight>=NW_RELIABLE_WINDOW) || (in_flight>=rsocket->cwnd))
+			break;
+		if(rsocket->pace_tokens<1)
+			break;
+		if(!nw_ReliableTransmit(rsocket,rsocket->send_next,false))
+			break;
+
+		rsocket->send_next++;
+	}
+}
+
+// Our peer has packet "seq", so free it up and open the window
+// Returns true if we hadn't heard about this packet before
+static bool nw_ReliableAckPacket(reliable_socket *rsocket,unsigned short seq)
+{
+	int i = seq & (NW_RELIABLE_QUEUE-1);
+
+	if((unsigned short)(seq-rsocket->send_base) >= (unsigned short)(rsocket->send_next-rsocket->send_base))
+		return false;
+	if(!rsocket->sbuffers[i])
+		return false;
+
+	mem_free(rsocket->sbuffers[i]);
+	rsocket->sbuffers[i] = NULL;
+
+	if((short)(seq-rsocket->high_ack)>0)
+		rsocket->high_ack = seq;
+
+	// Double the window every round trip until we pass ssthresh, then grow it by a packet
+	if(rsocket->cwnd<rsocket->ssthresh)
+		rsocket->cwnd += 1;
+	else
+		rsocket->cwnd += 1/rsocket->cwnd;
+	if(rsocket->cwnd>NW_RELIABLE_WINDOW)
+		rsocket->cwnd = NW_RELIABLE_WINDOW;
+
+	return true;
+}
+
+// Works through an ack from our peer
+static void nw_ReliableDoAck(reliable_socket *rsocket,ubyte *data,int len,float time_sent)
+{
+	float now = timer_GetTime();
+	unsigned int sig;
+	unsigned short seq;
+
+	memcpy(&sig,data,sizeof(unsigned int));
+	sig = INTEL_INT(sig);
+
+	// The ack hands back the time the packet it is for went out
+	if((unsigned short)((unsigned short)sig-rsocket->send_base) < (unsigned short)(rsocket->send_next-rsocket->send_base))
+		nw_ReliableUpdateRTT(rsocket,now-time_sent);
+	nw_ReliableAckPacket(rsocket,(unsigned short)sig);
+
+	if(len>=(int)RELIABLE_SACK_SIZE)
+	{
+		unsigned short next;
+		unsigned int bits;
+		int b;
+
+		memcpy(&next,data+sizeof(unsigned int),sizeof(unsigned short));
+		memcpy(&bits,data+sizeof(unsigned int)+sizeof(unsigned short),sizeof(unsigned int));
+		next = INTEL_SHORT(next);
+		bits = INTEL_INT(bits);
+
+		// Everything before "next" has arrived
+		for(seq=rsocket->send_base;(seq!=rsocket->send_next) && ((short)(next-seq)>0);seq++)
+			nw_ReliableAckPacket(rsocket,seq);
+
+		// ...and so have the packets with their bit set
+		for(b=0;b<32;b++)
+		{
+			if((bits & (1<<b)) && nw_ReliableAckPacket(rsocket,next+1+b))
+				rsocket->num_sacked++;
+		}
+	}
+
+	// Slide the window up past everything that's been acked
+	while((rsocket->send_base!=rsocket->send_next) && !rsocket->sbuffers[rsocket->send_base & (NW_RELIABLE_QUEUE-1)])
+		rsocket->send_base++;
+
+	if(rsocket->in_recovery && ((short)(rsocket->send_base-rsocket->recover_seq)>=0))
+		rsocket->in_recovery = 0;
+
+	// A hole with NW_DUP_THRESH acked packets after it is lost, unless we only just sent it again
+	for(seq=rsocket->send_base;(seq!=rsocket->send_next) && ((short)(rsocket->high_ack-seq)>=NW_DUP_THRESH);seq++)
+	{
+		int i = seq & (NW_RELIABLE_QUEUE-1);
+
+		if(rsocket->sbuffers[i] && !rsocket->lost[i] && ((now-rsocket->timesent[i])>rsocket->srtt))
+		{
+			rsocket->lost[i] = 1;
+			nw_ReliableLoss(rsocket,seq,false);
+		}
+	}
+
+	nw_ReliableSendPending(rsocket);
+}
+
+// Acks packet "seq" from our peer, along with everything else we have
+static void nw_SendReliableSack(reliable_socket *rsocket,unsigned short seq,float time_sent)
+{
+	reliable_header ack_header;
+	network_address send_address;
+	unsigned int sig = seq;
+	unsigned short next = rsocket->oursequence;
+	unsigned int bits = 0;
+	int b;
+
+	// Packets waiting to be read count as received
+	while(((unsigned short)(next-rsocket->oursequence)<NW_RELIABLE_RECV) && rsocket->rbuffers[next & (NW_RELIABLE_RECV-1)])
+		next++;
+
+	for(b=0;b<32;b++)
+	{
+		unsigned short s = next+1+b;
+
+		if((unsigned short)(s-rsocket->oursequence)>=NW_RELIABLE_RECV)
+			break;
+		if(rsocket->rbuffers[s & (NW_RELIABLE_RECV-1)])
+			bits |= (1<<b);
+	}
+
+	ack_header.type = RNT_ACK;
+	ack_header.compressed = 0;
+	ack_header.seq = 0;
+	ack_header.data_len = INTEL_SHORT((short)RELIABLE_SACK_SIZE);
+	ack_header.send_time = INTEL_FLOAT(time_sent);
+
+	sig = INTEL_INT(sig);
+	next = INTEL_SHORT(next);
+	bits = INTEL_INT(bits);
+	memcpy(ack_header.data,&sig,sizeof(unsigned int));
+	memcpy(ack_header.data+sizeof(unsigned int),&next,sizeof(unsigned short));
+	memcpy(ack_header.data+sizeof(unsigned int)+sizeof(unsigned short),&bits,sizeof(unsigned int));
+
+	nw_ReliableAddress(rsocket,&send_address);
+	nw_SendWithID(NWT_RELIABLE,(ubyte *)&ack_header,RELIABLE_PACKET_HEADER_ONLY_SIZE+RELIABLE_SACK_SIZE,&send_address);
+}
+
+int nw_GetReliableStats(int socknum,nw_reliable_stats *stats)
+{
+	reliable_socket *rsocket;
+
+	if(Use_DirectPlay || (socknum<0) || (socknum>=MAXRELIABLESOCKETS))
+		return 0;
+
+	rsocket = &reliable_sockets[socknum];
+	if(rsocket->status!=RNF_CONNECTED)
+		return 0;
+
+	stats->rtt = rsocket->srtt;
+	stats->rttvar = rsocket->rttvar;
+	stats->rto = rsocket->rto;
+	stats->cwnd = rsocket->cwnd;
+	stats->queued = (unsigned short)(rsocket->theirsequence-rsocket->send_base);
+	stats->sent = rsocket->num_sent;
+	stats->resent = rsocket->num_resent-rsocket->num_fast_resent;
+	stats->fast_resent = rsocket->num_fast_resent;
+	stats->sacked = rsocket->num_sacked;
+	return 1;
+}
+
 int nw_SendReliable(unsigned int socketid, ubyte *data, int length,bool urgent )
 {
 	int i;
-	int bytesout;
-	int use_buffer = -1;
 	reliable_socket *rsocket;
-	reliable_header send_header;
-	int send_this_packet=1;
 
 	if(length==0)
 	{
@@ -1165,110 +1609,43 @@ int nw_SendReliable(unsigned int socketid, ubyte *data, int length,bool urgent )
 		int pnum = rsocket->waiting_packet_number;
 		ASSERT(rsocket->sbuffers[pnum]);
 		//See if there's room for this data
-		if(sizeof(reliable_net_sendbuffer) < (rsocket->send_len[pnum]+length))
-		{
-			//Send the previous packet, then use the normal code to generate a new packet
-			mprintf((0,"Pending reliable packet buffer full, sending packet now.\n"));
-			rsocket->waiting_packet_number = -1;
-
-			use_buffer = pnum;
-			network_address send_address;
-			memset(&send_address,0,sizeof(network_address));
-			
-			memcpy(send_header.data,rsocket->sbuffers[pnum],rsocket->send_len[pnum]);
-			send_header.data_len = INTEL_SHORT(rsocket->send_len[pnum]);
-			send_header.type = RNT_DATA;
-			send_header.send_time = INTEL_FLOAT(timer_GetTime());
-
-			send_address.connection_type = rsocket->connection_type;
-
-			if(NP_TCP==rsocket->connection_type)
-			{
-				SOCKADDR_IN *inaddr = (SOCKADDR_IN *)&rsocket->addr;
-				memcpy(send_address.address,&inaddr->sin_addr, 4);
-				send_address.port = htons(inaddr->sin_port);
-				send_address.connection_type = NP_TCP;
-			}
-
-            #if __SUPPORT_IPX
-			else if(NP_IPX==rsocket->connection_type)
-			{
-				SOCKADDR_IPX *ipxaddr = (SOCKADDR_IPX *)&rsocket->addr;
-				#if (defined(WIN32) || defined(MACINTOSH))
-				memcpy(send_address.address,ipxaddr->sa_nodenum, 6);
-				memcpy(send_address.net_id,ipxaddr->sa_netnum, 4);				
-				send_address.port = htons(ipxaddr->sa_socket);
-				#else
-				memcpy(send_address.address,ipxaddr->sipx_node, 6);
-				memcpy(send_address.net_id,&ipxaddr->sipx_network, 4);
-				send_address.port = htons(ipxaddr->sipx_port);
-				#endif
-				send_address.connection_type = NP_IPX;
-			}
-            #endif
-
-			//mprintf((0,"Sending reliable packet! Sequence %d\n",send_header.seq));
-			bytesout = nw_SendWithID(NWT_RELIABLE,(ubyte *)&send_header,RELIABLE_PACKET_HEADER_ONLY_SIZE+rsocket->send_len[use_buffer],&send_address);					
-				
-			if((bytesout==SOCKET_ERROR)&&(WSAEWOULDBLOCK==WSAGetLastError()))
-			{
-				//This will cause it to try to send again next frame. (or sooner)
-				rsocket->timesent[use_buffer] = timer_GetTime()-(NETRETRYTIME*4);
-			}
-			else
-			{
-				rsocket->timesent[use_buffer] = timer_GetTime();
-			}			
-		}
-		else
+		if(sizeof(reliable_net_sendbuffer) >= (rsocket->send_len[pnum]+length))
 		{
 			//tack this data on the end of the previous packet
 			//mprintf((0,"Appending to delayed packet...\n"));
-			ASSERT(rsocket->sbuffers[pnum]);
 			memcpy(rsocket->sbuffers[pnum]->buffer+rsocket->send_len[pnum],data,length);
-			//int msize = mem_size(rsocket->sbuffers[pnum]);
 			rsocket->send_len[pnum] += length;
+			if(urgent)
+				nw_ReliableSendPending(rsocket);
 			return length;
-
 		}
+
+		//Let the previous packet go, then start a new one
+		rsocket->waiting_packet_number = -1;
 	}
 	
-	//Add the new packet to the sending list and send it.
-	for(i=0;i<MAXNETBUFFERS;i++)
+	//Add the new packet to the end of the send ring
+	if((unsigned short)(rsocket->theirsequence-rsocket->send_base)<NW_RELIABLE_QUEUE)
 	{
-		use_buffer = -1;
-		if(NULL==rsocket->sbuffers[i])
-		{
-			//mprintf((0,"Sending in nw_SendReliable() %d bytes seq=%d.\n",length,rsocket->theirsequence));
-			
-			rsocket->send_len[i] = length;
-			rsocket->sbuffers[i] = (reliable_net_sendbuffer *)mem_malloc(sizeof(reliable_net_sendbuffer));
-		
-			memcpy(rsocket->sbuffers[i]->buffer,data,length);	
+		i = rsocket->theirsequence & (NW_RELIABLE_QUEUE-1);
+		//mprintf((0,"Sending in nw_SendReliable() %d bytes seq=%d.\n",length,rsocket->theirsequence));
 
-			send_header.seq = INTEL_SHORT(rsocket->theirsequence);
-			rsocket->ssequence[i] = rsocket->theirsequence;
-						
-			use_buffer = i;
-			rsocket->waiting_packet_number = i;		
-			
-			rsocket->theirsequence++;
-			return length;
-		}		
+		rsocket->send_len[i] = length;
+		rsocket->sbuffers[i] = (reliable_net_sendbuffer *)mem_malloc(sizeof(reliable_net_sendbuffer));
+		memcpy(rsocket->sbuffers[i]->buffer,data,length);	
+		rsocket->timesent[i] = 0;
+		rsocket->retries[i] = 0;
+		rsocket->lost[i] = 0;
+
+		rsocket->waiting_packet_number = i;		
+		rsocket->theirsequence++;
+
+		nw_ReliableSendPending(rsocket);
+		return length;
 	}
 	mprintf((0,"Can't send packet because a buffer overflow nw_SendReliable(). socket = %d\n",socketid));
 	rsocket->status = RNF_BROKEN;
 	
-	for(i=0;i<MAXNETBUFFERS;i++)
-	{
-		if(rsocket->sbuffers[i])
-		{
-			mprintf((0,"Buffer %d: %d,%d,%d,%d,%d,%d\n",i,rsocket->sbuffers[i]->buffer[0],rsocket->sbuffers[i]->buffer[1],
-														rsocket->sbuffers[i]->buffer[2],rsocket->sbuffers[i]->buffer[3],
-														rsocket->sbuffers[i]->buffer[4],rsocket->sbuffers[i]->buffer[5]));
-		}
-	}
-	
 	//Error ("Couldn't send packet because of buffer overflow!");
 
 	//Int3();
@@ -1334,7 +1711,9 @@ void nw_DoNetworkIdle(void)
 	if(!Use_DirectPlay)
 	{
 		nw_DoReceiveCallbacks();
+		Nw_reliable_idle = true;
 		nw_ReliableResend();
+		Nw_reliable_idle = false;
 	}
 
 }
@@ -1378,6 +1757,12 @@ void nw_WorkReliable(ubyte * data,int len,network_address *naddr)
 
 	//memcpy(&rcv_addr,&naddr->address,sizeof(SOCKADDR));
 
+	if(len>(int)sizeof(reliable_header))
+	{
+		mprintf((0,"Dropping %d byte reliable packet\n",len));
+		return;
+	}
+
 	if(Net_connect_sequence == R_NET_SEQUENCE_CONNECTING)
 	{
 		nw_HandleConnectResponse(data,len,naddr);
@@ -1469,16 +1854,13 @@ void nw_WorkReliable(ubyte * data,int len,network_address *naddr)
 					if(reliable_sockets[i].status==RNF_UNUSED)
 					{
 						//Add the new connection here.
+						nw_ReliableResetSocket(&reliable_sockets[i]);
 						reliable_sockets[i].connection_type=link_type;
 						memcpy(&reliable_sockets[i].net_addr,naddr,sizeof(network_address));
 						memcpy(&reliable_sockets[i].addr,&rcv_addr,sizeof(SOCKADDR));
-						reliable_sockets[i].ping_pos = 0;
-						reliable_sockets[i].num_ping_samples = 0;
 						reliable_sockets[i].status = RNF_LIMBO;
 						reliable_sockets[i].last_packet_received = timer_GetTime();
 						reliable_sockets[i].last_sent = timer_GetTime();
-						reliable_sockets[i].waiting_packet_number = -1;
-						reliable_sockets[i].send_urgent = 0;
 
 						rsocket = &reliable_sockets[i];
 						rcvaddr = (SOCKADDR_IN *)&rcv_addr;
@@ -1570,42 +1952,8 @@ void nw_WorkReliable(ubyte * data,int len,network_address *naddr)
 			}
 			if(rcv_buff.type == RNT_ACK)
 			{
-				//Update ping time
-				rsocket->num_ping_samples++;
-				
-				rsocket->pings[rsocket->ping_pos] = rsocket->last_packet_received - INTEL_FLOAT(rcv_buff.send_time);
-				//mprintf((0,"ping time: %f\n",rsocket->pings[rsocket->ping_pos]));
-				if(rsocket->num_ping_samples>=MAX_PING_HISTORY)
-				{
-					float sort_ping[MAX_PING_HISTORY];
-					for(int a=0;a<MAX_PING_HISTORY;a++)
-						sort_ping[a] = rsocket->pings[a];
-
-					qsort(sort_ping,MAX_PING_HISTORY,sizeof(float),nw_PingCompare);
-					rsocket->mean_ping = ((sort_ping[MAX_PING_HISTORY/2]+sort_ping[(MAX_PING_HISTORY/2)+1]))/2;
-					//mprintf_at((2,i+1,0,"Ping: %f  ",rsocket->mean_ping));
-
-				}
-				rsocket->ping_pos++;
-				if(rsocket->ping_pos>=MAX_PING_HISTORY)
-				{
-					rsocket->ping_pos=0;				
-				}
-				for(i=0;i<MAXNETBUFFERS;i++)
-				{
-					unsigned int *acksig = (unsigned int *)&rcv_buff.data;
-					*acksig = INTEL_INT(*acksig);
-					if(rsocket)
-						if(rsocket->sbuffers[i])
-							if(rsocket->ssequence[i]==*acksig)
-							{
-								//mprintf((0,"Received ACK %d\n",*acksig));
-								mem_free(rsocket->sbuffers[i]);
-								rsocket->sbuffers[i] = NULL;	
-								rsocket->ssequence[i] = 0;
-							}
-				}
-				//remove that packet from the send buffer
+				//Free up what they've got and send more
+				nw_ReliableDoAck(rsocket,rcv_buff.data,INTEL_SHORT(rcv_buff.data_len),INTEL_FLOAT(rcv_buff.send_time));
 				rsocket->last_packet_received = timer_GetTime();
 				continue;
 			}
@@ -1618,68 +1966,42 @@ void nw_WorkReliable(ubyte * data,int len,network_address *naddr)
 			}
 			if(rcv_buff.type == RNT_DATA)
 			{
-				
-				//If the data is out of order by >= MAXNETBUFFERS-1 ignore that packet for now
-				int seqdelta;
-				seqdelta = INTEL_SHORT(rcv_buff.seq) - rsocket->oursequence;
-				if(seqdelta<0) seqdelta = seqdelta*-1;
-				if(seqdelta>=MAXNETBUFFERS-1)
+				unsigned short seq = INTEL_SHORT(rcv_buff.seq);
+				unsigned short seqdelta = seq-rsocket->oursequence;
+
+				if(seqdelta>=0x8000)
 				{
-					mprintf((0,"Received reliable packet out of order!\n"));
-					//It's out of order, so we won't ack it, which will mean we will get it again soon.
-					continue;
+					//We've already passed this one up, but they didn't get our ack
+					mprintf((0,"Received old packet with seq of %d\n",seq));
 				}
-				//else move data into the proper buffer position
-				int savepacket=1;
-				
-				if(rsocket->oursequence < (0xffff - (MAXNETBUFFERS-1)))
+				else if(seqdelta>=NW_RELIABLE_RECV)
 				{
-					if (rsocket->oursequence > INTEL_SHORT(rcv_buff.seq))
-					{
-						mprintf((0,"Received old packet with seq of %d\n",INTEL_SHORT(rcv_buff.seq)));
-						savepacket = 0;
-					}
-
+					mprintf((0,"Received reliable packet out of order!\n"));
+					//It's too far ahead to hold on to, so we won't ack it, which will mean we will get it again soon.
+					continue;
 				}
 				else
 				{
-					//Sequence is high, so prepare for wrap around
-					if( ((unsigned short)(INTEL_SHORT(rcv_buff.seq) + rsocket->oursequence)) > (MAXNETBUFFERS-1))
-					{
-						mprintf((0,"Received old packet with seq of %d\n",INTEL_SHORT(rcv_buff.seq)));
-						savepacket = 0;	
-					}
-				}
-
-				for(i=0;i<MAXNETBUFFERS;i++)
-				{
-					if( (NULL!=rsocket->rbuffers[i]) && (rsocket->rsequence[i] == INTEL_SHORT(rcv_buff.seq)))
+					//else move data into the proper buffer position
+					i = seq & (NW_RELIABLE_RECV-1);
+					if(NULL!=rsocket->rbuffers[i])
 					{
 						//Received duplicate packet!
 						mprintf((0,"Received duplicate packet!\n"));
-						savepacket = 0;
 					}
-				}
-				if(savepacket)
-				{
-					for(i=0;i<MAXNETBUFFERS;i++)
+					else
 					{
-						if(NULL==rsocket->rbuffers[i])
-						{
-							//mprintf((0,"Got good data seq: %d\n",rcv_buff.seq));
-							if(INTEL_SHORT(rcv_buff.data_len)>max_len) 
-								rsocket->recv_len[i] = max_len;//INTEL_SHORT(rcv_buff.data_len);
-							else 
-								rsocket->recv_len[i] = INTEL_SHORT(rcv_buff.data_len); 
-							rsocket->rbuffers[i] = (reliable_net_rcvbuffer *)mem_malloc(sizeof(reliable_net_rcvbuffer));
-							memcpy(rsocket->rbuffers[i]->buffer,rcv_buff.data,rsocket->recv_len[i]);	
-							rsocket->rsequence[i] = INTEL_SHORT(rcv_buff.seq);
-							//mprintf((0,"Adding packet to receive buffer in nw_ReceiveReliable().\n"));
-							break;
-						}
+						//mprintf((0,"Got good data seq: %d\n",seq));
+						if(INTEL_SHORT(rcv_buff.data_len)>max_len) 
+							rsocket->recv_len[i] = max_len;
+						else 
+							rsocket->recv_len[i] = INTEL_SHORT(rcv_buff.data_len); 
+						rsocket->rbuffers[i] = (reliable_net_rcvbuffer *)mem_malloc(sizeof(reliable_net_rcvbuffer));
+						memcpy(rsocket->rbuffers[i]->buffer,rcv_buff.data,rsocket->recv_len[i]);	
+						//mprintf((0,"Adding packet to receive buffer in nw_ReceiveReliable().\n"));
 					}
 				}
-				nw_SendReliableAck(&rsocket->addr,INTEL_SHORT(rcv_buff.seq),link_type,INTEL_FLOAT(rcv_buff.send_time));		
+				nw_SendReliableSack(rsocket,seq,INTEL_FLOAT(rcv_buff.send_time));
 			}
 			
 		}
@@ -1733,7 +2055,7 @@ void nw_HandleConnectResponse(ubyte *data,int len,network_address *server_addr)
 					if(reliable_sockets[i].status==RNF_UNUSED)
 					{
 						//Add the new connection here.
-						memset(&reliable_sockets[i],0,sizeof(reliable_socket));
+						nw_ReliableResetSocket(&reliable_sockets[i]);
 						reliable_sockets[i].connection_type = server_addr->connection_type;
 						memcpy(&reliable_sockets[i].net_addr,server_addr,sizeof(network_address));
 						reliable_sockets[i].last_packet_received = timer_GetTime();
@@ -1741,7 +2063,6 @@ void nw_HandleConnectResponse(ubyte *data,int len,network_address *server_addr)
 						reliable_sockets[i].status = RNF_LIMBO;
 						Net_connect_socket_id = i;
 						reliable_sockets[i].last_sent = timer_GetTime();
-						reliable_sockets[i].waiting_packet_number = -1;
 						mprintf((0,"Succesfully connected to server in nw_ConnectToServer().\n"));
 						//Now send I_AM_HERE packet
 						conn_header.type = RNT_I_AM_HERE;
@@ -1911,19 +2232,20 @@ void nw_CloseSocket( SOCKET *sockp )
 	mprintf((0,"Closing socket %d\n",*sockp));
 	//Go through every buffer and "free it up(tm)"
 	int i;
-	for(i=0;i<MAXNETBUFFERS;i++)
+	for(i=0;i<NW_RELIABLE_RECV;i++)
 	{
 		if(reliable_sockets[*sockp].rbuffers[i])
 		{
 			mem_free(reliable_sockets[*sockp].rbuffers[i]);
 			reliable_sockets[*sockp].rbuffers[i] = NULL;
-			reliable_sockets[*sockp].rsequence[i] = 0;
 		}
-		if(reliable_sockets[*sockp].sbuffers[i])
+	}
+	for(i=0;i<NW_RELIABLE_QUEUE;i++)
+	{
+		if(reliable_sockets[*sockp].sbuffers[i])
 		{
 			mem_free(reliable_sockets[*sockp].sbuffers[i]);
 			reliable_sockets[*sockp].sbuffers[i] = NULL;
-			reliable_sockets[*sockp].rsequence[i] = 0;
 		}
 	}
 	diss_conn_header.type = RNT_DISCONNECT;
@@ -2106,42 +2428,47 @@ void nw_psnet_buffer_init()
 	Psnet_highest_id = -1;
 }
 
+// returns how many packets are waiting in the buffer
+static int nw_psnet_buffer_count()
+{
+	if((Psnet_lowest_id == -1) || (Psnet_lowest_id > Psnet_highest_id))
+		return 0;
+
+	return Psnet_highest_id - Psnet_lowest_id + 1;
+}
+
 // buffer a packet (maintain order!)
+// Packets come out in the order they went in, so the buffers are used as a ring
 void nw_psnet_buffer_packet(ubyte *data, int length, network_address *from)
 {
-	int idx;
-	int found_buf = 0;
-	
-	// find the first empty packet
-	for(idx=0;idx<MAX_PACKET_BUFFERS;idx++)
+	// if there's no room, report an overrun
+	if(nw_psnet_buffer_count() >= MAX_PACKET_BUFFERS)
 	{
-		if(Psnet_buffers[idx].sequence_number == -1){
-			found_buf = 1;
-			break;
-		}
+		mprintf((0,"WARNING - Buffer overrun in psnet\n"));
+		return;
 	}
 
-	// if we didn't find the buffer, report an overrun
-	if(!found_buf)
-	{
-		mprintf((0,"WARNING - Buffer overrun in psnet\n"));
-	} 
-	else 
+	if(length > MAX_PACKET_SIZE)
 	{
-		// copy in the data
-		memcpy(Psnet_buffers[idx].data,data,length);
-		Psnet_buffers[idx].len = length;
-		memcpy(&Psnet_buffers[idx].from_addr,from,sizeof(network_address));
-		Psnet_buffers[idx].sequence_number = Psnet_seq_number;
-		
-		// keep track of the highest id#
-		Psnet_highest_id = Psnet_seq_number++;
+		mprintf((0,"WARNING - Dropping %d byte packet in psnet\n",length));
+		return;
+	}
 
-		// set the lowest id# for the first time
-		if(Psnet_lowest_id == -1)
-		{
-			Psnet_lowest_id = Psnet_highest_id;
-		}
+	int idx = Psnet_seq_number % MAX_PACKET_BUFFERS;
+
+	// copy in the data
+	memcpy(Psnet_buffers[idx].data,data,length);
+	Psnet_buffers[idx].len = length;
+	memcpy(&Psnet_buffers[idx].from_addr,from,sizeof(network_address));
+	Psnet_buffers[idx].sequence_number = Psnet_seq_number;
+	
+	// keep track of the highest id#
+	Psnet_highest_id = Psnet_seq_number++;
+
+	// set the lowest id# for the first time
+	if((Psnet_lowest_id == -1) || (Psnet_lowest_id > Psnet_highest_id))
+	{
+		Psnet_lowest_id = Psnet_highest_id;
 	}
 }
 
@@ -2149,29 +2476,16 @@ void nw_psnet_buffer_packet(ubyte *data, int length, network_address *from)
 // get the index of the next packet in order!
 int nw_psnet_buffer_get_next_by_dpid(ubyte *data, int *length, unsigned long dpid)
 {	
-	int idx;
-	int found_buf = 0;
-
 	// if there are no buffers, do nothing
-	if((Psnet_lowest_id == -1) || (Psnet_lowest_id > Psnet_highest_id))
+	if(nw_psnet_buffer_count() == 0)
 	{
 		return 0;
 	}
 
-	// search until we find the lowest packet index id#
-	for(idx=0;idx<MAX_PACKET_BUFFERS;idx++)
-	{
-		unsigned long *thisid;
-		thisid = (unsigned long *) &Psnet_buffers[idx].from_addr.address;
-		// if we found the buffer
-		if((Psnet_buffers[idx].sequence_number == Psnet_lowest_id)&&(dpid==*thisid))
-		{
-			found_buf = 1;
-			break;
-		}
-	}
+	int idx = Psnet_lowest_id % MAX_PACKET_BUFFERS;
+	unsigned long *thisid = (unsigned long *) &Psnet_buffers[idx].from_addr.address;
 
-	if(!found_buf)
+	if(dpid != *thisid)
 		return 0;
 	
 	// copy out the buffer data
@@ -2191,28 +2505,16 @@ int nw_psnet_buffer_get_next_by_dpid(ubyte *data, int *length, unsigned long dpi
 // get the index of the next packet in order!
 int nw_psnet_buffer_get_next(ubyte *data, int *length, network_address *from)
 {	
-	int idx;
-	int found_buf = 0;
-
 	// if there are no buffers, do nothing
-	if((Psnet_lowest_id == -1) || (Psnet_lowest_id > Psnet_highest_id))
+	if(nw_psnet_buffer_count() == 0)
 	{
 		return 0;
 	}
 
-	// search until we find the lowest packet index id#
-	for(idx=0;idx<MAX_PACKET_BUFFERS;idx++)
-	{
-		// if we found the buffer
-		if(Psnet_buffers[idx].sequence_number == Psnet_lowest_id)
-		{
-			found_buf = 1;
-			break;
-		}
-	}
+	int idx = Psnet_lowest_id % MAX_PACKET_BUFFERS;
 
 	// at this point, we should _always_ have found the buffer
-	ASSERT(found_buf);
+	ASSERT(Psnet_buffers[idx].sequence_number == Psnet_lowest_id);
 	
 	// copy out the buffer data
 	memcpy(data,Psnet_buffers[idx].data,Psnet_buffers[idx].len);
@@ -2612,6 +2914,302 @@ NetworkReceiveCallback nw_UnRegisterCallback(ubyte id)
 	return nfp;
 }
 
+// Reads up to "max" datagrams off a socket without blocking
+// Returns how many were read
+static int nw_ReadDatagrams(SOCKET sock,nw_datagram *dgrams,int max)
+{
+#ifdef NW_USE_MMSG
+	static struct mmsghdr msgs[NW_RECV_BATCH];
+	static struct iovec iovs[NW_RECV_BATCH];
+	int i;
+
+	if (max>NW_RECV_BATCH)
+		max=NW_RECV_BATCH;
+
+	for (i=0;i<max;i++)
+	{
+		iovs[i].iov_base=dgrams[i].data;
+		iovs[i].iov_len=NW_MAX_DATAGRAM;
+		memset(&msgs[i].msg_hdr,0,sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov=&iovs[i];
+		msgs[i].msg_hdr.msg_iovlen=1;
+		msgs[i].msg_hdr.msg_name=&dgrams[i].addr;
+		msgs[i].msg_hdr.msg_namelen=sizeof(SOCKADDR_IN);
+	}
+
+	int num=recvmmsg(sock,msgs,max,MSG_DONTWAIT,NULL);
+	Nw_batch_stats.recv_calls++;
+
+	if (num<0)
+	{
+		if (errno!=EWOULDBLOCK && errno!=EAGAIN)
+			mprintf((0, "Read error on IP socket.  Winsock error %d \n", errno));
+		return 0;
+	}
+
+	for (i=0;i<num;i++)
+		dgrams[i].len=msgs[i].msg_len;
+#else
+	socklen_t from_len=sizeof(SOCKADDR_IN);
+	int num=1;
+
+	dgrams[0].len=recvfrom(sock,(char *)dgrams[0].data,NW_MAX_DATAGRAM,0,(SOCKADDR*)&dgrams[0].addr,&from_len);
+	Nw_batch_stats.recv_calls++;
+
+	if (dgrams[0].len==SOCKET_ERROR)
+	{
+		int x = WSAGetLastError();
+		if(x!=WSAEWOULDBLOCK)
+			mprintf((0, "Read error on IP socket.  Winsock error %d \n", x));
+		return 0;
+	}
+#endif
+
+	Nw_batch_stats.recv_datagrams+=num;
+	return num;
+}
+
+// Hands a datagram read off the IP socket to whoever handles its packet id
+static void nw_DispatchDatagram(nw_datagram *dgram)
+{
+	network_address from_addr;
+
+	if (dgram->len<1)
+		return;
+
+	memset(&from_addr, 0x00, sizeof(network_address));
+	from_addr.connection_type = NP_TCP;
+	from_addr.port = ntohs( dgram->addr.sin_port );
+	
+	#ifdef WIN32
+	memcpy(from_addr.address, &dgram->addr.sin_addr.S_un.S_addr, 4);
+	#else
+	memcpy(from_addr.address, &dgram->addr.sin_addr.s_addr, 4);
+	#endif
+
+	ubyte packet_id = (dgram->data[0] & 0x0f);
+	if(Netcallbacks[packet_id])
+	{
+		int rlen = dgram->len-1;
+		if(packet_id==NWT_UNRELIABLE)
+		{
+			NetStatistics.udp_total_packets_rec++;
+			NetStatistics.udp_total_bytes_rec+=rlen;
+		}else if(packet_id==NWT_RELIABLE)
+		{
+			NetStatistics.tcp_total_packets_rec++;
+			NetStatistics.tcp_total_bytes_rec+=rlen;
+		}
+		
+		Netcallbacks[packet_id](dgram->data+1,rlen,&from_addr);
+	}
+}
+
+// Adds a packet to a batch that's going out later.  Unreliable game data is a run of whole
+// messages, so if the last datagram in the batch for this address is unreliable data too
+// and there's room, the packet is tacked onto the end of it instead.
+// Returns false if the batch is full.
+static bool nw_AddDatagram(nw_datagram *batch,int *num,int max,SOCKADDR_IN *addr,ubyte *packet,int len)
+{
+	nw_datagram *dgram;
+	int i;
+
+	ASSERT(len<=NW_MAX_DATAGRAM);
+
+	for (i=*num-1;i>=0;i--)
+	{
+		dgram=&batch[i];
+		if (dgram->addr.sin_addr.s_addr!=addr->sin_addr.s_addr || dgram->addr.sin_port!=addr->sin_port)
+			continue;
+
+		if (packet[0]==NWT_UNRELIABLE && dgram->coalesce && dgram->len+len-1<=NW_COALESCE_SIZE+1)
+		{
+			memcpy(dgram->data+dgram->len,packet+1,len-1);
+			dgram->len+=len-1;
+			Nw_batch_stats.coalesced++;
+			return true;
+		}
+		break;
+	}
+
+	if (*num>=max)
+		return false;
+
+	dgram=&batch[(*num)++];
+	dgram->addr=*addr;
+	dgram->len=len;
+	dgram->coalesce=(packet[0]==NWT_UNRELIABLE && len-1<=NW_COALESCE_SIZE);
+	memcpy(dgram->data,packet,len);
+
+	return true;
+}
+
+// Sends a batch of datagrams without blocking.  Like a socket that isn't writable in
+// nw_SendWithID, anything the socket won't take is dropped.
+// Returns how many went out.
+static int nw_WriteDatagrams(SOCKET sock,nw_datagram *batch,int num)
+{
+	int sent=0;
+
+#ifdef NW_USE_MMSG
+	static struct mmsghdr msgs[NW_SEND_BATCH];
+	static struct iovec iovs[NW_SEND_BATCH];
+
+	ASSERT(num<=NW_SEND_BATCH);
+
+	for (int i=0;i<num;i++)
+	{
+		iovs[i].iov_base=batch[i].data;
+		iovs[i].iov_len=batch[i].len;
+		memset(&msgs[i].msg_hdr,0,sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov=&iovs[i];
+		msgs[i].msg_hdr.msg_iovlen=1;
+		msgs[i].msg_hdr.msg_name=&batch[i].addr;
+		msgs[i].msg_hdr.msg_namelen=sizeof(SOCKADDR_IN);
+	}
+
+	while (sent<num)
+	{
+		int ret=sendmmsg(sock,&msgs[sent],num-sent,MSG_DONTWAIT);
+		Nw_batch_stats.send_calls++;
+
+		if (ret<=0)
+		{
+			if (ret<0 && errno!=EWOULDBLOCK && errno!=EAGAIN)
+				mprintf((0, "Couldn't send data (%d)!\n", errno));
+			break;
+		}
+		sent+=ret;
+	}
+#else
+	for (int i=0;i<num;i++)
+	{
+		int ret=sendto(sock,(char *)batch[i].data,batch[i].len,0,(SOCKADDR*)&batch[i].addr,sizeof(SOCKADDR_IN));
+		Nw_batch_stats.send_calls++;
+
+		if (ret==SOCKET_ERROR)
+		{
+			int lasterr=WSAGetLastError();
+			if (lasterr!=WSAEWOULDBLOCK)
+				mprintf((0, "Couldn't send data (%d)!\n", lasterr));
+			continue;
+		}
+		sent++;
+	}
+#endif
+
+	Nw_batch_stats.send_datagrams+=sent;
+	return sent;
+}
+
+// Sends whatever has been batched up
+static void nw_FlushSendBatch()
+{
+	if (Nw_num_send_batch>0 && TCP_active && Sockets_initted)
+		nw_WriteDatagrams(TCP_socket,Nw_send_batch,Nw_num_send_batch);
+
+	Nw_num_send_batch=0;
+}
+
+void nw_BeginSendBatch()
+{
+	Nw_send_batching++;
+}
+
+void nw_EndSendBatch()
+{
+	ASSERT(Nw_send_batching>0);
+
+	if (--Nw_send_batching==0)
+		nw_FlushSendBatch();
+}
+
+void nw_GetBatchStats(nw_batch_stats *stats)
+{
+	if (stats)
+		*stats=Nw_batch_stats;
+	else
+		memset(&Nw_batch_stats,0,sizeof(Nw_batch_stats));
+}
+
+// ------------------------------------------------------------------------------------------------------
+// NETWORK SIMULATION
+//
+
+// Datagrams we can hold back at once.  Any more get dropped, like a full router queue would.
+#define NW_SIM_QUEUE			512
+
+static float Nw_sim_loss = 0;
+static float Nw_sim_latency = 0;
+static unsigned int Nw_sim_seed = 1;
+static nw_datagram *Nw_sim_queue = NULL;
+static float Nw_sim_due[NW_SIM_QUEUE];
+static int Nw_sim_first = 0;
+static int Nw_sim_count = 0;
+
+void nw_SetNetworkSimulation(float loss,float latency)
+{
+	Nw_sim_loss = loss;
+	Nw_sim_latency = latency;
+
+	if((latency>0) && !Nw_sim_queue)
+		Nw_sim_queue = (nw_datagram *)mem_malloc(NW_SIM_QUEUE*sizeof(nw_datagram));
+
+	if((loss>0) || (latency>0))
+		mprintf((0,"Simulating %.1f%% packet loss and %dms latency on outgoing packets\n",loss*100,(int)(latency*1000)));
+}
+
+// Drops or holds back an IP datagram we are about to send
+// Returns true if the datagram has been dealt with
+static bool nw_SimSend(SOCKADDR_IN *addr,ubyte *data,int len)
+{
+	if(Nw_sim_loss>0)
+	{
+		Nw_sim_seed = Nw_sim_seed*1103515245+12345;
+		if((float)((Nw_sim_seed>>16)&0x7fff)<(Nw_sim_loss*0x8000))
+			return true;
+	}
+
+	if(Nw_sim_latency<=0)
+		return false;
+
+	if(Nw_sim_count==NW_SIM_QUEUE)
+		return true;
+
+	nw_datagram *dgram = &Nw_sim_queue[(Nw_sim_first+Nw_sim_count)%NW_SIM_QUEUE];
+	memcpy(&dgram->addr,addr,sizeof(SOCKADDR_IN));
+	memcpy(dgram->data,data,len);
+	dgram->len = len;
+	Nw_sim_due[(Nw_sim_first+Nw_sim_count)%NW_SIM_QUEUE] = timer_GetTime()+Nw_sim_latency;
+	Nw_sim_count++;
+	return true;
+}
+
+// Sends the held back datagrams whose time has come
+static void nw_SimRelease()
+{
+	float now = timer_GetTime();
+
+	while(Nw_sim_count && (Nw_sim_due[Nw_sim_first]<=now))
+	{
+		nw_datagram *dgram = &Nw_sim_queue[Nw_sim_first];
+
+		if(Nw_send_batching)
+		{
+			if(!nw_AddDatagram(Nw_send_batch,&Nw_num_send_batch,NW_SEND_BATCH,&dgram->addr,dgram->data,dgram->len))
+			{
+				nw_FlushSendBatch();
+				nw_AddDatagram(Nw_send_batch,&Nw_num_send_batch,NW_SEND_BATCH,&dgram->addr,dgram->data,dgram->len);
+			}
+		}
+		else
+			nw_WriteDatagrams(TCP_socket,dgram,1);
+
+		Nw_sim_first = (Nw_sim_first+1)%NW_SIM_QUEUE;
+		Nw_sim_count--;
+	}
+}
+
 int nw_SendWithID(ubyte id,ubyte *data,int len,network_address *who_to)
 {
 	ubyte packet_data[1500];
@@ -2733,6 +3331,27 @@ int nw_SendWithID(ubyte id,ubyte *data,int len,network_address *who_to)
 	send_len = len;
 	send_data = (ubyte *)packet_data;
 
+	if (who_to->connection_type == NP_TCP)
+	{
+		memset(&sock_addr, 0, sizeof(sock_addr));
+		sock_addr.sin_family = AF_INET; 
+		memcpy(&sock_addr.sin_addr.s_addr, iaddr, 4);
+		sock_addr.sin_port = htons(port); 
+
+		if (((Nw_sim_loss>0) || (Nw_sim_latency>0)) && nw_SimSend(&sock_addr, send_data, send_len))
+			return 1;
+	}
+
+	// Inside a send batch, IP packets wait for nw_EndSendBatch
+	if (Nw_send_batching && who_to->connection_type == NP_TCP)
+	{
+		if (!nw_AddDatagram(Nw_send_batch, &Nw_num_send_batch, NW_SEND_BATCH, &sock_addr, send_data, send_len))
+		{
+			nw_FlushSendBatch();
+			nw_AddDatagram(Nw_send_batch, &Nw_num_send_batch, NW_SEND_BATCH, &sock_addr, send_data, send_len);
+		}
+		return 1;
+	}
 
 	FD_ZERO(&wfds);
 	FD_SET( send_sock, &wfds );
@@ -2778,6 +3397,9 @@ int nw_SendWithID(ubyte id,ubyte *data,int len,network_address *who_to)
 				sock_addr.sin_port = htons(port); 
 
 				ret = sendto( TCP_socket, (char *)send_data, send_len, 0, (SOCKADDR*)&sock_addr, sizeof(sock_addr) );
+				Nw_batch_stats.send_calls++;
+				if ( ret != SOCKET_ERROR )
+					Nw_batch_stats.send_datagrams++;
 				break;
 	
 			default:
@@ -2807,77 +3429,27 @@ int nw_DoReceiveCallbacks(void)
 {
     #if __SUPPORT_IPX
 	SOCKADDR_IPX ipx_addr;			// IPX socket structure
-    #endif
-	SOCKADDR_IN ip_addr;				// UDP/TCP socket structure		
 	socklen_t		read_len, from_len;
 	network_address	from_addr;
 
 	ubyte packet_data[1500];
+    #endif
+
+	if (Nw_sim_count)
+		nw_SimRelease();
 
 	nw_ReliableResend();
 
 	while ( TCP_active ) 
 	{
-		// check if there is any data on the socket to be read.  The amount of data that can be 
-		// atomically read is stored in len.
-		
-#if 0
-		fd_set	rfds;
-		FD_ZERO(&rfds);
-		FD_SET( TCP_socket, &rfds );
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 0;
+		int num = nw_ReadDatagrams(TCP_socket, Nw_recv_ring, NW_RECV_BATCH);
 
-		timeval	timeout;
-		if ( select( TCP_socket+1, &rfds, NULL, NULL, &timeout) == SOCKET_ERROR) 
-		{
-			mprintf((0, "Error %d doing a socket select on IP read\n", WSAGetLastError()));
-			break;
-		}
+		for (int i = 0; i < num; i++)
+			nw_DispatchDatagram(&Nw_recv_ring[i]);
 
-		// if the read file descriptor is not set, then bail!
-		if ( !FD_ISSET(TCP_socket, &rfds ) )
+		// Stop when the socket is empty, or leave the rest in it until there's room to buffer them
+		if (num < NW_RECV_BATCH || nw_psnet_buffer_count() > MAX_PACKET_BUFFERS - NW_RECV_BATCH)
 			break;
-#endif
-		// get data off the socket and process
-		from_len = sizeof(SOCKADDR_IN);
-		read_len = recvfrom( TCP_socket, (char *)packet_data,1500, 0,  (SOCKADDR*)&ip_addr, &from_len );
-		
-		if ( read_len == SOCKET_ERROR ) 
-		{
-			int x = WSAGetLastError();
-			if(x!=WSAEWOULDBLOCK)
-			{
-				mprintf((0, "Read error on IP socket.  Winsock error %d \n", x));
-			}
-			break;
-		}
-		memset(&from_addr, 0x00, sizeof(network_address));
-		from_addr.connection_type = NP_TCP;
-		from_addr.port = ntohs( ip_addr.sin_port );
-		
-		#ifdef WIN32
-		memcpy(from_addr.address, &ip_addr.sin_addr.S_un.S_addr, 4);
-		#else
-		memcpy(from_addr.address, &ip_addr.sin_addr.s_addr, 4);
-		#endif
-		ubyte packet_id = (packet_data[0] & 0x0f);
-		if(Netcallbacks[packet_id])
-		{
-			//mprintf((0,"Calling network callback for id %d.\n",packet_id));
-			int rlen = read_len-1;
-			if(packet_id==NWT_UNRELIABLE)
-			{
-				NetStatistics.udp_total_packets_rec++;
-				NetStatistics.udp_total_bytes_rec+=rlen;
-			}else if(packet_id==NWT_RELIABLE)
-			{
-				NetStatistics.tcp_total_packets_rec++;
-				NetStatistics.tcp_total_bytes_rec+=rlen;
-			}
-			
-			Netcallbacks[packet_id](packet_data+1,rlen,&from_addr);
-		}
 	}
 
     #if __SUPPORT_IPX
@@ -2947,16 +3519,29 @@ int nw_DoReceiveCallbacks(void)
 }
 
 
+
+int nw_GetReceiveSockets(SOCKET *socks,int max)
+{
+	int num=0;
+
+	// Reading now would leave everything in the socket anyway
+	if (nw_psnet_buffer_count() > MAX_PACKET_BUFFERS - NW_RECV_BATCH)
+		return 0;
+
+	if (TCP_active && num<max)
+		socks[num++]=TCP_socket;
+    #if __SUPPORT_IPX
+	if (IPX_active && num<max)
+		socks[num++]=IPX_socket;
+    #endif
+
+	return num;
+}
+
 //Resend any unack'd packets and send any buffered packets, heartbeats, etc.
 void nw_ReliableResend(void)
 {
-	int i,j;
-	int rcode = -1;
-	short max_len = NETBUFFERSIZE;
-	static reliable_header rcv_buff;
-	static SOCKADDR rcv_addr;
-	int bytesin = 0;
-	int addrlen = sizeof(SOCKADDR);	
+	int j;
 	reliable_socket *rsocket = NULL;
 	//Go through each reliable socket that is connected and do any needed work.
 	for(j=0;j<MAXRELIABLESOCKETS;j++)
@@ -2984,169 +3569,21 @@ void nw_ReliableResend(void)
 		
 		if(rsocket->status==RNF_CONNECTED)
 		{
-			float retry_packet_time;
-			if((rsocket->mean_ping==0) || (rsocket->mean_ping > (NETRETRYTIME*4)))
-			{
-				retry_packet_time = NETRETRYTIME;
-			}
-			else
-			{
-				if(rsocket->mean_ping<MIN_NET_RETRYTIME)
-				{
-					retry_packet_time = (float)MIN_NET_RETRYTIME;
-					//mprintf((0,"Using retransmission time of %f\n",retry_packet_time));
-				}
-				else 
-				{
-					retry_packet_time = ((float)(float)rsocket->mean_ping * (float)1.25);
-					//mprintf((0,"Using retransmission time of %f\n",retry_packet_time));
-				}
-			}
-			//Iterate through send buffers.  
-			for(i=0;i<MAXNETBUFFERS;i++)
-			{
-				if( 
-					( (i==rsocket->waiting_packet_number) 
-					&& ( (((timer_GetTime() - rsocket->last_sent) > R_NET_PACKET_QUEUE_TIME)) || ((rsocket->mean_ping>0)&&(rsocket->mean_ping<R_NET_PACKET_QUEUE_TIME)) || rsocket->send_urgent ) 
-					)
-					|| ( (rsocket->sbuffers[i]) && ((timer_GetTime() - rsocket->timesent[i]) >= retry_packet_time) )
-				  ) //Send again
-				{
-					
-					if(i==rsocket->waiting_packet_number)
-					{
-						rsocket->waiting_packet_number = -1;
-						rsocket->last_sent = timer_GetTime();
-						//mprintf((0,"Sending delayed packet...\n"));
-					}
-					reliable_header send_header;
-					//mprintf((0,"Resending reliable packet in nw_WorkReliable().\n"));
-					send_header.send_time = INTEL_FLOAT(timer_GetTime());
-					send_header.seq = INTEL_SHORT(rsocket->ssequence[i]);
-					memcpy(send_header.data,rsocket->sbuffers[i]->buffer,rsocket->send_len[i]);
-					send_header.data_len = INTEL_SHORT(rsocket->send_len[i]);
-					send_header.type = RNT_DATA;
-					
-					network_address send_address;
-					memset(&send_address,0,sizeof(network_address));
-					
-					send_address.connection_type = rsocket->connection_type;					
-					
-					if(NP_TCP==send_address.connection_type)
-					{
-						SOCKADDR_IN *inaddr = (SOCKADDR_IN *)&rsocket->addr;
-						memcpy(send_address.address,&inaddr->sin_addr, 4);
-						send_address.port = htons(inaddr->sin_port);
-						send_address.connection_type = NP_TCP;
-
-						int len = RELIABLE_PACKET_HEADER_ONLY_SIZE+rsocket->send_len[i];
-						NetStatistics.tcp_total_packets_sent--;//decrement because we are going to inc
-																// in nw_SendWithID
-						NetStatistics.tcp_total_bytes_sent -= len;//see above
-						NetStatistics.tcp_total_packets_resent++;
-						NetStatistics.tcp_total_bytes_resent += len;						
-					}
-
-                    #if __SUPPORT_IPX
-					else if(NP_IPX==send_address.connection_type)
-					{
-						SOCKADDR_IPX *ipxaddr = (SOCKADDR_IPX *)&rsocket->addr;
-						#if (defined(WIN32) || defined(MACINTOSH))
-						memcpy(send_address.address,ipxaddr->sa_nodenum, 6);
-						memcpy(send_address.net_id,ipxaddr->sa_netnum, 4);				
-						send_address.port = htons(ipxaddr->sa_socket);
-						#else
-						memcpy(send_address.address,ipxaddr->sipx_node, 6);
-						memcpy(send_address.net_id,&ipxaddr->sipx_network, 4);				
-						send_address.port = htons(ipxaddr->sipx_port);
-						#endif
-						send_address.connection_type = NP_IPX;
-
-						int len = RELIABLE_PACKET_HEADER_ONLY_SIZE+rsocket->send_len[i];
-						NetStatistics.spx_total_packets_sent--;//decrement because we are going to inc
-																// in nw_SendWithID
-						NetStatistics.spx_total_bytes_sent -= len;//see above
-						NetStatistics.spx_total_packets_resent++;
-						NetStatistics.spx_total_bytes_resent += len;						
-					}
-                    #endif
-
-					//mprintf((0,"Resending reliable packet! Sequence %d\n",send_header.seq));
-					rcode = nw_SendWithID(NWT_RELIABLE,(ubyte *)&send_header,RELIABLE_PACKET_HEADER_ONLY_SIZE+rsocket->send_len[i],&send_address);
-					
-					if((rcode==SOCKET_ERROR)&&(WSAEWOULDBLOCK==WSAGetLastError()))
-					{
-						//The packet didn't get sent, flag it to try again next frame
-						rsocket->timesent[i] = timer_GetTime()-(NETRETRYTIME*4);
-					}
-					else
-					{
-						rsocket->last_packet_sent = timer_GetTime();
-						rsocket->timesent[i] = timer_GetTime();
-					}
-					
-				}
-			}
+			nw_ReliableSendPending(rsocket);
 			//We've sent all the packets, now we go out of urgent mode.
 			rsocket->send_urgent = 0;
 			if((rsocket->status==RNF_CONNECTED) && ((timer_GetTime() - rsocket->last_packet_sent)>NETHEARTBEATTIME))
 			{
 				reliable_header send_header;
-				//mprintf((0,"Resending reliable packet in nw_WorkReliable().\n"));
+				network_address send_address;
+
 				send_header.send_time = INTEL_FLOAT(timer_GetTime());
 				send_header.seq = INTEL_SHORT((short)0);
 				send_header.data_len = INTEL_SHORT((short)0);
 				send_header.type = RNT_HEARTBEAT;
 
-				rcode = -1;
-				network_address send_address;
-				memset(&send_address,0,sizeof(network_address));
-				
-				send_address.connection_type = rsocket->connection_type;					
-				
-				if(NP_TCP==send_address.connection_type)
-				{
-					SOCKADDR_IN *inaddr = (SOCKADDR_IN *)&rsocket->addr;
-					memcpy(send_address.address,&inaddr->sin_addr, 4);
-					send_address.port = htons(inaddr->sin_port);
-					send_address.connection_type = NP_TCP;
-
-					int len = RELIABLE_PACKET_HEADER_ONLY_SIZE+rsocket->send_len[i];
-					NetStatistics.tcp_total_packets_sent--;//decrement because we are going to inc
-																// in nw_SendWithID
-					NetStatistics.tcp_total_bytes_sent -= len;//see above
-					NetStatistics.tcp_total_packets_resent++;
-					NetStatistics.tcp_total_bytes_resent += len;						
-				}
-
-                #if __SUPPORT_IPX
-				else if(NP_IPX==send_address.connection_type)
-				{
-					SOCKADDR_IPX *ipxaddr = (SOCKADDR_IPX *)&rsocket->addr;
-					#if (defined(WIN32) || defined(MACINTOSH))
-					memcpy(send_address.address,ipxaddr->sa_nodenum, 6);
-					memcpy(send_address.net_id,ipxaddr->sa_netnum, 4);				
-					send_address.port = htons(ipxaddr->sa_socket);
-					#else
-					memcpy(send_address.address,ipxaddr->sipx_node, 6);
-					memcpy(send_address.net_id,&ipxaddr->sipx_network, 4);				
-					send_address.port = htons(ipxaddr->sipx_port);
-					#endif
-					send_address.connection_type = NP_IPX;
-
-					int len = RELIABLE_PACKET_HEADER_ONLY_SIZE+rsocket->send_len[i];
-					NetStatistics.spx_total_packets_sent--;//decrement because we are going to inc
-																// in nw_SendWithID
-					NetStatistics.spx_total_bytes_sent -= len;//see above
-					NetStatistics.spx_total_packets_resent++;
-					NetStatistics.spx_total_bytes_resent += len;						
-				}
-                #endif
-
-				rcode = nw_SendWithID(NWT_RELIABLE,(ubyte *)&send_header,RELIABLE_PACKET_HEADER_ONLY_SIZE,&send_address);
-				
-
-				if((rcode!=SOCKET_ERROR)&&(WSAEWOULDBLOCK!=WSAGetLastError()))
+				nw_ReliableAddress(rsocket,&send_address);
+				if(nw_SendWithID(NWT_RELIABLE,(ubyte *)&send_header,RELIABLE_PACKET_HEADER_ONLY_SIZE,&send_address))
 				{
 					//It must have been sent
 					rsocket->last_packet_sent = timer_GetTime();
@@ -3176,3 +3613,561 @@ void nw_GetNetworkStats(tNetworkStatus *stats)
 
 	memcpy(stats,&NetStatistics,sizeof(NetStatistics));
 }
+
+// ------------------------------------------------------------------------------------------------------
+// LOOPBACK LOAD TEST
+//
+
+#define TEST_NW_CLIENTS			16
+#define TEST_NW_TICKS			600		// 20 seconds at 30 frames a second
+#define TEST_NW_POS_SIZE		40		// a player position message
+#define TEST_NW_ROBOT_SIZE		400		// a client's Multi_send_buffer
+
+static SOCKET nw_TestSocket(SOCKADDR_IN *addr)
+{
+	SOCKET sock=socket(AF_INET,SOCK_DGRAM,0);
+	socklen_t addrlen=sizeof(SOCKADDR_IN);
+
+	memset(addr,0,sizeof(SOCKADDR_IN));
+	addr->sin_family=AF_INET;
+	addr->sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	addr->sin_port=0;
+
+	if (sock==INVALID_SOCKET || bind(sock,(SOCKADDR*)addr,sizeof(SOCKADDR_IN))==SOCKET_ERROR)
+		return INVALID_SOCKET;
+
+	getsockname(sock,(SOCKADDR*)addr,&addrlen);
+	nw_SetSocketOptions(sock);
+	return sock;
+}
+
+// Closes a loopback test socket
+static void nw_TestCloseSocket(SOCKET sock)
+{
+	#ifdef WIN32
+	closesocket(sock);
+	#else
+	close(sock);
+	#endif
+}
+
+// Builds an unreliable packet holding one game message of "size" bytes
+static int nw_TestMessage(ubyte *packet,int type,int size,int tag)
+{
+	packet[0]=NWT_UNRELIABLE;
+	packet[1]=type;
+	packet[2]=size & 0xff;
+	packet[3]=size>>8;
+	for (int i=3;i<size;i++)
+		packet[1+i]=(ubyte)(tag+i);
+
+	return size+1;
+}
+
+// Counts the game messages in a datagram, or returns -1 if it doesn't parse
+static int nw_TestCountMessages(ubyte *data,int len)
+{
+	int count=0,pos=1;
+
+	if (len<1 || data[0]!=NWT_UNRELIABLE)
+		return -1;
+
+	while (pos<len)
+	{
+		if (len-pos<3)
+			return -1;
+
+		int size=data[pos+1] | (data[pos+2]<<8);
+		if (size<3 || pos+size>len)
+			return -1;
+
+		pos+=size;
+		count++;
+	}
+
+	return count;
+}
+
+void nw_TestBatchedIO()
+{
+	SOCKADDR_IN server_addr,client_addrs[TEST_NW_CLIENTS];
+	SOCKET server,clients[TEST_NW_CLIENTS];
+	int i,c;
+
+	// This runs at startup, before nw_InitNetworking
+#ifdef WIN32
+	WSADATA ws_data;
+	if (WSAStartup(MAKEWORD(1,1),&ws_data)!=0)
+	{
+		mprintf((0,"TestBatchedIO: Couldn't start Winsock\n"));
+		return;
+	}
+#endif
+
+	server=nw_TestSocket(&server_addr);
+	for (c=0;c<TEST_NW_CLIENTS;c++)
+		clients[c]=nw_TestSocket(&client_addrs[c]);
+
+	for (c=0;c<TEST_NW_CLIENTS;c++)
+	{
+		if (server==INVALID_SOCKET || clients[c]==INVALID_SOCKET)
+		{
+			mprintf((0,"TestBatchedIO: Couldn't open loopback sockets\n"));
+#ifdef WIN32
+			WSACleanup();
+#endif
+			return;
+		}
+	}
+
+	mprintf((0,"TestBatchedIO: %d clients, %d ticks, each client gets %d positions and a %d byte buffer a tick\n",
+		TEST_NW_CLIENTS,TEST_NW_TICKS,TEST_NW_CLIENTS-1,TEST_NW_ROBOT_SIZE));
+
+	nw_batch_stats old_stats=Nw_batch_stats;
+	ubyte packet[NW_MAX_DATAGRAM];
+
+	for (int batched=0;batched<2;batched++)
+	{
+		int recv_calls=0,recv_datagrams=0,send_calls=0,send_datagrams=0;
+		int sent_messages=0,got_messages=0,bad_datagrams=0;
+		double recv_time=0,send_time=0;
+
+		memset(&Nw_batch_stats,0,sizeof(Nw_batch_stats));
+
+		for (int tick=0;tick<TEST_NW_TICKS;tick++)
+		{
+			// Every client sends its position
+			for (c=0;c<TEST_NW_CLIENTS;c++)
+			{
+				int len=nw_TestMessage(packet,100,TEST_NW_POS_SIZE,c+tick);
+				sendto(clients[c],(char *)packet,len,0,(SOCKADDR*)&server_addr,sizeof(SOCKADDR_IN));
+			}
+
+			// The server reads them all
+			double start=timer_GetTime64();
+			if (batched)
+			{
+				while (nw_ReadDatagrams(server,Nw_recv_ring,NW_RECV_BATCH)==NW_RECV_BATCH)
+					;
+			}
+			else
+			{
+				SOCKADDR_IN from;
+				for (;;)
+				{
+					socklen_t from_len=sizeof(SOCKADDR_IN);
+					int len=recvfrom(server,(char *)packet,NW_MAX_DATAGRAM,0,(SOCKADDR*)&from,&from_len);
+					recv_calls++;
+					if (len==SOCKET_ERROR)
+						break;
+					recv_datagrams++;
+				}
+			}
+			recv_time+=timer_GetTime64()-start;
+
+			// The server sends every other client's position and a buffer of robots to each client
+			start=timer_GetTime64();
+			int num_batch=0;
+			for (c=0;c<TEST_NW_CLIENTS;c++)
+			{
+				for (i=0;i<=TEST_NW_CLIENTS;i++)
+				{
+					if (i==c)
+						continue;
+
+					int len;
+					if (i==TEST_NW_CLIENTS)
+						len=nw_TestMessage(packet,101,TEST_NW_ROBOT_SIZE,tick);
+					else
+						len=nw_TestMessage(packet,100,TEST_NW_POS_SIZE,i+tick);
+					sent_messages++;
+
+					if (batched)
+					{
+						if (!nw_AddDatagram(Nw_send_batch,&num_batch,NW_SEND_BATCH,&client_addrs[c],packet,len))
+						{
+							nw_WriteDatagrams(server,Nw_send_batch,num_batch);
+							num_batch=0;
+							nw_AddDatagram(Nw_send_batch,&num_batch,NW_SEND_BATCH,&client_addrs[c],packet,len);
+						}
+					}
+					else
+					{
+						// nw_SendWithID checks the socket is writable first
+						fd_set wfds;
+						timeval timeout={0,0};
+						FD_ZERO(&wfds);
+						FD_SET(server,&wfds);
+						select(server+1,NULL,&wfds,NULL,&timeout);
+						if (sendto(server,(char *)packet,len,0,(SOCKADDR*)&client_addrs[c],sizeof(SOCKADDR_IN))!=SOCKET_ERROR)
+							send_datagrams++;
+						send_calls+=2;
+					}
+				}
+			}
+			if (batched && num_batch>0)
+				nw_WriteDatagrams(server,Nw_send_batch,num_batch);
+			send_time+=timer_GetTime64()-start;
+
+			// The clients check they got every message
+			for (c=0;c<TEST_NW_CLIENTS;c++)
+			{
+				SOCKADDR_IN from;
+				for (;;)
+				{
+					socklen_t from_len=sizeof(SOCKADDR_IN);
+					int len=recvfrom(clients[c],(char *)packet,NW_MAX_DATAGRAM,0,(SOCKADDR*)&from,&from_len);
+					if (len==SOCKET_ERROR)
+						break;
+
+					int num=nw_TestCountMessages(packet,len);
+					if (num<0 || len-1>NW_COALESCE_SIZE)
+						bad_datagrams++;
+					else
+						got_messages+=num;
+				}
+			}
+		}
+
+		if (batched)
+		{
+			recv_calls=Nw_batch_stats.recv_calls;
+			recv_datagrams=Nw_batch_stats.recv_datagrams;
+			send_calls=Nw_batch_stats.send_calls;
+			send_datagrams=Nw_batch_stats.send_datagrams;
+		}
+
+		mprintf((0,"TestBatchedIO: %s: %.1f recv calls for %.1f datagrams, %.1f send calls for %.1f datagrams a tick, %.1f us a tick\n",
+			batched?"batched":"one at a time",(float)recv_calls/TEST_NW_TICKS,(float)recv_datagrams/TEST_NW_TICKS,
+			(float)send_calls/TEST_NW_TICKS,(float)send_datagrams/TEST_NW_TICKS,(float)((recv_time+send_time)*1000000.0/TEST_NW_TICKS)));
+		mprintf((0,"TestBatchedIO: %s: %d of %d messages arrived, %d bad datagrams\n",
+			batched?"batched":"one at a time",got_messages,sent_messages,bad_datagrams));
+	}
+
+	Nw_batch_stats=old_stats;
+
+	nw_TestCloseSocket(server);
+	for (c=0;c<TEST_NW_CLIENTS;c++)
+		nw_TestCloseSocket(clients[c]);
+
+#ifdef WIN32
+	WSACleanup();
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------------
+// RELIABLE JOIN TEST
+//
+
+#define TEST_REL_STAGES			4
+#define TEST_REL_TRIALS			3
+#define TEST_REL_LATENCY		0.05f		// each way
+#define TEST_REL_FRAME_TIME		0.01f
+#define TEST_REL_TIMEOUT		60.0f
+
+// Message types
+#define TEST_REL_REQUEST		1		// the client wants the next stage
+#define TEST_REL_DATA			2		// part of a stage
+#define TEST_REL_DONE			3		// the client has everything
+
+#define TEST_REL_HEADER_SIZE	6		// type, size, stage, message number
+
+// Bytes the server sends for each stage of the join: players, buildings, objects and world states
+static const int Test_rel_stage_bytes[TEST_REL_STAGES]={2048,4096,32768,12288};
+
+typedef struct
+{
+	int ok;
+	float join_time;
+	nw_reliable_stats stats;
+} test_rel_result;
+
+#ifdef __LINUX__
+
+static void nw_TestReliableFrame()
+{
+	nw_DoNetworkIdle();
+	usleep((int)(TEST_REL_FRAME_TIME*1000000));
+}
+
+static void nw_TestReliableSend(int sock,int type,int stage,int msgnum,int size)
+{
+	ubyte msg[NETBUFFERSIZE];
+	int i;
+
+	msg[0]=type;
+	msg[1]=size & 0xff;
+	msg[2]=size>>8;
+	msg[3]=stage;
+	msg[4]=msgnum & 0xff;
+	msg[5]=msgnum>>8;
+	for (i=TEST_REL_HEADER_SIZE;i<size;i++)
+		msg[i]=(ubyte)(msgnum*7+i);
+
+	nw_SendReliable(sock,msg,size,type!=TEST_REL_DATA);
+}
+
+// Sends a whole stage in one go, the way the join functions do
+static void nw_TestReliableSendStage(int sock,int stage)
+{
+	unsigned int seed=stage+1;
+	int bytes=0,msgnum=0;
+
+	while (bytes<Test_rel_stage_bytes[stage])
+	{
+		seed=seed*1103515245+12345;
+		int size=TEST_REL_HEADER_SIZE+16+((seed>>16)%224);
+
+		nw_TestReliableSend(sock,TEST_REL_DATA,stage,msgnum++,size);
+		bytes+=size;
+	}
+}
+
+// Closes the socket the parent gave us and starts the network layer over on "port"
+static void nw_TestReliableReset(ushort port,float loss,unsigned int seed)
+{
+	if (TCP_socket!=INVALID_SOCKET)
+		close(TCP_socket);
+
+	memset(reliable_sockets,0,sizeof(reliable_sockets));
+	serverconn=UINT_MAX;
+	Net_connect_sequence=R_NET_SEQUENCE_NONE;
+	Nw_send_batching=0;
+	Nw_num_send_batch=0;
+	Nw_sim_count=0;
+
+	nw_InitSockets(port);
+	nw_SetNetworkSimulation(loss,TEST_REL_LATENCY);
+	Nw_sim_seed=seed;
+}
+
+static void nw_TestReliableServer(test_rel_result *result)
+{
+	float start=timer_GetTime();
+	network_address from;
+	ubyte buf[NETBUFFERSIZE];
+	int sock=INVALID_SOCKET;
+	int size;
+	bool done=false;
+
+	while (sock==INVALID_SOCKET)
+	{
+		if (timer_GetTime()-start>TEST_REL_TIMEOUT)
+			return;
+
+		nw_TestReliableFrame();
+		sock=nw_CheckListenSocket(&from);
+	}
+
+	while (!done)
+	{
+		if (timer_GetTime()-start>TEST_REL_TIMEOUT)
+			return;
+
+		nw_TestReliableFrame();
+
+		while ((size=nw_ReceiveReliable(sock,buf,sizeof(buf)))>0)
+		{
+			for (int pos=0;pos+TEST_REL_HEADER_SIZE<=size;pos+=buf[pos+1]|(buf[pos+2]<<8))
+			{
+				if (buf[pos]==TEST_REL_REQUEST)
+					nw_TestReliableSendStage(sock,buf[pos+3]);
+				else if (buf[pos]==TEST_REL_DONE)
+					done=true;
+			}
+		}
+	}
+
+	result->ok=nw_GetReliableStats(sock,&result->stats);
+}
+
+static void nw_TestReliableClient(ushort server_port,test_rel_result *result)
+{
+	network_address server_addr;
+	ubyte buf[NETBUFFERSIZE];
+	SOCKET sock;
+	unsigned int ip=inet_addr("127.0.0.1");
+	int stage,bytes,msgnum,size;
+
+	memset(&server_addr,0,sizeof(network_address));
+	server_addr.connection_type=NP_TCP;
+	memcpy(server_addr.address,&ip,4);
+	server_addr.port=server_port;
+
+	nw_ConnectToServer(&sock,&server_addr);
+	if (sock==INVALID_SOCKET)
+		return;
+
+	// We can't send anything until the server has seen us
+	float start=timer_GetTime();
+	while (!nw_GetReliableStats(sock,&result->stats))
+	{
+		if (timer_GetTime()-start>TEST_REL_TIMEOUT)
+			return;
+		nw_TestReliableFrame();
+	}
+
+	start=timer_GetTime();
+
+	for (stage=0;stage<TEST_REL_STAGES;stage++)
+	{
+		nw_TestReliableSend(sock,TEST_REL_REQUEST,stage,0,TEST_REL_HEADER_SIZE);
+
+		for (bytes=0,msgnum=0;bytes<Test_rel_stage_bytes[stage];)
+		{
+			if (timer_GetTime()-start>TEST_REL_TIMEOUT)
+				return;
+
+			nw_TestReliableFrame();
+
+			while ((size=nw_ReceiveReliable(sock,buf,sizeof(buf)))>0)
+			{
+				int pos,len;
+
+				for (pos=0;pos+TEST_REL_HEADER_SIZE<=size;pos+=len,msgnum++,bytes+=len)
+				{
+					len=buf[pos+1]|(buf[pos+2]<<8);
+
+					// Everything has to arrive, in order, and intact
+					if (buf[pos]!=TEST_REL_DATA || buf[pos+3]!=stage || (buf[pos+4]|(buf[pos+5]<<8))!=msgnum || pos+len>size)
+					{
+						mprintf((0,"TestReliable: bad message %d in stage %d\n",msgnum,stage));
+						return;
+					}
+					for (int i=TEST_REL_HEADER_SIZE;i<len;i++)
+					{
+						if (buf[pos+i]!=(ubyte)(msgnum*7+i))
+						{
+							mprintf((0,"TestReliable: message %d in stage %d is corrupt\n",msgnum,stage));
+							return;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	result->join_time=timer_GetTime()-start;
+	result->ok=1;
+
+	// Hang around until the server has heard we're done
+	nw_TestReliableSend(sock,TEST_REL_DONE,0,0,TEST_REL_HEADER_SIZE);
+	start=timer_GetTime();
+	while (timer_GetTime()-start<1.0f)
+		nw_TestReliableFrame();
+}
+
+// Runs one side of the test in a child process and returns its pid
+static pid_t nw_TestReliableFork(bool server,ushort port,ushort server_port,float loss,unsigned int seed,int *fd)
+{
+	int fds[2];
+
+	if (pipe(fds)<0)
+		return -1;
+
+	pid_t pid=fork();
+	if (pid==0)
+	{
+		test_rel_result result;
+
+		memset(&result,0,sizeof(result));
+		close(fds[0]);
+
+		nw_TestReliableReset(port,loss,seed);
+		if (server)
+			nw_TestReliableServer(&result);
+		else
+			nw_TestReliableClient(server_port,&result);
+
+		write(fds[1],&result,sizeof(result));
+		_exit(0);
+	}
+
+	close(fds[1]);
+	*fd=fds[0];
+	return pid;
+}
+
+// Waits until "deadline" for a child's result, then makes sure the child is gone.  A child that
+// hasn't answered by then is hung, so it gets killed.
+static void nw_TestReliableFinish(pid_t pid,int fd,float deadline,test_rel_result *result)
+{
+	struct pollfd pfd;
+	int wait_ms=(int)((deadline-timer_GetTime())*1000);
+
+	pfd.fd=fd;
+	pfd.events=POLLIN;
+	pfd.revents=0;
+
+	if (poll(&pfd,1,wait_ms>0?wait_ms:0)<=0 || read(fd,result,sizeof(*result))!=sizeof(*result))
+	{
+		memset(result,0,sizeof(*result));
+		kill(pid,SIGKILL);
+	}
+
+	close(fd);
+	waitpid(pid,NULL,0);
+}
+
+#endif
+
+void nw_TestReliable()
+{
+#ifdef __LINUX__
+	static const float loss[]={0,0.05f,0.10f};
+	ushort port=40000+(getpid()%10000)*2;
+
+	for (int l=0;l<(int)(sizeof(loss)/sizeof(loss[0]));l++)
+	{
+		float join_time=0;
+		int sent=0,resent=0,fast_resent=0,ok=0;
+		float rtt=0,cwnd=0;
+
+		for (int trial=0;trial<TEST_REL_TRIALS;trial++)
+		{
+			test_rel_result server,client;
+			int server_fd,client_fd;
+
+			memset(&server,0,sizeof(server));
+			memset(&client,0,sizeof(client));
+
+			pid_t server_pid=nw_TestReliableFork(true,port,0,loss[l],trial*2+1,&server_fd);
+			pid_t client_pid=server_pid<0?-1:nw_TestReliableFork(false,port+1,port,loss[l],trial*2+2,&client_fd);
+			if (server_pid<0 || client_pid<0)
+			{
+				if (server_pid>=0)
+					nw_TestReliableFinish(server_pid,server_fd,0,&server);
+				mprintf((0,"TestReliable: couldn't start the test processes\n"));
+				return;
+			}
+
+			// Both sides give up after TEST_REL_TIMEOUT, so this only runs out if one of them hangs
+			float deadline=timer_GetTime()+TEST_REL_TIMEOUT+5.0f;
+			nw_TestReliableFinish(client_pid,client_fd,deadline,&client);
+			nw_TestReliableFinish(server_pid,server_fd,deadline,&server);
+
+			if (!client.ok || !server.ok)
+				continue;
+
+			ok++;
+			join_time+=client.join_time;
+			sent+=server.stats.sent;
+			resent+=server.stats.resent;
+			fast_resent+=server.stats.fast_resent;
+			rtt+=server.stats.rtt;
+			cwnd+=server.stats.cwnd;
+		}
+
+		if (!ok)
+		{
+			mprintf((0,"TestReliable: %.0f%% loss: every join failed\n",loss[l]*100));
+			continue;
+		}
+
+		mprintf((0,"TestReliable: %.0f%% loss, %dms round trip: %d of %d joins, %.2f sec a join, %d packets, %d resent after a timeout, %d resent early, rtt %.0fms, window %.0f\n",
+			loss[l]*100,(int)(TEST_REL_LATENCY*2000),ok,TEST_REL_TRIALS,join_time/ok,sent/ok,resent/ok,fast_resent/ok,rtt*1000/ok,cwnd/ok));
+	}
+#else
+	mprintf((0,"TestReliable: only runs where we have fork()\n"));
+#endif
+}
@@ -869,6 +869,7 @@
 
 #ifndef NED_PHYSICS
 #include "gametexture.h"
+#include "vclip.h"
 #else
 #include "..\neweditor\ned_GameTexture.h"
 #endif
@@ -879,6 +880,9 @@
 #include "player.h"
 #include "doorway.h"
 #include "renderer.h"
+#include "objgrid.h"
+#include "ddio.h"
+#include <vector>
 
 // Debug performance includes (do nothing in final release)
 #ifndef NED_PHYSICS
@@ -899,57 +903,65 @@ bool FVI_always_check_ceiling = false;
 //This doesn't really belong here, but I don't know where else to put it.
 float Ceiling_height = MAX_TERRAIN_HEIGHT;
 
+// The state below is per thread, so that wall-only queries can be run on job threads
+// (see fvi_FindWallIntersection).
+
 // Bit fields for quick 'already-checked' checking
-unsigned char fvi_visit_list[MAX_ROOMS/8 + 1];										// This bit-field provides a fast check if a mine segment has been visited
-unsigned char fvi_terrain_visit_list[(TERRAIN_DEPTH * TERRAIN_WIDTH)/8 + 1]; // This bit-field provides a fast check if a terrain segment has been visited
-unsigned char fvi_terrain_obj_visit_list[(TERRAIN_DEPTH * TERRAIN_WIDTH)/8 + 1]; // This bit-field provides a fast check if a terrain segment has been visited
+thread_local unsigned char fvi_visit_list[MAX_ROOMS/8 + 1];										// This bit-field provides a fast check if a mine segment has been visited
+thread_local unsigned char fvi_terrain_visit_list[(TERRAIN_DEPTH * TERRAIN_WIDTH)/8 + 1]; // This bit-field provides a fast check if a terrain segment has been visited
+thread_local unsigned char fvi_terrain_obj_visit_list[(TERRAIN_DEPTH * TERRAIN_WIDTH)/8 + 1]; // This bit-field provides a fast check if a terrain segment has been visited
 
 // The number rooms and terrain cells that this fvi call visited.
-int fvi_num_rooms_visited;
-int fvi_num_cells_visited;
-int fvi_num_cells_obj_visited;
+thread_local int fvi_num_rooms_visited;
+thread_local int fvi_num_cells_visited;
+thread_local int fvi_num_cells_obj_visited;
 
 // Should we do a terrain check.  This flag exists because if we do a terrain check, it always does a full check. So,
 // we only have to do it once.
-bool f_check_terrain;
-bool fvi_zero_rad;
+thread_local bool f_check_terrain;
+thread_local bool fvi_zero_rad;
 
 // Unordered list of rooms and terrain cells that this fvi call visited.
 //DAJ changed to ushorts to save memory 
-ushort fvi_rooms_visited[MAX_ROOMS];				// This should be a small number (100 to 1000)
-ushort fvi_cells_visited[MAX_CELLS_VISITED];		// Use this so that we do not have to use 256x256 elements
-ushort fvi_cells_obj_visited[MAX_CELLS_VISITED];
+thread_local ushort fvi_rooms_visited[MAX_ROOMS];				// This should be a small number (100 to 1000)
+thread_local ushort fvi_cells_visited[MAX_CELLS_VISITED];		// Use this so that we do not have to use 256x256 elements
+thread_local ushort fvi_cells_obj_visited[MAX_CELLS_VISITED];
 
 // Fvi wall collision stuff
-float fvi_wall_sphere_rad;
-vector fvi_wall_sphere_offset;
-vector fvi_wall_sphere_p0;
-vector fvi_wall_sphere_p1;
+thread_local float fvi_wall_sphere_rad;
+thread_local vector fvi_wall_sphere_offset;
+thread_local vector fvi_wall_sphere_p0;
+thread_local vector fvi_wall_sphere_p1;
 
-float fvi_anim_sphere_rad;
-vector fvi_anim_sphere_offset;
-vector fvi_anim_sphere_p0;
-vector fvi_anim_sphere_p1;
+thread_local float fvi_anim_sphere_rad;
+thread_local vector fvi_anim_sphere_offset;
+thread_local vector fvi_anim_sphere_p0;
+thread_local vector fvi_anim_sphere_p1;
 
 // Fvi information pointers.  
-fvi_info * fvi_hit_data_ptr;
-fvi_query * fvi_query_ptr;
+thread_local fvi_info * fvi_hit_data_ptr;
+thread_local fvi_query * fvi_query_ptr;
 
 // Best collision's distance
-float fvi_collision_dist;
+thread_local float fvi_collision_dist;
 
 // AABB for the movement
-vector fvi_max_xyz;
-vector fvi_min_xyz;
-vector fvi_movement_delta;
+thread_local vector fvi_max_xyz;
+thread_local vector fvi_min_xyz;
+thread_local vector fvi_movement_delta;
 
 // AABB for the movement
-vector fvi_wall_max_xyz;
-vector fvi_wall_min_xyz;
+thread_local vector fvi_wall_max_xyz;
+thread_local vector fvi_wall_min_xyz;
 
 // CHRISHACK -- Do we still need this????
-int fvi_curobj;
-int fvi_moveobj;
+thread_local int fvi_curobj;
+thread_local int fvi_moveobj;
+
+// Set while fvi_FindWallIntersection runs a query on this thread
+static thread_local bool Fvi_job_query = false;
+// Set if that query reached a face it couldn't safely look at
+static thread_local bool Fvi_job_unsafe = false;
 
 // Recorded faces
 fvi_face_room_list Fvi_recorded_faces[MAX_RECORDED_FACES];
@@ -1933,8 +1945,6 @@ inline bool room_manual_AABB(const face *room_face, const vector *min_xyz, const
 	return overlap;
 }
 
-#define MAX_QUICK_ROOMS 20
-
 // Returns the number of faces that are approximately within the specified radius
 int fvi_QuickDistFaceList(int init_room_index, vector *pos, float rad, fvi_face_room_list *quick_fr_list, int max_elements)
 {
@@ -2282,10 +2292,13 @@ int fvi_QuickDistObjectList(vector *pos, int init_room_index, float rad, short *
 			cur_room = &Rooms[next_rooms[cur_next_room_index]];
 				
 			// Do object stuff
-			int cur_obj_index = cur_room->objects;
+			static short room_objs[MAX_OBJECTS];
+			int num_room_objs = ObjGridGather(ROOMNUM(cur_room), &fvi_min_xyz, &fvi_max_xyz, room_objs);
 			
-			while(cur_obj_index > -1)
+			for(int j = 0; j < num_room_objs; j++)
 			{
+				int cur_obj_index = room_objs[j];
+
 				if(num_objects >= max_elements) break;
 				if((f_include_non_collide_objects) || CollisionRayResult[Objects[cur_obj_index].type] != RESULT_NOTHING)
 				{
@@ -2301,8 +2314,6 @@ int fvi_QuickDistObjectList(vector *pos, int init_room_index, float rad, short *
 						}
 					}
 				}
-
-				cur_obj_index = Objects[cur_obj_index].next;
 			}
 
 			if(num_objects >= max_elements) break;
@@ -2365,6 +2376,82 @@ skip_room_prop:
 	return num_objects;
 }
 
+int fvi_QuickDistRoomList(vector *pos, int init_room_index, float rad, short *room_list, int max_elements)
+{
+	int next_rooms[MAX_QUICK_ROOMS];
+	int highest_next_room_index;
+	int cur_next_room_index;
+	int num_rooms = 0;
+	vector delta;
+	int i, x;
+
+	ASSERT(pos != NULL);
+	ASSERT(init_room_index >= 0 && init_room_index <= Highest_room_index && Rooms[init_room_index].used != 0);
+	ASSERT(rad >= 0.0f);
+
+	// Quick volume
+	delta.x = delta.y = delta.z = rad;
+	fvi_wall_min_xyz = fvi_wall_max_xyz = *pos;
+
+	fvi_wall_min_xyz -= delta;
+	fvi_wall_max_xyz += delta;
+
+	// Initially this is the only room in the list
+	next_rooms[0] = init_room_index;
+	highest_next_room_index = 0;
+	cur_next_room_index = 0;
+
+	// Use standard fvi list_array / bool list 
+	fvi_visit_list[init_room_index >> 3] |= 0x01 << (init_room_index % 8);
+	fvi_rooms_visited[0] = init_room_index;
+	fvi_num_rooms_visited = 1;
+
+	// Same walk as fvi_QuickDistObjectList, without gathering the objects
+	while(num_rooms < max_elements && cur_next_room_index <= highest_next_room_index)
+	{
+		room *cur_room = &Rooms[next_rooms[cur_next_room_index]];
+
+		room_list[num_rooms++] = ROOMNUM(cur_room);
+
+		for (x = 0; x < cur_room->num_portals; x++)
+		{
+			int portal_num;
+			int connect_room;
+
+			i = cur_room->portals[x].portal_face;
+
+			if (!room_movement_AABB(&cur_room->faces[i])) continue;
+
+			portal_num = cur_room->faces[i].portal_num;
+			connect_room = cur_room->portals[portal_num].croom;
+
+			// If the conect_room is not a terrain cell and we still have a slot in the next room list...
+			if(connect_room >= 0 && highest_next_room_index + 1 < MAX_QUICK_ROOMS)
+			{
+				ASSERT(Rooms[connect_room].used);
+
+				if ((fvi_visit_list[connect_room >> 3] & (0x01 << ((connect_room) % 8))) == 0) 
+				{
+					fvi_visit_list[connect_room >> 3] |= 0x01 << (connect_room % 8);
+					fvi_rooms_visited[fvi_num_rooms_visited++] = connect_room;
+
+					next_rooms[++highest_next_room_index] = connect_room;
+				}
+			}
+		}
+
+		cur_next_room_index++;
+	}
+
+	// Cleans up the boolean room visit list
+	for(i = 0; i < fvi_num_rooms_visited; i++)
+	{
+		fvi_visit_list[fvi_rooms_visited[i] >> 3] = 0;
+	}
+
+	return num_rooms;
+}
+
 bool fvi_QuickRoomCheck(vector *pos, room *cur_room, bool try_again)
 {
 	vector hit_point;				// where we hit
@@ -2696,6 +2783,164 @@ void fvi_rooms_objs(void);
 extern bool Tracking_FVI;
 #endif
 
+// Query recording, for checking the object grid against plain room list walks
+struct fvi_recorded_query
+{
+	fvi_query fq;
+	vector p0, p1;
+	matrix orient;
+	vector rotvel, rotthrust, velocity, thrust;
+	angle turnroll;
+	std::vector<int> ignore_list;
+};
+
+static std::vector<fvi_recorded_query> Fvi_recorded_queries;
+static bool Fvi_recording_queries = false;
+
+static void fvi_RecordQuery(const fvi_query *fq)
+{
+	Fvi_recorded_queries.emplace_back();
+	fvi_recorded_query &rec = Fvi_recorded_queries.back();
+
+	rec.fq = *fq;
+	rec.p0 = *fq->p0;
+	rec.p1 = *fq->p1;
+	if(fq->o_orient) rec.orient = *fq->o_orient;
+	if(fq->o_rotvel) rec.rotvel = *fq->o_rotvel;
+	if(fq->o_rotthrust) rec.rotthrust = *fq->o_rotthrust;
+	if(fq->o_velocity) rec.velocity = *fq->o_velocity;
+	if(fq->o_thrust) rec.thrust = *fq->o_thrust;
+	if(fq->o_turnroll) rec.turnroll = *fq->o_turnroll;
+
+	if(fq->ignore_obj_list)
+	{
+		for(int *ip = fq->ignore_obj_list; *ip != -1; ip++)
+			rec.ignore_list.push_back(*ip);
+		rec.ignore_list.push_back(-1);
+	}
+}
+
+// Rebuilds a recorded query, pointing it at the recorded copies of its data
+static fvi_query fvi_RecordedQuery(fvi_recorded_query &rec)
+{
+	fvi_query fq = rec.fq;
+
+	fq.p0 = &rec.p0;
+	fq.p1 = &rec.p1;
+	if(fq.o_orient) fq.o_orient = &rec.orient;
+	if(fq.o_rotvel) fq.o_rotvel = &rec.rotvel;
+	if(fq.o_rotthrust) fq.o_rotthrust = &rec.rotthrust;
+	if(fq.o_velocity) fq.o_velocity = &rec.velocity;
+	if(fq.o_thrust) fq.o_thrust = &rec.thrust;
+	if(fq.o_turnroll) fq.o_turnroll = &rec.turnroll;
+	if(fq.ignore_obj_list) fq.ignore_obj_list = rec.ignore_list.data();
+
+	// Don't disturb the face list the game recorded
+	fq.flags &= ~(FQ_RECORD | FQ_NEW_RECORD_LIST);
+
+	return fq;
+}
+
+static bool fvi_SameResult(const fvi_info *a, const fvi_info *b)
+{
+	if(a->hit_type[0] != b->hit_type[0] || a->num_hits != b->num_hits || a->hit_room != b->hit_room ||
+		a->hit_dist != b->hit_dist || a->hit_pnt != b->hit_pnt)
+		return false;
+
+	for(int i = 0; i < a->num_hits && i < MAX_HITS; i++)
+	{
+		if(a->hit_type[i] != b->hit_type[i] || a->hit_object[i] != b->hit_object[i] ||
+			a->hit_face[i] != b->hit_face[i] || a->hit_face_room[i] != b->hit_face_room[i])
+			return false;
+	}
+
+	return true;
+}
+
+void fvi_StartQueryRecording()
+{
+	Fvi_recorded_queries.clear();
+	Fvi_recording_queries = true;
+}
+
+void fvi_ReplayRecordedQueries()
+{
+	if(!Fvi_recording_queries)
+		return;
+	Fvi_recording_queries = false;
+
+	// Drop queries from objects that have since been deleted
+	for(size_t q = 0; q < Fvi_recorded_queries.size(); )
+	{
+		int objnum = Fvi_recorded_queries[q].fq.thisobjnum;
+		if(objnum >= 0 && Objects[objnum].type == OBJ_NONE)
+			Fvi_recorded_queries.erase(Fvi_recorded_queries.begin() + q);
+		else
+			q++;
+	}
+
+	int num_queries = Fvi_recorded_queries.size();
+	if(num_queries == 0)
+		return;
+
+	bool grid_was_enabled = Obj_grid_enabled;
+	std::vector<fvi_info> results[2];
+	double times[2];
+	int i, pass;
+
+	// Pass 0 walks the room object lists, pass 1 uses the object grid
+	for(pass = 0; pass < 2; pass++)
+	{
+		Obj_grid_enabled = (pass == 1);
+		results[pass].resize(num_queries);
+
+		double start = timer_GetTime64();
+		for(i = 0; i < num_queries; i++)
+		{
+			fvi_query fq = fvi_RecordedQuery(Fvi_recorded_queries[i]);
+			fvi_FindIntersection(&fq, &results[pass][i]);
+		}
+		times[pass] = timer_GetTime64() - start;
+	}
+
+	int num_mismatches = 0;
+	for(i = 0; i < num_queries; i++)
+	{
+		if(!fvi_SameResult(&results[0][i], &results[1][i]))
+		{
+			if(num_mismatches < 10)
+				mprintf((0, "FVI replay: query %d from object %d in room %d hit %d/%d with the room lists and %d/%d with the grid\n", i,
+					Fvi_recorded_queries[i].fq.thisobjnum, Fvi_recorded_queries[i].fq.startroom,
+					results[0][i].hit_type[0], results[0][i].hit_object[0], results[1][i].hit_type[0], results[1][i].hit_object[0]));
+			num_mismatches++;
+		}
+	}
+
+	// Also check the quick object lists around the same movements
+	static short list_objs[MAX_OBJECTS], grid_objs[MAX_OBJECTS];
+	int num_list_mismatches = 0;
+	for(i = 0; i < num_queries; i++)
+	{
+		fvi_recorded_query &rec = Fvi_recorded_queries[i];
+		float rad = rec.fq.rad + vm_VectorDistance(&rec.p0, &rec.p1);
+
+		Obj_grid_enabled = false;
+		int num_list = fvi_QuickDistObjectList(&rec.p0, rec.fq.startroom, rad, list_objs, MAX_OBJECTS, false);
+		Obj_grid_enabled = true;
+		int num_grid = fvi_QuickDistObjectList(&rec.p0, rec.fq.startroom, rad, grid_objs, MAX_OBJECTS, false);
+
+		if(num_list != num_grid || memcmp(list_objs, grid_objs, num_list * sizeof(short)))
+			num_list_mismatches++;
+	}
+
+	Obj_grid_enabled = grid_was_enabled;
+
+	mprintf((0, "FVI replay: %d queries, %d mismatches, %d object list mismatches\n", num_queries, num_mismatches, num_list_mismatches));
+	mprintf((0, "FVI replay: room lists %.3f ms, object grid %.3f ms\n", times[0] * 1000, times[1] * 1000));
+
+	Fvi_recorded_queries.clear();
+}
+
 int fvi_FindIntersection(fvi_query *fq,fvi_info *hit_data, bool no_subdivision)
 {
 	int i;
@@ -2707,8 +2952,12 @@ int fvi_FindIntersection(fvi_query *fq,fvi_info *hit_data, bool no_subdivision)
 		return HIT_NONE;
 	}
 
+	// Subdivided queries get replayed as part of the query they came from
+	if(Fvi_recording_queries && !no_subdivision && !Fvi_job_query)
+		fvi_RecordQuery(fq);
+
 	#ifndef NED_PHYSICS
-	if (Tracking_FVI)
+	if (Tracking_FVI && !Fvi_job_query)
 	{
 		mprintf ((0,"Track FVI - Ray %d, thisobjnum=%d, startroom=%d, rad=%f\n",FVI_counter,fq->thisobjnum,fq->startroom,fq->rad));
 	}
@@ -2720,11 +2969,15 @@ int fvi_FindIntersection(fvi_query *fq,fvi_info *hit_data, bool no_subdivision)
 	INT64 curr_time;
 	RTP_GETCLOCK(curr_time);
 
-	RTP_tSTARTTIME(fvi_time,curr_time);
-	RTP_INCRVALUE(fvi_calls,1);
+	if(!Fvi_job_query)
+	{
+		RTP_tSTARTTIME(fvi_time,curr_time);
+		RTP_INCRVALUE(fvi_calls,1);
+	}
 #endif
 
-	FVI_counter++;
+	if(!Fvi_job_query)
+		FVI_counter++;
 	/////////////////////////////////////////
 
 	// Setup our globals
@@ -2906,7 +3159,8 @@ int fvi_FindIntersection(fvi_query *fq,fvi_info *hit_data, bool no_subdivision)
 
 			*hit_data = fvi_new_hit_data;
 #ifdef USE_RTP
-			RTP_tENDTIME(fvi_time,curr_time);
+			if(!Fvi_job_query)
+				RTP_tENDTIME(fvi_time,curr_time);
 #endif
 			return hit_data->hit_type[0];
 		}
@@ -2917,7 +3171,8 @@ int fvi_FindIntersection(fvi_query *fq,fvi_info *hit_data, bool no_subdivision)
 	{
 		ASSERT(!(Rooms[fq->startroom].flags & RF_EXTERNAL)); // If we hit this, it is not FVI's fault
 		                                                    // The caller to fvi has a bug
-		FVI_room_counter++;
+		if(!Fvi_job_query)
+			FVI_room_counter++;
 		//do_fvi_rooms(fq->startroom);
 		fvi_room(fq->startroom, -1);
 
@@ -3028,11 +3283,29 @@ int fvi_FindIntersection(fvi_query *fq,fvi_info *hit_data, bool no_subdivision)
 
 	// Return the hit type
 #ifdef USE_RTP
-	RTP_tENDTIME(fvi_time,curr_time);
+	if(!Fvi_job_query)
+		RTP_tENDTIME(fvi_time,curr_time);
 #endif
 	return hit_data->hit_type[0];
 }
 
+int fvi_FindWallIntersection(fvi_query *fq,fvi_info *hit_data)
+{
+	ASSERT(!(fq->flags & (FQ_CHECK_OBJS | FQ_RECORD | FQ_NEW_RECORD_LIST | FQ_TRANSPOINT | FQ_IGNORE_RENDER_THROUGH_PORTALS)));
+
+	Fvi_job_query = true;
+	Fvi_job_unsafe = false;
+
+	int fate = fvi_FindIntersection(fq, hit_data);
+
+	Fvi_job_query = false;
+
+	if(Fvi_job_unsafe)
+		return -1;
+
+	return fate;
+}
+
 int obj_in_list(int objnum,int *obj_list)
 {
 	int t;
@@ -4618,8 +4891,9 @@ check_big_objs: 	// Check Big objects
 
 void fvi_rooms_objs(void)
 {
-	int objnum;
-	int i;
+	static short room_objs[MAX_OBJECTS];
+	int num_room_objs;
+	int i, j;
 	room *cur_room;
 
 	//first, see if vector hit any objects in this segment
@@ -4631,10 +4905,11 @@ void fvi_rooms_objs(void)
 		ASSERT((fvi_visit_list[ROOMNUM(cur_room) >> 3] & (0x01 << (ROOMNUM(cur_room) % 8))) != 0);
 		ASSERT(ROOMNUM(cur_room) >= 0 && ROOMNUM(cur_room) <= Highest_room_index && cur_room->used);
 
-		for (objnum = cur_room->objects; objnum != -1; objnum = Objects[objnum].next)
+		// Only the objects near the movement box can pass the AABB check in check_hit_obj
+		num_room_objs = ObjGridGather(ROOMNUM(cur_room), &fvi_min_xyz, &fvi_max_xyz, room_objs);
+		for (j = 0; j < num_room_objs; j++)
 		{
-			ASSERT(objnum != -1);
-			check_hit_obj(objnum);
+			check_hit_obj(room_objs[j]);
 		}
 	}
 }
@@ -4695,6 +4970,26 @@ bool PhysPastPortal(const room *rp,portal *pp)
 }
 
 
+//GetFacePhysicsFlags() looks up the face's bitmap, which can evaluate a procedural or page in an
+//animation.  Queries on job threads stop at faces that could need either.
+static inline int fvi_FacePhysicsFlags(const room *rp,const face *fp)
+{
+#ifndef NED_PHYSICS
+	if(Fvi_job_query)
+	{
+		texture *texp = &GameTextures[fp->tmap];
+
+		if((texp->flags & TF_PROCEDURAL) || ((texp->flags & TF_ANIMATED) && (GameVClips[texp->bm_handle].flags & VCF_NOT_RESIDENT)))
+		{
+			Fvi_job_unsafe = true;
+			return FPF_SOLID;
+		}
+	}
+#endif
+
+	return GetFacePhysicsFlags(rp, fp);
+}
+
 int fvi_room(int room_index, int from_portal, int room_obj) 
 {
 	vector hit_point;				// where we hit
@@ -4772,7 +5067,7 @@ int fvi_room(int room_index, int from_portal, int room_obj)
 //			if ((msector & cur_room->faces[i].sector) != cur_room->faces[i].sector) continue;
   			if (!room_movement_AABB(&cur_room->faces[i])) continue;
   			
-  			face_info = GetFacePhysicsFlags(cur_room, &cur_room->faces[i]);
+  			face_info = fvi_FacePhysicsFlags(cur_room, &cur_room->faces[i]);
   			if(face_info == FPT_IGNORE) continue;
 
   			if(portal_num >= 0 && portal_num == from_portal) continue;
@@ -4876,7 +5171,7 @@ int fvi_room(int room_index, int from_portal, int room_obj)
 					portal_num = cur_face->portal_num;
 					if(portal_num >= 0 && portal_num == from_portal) continue;
 
-					face_info = GetFacePhysicsFlags(cur_room, cur_face);
+					face_info = fvi_FacePhysicsFlags(cur_room, cur_face);
 					if(face_info == FPT_IGNORE) continue;
 
 					f_backface = false;
@@ -19,7 +19,12 @@
 #include "gl_local.h"
 #include "gl_mesh.h"
 
-MeshBuilder::MeshBuilder()
+MeshBuilder::MeshBuilder() : MeshBuilder(false)
+{
+}
+
+MeshBuilder::MeshBuilder(bool use_frame_arena)
+	: m_vertices(FrameAllocator<RendVertex>(use_frame_arena)), m_indicies(FrameAllocator<uint32_t>(use_frame_arena))
 {
 	m_initialized = false;
 	m_vertexstartoffset = m_vertexstartcount = 0;
@@ -177,6 +182,10 @@ void VertexBuffer::Initialize(uint32_t numvertices, uint32_t datasize, void* dat
 	glEnableVertexAttribArray(6);
 	glVertexAttribPointer(6, 2, GL_FLOAT, GL_FALSE, sizeof(RendVertex), (void*)offsetof(RendVertex, u2));
 
+	//Room number
+	glEnableVertexAttribArray(7);
+	glVertexAttribIPointer(7, 1, GL_INT, sizeof(RendVertex), (void*)offsetof(RendVertex, roomnum));
+
 	m_size = datasize;
 	m_vertexcount = numvertices;
 
@@ -229,6 +238,16 @@ void VertexBuffer::DrawIndexed(ElementRange range) const
 	glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (const void*)(range.offset * sizeof(uint32_t)));
 }
 
+void VertexBuffer::DrawIndexedMulti(const uint32_t* offsets, const int* counts, int numranges) const
+{
+	static std::vector<const void*> pointers;
+	pointers.resize(numranges);
+	for (int i = 0; i < numranges; i++)
+		pointers[i] = (const void*)(offsets[i] * sizeof(uint32_t));
+
+	glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, pointers.data(), numranges);
+}
+
 void VertexBuffer::Destroy()
 {
 	if (m_vaoname != 0)
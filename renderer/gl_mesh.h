@@ -22,6 +22,7 @@
 #include <vector>
 #include "pstypes.h"
 #include "vecmat.h"
+#include "framealloc.h"
 
 //A sortable element is used to batch up elements by their texture and lightmap handle, if used. 
 struct SortableElement
@@ -48,6 +49,7 @@ struct RendVertex
 	float u1, v1;
 	float u2, v2;
 	float uslide, vslide; //only slide uv1 for the moment
+	int roomnum; //used to look up the per room data in room shaders
 };
 
 //A batch of 0-2 texture handles.
@@ -100,6 +102,8 @@ public:
 	void Draw(ElementRange range) const;
 	//Draws a range of vertices from the buffer, from the range of the currently bound index buffer
 	void DrawIndexed(ElementRange range) const;
+	//Draws several ranges of the currently bound index buffer in one call. Offsets are in indices.
+	void DrawIndexedMulti(const uint32_t* offsets, const int* counts, int numranges) const;
 
 	void Destroy();
 };
@@ -137,11 +141,20 @@ class MeshBuilder
 	uint32_t m_indexstartoffset;
 	uint32_t m_indexstartcount;
 
-	std::vector<RendVertex> m_vertices;
-	std::vector<uint32_t> m_indicies;
+	std::vector<RendVertex, FrameAllocator<RendVertex>> m_vertices;
+	std::vector<uint32_t, FrameAllocator<uint32_t>> m_indicies;
 
 public:
 	MeshBuilder();
+	//If use_frame_arena is true, the vertex and index lists are allocated from the frame arena,
+	//and the builder must not be kept past the end of the frame.
+	explicit MeshBuilder(bool use_frame_arena);
+
+	//Allocator the lists are stored with, for any scratch lists that go with this mesh.
+	FrameAllocator<uint32_t> Allocator() const
+	{
+		return m_indicies.get_allocator();
+	}
 
 	//Begins submitting vertices for a render pass.
 	void BeginVertices();
@@ -19,21 +19,29 @@
 #include <string>
 #include <vector>
 #include "CFILE.H"
+#include "gl_local.h"
 #include "gl_shader.h"
 #include "pserror.h"
 #include "renderer.h"
 
 GLuint commonbuffername;
 GLuint legacycommonbuffername;
-GLuint fogbuffername;
 GLuint specularbuffername;
 
+//Per room data is packed into a buffer texture, so there's no limit on how many rooms can be drawn
+GLuint roombuffername;
+GLuint roomtexturename;
+int roombuffersize;
+
 ShaderProgram* lastshaderprog = nullptr;
 
 constexpr int COMMON_BINDING = 0;
 constexpr int LEGACY_BINDING = 1;
 constexpr int SPECULAR_BINDING = 2;
-constexpr int ROOM_BINDING = 3;
+
+//Texture unit the room data buffer texture is bound to
+constexpr int ROOMDATA_UNIT = 3;
+constexpr int ROOMDATA_INITIAL_SIZE = 400;
 
 //Shader pipeline system.
 //Contains a table of all shader definitions used by newrender. Renderer will request shader handles by name.
@@ -81,10 +89,20 @@ void opengl_InitShaders(void)
 	if (err != GL_NO_ERROR)
 		Int3();
 
-	glGenBuffers(1, &fogbuffername);
-	glBindBuffer(GL_COPY_WRITE_BUFFER, fogbuffername);
-	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(RoomBlock) * 100, nullptr, GL_DYNAMIC_READ);
-	glBindBufferBase(GL_UNIFORM_BUFFER, ROOM_BINDING, fogbuffername);
+	//Each RoomBlock is three RGBA texels
+	roombuffersize = ROOMDATA_INITIAL_SIZE;
+	glGenBuffers(1, &roombuffername);
+	glBindBuffer(GL_TEXTURE_BUFFER, roombuffername);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(RoomBlock) * roombuffersize, nullptr, GL_DYNAMIC_DRAW);
+
+	glGenTextures(1, &roomtexturename);
+	glActiveTexture(GL_TEXTURE0 + ROOMDATA_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, roomtexturename);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, roombuffername);
+	if (Last_texel_unit_set >= 0)
+		glActiveTexture(GL_TEXTURE0 + Last_texel_unit_set);
+	else
+		glActiveTexture(GL_TEXTURE0);
 
 	err = glGetError();
 	if (err != GL_NO_ERROR)
@@ -146,19 +164,23 @@ void rend_UpdateSpecular(SpecularBlock* specularstate)
 
 void rend_UpdateFogBrightness(RoomBlock* roomstate, int numrooms)
 {
-	glBindBuffer(GL_COPY_WRITE_BUFFER, fogbuffername);
-	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(RoomBlock) * numrooms, roomstate);
+	glBindBuffer(GL_TEXTURE_BUFFER, roombuffername);
+	if (numrooms > roombuffersize)
+	{
+		//The texture sees the new storage without needing to be reattached
+		roombuffersize = numrooms;
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(RoomBlock) * roombuffersize, roomstate, GL_DYNAMIC_DRAW);
+	}
+	else
+	{
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(RoomBlock) * numrooms, roomstate);
+	}
 
 	GLenum err = glGetError();
 	if (err != GL_NO_ERROR)
 		Int3();
 }
 
-void rend_SetCurrentRoomNum(int roomblocknum)
-{
-	glBindBufferRange(GL_UNIFORM_BUFFER, ROOM_BINDING, fogbuffername, roomblocknum * sizeof(RoomBlock), sizeof(RoomBlock));
-}
-
 void GL_UpdateLegacyBlock(float* projection, float* modelview)
 {
 	CommonBlock newblock;
@@ -256,12 +278,10 @@ void ShaderProgram::CreateCommonBindings(int bindindex)
 		glUniformBlockBinding(m_name, uboindex, SPECULAR_BINDING);
 	}
 	
-	//Find RoomBlock
-	uboindex = glGetUniformBlockIndex(m_name, "RoomBlock");
-	if (uboindex != GL_INVALID_INDEX)
-	{
-		glUniformBlockBinding(m_name, uboindex, ROOM_BINDING);
-	}
+	//Find roomdata
+	index = glGetUniformLocation(m_name, "roomdata");
+	if (index != -1)
+		glUniform1i(index, ROOMDATA_UNIT);
 
 	GLenum err = glGetError();
 	if (err != GL_NO_ERROR)
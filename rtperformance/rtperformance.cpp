@@ -58,6 +58,14 @@
 #include <windows.h>
 #endif
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#ifdef __LINUX__
+#include <time.h>
+#endif
+
 #include "rtperformance.h"
 #include "pstypes.h"
 #include "mono.h"
@@ -65,6 +73,7 @@
 #include "manage.h"
 #include "ddio.h"
 #include "CFILE.H"
+#include "args.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -73,9 +82,12 @@
 
 float rtp_startlog_time;
 
-// maximum number of samples before we stop and autoflush
+// number of frames kept.  Once full, the oldest frames are overwritten
 #define MAX_RTP_SAMPLES	3800	//this is a little more than whats needed for 2 minutes at 30fps
 
+// number of zones kept per thread (must be a power of 2).  Once full, the oldest zones are overwritten
+#define MAX_RTP_ZONE_EVENTS	(1 << 17)
+
 //		Internal Global Vars
 // ------------------------------
 INT64 Runtime_performance_flags = RTI_FRAMETIME;
@@ -87,6 +99,72 @@ unsigned char Runtime_performance_enabled = 0;
 tRTFrameInfo RTP_SingleFrame;
 #ifdef USE_RTP
 tRTFrameInfo RTP_FrameBuffer[MAX_RTP_SAMPLES];
+
+static const char *RTP_subsystem_names[RTZ_NUM_SUBSYSTEMS] = {"Game","Render","Multi","AI","Physics","VisEffect"};
+
+typedef struct
+{
+	const char *name;
+	INT64 start;
+	INT64 duration;
+	short subsystem;
+	short depth;
+}tRTZoneEvent;
+
+// Every thread that records a zone gets one of these.  Only the owning thread writes to it, and the
+// log is only started or written between frames, when the job threads are idle.
+typedef struct
+{
+	int tid;
+	std::atomic<unsigned int> count;			//zones written since the log started
+	tRTZoneEvent events[MAX_RTP_ZONE_EVENTS];
+}tRTThreadBuffer;
+
+static std::mutex RTP_thread_buffer_lock;
+static std::vector<std::unique_ptr<tRTThreadBuffer>> RTP_thread_buffers;
+static thread_local tRTThreadBuffer *RTP_this_thread_buffer = nullptr;
+
+static thread_local int RTP_zone_depth = 0;
+static thread_local int RTP_subsystem_depth[RTZ_NUM_SUBSYSTEMS];
+
+// Time in the outermost zones of each subsystem during the current frame, from all threads
+static std::atomic<long long> RTP_zone_totals[RTZ_NUM_SUBSYSTEMS];
+
+static INT64 RTP_log_start_clock = 0;
+static INT64 RTP_last_frame_clock = 0;
+
+static tRTThreadBuffer *rtp_GetThreadBuffer(void)
+{
+	if (!RTP_this_thread_buffer)
+	{
+		tRTThreadBuffer *tb = new tRTThreadBuffer;
+		tb->count = 0;
+
+		std::lock_guard<std::mutex> lock(RTP_thread_buffer_lock);
+		tb->tid = (int)RTP_thread_buffers.size() + 1;
+		RTP_thread_buffers.emplace_back(tb);
+		RTP_this_thread_buffer = tb;
+	}
+
+	return RTP_this_thread_buffer;
+}
+
+// Returns the number of frames in the frame buffer, and the buffer index of the oldest
+static unsigned int rtp_GetRecordedFrames(unsigned int *first)
+{
+	unsigned int num_frames = Runtime_performance_counter;
+	if (num_frames > MAX_RTP_SAMPLES)
+		num_frames = MAX_RTP_SAMPLES;
+
+	*first = (Runtime_performance_counter - num_frames) % MAX_RTP_SAMPLES;
+	return num_frames;
+}
+
+// Converts a clock to microseconds since the log started, for the trace
+static double rtp_TraceTime(INT64 clock)
+{
+	return (double)(clock - RTP_log_start_clock) * 1000000.0 / (double)Runtime_performance_clockfreq;
+}
 #endif
 
 
@@ -101,10 +179,11 @@ void rtp_WriteBufferLog(void)
 	Runtime_performance_enabled = 1; //make sure it's enabled for the macros
 	//determine how many frames to write out
 	unsigned int Num_frames;
+	unsigned int first_frame;
 	unsigned int counter;
 	char buffer[4096];
 
-	Num_frames = min(Runtime_performance_counter,MAX_RTP_SAMPLES);
+	Num_frames = rtp_GetRecordedFrames(&first_frame);
 
 	// Open the log file for writing
 	ddio_MakePath(buffer,User_directory,"D3Performance.txt",NULL);	
@@ -114,11 +193,16 @@ void rtp_WriteBufferLog(void)
 		mprintf((0,"RTP: Recording Log\n"));
 
 		strcpy(buffer,"FrameNum,FrameTime,RenderFrameTime,MultiFrameTime,MusicFrameTime,AmbientSoundTime,WeatherFrameTime,PlayerFrameTime,DoorwayFrameTime,LevelGoalFrameTime,MatCenFrameTime,ObjectFrameTime,AIFrameAllTime,ProcessKeysTime,REN:NumTexturesUploaded,REN:PolysDrawn,OBJ:CT_FlyingTime,OBJ:CT_AIDoFrameTime,OBJ:CT_WeaponFrameTime,OBJ:CT_ExplosionFrameTime,OBJ:CT_DebrisFrameTime,OBJ:CT_SplinterFrameTime,OBJ:MT_PhsyicsFrameTime,OBJ:MT_WalkingFrame,OBJ:MT_ShockWaveTime,OBJ:DoEffectTime,OBJ:MovePlayerTime,OBJ:D3XIntervalTime,OBJ:ObjLightTime,FRAME:NormalEventTime,AnimCycle,VisEffectMoveAll,DoPhysLinkedFrame,ObjDoFrame,NumFVICalls,FVITime");
+		for (int i = 0; i < RTZ_NUM_SUBSYSTEMS; i++)
+		{
+			strcat(buffer,",ZONE:");
+			strcat(buffer,RTP_subsystem_names[i]);
+		}
 		cf_WriteString(file,buffer);
 
 		// Loop through all the frames, and write out the data for each frame
 		for( counter = 0; counter < Num_frames; counter++ ){
-			tRTFrameInfo *fi = &RTP_FrameBuffer[counter];
+			tRTFrameInfo *fi = &RTP_FrameBuffer[(first_frame + counter) % MAX_RTP_SAMPLES];
 			double renderframe_time;
 			double multiframe_time;
 			double musicframe_time;
@@ -189,7 +273,14 @@ void rtp_WriteBufferLog(void)
 				processkeys_time,fi->texture_uploads,fi->polys_drawn,ct_flying_time,ct_aidoframe_time,ct_weaponframe_time,
 				ct_explosionframe_time,ct_debrisframe_time,ct_splinterframe_time,mt_physicsframe_time,mt_walkingframe_time,
 				mt_shockwave_time,obj_doeffect_time,obj_move_player_time,obj_d3xint_time,obj_objlight_time,normalevent_time,cycle_anim,
-				vis_eff_move,phys_link,obj_do_frm,fi->fvi_calls,fi->fvi_time);
+				vis_eff_move,phys_link,obj_do_frm,fi->fvi_calls,fvi_time);
+
+			for (int i = 0; i < RTZ_NUM_SUBSYSTEMS; i++)
+			{
+				double zone_time;
+				RTP_CLOCKSECONDS(fi->zone_time[i],zone_time);
+				sprintf(buffer + strlen(buffer),",%f",zone_time);
+			}
 			
 			
 			cf_WriteString(file,buffer);
@@ -202,6 +293,186 @@ void rtp_WriteBufferLog(void)
 #endif
 }
 
+/*
+void rtp_WriteTraceLog
+	Writes the zones recorded since the log started to file, in the Chrome trace event format
+*/
+void rtp_WriteTraceLog(void)
+{
+#ifdef USE_RTP
+	char buffer[_MAX_PATH];
+
+	ddio_MakePath(buffer,User_directory,"D3Trace.json",NULL);
+	CFILE *file = cfopen(buffer,"wt");
+	if (!file)
+	{
+		mprintf((0,"RTP: Unable to open trace for writing\n"));
+		return;
+	}
+
+	mprintf((0,"RTP: Recording Trace\n"));
+	cfprintf(file,"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	// Name the threads. The frames go on their own track
+	cfprintf(file,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Frames\"}}");
+
+	std::lock_guard<std::mutex> lock(RTP_thread_buffer_lock);
+	for (std::unique_ptr<tRTThreadBuffer> &tb : RTP_thread_buffers)
+		cfprintf(file,",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",tb->tid,tb->tid);
+
+	unsigned int first_frame;
+	unsigned int num_frames = rtp_GetRecordedFrames(&first_frame);
+	for (unsigned int i = 0; i < num_frames; i++)
+	{
+		tRTFrameInfo *fi = &RTP_FrameBuffer[(first_frame + i) % MAX_RTP_SAMPLES];
+		cfprintf(file,",\n{\"name\":\"Frame %d\",\"cat\":\"Frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":0}",
+			(int)fi->frame_num,rtp_TraceTime(fi->frame_start),rtp_TraceTime(fi->frame_start + fi->frame_clocks) - rtp_TraceTime(fi->frame_start));
+	}
+
+	for (std::unique_ptr<tRTThreadBuffer> &tb : RTP_thread_buffers)
+	{
+		unsigned int count = tb->count.load(std::memory_order_acquire);
+		unsigned int start = (count > MAX_RTP_ZONE_EVENTS) ? count - MAX_RTP_ZONE_EVENTS : 0;
+
+		for (unsigned int i = start; i < count; i++)
+		{
+			tRTZoneEvent *ev = &tb->events[i & (MAX_RTP_ZONE_EVENTS - 1)];
+			if (ev->start < RTP_log_start_clock)
+				continue;
+
+			cfprintf(file,",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+				ev->name,RTP_subsystem_names[ev->subsystem],rtp_TraceTime(ev->start),
+				(double)ev->duration * 1000000.0 / (double)Runtime_performance_clockfreq,tb->tid);
+		}
+	}
+
+	cfprintf(file,"\n]}\n");
+	cfclose(file);
+#endif
+}
+
+/*
+int rtp_GetSummary
+	Fills buffer with a few lines giving the time per frame of each subsystem over the frames
+	recorded so far.  Returns the number of frames summarized.
+*/
+int rtp_GetSummary(char *buffer,int size)
+{
+#ifdef USE_RTP
+	unsigned int first_frame;
+	unsigned int num_frames = rtp_GetRecordedFrames(&first_frame);
+
+	if (num_frames == 0)
+	{
+		snprintf(buffer,size,"RTP: No frames recorded\n");
+		return 0;
+	}
+
+	double freq = (double)Runtime_performance_clockfreq;
+	double frame_total = 0, frame_max = 0;
+	double zone_total[RTZ_NUM_SUBSYSTEMS] = {};
+	double zone_max[RTZ_NUM_SUBSYSTEMS] = {};
+
+	for (unsigned int i = 0; i < num_frames; i++)
+	{
+		tRTFrameInfo *fi = &RTP_FrameBuffer[(first_frame + i) % MAX_RTP_SAMPLES];
+
+		double frame_time = (double)fi->frame_clocks / freq;
+		frame_total += frame_time;
+		if (frame_time > frame_max)
+			frame_max = frame_time;
+
+		for (int j = 0; j < RTZ_NUM_SUBSYSTEMS; j++)
+		{
+			double zone_time = (double)fi->zone_time[j] / freq;
+			zone_total[j] += zone_time;
+			if (zone_time > zone_max[j])
+				zone_max[j] = zone_time;
+		}
+	}
+
+	int len = snprintf(buffer,size,"RTP: %d frames, avg %.3f ms, max %.3f ms\n",num_frames,frame_total * 1000.0 / num_frames,frame_max * 1000.0);
+
+	// Zones on the job threads run alongside the main thread, so a subsystem can take more than 100%
+	for (int j = 0; j < RTZ_NUM_SUBSYSTEMS && len >= 0 && len < size; j++)
+	{
+		len += snprintf(buffer + len,size - len,"  %-10s avg %7.3f ms  max %7.3f ms  %5.1f%%\n",RTP_subsystem_names[j],
+			zone_total[j] * 1000.0 / num_frames,zone_max[j] * 1000.0,frame_total > 0 ? zone_total[j] * 100.0 / frame_total : 0.0);
+	}
+
+	return num_frames;
+#else
+	snprintf(buffer,size,"RTP: Run-time profiling isn't in this build\n");
+	return 0;
+#endif
+}
+
+// Writes the summary to file and the mono window
+static void rtp_WriteSummaryLog(void)
+{
+#ifdef USE_RTP
+	char buffer[2048];
+	char path[_MAX_PATH];
+
+	rtp_GetSummary(buffer,sizeof(buffer));
+	mprintf((0,"%s",buffer));
+
+	ddio_MakePath(path,User_directory,"D3PerfSummary.txt",NULL);
+	CFILE *file = cfopen(path,"wt");
+	if (file)
+	{
+		cfprintf(file,"%s",buffer);
+		cfclose(file);
+	}
+	else
+		mprintf((0,"RTP: Unable to open summary for writing\n"));
+#endif
+}
+
+/*
+INT64 rtp_ZoneBegin
+	Starts a zone on the calling thread, returning its start time
+*/
+INT64 rtp_ZoneBegin(int subsystem)
+{
+#ifdef USE_RTP
+	RTP_zone_depth++;
+	RTP_subsystem_depth[subsystem]++;
+	return rtp_GetClock();
+#else
+	return 0;
+#endif
+}
+
+/*
+void rtp_ZoneEnd
+	Ends a zone started with rtp_ZoneBegin, adding it to the thread's buffer
+*/
+void rtp_ZoneEnd(const char *name,int subsystem,INT64 start)
+{
+#ifdef USE_RTP
+	INT64 duration = rtp_GetClock() - start;
+
+	RTP_zone_depth--;
+	// Nested zones of the same subsystem are already counted by the outer one
+	if (--RTP_subsystem_depth[subsystem] == 0)
+		RTP_zone_totals[subsystem].fetch_add(duration,std::memory_order_relaxed);
+
+	if (!Runtime_performance_enabled)
+		return;
+
+	tRTThreadBuffer *tb = rtp_GetThreadBuffer();
+	unsigned int count = tb->count.load(std::memory_order_relaxed);
+	tRTZoneEvent *ev = &tb->events[count & (MAX_RTP_ZONE_EVENTS - 1)];
+	ev->name = name;
+	ev->start = start;
+	ev->duration = duration;
+	ev->subsystem = subsystem;
+	ev->depth = RTP_zone_depth;
+	tb->count.store(count + 1,std::memory_order_release);
+#endif
+}
+
 /*
 void rtp_RecordFrame
 	Calling this will record the data of the frame into the internal log, and prepare for
@@ -214,17 +485,21 @@ void rtp_RecordFrame(void)
 		//	do our saving of information
 		// --------------------------------
 
+		INT64 now = rtp_GetClock();
+
 		RTP_SingleFrame.frame_num = Runtime_performance_frame_counter;	//save the frame num
+		RTP_SingleFrame.frame_start = RTP_last_frame_clock;
+		RTP_SingleFrame.frame_clocks = now - RTP_last_frame_clock;
+		RTP_last_frame_clock = now;
 
-		// Copy everything into the buffer, and advance the buffer
-		memcpy(&RTP_FrameBuffer[Runtime_performance_counter],&RTP_SingleFrame,sizeof(tRTFrameInfo));
+		for (int i = 0; i < RTZ_NUM_SUBSYSTEMS; i++)
+			RTP_SingleFrame.zone_time[i] = RTP_zone_totals[i].exchange(0,std::memory_order_relaxed);
 
-		Runtime_performance_counter++;
+		// Copy everything into the buffer, and advance the buffer.  When the buffer
+		// is full, the oldest frame is replaced
+		memcpy(&RTP_FrameBuffer[Runtime_performance_counter % MAX_RTP_SAMPLES],&RTP_SingleFrame,sizeof(tRTFrameInfo));
 
-		if ( Runtime_performance_counter >= MAX_RTP_SAMPLES ){
-			// uh oh, we hit the end of our samples, flush the buffer and stop
-			rtp_StopLog();
-		}
+		Runtime_performance_counter++;
 
 		//	reset our global struct to zero everything out	
 		// ------------------------------------------------
@@ -253,8 +528,10 @@ void rtp_Init(void)
 	Runtime_performance_counter = 0;
 	Runtime_performance_enabled = 0;
 
-	#ifdef MACINTOSH
+	#if defined(MACINTOSH)
 		Runtime_performance_clockfreq = 1000000;	//micoseconds
+	#elif defined(__LINUX__)
+		Runtime_performance_clockfreq = 1000000000;	//nanoseconds
 	#else
 	LARGE_INTEGER freq;
 	if(!QueryPerformanceFrequency(&freq)) {
@@ -269,6 +546,10 @@ void rtp_Init(void)
 	rtp_EnableFlags(RTI_FRAMETIME);
 
 	atexit(rtp_Close);
+
+	// -rtplog records from startup until the game quits, or the log is stopped
+	if (FindArg("-rtplog"))
+		rtp_StartLog();
 #endif
 }
 
@@ -317,9 +598,21 @@ void rtp_StartLog(void)
 #ifdef USE_RTP
 	mprintf((0,"RTP: Starting Log\n"));
 	Runtime_performance_counter = 0;
-	Runtime_performance_enabled = 1;
 	memset(&RTP_SingleFrame,0,sizeof(tRTFrameInfo));
 	rtp_startlog_time = timer_GetTime();
+
+	RTP_log_start_clock = rtp_GetClock();
+	RTP_last_frame_clock = RTP_log_start_clock;
+	for (int i = 0; i < RTZ_NUM_SUBSYSTEMS; i++)
+		RTP_zone_totals[i] = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(RTP_thread_buffer_lock);
+		for (std::unique_ptr<tRTThreadBuffer> &tb : RTP_thread_buffers)
+			tb->count = 0;
+	}
+
+	Runtime_performance_enabled = 1;
 #endif
 }
 
@@ -336,6 +629,8 @@ void rtp_StopLog(void)
 	
 	// Save out the log now
 	rtp_WriteBufferLog();
+	rtp_WriteTraceLog();
+	rtp_WriteSummaryLog();
 
 	Runtime_performance_enabled = 0;
 #endif
@@ -374,12 +669,16 @@ INT64 rtp_GetClock
 INT64 rtp_GetClock(void)
 {
 #ifdef USE_RTP
-	#ifdef MACINTOSH
+	#if defined(MACINTOSH)
 		INT64 currentTimeUI	= 0;
 		
 		// Get the current time in microseconds
 		Microseconds((UnsignedWide*)(&currentTimeUI));
 		return currentTimeUI;
+	#elif defined(__LINUX__)
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return (INT64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 	#else
 		LARGE_INTEGER t;
 		QueryPerformanceCounter(&t);
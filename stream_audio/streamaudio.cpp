@@ -163,12 +163,17 @@
  *
  * $NoKeywords: $
  */
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "streamaudio.h"
 #include "pserror.h"
 #include "CFILE.H"
 #include "mem.h"
 #include "Macros.h"
 #include "ddio.h"
+#include "args.h"
 #include <stdlib.h>
 #include <string.h>
 //#include "samirlog.h"
@@ -180,11 +185,29 @@ unsigned AudioDecoder_Read(AudioDecoder *ad, void *buf, unsigned qty);
 void AudioDecoder_Close(AudioDecoder *ad);
 void AudioDecoder_MallocFree(MemoryAllocFunc *fn_malloc, MemoryFreeFunc *fn_free);
 #endif 
+//	guards everything but the buffer ring against the decode thread. taken by the decode thread for
+//	one pass over the streams at a time, and by the calls that open, start and stop streams.
+static std::recursive_mutex &StreamLock()
+{
+	static std::recursive_mutex lock;
+	return lock;
+}
+static std::thread *Stream_decode_thread = NULL;
+static std::condition_variable_any Stream_decode_wake;
+static bool Stream_decode_quit = false;
+//	handed to the sound system when the decode thread falls behind. about 45ms of 16-bit stereo.
+#define STRM_SILENCE_SIZE		4096
+static ubyte Stream_silence_16[STRM_SILENCE_SIZE];
+static ubyte Stream_silence_8[STRM_SILENCE_SIZE];
+static int Stream_last_underruns = 0;
 //	this stream is for everyone (used by the StreamPlay interface)
 static AudioStream User_audio_stream;
 llsSystem *AudioStream::m_ll_sndsys = NULL;
 AudioStream *AudioStream::m_streams[STRM_LIMIT];
 int AudioStream::m_thisid = -1;
+AudioStream *AudioStream::m_firststream = NULL;
+std::atomic<int> AudioStream::m_totalunderruns(0);
+int AudioStream::m_latency = STRM_DEFAULT_LATENCY;
 #define SAMPLES_PER_STREAM_SHORT_BUF		22050
 #define SAMPLES_PER_STREAM_BUF				44100
 //	sets the low-level sound object
@@ -197,6 +220,23 @@ void AudioStream::InitSystem(llsSystem *sndsys)
 	{
 		AudioStream::m_streams[i] = NULL;
 	}
+	i = FindArg("-streamlatency");
+	if (i) {
+		AudioStream::m_latency = atoi(GetArg(i+1));
+		if (AudioStream::m_latency < 0) 
+			AudioStream::m_latency = 0;
+		mprintf((0, "STRMAUD: Stream latency set to %dms\n", AudioStream::m_latency));
+	}
+	memset(Stream_silence_8, 0x80, sizeof(Stream_silence_8));
+	if (!Stream_decode_thread) {
+		static bool registered = false;
+		Stream_decode_quit = false;
+		Stream_decode_thread = new std::thread(AudioStream::DecodeThread);
+		if (!registered) {
+			atexit(AudioStream::StopDecodeThread);
+			registered = true;
+		}
+	}
 }
 //	shutdsown
 void AudioStream::Shutdown()
@@ -213,6 +253,50 @@ void AudioStream::Shutdown()
 		}
 		AudioStream::m_ll_sndsys = NULL;
 	}
+	AudioStream::StopDecodeThread();
+}
+void AudioStream::StopDecodeThread()
+{
+	if (!Stream_decode_thread)
+		return;
+	{
+		std::lock_guard<std::recursive_mutex> lock(StreamLock());
+		Stream_decode_quit = true;
+	}
+	Stream_decode_wake.notify_one();
+	Stream_decode_thread->join();
+	delete Stream_decode_thread;
+	Stream_decode_thread = NULL;
+}
+//	keeps the buffer rings of all streams topped up. playing streams are filled as far as their ring
+//	goes, stopped ones as far as they were asked to predecode.
+void AudioStream::DecodeThread()
+{
+	std::unique_lock<std::recursive_mutex> lock(StreamLock());
+	while (!Stream_decode_quit)
+	{
+		bool busy = false;
+	// fill one buffer per stream per pass, so the lock is let go between buffers.
+		for (AudioStream *strm = m_firststream; strm; strm = strm->m_nextstream)
+		{
+			if (!strm->m_archive.Opened()) 
+				continue;
+			if (strm->m_state == STRM_PLAYING) {
+				busy |= strm->UpdateData();
+			}
+			else if (strm->m_state == STRM_STOPPED && strm->BufferedBytes() < strm->m_predecode_bytes) {
+				busy |= strm->UpdateData();
+			}
+		}
+		if (busy) {
+			lock.unlock();
+			lock.lock();
+		}
+		else {
+		// woken by Frame, but don't count on it while the game is stalled.
+			Stream_decode_wake.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
 }
 // allocates a stream slot for a stream
 bool AudioStream::ActivateStream(AudioStream *stream)
@@ -243,6 +327,12 @@ void AudioStream::Frame()
 	float time = timer_GetTime();
 	if (!m_ll_sndsys)
 		return;
+// buffers are refilled by the decode thread.
+	Stream_decode_wake.notify_one();
+	if (m_totalunderruns != Stream_last_underruns) {
+		Stream_last_underruns = m_totalunderruns;
+		mprintf((0, "STRMAUD: %d stream underruns so far\n", Stream_last_underruns));
+	}
 	for(t=0; t < STRM_LIMIT; t++) 
 	{
 		if (AudioStream::m_streams[t]) {
@@ -257,8 +347,6 @@ void AudioStream::Frame()
 					strm->m_curmeasure++;
 				}
 				strm->m_last_frametime = time;
-				if (strm->m_state == STRM_PLAYING) 
-					strm->UpdateData();
 			}
 			else if (strm->m_state == STRM_STOPPING) {
 				if (!AudioStream::m_ll_sndsys->IsSoundInstancePlaying(strm->m_llshandle)) {
@@ -275,11 +363,12 @@ void AudioStream::Frame()
 				strm->DeactivateStream(strm);
 			}
 			else if (strm->m_start_on_frame) {
+				std::lock_guard<std::recursive_mutex> lock(StreamLock());
 				strm->m_llshandle = m_ll_sndsys->PlayStream(&strm->m_playinfo);
 				if(strm->m_llshandle > -1) {
 				// for one buffer samples, prepare to stop now so that the one and only one buffer gets called.
 				//	looped one buffer samples dont do this though...
-					if (strm->m_nbufs == 1 && !strm->m_start_on_frame_looped) {
+					if (CHECK_FLAG(strm->m_buffer[strm->m_sbufidx].flags, STRM_BUFF_TERMINAL) && !strm->m_start_on_frame_looped) {
 						strm->m_state = STRM_STOPPING;
 					}
 					else {
@@ -333,11 +422,33 @@ AudioStream::AudioStream()
 	m_playcount = 0;
 	m_curid = -1;
 	m_nbufs = 0;
+	m_nslots = STRM_BUFCOUNT;
+	m_bytes_per_sec = 0;
+	m_predecode_bytes = 0;
 	m_start_on_frame = false;
+	m_underruns = 0;
+	for (int i = 0; i < STRM_MAX_BUFCOUNT; i++)
+	{
+		m_buffer[i].data = NULL;
+		m_buffer[i].nbytes = 0;
+		m_buffer[i].flags = 0;
+		m_buffer[i].id = -1;
+	}
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
+	m_nextstream = m_firststream;
+	m_firststream = this;
 }
 AudioStream::~AudioStream()
 {
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
 	AudioStream::Close();
+	for (AudioStream **link = &m_firststream; *link; link = &(*link)->m_nextstream)
+	{
+		if (*link == this) {
+			*link = m_nextstream;
+			break;
+		}
+	}
 }
 // sets flags for playback (STRM_OPNF_XXX)
 void AudioStream::SetFlags(int flags)
@@ -346,6 +457,7 @@ void AudioStream::SetFlags(int flags)
 }
 void AudioStream::SetLoopCount(int loop_count)
 {
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
 // if loop_count = 0, then m_loopcount= -1, infinite;
 // if loop_count = 1, then m_loopcount=0, no looping, etc.
 	m_loopcount = loop_count-1;
@@ -371,6 +483,7 @@ float AudioStream::GetVolume()
 //	flags specify what type of stream it is.
 bool AudioStream::Open(const char *filename,int open_flags)
 {
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
 // don't open a stream that's already open, or bogus filename
 	if (m_state != STRM_INVALID) {
 		AudioStream::Close();
@@ -393,6 +506,8 @@ bool AudioStream::Open(const char *filename,int open_flags)
 	m_readahead_finished_loop = false;
 	m_curid = -1;
 	m_nbufs = 0;
+	m_predecode_bytes = 0;
+	m_underruns = 0;
 	m_start_on_frame = m_start_on_frame_looped = false;
 //	open up stream file
 	if (m_archive.Open(filename)) {
@@ -402,19 +517,23 @@ bool AudioStream::Open(const char *filename,int open_flags)
 		m_thisid++;
 		m_curid = m_thisid;
 		
-		for (i=0;i<STRM_BUFCOUNT; i++)
+		for (i=0;i<STRM_MAX_BUFCOUNT; i++)
 		{
 			m_buffer[i].flags = 0;
 			m_buffer[i].nbytes = 0;
 			m_buffer[i].data = NULL;
 			m_buffer[i].id = -1;									// marks stream buffer to be allocated.
 		}
-	// gradual streams don't readahead yet.
-		nbufs = CHECK_FLAG(m_flags, STRM_OPNF_GRADUAL) ? 1 : STRM_BUFCOUNT;
+	// only the first buffer is decoded here, the decode thread reads ahead the rest.
+		nbufs = 1;
 	
 		if (!AudioStream::ReopenDigitalStream(0, nbufs)) {
 			return false;
 		}
+	// gradual streams don't readahead yet.
+		if (!CHECK_FLAG(m_flags, STRM_OPNF_GRADUAL)) {
+			m_predecode_bytes = (int)(((long long)m_latency * m_bytes_per_sec) / 1000);
+		}
 		m_loopmutex.Create();
 		AudioStream::SetLoopCount(1);
 		m_laststate = m_state;
@@ -426,6 +545,7 @@ bool AudioStream::Open(const char *filename,int open_flags)
 //	deallocates all stream buffers and decoder.
 void AudioStream::Close()
 {
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
 	int i;
 	if (m_archive.Opened()) {
 	// stop the stream, close the archive, close the decoder.
@@ -434,7 +554,7 @@ void AudioStream::Close()
 		m_loopmutex.Destroy();
 		m_curid = -1;
 	// free streaming buffers and decoder if we need to.
-		for (i = 0; i < STRM_BUFCOUNT; i++)
+		for (i = 0; i < STRM_MAX_BUFCOUNT; i++)
 		{
 			if (m_buffer[i].data) {
 				mem_free(m_buffer[i].data);
@@ -453,16 +573,13 @@ void AudioStream::Close()
 	}
 	m_playcount = 0;
 	m_nbufs = 0;
+	m_predecode_bytes = 0;
 	m_state = STRM_INVALID;
 }
 // has stream finished with its readahead of current loop?
 bool AudioStream::ReadAheadFinishedLoop()
 {
-	if (m_readahead_finished_loop) {
-		m_readahead_finished_loop = false;
-		return true;
-	}
-	return false;
+	return m_readahead_finished_loop.exchange(false);
 }
 // are we still reading from disk?
 bool AudioStream::ReadAhead()
@@ -471,13 +588,47 @@ bool AudioStream::ReadAhead()
 }
 bool AudioStream::IsReady()
 {
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
 	if (m_state == STRM_STOPPED) {
-		if (!m_readahead || m_fbufidx == (STRM_BUFCOUNT-1)) {
+		if (!m_readahead || BufferedBytes() >= m_predecode_bytes) {
+			return true;
+		}
+	// the ring may be too small to hold everything asked for.
+		if (CHECK_FLAG(m_buffer[(m_fbufidx+1) % m_nslots].flags, STRM_BUFF_USED)) {
 			return true;
 		}
 	}
 	return false;
 }
+// bytes decoded and waiting to be played, including the buffer being played.
+int AudioStream::BufferedBytes()
+{
+	int i, total = 0;
+	for (i = 0; i < m_nslots; i++)
+	{
+		if (CHECK_FLAG(m_buffer[i].flags, STRM_BUFF_USED)) {
+			total += m_buffer[i].nbytes;
+		}
+	}
+	return total;
+}
+// decodes the first ms of a stopped stream on the calling thread.  returns false if the ring can't
+//	hold that much, in which case it's filled as far as it goes.
+bool AudioStream::Predecode(int ms)
+{
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
+	if (m_state != STRM_STOPPED || !m_archive.Opened()) {
+		return false;
+	}
+	m_predecode_bytes = (int)(((long long)ms * m_bytes_per_sec) / 1000);
+	while (BufferedBytes() < m_predecode_bytes)
+	{
+		if (!AudioStream::UpdateData()) {
+			break;
+		}
+	}
+	return (!m_readahead || BufferedBytes() >= m_predecode_bytes);
+}
 //////////////////////////////////////////////////////////////////////////////
 bool AudioStream::ReopenDigitalStream(ubyte fbufidx, int nbufs)
 {
@@ -533,6 +684,7 @@ bool AudioStream::ReopenDigitalStream(ubyte fbufidx, int nbufs)
 		return false;
 	}
 	
+	m_bytes_per_sec = 22050*granularity;
 	long bytes_per_buf = (SAMPLES_PER_STREAM_BUF*granularity);
 	long filelen = (sample_count/channels)*granularity;
 	int nbuffers = filelen/bytes_per_buf;
@@ -566,8 +718,27 @@ bool AudioStream::ReopenDigitalStream(ubyte fbufidx, int nbufs)
 			}
 		}
 	}
+// size the ring so it holds the latency on top of the buffer being played and the one being decoded.
+	m_nslots = (int)((((long long)m_latency * m_bytes_per_sec) / 1000 + m_bufsize - 1) / m_bufsize) + 2;
+	if (m_nslots < STRM_BUFCOUNT) m_nslots = STRM_BUFCOUNT;
+	if (m_nslots > STRM_MAX_BUFCOUNT) m_nslots = STRM_MAX_BUFCOUNT;
+// allocate the whole ring now, so the decode thread never has to.
+	for (int i = 0; i < m_nslots; i++)
+	{
+	// if our stream's current id does not match the streaming buffer's id, then we need to reallocate
+	// the stream buffer with the new memory size
+		if (m_buffer[i].id != (int)m_curid) {
+			if (m_buffer[i].data) {
+				mem_free(m_buffer[i].data);
+			}
+			m_buffer[i].data = (ubyte *)mem_malloc(m_bufsize);
+			m_buffer[i].id = (int)m_curid;
+		}
+		m_buffer[i].nbytes = 0;
+		m_buffer[i].flags = 0;
+	}
 	//mprintf((0,"STRM[%d]: Using buffer size of %d\n",m_curid, m_bufsize));
-	LOGFILE((_logfp,"STRM[%d]: Using buffer size of %d\n",m_curid, m_bufsize));
+	LOGFILE((_logfp,"STRM[%d]: Using buffer size of %d, %d buffers\n",m_curid, m_bufsize, m_nslots));
 // mark stream as not done.
 	m_readahead = true;
 	m_readahead_finished_loop = false;
@@ -580,18 +751,8 @@ bool AudioStream::ReopenDigitalStream(ubyte fbufidx, int nbufs)
 	nbufs--;
 	while (!CHECK_FLAG(m_buffer[m_fbufidx].flags, STRM_BUFF_USED) && nbufs >= 0 && m_readahead)
 	{
-	// if our stream's current id does not match the streaming buffer's id, then we need to reallocate
-	// the stream buffer with the new memory size
-		if (m_buffer[m_fbufidx].id != (int)m_curid) {
-			if (m_buffer[m_fbufidx].data) {
-				mem_free(m_buffer[m_fbufidx].data);
-			}
-			m_buffer[m_fbufidx].data = (ubyte *)mem_malloc(m_bufsize);
-		}
 		m_buffer[m_fbufidx].nbytes = AudioStream::ReadFileData(m_fbufidx, m_bufsize);
-		m_buffer[m_fbufidx].flags = 0;
-		m_buffer[m_fbufidx].flags |= STRM_BUFF_USED;
-		m_buffer[m_fbufidx].id = m_thisid;
+		m_buffer[m_fbufidx].flags = STRM_BUFF_USED;
 		m_playbytesleft -= m_buffer[m_fbufidx].nbytes;
 //		mprintf((0, "[%d]:pbytesleft=%d\n", m_curid, m_playbytesleft));
 		LOGFILE((_logfp, "[%d]:pbytesleft=%d\n", m_curid, m_playbytesleft));
@@ -618,10 +779,10 @@ bool AudioStream::ReopenDigitalStream(ubyte fbufidx, int nbufs)
 //@@			m_readahead = false;
 //@@			m_readahead_finished_loop = true;
 //@@		}
-		m_fbufidx = (m_fbufidx+1) % STRM_BUFCOUNT;
+		m_fbufidx = (m_fbufidx+1) % m_nslots;
 	}
 // readjust file buffer index down so that it matches the CURRENT file index, not the next one.
-	if (m_fbufidx == 0) m_fbufidx = STRM_BUFCOUNT-1;
+	if (m_fbufidx == 0) m_fbufidx = m_nslots-1;
 	else m_fbufidx--;
 	return true;
 }
@@ -630,6 +791,7 @@ bool AudioStream::ReopenDigitalStream(ubyte fbufidx, int nbufs)
 bool AudioStream::Play(bool start_on_frame)
 {
 //	call low level stream manager. - samir
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
 	int sflag = SIF_STREAMING_16_M,i;
 	bool looped = false;
 	if (m_state == STRM_INVALID) {
@@ -660,11 +822,12 @@ bool AudioStream::Play(bool start_on_frame)
 		AudioStream::Reset();
 	}
 	m_playcount++;
+	m_predecode_bytes = 0;
 	m_measure_timer = 0.0f;
 	m_last_frametime = timer_GetTime();
 //	check for terminal and if loopcount != 0 then specify terminal as looping
 	if (m_loopcount != 0) {
-		for (i = 0; i < STRM_BUFCOUNT; i++)
+		for (i = 0; i < m_nslots; i++)
 		{
 			if (CHECK_FLAG(m_buffer[i].flags, STRM_BUFF_USED)) {
 				if (CHECK_FLAG(m_buffer[i].flags, STRM_BUFF_TERMINAL)) {
@@ -705,7 +868,7 @@ bool AudioStream::Play(bool start_on_frame)
 		if(m_llshandle > -1) {
 		// for one buffer samples, prepare to stop now so that the one and only one buffer gets called.
 		//	looped one buffer samples dont do this though...
-			if (m_nbufs == 1 && !looped) {
+			if (CHECK_FLAG(m_buffer[m_sbufidx].flags, STRM_BUFF_TERMINAL) && !looped) {
 				m_state = STRM_STOPPING;
 			}
 			else {
@@ -743,6 +906,7 @@ void AudioStream::Resume()
 // causes a rewind to start of stream, if on_measure is true, stop occurs when measure ends
 void AudioStream::Stop(bool on_measure, int *stop_flag)								
 {
+	std::lock_guard<std::recursive_mutex> lock(StreamLock());
 	if (!m_ll_sndsys) {
 		return;
 	}
@@ -801,11 +965,10 @@ void AudioStream::Reset()
 	} 
 }
 //////////////////////////////////////////////////////////////////////////////
-// invoked by AudioStreamCB.
-#pragma optimize("", off)
+// invoked by AudioStreamCB, from the sound system's thread.  must not take StreamLock.
 void *AudioStream::StreamCallback(int *size)
 {
-	ubyte nextbuffer = (m_sbufidx+1) % STRM_BUFCOUNT;
+	ubyte nextbuffer = (m_sbufidx+1) % m_nslots;
 	void *data = NULL;
 // we're not done yet.
 //adjust sound buffer to the next buffer
@@ -826,6 +989,18 @@ void *AudioStream::StreamCallback(int *size)
 		return NULL;
 	}
 	if (!CHECK_FLAG(m_buffer[nextbuffer].flags, STRM_BUFF_USED)) {
+	// unless this was the last buffer, the decode thread just hasn't caught up.  play a little silence
+	//	and look again after it.
+		int curflags = m_buffer[m_sbufidx].flags;
+		if (!CHECK_FLAG(curflags, STRM_BUFF_TERMINAL) || CHECK_FLAG(curflags, STRM_BUFF_LOOPEND)) {
+			m_underruns++;
+			m_totalunderruns++;
+			*size = STRM_SILENCE_SIZE;
+			if (m_playinfo.m_stream_format == SIF_STREAMING_8_M || m_playinfo.m_stream_format == SIF_STREAMING_8_S) {
+				return Stream_silence_8;
+			}
+			return Stream_silence_16;
+		}
 	//	mprintf((0, "STRM[%d]: Playing onetime buffer?\n",m_curid));
 		LOGFILE((_logfp, "STRM[%d]: Playing onetime buffer?\n",m_curid));
 		m_state = STRM_STOPPED;
@@ -836,9 +1011,9 @@ void *AudioStream::StreamCallback(int *size)
 //@@		*size = m_buffer[m_sbufidx].nbytes;
 //@@		return data;
 	}
-// mark played buffer as unused.
-	m_buffer[m_sbufidx].flags =0;
+// mark played buffer as unused.  clearing the flags gives it back to the decoder.
 	m_buffer[m_sbufidx].nbytes = 0;
+	m_buffer[m_sbufidx].flags =0;
 	m_sbufidx = nextbuffer;
 //	ASSERT(CHECK_FLAG(m_buffer[m_sbufidx].flags, STRM_BUFF_USED));
 //	mprintf((0,"%c",m_sbufidx+'A'));
@@ -873,7 +1048,6 @@ void *AudioStream::StreamCallback(int *size)
 	}
 	return data;
 }
-#pragma optimize("", on)
 // reads in decompressed raw data.
 int AudioStream::ReadFileData(int buf, int len)
 {
@@ -899,20 +1073,19 @@ int AudioStream::ReadFileData(int buf, int len)
 
 	return m_archive.Read(m_buffer[buf].data,len);
 }
-// TURN OFF OPTIMIZATIONS HERE.  Placement of instructions is VERY IMPORTANT here.  synched with StreamCallback,
-//	which also has optimizations off.
-#pragma optimize("", off)
-// updates file buffers
-void AudioStream::UpdateData()
+// updates file buffers.  called by the decode thread, or with StreamLock held.  the buffer's flags are
+//	only set once it's completely filled in, since StreamCallback may pick it up right after.
+bool AudioStream::UpdateData()
 {
-	int nextbuffer = ((m_fbufidx+1) % STRM_BUFCOUNT);
+	int nextbuffer = ((m_fbufidx+1) % m_nslots);
+	int flags;
 //	check if are on a measure boundary for current stream.  if so, then check if we have a next request pending
 	if (CHECK_FLAG(m_buffer[nextbuffer].flags, STRM_BUFF_USED)) {
-		return;
+		return false;
 	}
 // quit out if we can.
 	if(nextbuffer == m_sbufidx) { 
-		return;
+		return false;
 	}
 // do read!
 //	READ DATA INTO BUFFER.  UPDATE BYTES LEFT PER MEASURE, ETC.
@@ -920,18 +1093,9 @@ void AudioStream::UpdateData()
 	// ok update the next buffer with data
 		m_fbufidx = nextbuffer;
 	//	mprintf((0,"%c",m_fbufidx+'a'));
-	// if our stream's current id does not match the streaming buffer's id, then we need to reallocate
-	// the stream buffer with the new memory size
-		if (m_buffer[m_fbufidx].id != (int)m_curid) {
-			if (m_buffer[m_fbufidx].data) {
-				mem_free(m_buffer[m_fbufidx].data);
-			}
-			m_buffer[m_fbufidx].data = (ubyte *)mem_malloc(m_bufsize);
-		}
+		ASSERT(m_buffer[m_fbufidx].id == (int)m_curid);
 		m_buffer[m_fbufidx].nbytes = AudioStream::ReadFileData(m_fbufidx, m_bufsize);
-		m_buffer[m_fbufidx].flags = 0;
-		m_buffer[m_fbufidx].flags |= STRM_BUFF_USED;
-		m_buffer[m_fbufidx].id = (int)m_curid;
+		flags = STRM_BUFF_USED;
 		m_playbytesleft -= m_buffer[m_fbufidx].nbytes;
 //		mprintf((0, "[%d]:pbytesleft=%d\n", m_curid, m_playbytesleft));
 		LOGFILE((_logfp, "[%d]:pbytesleft=%d\n", m_curid, m_playbytesleft));
@@ -944,27 +1108,29 @@ void AudioStream::UpdateData()
 			}
 		//	mprintf((0, "TERMINAL buffer.\n"));
 			LOGFILE((_logfp, "STRM[%d]: TERMINAL buffer.\n", m_curid));
-			m_buffer[m_fbufidx].flags |= STRM_BUFF_TERMINAL;
+			flags |= STRM_BUFF_TERMINAL;
 			m_readahead = false;
 			m_readahead_finished_loop = true;
 		}
 	// looping?
-		if (CHECK_FLAG(m_buffer[m_fbufidx].flags, STRM_BUFF_TERMINAL)) {
+		if (CHECK_FLAG(flags, STRM_BUFF_TERMINAL)) {
 			if (m_loopcount == -1) {
-				m_buffer[m_fbufidx].flags |= STRM_BUFF_LOOPEND;
+				flags |= STRM_BUFF_LOOPEND;
 				AudioStream::Reset();
 			}
 			else if (m_loopcount > 0) {
-				m_buffer[m_fbufidx].flags |= STRM_BUFF_LOOPEND;
+				flags |= STRM_BUFF_LOOPEND;
 				AudioStream::Reset();
 				m_loopcount--;
 			}
 			m_readahead_finished_loop = true;
 		}
+		m_buffer[m_fbufidx].flags = flags;
+		return true;
 	}
+	return false;
 }
 
-#pragma optimize("", on)
 ///////////////////////////////////////////////////////////////////////////////
 //	decoder
 int ADecodeFileRead(void *data, void *buf, unsigned qty)